@@ -9,9 +9,7 @@ AACEncoder::AACEncoder()
 
 AACEncoder::~AACEncoder()
 {
-    if(!ctx_){
-        avcodec_free_context(&ctx_);
-    }
+
 }
 
 RET_CODE AACEncoder::Init(const Properties &properties)
@@ -47,64 +45,7 @@ RET_CODE AACEncoder::Init(const Properties &properties)
         avcodec_free_context(&ctx_);
         return RET_FAIL;
     }
-}
-
-AVPacket *AACEncoder::Encode(AVFrame *frame, const int64_t pts, int flush, int *pkt_frame, RET_CODE *ret)
-{
-    int local_ret = 0;
-    *pkt_frame = 0;
-    
-    // 1. 上下文检查
-    if(!ctx_){
-        *ret = RET_FAIL;
-        LogError("AAC: no context");
-        return NULL;
-    }
-
-    // 2. 设置帧的时间戳并发送帧
-    if(frame){
-        frame->pts = pts;
-        local_ret = avcodec_send_frame(ctx_,frame);
-        if(local_ret < 0){
-            *pkt_frame = 1;
-            if(local_ret == AVERROR(EAGAIN)){
-                *ret = RET_ERR_EAGAIN;
-                return NULL;
-            }else if(local_ret == RET_ERR_EOF){
-                *ret = RET_ERR_EOF;
-                return NULL;
-            }else{
-                *ret = RET_FAIL;
-                return NULL;
-            }
-        }
-    }
-
-    // 3. Flush 编码器
-    if(flush){
-        avcodec_flush_buffers(ctx_);
-    }
-
-    // 4. 接收编码后的数据包
-    AVPacket *packet = av_packet_alloc();
-    local_ret = avcodec_receive_packet(ctx_,packet);
-    if(local_ret < 0){
-        av_packet_free(&packet);
-        *pkt_frame = 0;
-        if(local_ret == AVERROR(EAGAIN)){
-            *ret = RET_ERR_EAGAIN;
-            return NULL;
-        }else if(local_ret == RET_ERR_EOF){
-            *ret = RET_ERR_EOF;
-            return NULL;
-        }else{
-            *ret = RET_FAIL;
-            return NULL;
-        }
-    }else{
-        *ret = RET_OK;
-        return packet;
-    }
+    return RET_OK;
 }
 
 RET_CODE AACEncoder::GetAdtsHeader(uint8_t *adts_header, int aac_length)
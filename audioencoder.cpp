@@ -0,0 +1,290 @@
+#include "audioencoder.h"
+#include "dlog.h"
+
+extern "C" {
+#include <libavutil/opt.h>
+#include <libavutil/samplefmt.h>
+}
+
+AudioEncoder::AudioEncoder()
+{
+
+}
+
+AudioEncoder::~AudioEncoder()
+{
+    if(silence_pkt_) {
+        av_packet_free(&silence_pkt_);
+    }
+    if(ctx_){
+        avcodec_free_context(&ctx_);
+    }
+}
+
+AVPacket *AudioEncoder::Encode(AVFrame *frame, const int64_t pts, int flush, int *pkt_frame, RET_CODE *ret)
+{
+    int local_ret = 0;
+    *pkt_frame = 0;
+    
+    // 1. 上下文检查
+    if(!ctx_){
+        *ret = RET_FAIL;
+        LogError("audio: no context");
+        return NULL;
+    }
+
+    // 2. 设置帧的时间戳并发送帧
+    if(frame){
+        frame->pts = pts;
+        local_ret = avcodec_send_frame(ctx_,frame);
+        if(local_ret < 0){
+            *pkt_frame = 1;
+            if(local_ret == AVERROR(EAGAIN)){
+                *ret = RET_ERR_EAGAIN;
+                return NULL;
+            }else if(local_ret == RET_ERR_EOF){
+                *ret = RET_ERR_EOF;
+                return NULL;
+            }else{
+                *ret = RET_FAIL;
+                return NULL;
+            }
+        }
+    }
+
+    // 3. Flush 编码器
+    if(flush){
+        avcodec_flush_buffers(ctx_);
+    }
+
+    // 4. 接收编码后的数据包
+    AVPacket *packet = av_packet_alloc();
+    local_ret = avcodec_receive_packet(ctx_,packet);
+    if(local_ret < 0){
+        av_packet_free(&packet);
+        *pkt_frame = 0;
+        if(local_ret == AVERROR(EAGAIN)){
+            *ret = RET_ERR_EAGAIN;
+            return NULL;
+        }else if(local_ret == RET_ERR_EOF){
+            *ret = RET_ERR_EOF;
+            return NULL;
+        }else{
+            *ret = RET_FAIL;
+            return NULL;
+        }
+    }else{
+        *ret = RET_OK;
+        return packet;
+    }
+}
+
+RET_CODE AudioEncoder::Encode(AVFrame *frame, const int64_t pts, const PacketCallback &callback)
+{
+    // 1. 上下文检查
+    if(!ctx_){
+        LogError("audio: no context");
+        return RET_FAIL;
+    }
+
+    // 2. 设置帧的时间戳并发送帧
+    if(frame) {
+        frame->pts = pts;
+        int ret = avcodec_send_frame(ctx_, frame);
+        if(ret == AVERROR(EAGAIN)) {
+            // 先把编码器里面的包取出来再送一次
+            receivePackets(callback);
+            ret = avcodec_send_frame(ctx_, frame);
+        }
+        if(ret < 0) {
+            char buf[1024] = { 0 };
+            av_strerror(ret, buf, sizeof(buf) - 1);
+            LogError("audio: avcodec_send_frame failed:%s", buf);
+            return ret == AVERROR(EAGAIN) ? RET_ERR_EAGAIN : RET_FAIL;
+        }
+        stats_.OnSend(pts);
+        frames_pending_ = true;
+    }
+
+    // 3. 取出所有能输出的包
+    return receivePackets(callback);
+}
+
+RET_CODE AudioEncoder::Flush(const PacketCallback &callback)
+{
+    if(!ctx_){
+        LogError("audio: no context");
+        return RET_FAIL;
+    }
+    // 送NULL进入drain模式
+    int ret = avcodec_send_frame(ctx_, NULL);
+    if(ret < 0 && ret != AVERROR_EOF) {
+        LogError("audio: enter drain mode failed");
+        return RET_FAIL;
+    }
+    ret = receivePackets(callback);
+    return (ret == RET_ERR_EOF) ? RET_OK : (RET_CODE)ret;
+}
+
+// 返回值: RET_OK 已经取完(EAGAIN); RET_ERR_EOF drain完成; RET_FAIL出错
+RET_CODE AudioEncoder::receivePackets(const PacketCallback &callback)
+{
+    while(true) {
+        AVPacket *packet = av_packet_alloc();
+        if(!packet) {
+            return RET_ERR_OUTOFMEMORY;
+        }
+        int ret = avcodec_receive_packet(ctx_, packet);
+        if(ret < 0) {
+            av_packet_free(&packet);
+            if(ret == AVERROR(EAGAIN)) {
+                return RET_OK;
+            } else if(ret == AVERROR_EOF) {
+                return RET_ERR_EOF;
+            }
+            LogError("audio: avcodec_receive_packet failed:%d", ret);
+            return RET_FAIL;
+        }
+        stats_.OnPacket(packet, true);
+        last_pts_ = packet->pts;
+        if(callback) {
+            callback(packet);
+        } else {
+            av_packet_free(&packet);
+        }
+    }
+}
+
+RET_CODE AudioEncoder::PrepareSilencePacket()
+{
+    if(!ctx_) {
+        LogError("audio: no context");
+        return RET_FAIL;
+    }
+    if(silence_pkt_) {
+        return RET_OK;
+    }
+
+    // 1. 用相同的参数再打开一个编码器
+    AVCodecContext *ctx = openContext();
+    if(!ctx) {
+        return RET_FAIL;
+    }
+
+    // 2. 送入若干帧全0数据，跳过编码器priming阶段，取最后输出的包
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    RET_CODE ret = RET_FAIL;
+    if(frame && pkt) {
+        frame->format           = ctx->sample_fmt;
+        frame->nb_samples       = ctx->frame_size;
+        frame->channels         = ctx->channels;
+        frame->channel_layout   = ctx->channel_layout;
+        if(av_frame_get_buffer(frame, 0) == 0) {
+            av_samples_set_silence(frame->data, 0, frame->nb_samples, frame->channels,
+                                   (enum AVSampleFormat)frame->format);
+            for(int i = 0; i < 8; i++) {
+                frame->pts = (int64_t)i * frame->nb_samples;
+                if(avcodec_send_frame(ctx, frame) < 0) {
+                    break;
+                }
+                while(avcodec_receive_packet(ctx, pkt) == 0) {
+                    if(silence_pkt_) {
+                        av_packet_free(&silence_pkt_);
+                    }
+                    silence_pkt_ = av_packet_clone(pkt);
+                    av_packet_unref(pkt);
+                }
+            }
+            if(silence_pkt_) {
+                LogInfo("audio: silence packet size:%d", silence_pkt_->size);
+                ret = RET_OK;
+            }
+        }
+    }
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    avcodec_free_context(&ctx);
+    if(ret != RET_OK) {
+        LogError("audio: prepare silence packet failed");
+    }
+    return ret;
+}
+
+AVCodecContext *AudioEncoder::openContext()
+{
+    AVCodecContext *ctx = avcodec_alloc_context3(codec_);
+    if(!ctx) {
+        LogError("audio: avcodec_alloc_context3 failed");
+        return NULL;
+    }
+    ctx->channels              = ctx_->channels;
+    ctx->channel_layout        = ctx_->channel_layout;
+    ctx->sample_fmt            = ctx_->sample_fmt;
+    ctx->sample_rate           = ctx_->sample_rate;
+    ctx->bit_rate              = ctx_->bit_rate;
+    ctx->time_base             = ctx_->time_base;
+    ctx->strict_std_compliance = ctx_->strict_std_compliance;
+    if(ctx->priv_data && ctx_->priv_data) {
+        av_opt_copy(ctx->priv_data, ctx_->priv_data);   // 编码器私有参数，比如opus的帧长
+    }
+    if(avcodec_open2(ctx, codec_, NULL) < 0) {
+        LogError("audio: avcodec_open2 failed");
+        avcodec_free_context(&ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+RET_CODE AudioEncoder::EncodeSilence(const int64_t pts, const PacketCallback &callback)
+{
+    if(!silence_pkt_ || !ctx_) {
+        return RET_FAIL;
+    }
+    // 编码器输出的pts比输入早initial_padding，pts单位是ms
+    int64_t silence_pts = pts - av_rescale(ctx_->initial_padding, 1000, ctx_->sample_rate);
+
+    // 1. 刚进入静音: 编码器有一帧延迟，还缓存着最后的有声帧，drain出来之后换一个新的上下文
+    //    位置不早于这一帧的包是编码器补的尾部，本来就是静音，丢掉
+    if(frames_pending_) {
+        AVCodecContext *ctx = openContext();
+        if(!ctx) {
+            return RET_FAIL;
+        }
+        int64_t last_pts = last_pts_;
+        Flush([&](AVPacket *packet) {
+            if(packet->pts >= silence_pts) {
+                av_packet_free(&packet);
+                return;
+            }
+            last_pts = packet->pts;
+            if(callback) {
+                callback(packet);
+            } else {
+                av_packet_free(&packet);
+            }
+        });
+        last_pts_ = last_pts;
+        avcodec_free_context(&ctx_);
+        ctx_ = ctx;
+        frames_pending_ = false;
+    }
+
+    // 2. 静音包接在最后输出的包后面，dts严格递增
+    AVPacket *packet = av_packet_clone(silence_pkt_);
+    if(!packet) {
+        return RET_ERR_OUTOFMEMORY;
+    }
+    if(last_pts_ != AV_NOPTS_VALUE && silence_pts <= last_pts_) {
+        silence_pts = last_pts_ + 1;
+    }
+    packet->pts = silence_pts;
+    packet->dts = silence_pts;
+    last_pts_ = silence_pts;
+    if(callback) {
+        callback(packet);
+    } else {
+        av_packet_free(&packet);
+    }
+    return RET_OK;
+}
@@ -0,0 +1,112 @@
+#ifndef AUDIOENCODER_H
+#define AUDIOENCODER_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+#include "mediabase.h"
+#include "encoderstats.h"
+
+// 音频编码器的公共接口，AACEncoder、OpusEncoder都从这里派生
+class AudioEncoder
+{
+public:
+    AudioEncoder();
+    virtual ~AudioEncoder();
+
+    virtual RET_CODE Init(const Properties &properties) = 0;
+    /**
+     * @brief Encode
+     * @param frame     输入帧
+     * @param pts       时间戳
+     * @param flush     是否flush
+     * @param pkt_frame *pkt_frame = 0，receive_packet报错; *pkt_frame = 1, send_frame报错
+     * @param ret   只有RET_OK才不需要做异常处理
+     * @return
+     */
+    virtual AVPacket *Encode(AVFrame *frame, const int64_t pts, int flush, int *pkt_frame, RET_CODE *ret);
+    /**
+     * @brief Encode 送入一帧，并取出编码器当前能输出的所有包
+     * @param frame     输入帧
+     * @param pts       时间戳
+     * @param callback  每输出一个包回调一次
+     * @return RET_OK正常; RET_ERR_EAGAIN编码器满了，这一帧没有送进去
+     */
+    virtual RET_CODE Encode(AVFrame *frame, const int64_t pts, const PacketCallback &callback);
+    /**
+     * @brief Flush 进入drain模式，输出编码器缓存的所有包，之后编码器不能再送帧
+     * @param callback  每输出一个包回调一次
+     * @return
+     */
+    virtual RET_CODE Flush(const PacketCallback &callback);
+
+    virtual int GetFormat() {
+        return ctx_->sample_fmt;
+    }
+    virtual int GetChannels() {
+        return ctx_->channels;
+    }
+    virtual int GetChannelLayout() {
+        return ctx_->channel_layout;
+    }
+    // 一帧有多少个采样点
+    virtual int GetFrameSamples() {      // 采样点数量，只是说的一个通道
+        return ctx_->frame_size;
+    }
+    virtual int GetFrameSampleRate() {      // 采样率
+        return ctx_->sample_rate;
+    }
+    // 一帧占用的字节数
+    virtual int GetFrameBytes() {
+        return av_get_bytes_per_sample(ctx_->sample_fmt) * ctx_->channels * ctx_->frame_size;
+    }
+    // 一帧的时长，单位ms
+    virtual double GetFrameDuration() {
+        return ctx_->frame_size * 1000.0 / ctx_->sample_rate;
+    }
+    // 编码器自己是否处理静音(opus DTX)
+    virtual bool IsDtx() {
+        return false;
+    }
+    /**
+     * @brief PrepareSilencePacket 预先编码数字静音，缓存一个稳定后的包
+     *        用另外一个编码器上下文编码，不影响正在使用的编码器状态
+     * @return
+     */
+    RET_CODE PrepareSilencePacket();
+    /**
+     * @brief EncodeSilence 用缓存的静音包代替一帧编码，payload是引用计数共享的
+     *        刚进入静音时先drain编码器，输出还缓存在里面的有声帧，然后重新打开编码器
+     *        静音包的时间戳和编码器输出在同一条时间线上: 同样减去initial_padding，并且严格递增
+     * @param pts       这一帧输入的时间戳
+     * @param callback  drain出来的包和静音包各回调一次
+     * @return 没有调用PrepareSilencePacket或者重新打开失败时返回RET_FAIL，调用者照常编码
+     */
+    RET_CODE EncodeSilence(const int64_t pts, const PacketCallback &callback);
+
+    // 每帧的延迟和大小统计，可以在任意线程调用
+    inline void GetStats(EncoderStatsInfo *info) {
+        stats_.GetStats(info);
+    }
+
+    inline enum AVCodecID GetCodecId() {
+        return ctx_->codec_id;
+    }
+    inline AVCodecContext *get_codec_context() {
+        return ctx_;
+    }
+
+protected:
+    RET_CODE receivePackets(const PacketCallback &callback);
+    // 用相同的参数和私有选项打开一个新的编码器上下文
+    AVCodecContext *openContext();
+
+    AVCodec *codec_         = NULL;
+    AVCodecContext  *ctx_   = NULL;
+    AVPacket *silence_pkt_  = NULL;
+    bool frames_pending_    = false;            // 编码器里面有还没有输出的帧
+    int64_t last_pts_       = AV_NOPTS_VALUE;   // 最后输出的包的时间戳，包括静音包
+    EncoderStats stats_;    // 音频编码器不重排序，按先进先出匹配送帧时间
+};
+
+#endif // AUDIOENCODER_H
@@ -0,0 +1,109 @@
+#include "bitratecontroller.h"
+#include "dlog.h"
+
+BitrateController::BitrateController()
+{
+
+}
+
+BitrateController::~BitrateController()
+{
+
+}
+
+RET_CODE BitrateController::Init(const Properties &properties)
+{
+    bitrate_            = properties.GetProperty("start_bitrate", 1024*1024);
+    min_bitrate_        = properties.GetProperty("min_bitrate", bitrate_ / 4);
+    max_bitrate_        = properties.GetProperty("max_bitrate", bitrate_);
+    high_water_         = properties.GetProperty("high_water", 300);
+    low_water_          = properties.GetProperty("low_water", 100);
+    growth_threshold_   = properties.GetProperty("growth_threshold", 200);
+    decrease_percent_   = properties.GetProperty("decrease_percent", 75);
+    increase_percent_   = properties.GetProperty("increase_percent", 5);
+    hold_time_          = properties.GetProperty("hold_time", 5000);
+    interval_           = properties.GetProperty("interval", 500);
+
+    if(min_bitrate_ <= 0 || min_bitrate_ > max_bitrate_ || low_water_ >= high_water_
+            || decrease_percent_ <= 0 || decrease_percent_ >= 100 || increase_percent_ <= 0
+            || interval_ <= 0) {
+        LogError("bitrate:[%d, %d], water:[%d, %d], percent:%d/%d, interval:%d",
+                 min_bitrate_, max_bitrate_, low_water_, high_water_,
+                 decrease_percent_, increase_percent_, interval_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    if(bitrate_ < min_bitrate_) bitrate_ = min_bitrate_;
+    if(bitrate_ > max_bitrate_) bitrate_ = max_bitrate_;
+    return RET_OK;
+}
+
+int BitrateController::Update(int64_t now, int64_t queue_duration, int64_t sent_bytes, int *reason)
+{
+    *reason = BITRATE_REASON_NONE;
+    // 1. 第一次只记录状态
+    if(pre_time_ == 0) {
+        pre_time_ = now;
+        pre_duration_ = queue_duration;
+        pre_sent_bytes_ = sent_bytes;
+        return 0;
+    }
+    int64_t dt = now - pre_time_;
+    if(dt < interval_) {
+        return 0;
+    }
+
+    // 2. 计算队列增长速度(ms/s)和发送吞吐量(bps)
+    int64_t growth = (queue_duration - pre_duration_) * 1000 / dt;
+    throughput_ = (int)((sent_bytes - pre_sent_bytes_) * 8 * 1000 / dt);
+    pre_time_ = now;
+    pre_duration_ = queue_duration;
+    pre_sent_bytes_ = sent_bytes;
+
+    // 3. 拥塞: 降码率, 不超过实际能发出去的吞吐量
+    //    超过高水位但已经在快速下降时不再继续降，等上一次调整生效
+    int bitrate = bitrate_;
+    if(queue_duration > high_water_ && growth >= 0) {
+        *reason = BITRATE_REASON_QUEUE_HIGH;
+    } else if(growth > growth_threshold_ && queue_duration > low_water_) {
+        *reason = BITRATE_REASON_QUEUE_GROWTH;
+    }
+    congested_ = *reason != BITRATE_REASON_NONE;
+    if(congested_) {
+        bitrate = (int)((int64_t)bitrate_ * decrease_percent_ / 100);
+        if(throughput_ > 0 && throughput_ * 9 / 10 < bitrate) {
+            bitrate = throughput_ * 9 / 10;
+        }
+        if(bitrate < min_bitrate_) {
+            bitrate = min_bitrate_;
+        }
+        last_decrease_time_ = now;
+    } else if(queue_duration < low_water_ && now - last_decrease_time_ > hold_time_) {
+        // 4. 队列已经排空并且稳定: 加性升码率, 每次加固定步长
+        bitrate = bitrate_ + (int)((int64_t)max_bitrate_ * increase_percent_ / 100);
+        if(bitrate > max_bitrate_) {
+            bitrate = max_bitrate_;
+        }
+        *reason = BITRATE_REASON_QUEUE_DRAINED;
+    }
+
+    if(bitrate == bitrate_) {
+        *reason = BITRATE_REASON_NONE;
+        return 0;
+    }
+    LogInfo("bitrate %d -> %d, reason:%d, queue:%lldms, growth:%lldms/s, throughput:%d",
+            bitrate_, bitrate, *reason, queue_duration, growth, throughput_);
+    bitrate_ = bitrate;
+    return bitrate_;
+}
+
+void BitrateController::SetRange(int min_bitrate, int max_bitrate)
+{
+    if(min_bitrate <= 0 || min_bitrate > max_bitrate) {
+        LogError("bitrate range:[%d, %d]", min_bitrate, max_bitrate);
+        return;
+    }
+    min_bitrate_ = min_bitrate;
+    max_bitrate_ = max_bitrate;
+    if(bitrate_ < min_bitrate_) bitrate_ = min_bitrate_;
+    if(bitrate_ > max_bitrate_) bitrate_ = max_bitrate_;
+}
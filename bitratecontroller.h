@@ -0,0 +1,87 @@
+#ifndef BITRATECONTROLLER_H
+#define BITRATECONTROLLER_H
+
+#include "mediabase.h"
+
+// 调整码率的原因，和MSG_RTSP_BITRATE_CHANGE的arg2对应
+enum BITRATE_REASON
+{
+    BITRATE_REASON_NONE = 0,
+    BITRATE_REASON_QUEUE_HIGH,          // 队列时长超过高水位并且没有下降
+    BITRATE_REASON_QUEUE_GROWTH,        // 队列时长增长太快
+    BITRATE_REASON_QUEUE_DRAINED        // 队列低于低水位并且稳定了一段时间
+};
+
+// 根据发送队列的时长、增长速度和实际发送吞吐量调整视频码率
+// 降码率是乘性的，升码率是加性的，并且降完之后要保持hold_time才允许升，避免来回抖动
+class BitrateController
+{
+public:
+    BitrateController();
+    ~BitrateController();
+    /**
+     * @brief Init
+     * @param "start_bitrate", 起始码率bps
+     *        "min_bitrate", 最小码率，默认start_bitrate/4
+     *        "max_bitrate", 最大码率，默认start_bitrate
+     *        "high_water", 队列高水位ms，默认300
+     *        "low_water", 队列低水位ms，默认100
+     *        "growth_threshold", 队列增长速度门限(ms/s)，默认200
+     *        "decrease_percent", 每次降到原来的百分比，默认75
+     *        "increase_percent", 每次升高的步长，按max_bitrate的百分比，默认5
+     *        "hold_time", 降码率之后多久才允许升ms，默认5000
+     *        "interval", 检测间隔ms，默认500
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    /**
+     * @brief Update 按检测间隔更新一次
+     * @param now               当前时间ms
+     * @param queue_duration    当前队列缓存的时长ms
+     * @param sent_bytes        累计已发送的字节数
+     * @param reason            调整的原因
+     * @return 新的码率，0代表不需要调整
+     */
+    int Update(int64_t now, int64_t queue_duration, int64_t sent_bytes, int *reason);
+
+    // 重新设置码率范围，比如分辨率变化之后
+    void SetRange(int min_bitrate, int max_bitrate);
+
+    inline int GetBitrate() {
+        return bitrate_;
+    }
+    inline int GetMinBitrate() {
+        return min_bitrate_;
+    }
+    inline int GetMaxBitrate() {
+        return max_bitrate_;
+    }
+    // 最近一个检测周期是否拥塞，码率已经最低时即使拥塞Update也不会返回新码率
+    inline bool IsCongested() {
+        return congested_;
+    }
+    // 最近一个检测周期测得的发送吞吐量 bps
+    inline int GetThroughput() {
+        return throughput_;
+    }
+private:
+    int bitrate_ = 0;
+    int min_bitrate_ = 0;
+    int max_bitrate_ = 0;
+    int high_water_ = 300;
+    int low_water_ = 100;
+    int growth_threshold_ = 200;
+    int decrease_percent_ = 75;
+    int increase_percent_ = 5;
+    int hold_time_ = 5000;
+    int interval_ = 500;
+
+    int64_t pre_time_ = 0;
+    int64_t pre_duration_ = 0;
+    int64_t pre_sent_bytes_ = 0;
+    int64_t last_decrease_time_ = 0;
+    int throughput_ = 0;
+    bool congested_ = false;
+};
+
+#endif // BITRATECONTROLLER_H
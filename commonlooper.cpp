@@ -24,10 +24,11 @@ RET_CODE CommonLooper::Start()
     return RET_OK;
 }
 
+// 返回时工作线程已经退出，各个DeInit依赖这一点: 先Stop采集/发送线程，再drain或者释放编码器和队列
 void CommonLooper::Stop()
 {
     request_abort_ = true;
-    if(!worker_){
+    if(worker_){
         worker_->join();
         delete worker_;
         worker_ = NULL;
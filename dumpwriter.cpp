@@ -0,0 +1,308 @@
+#include <chrono>
+#include "dumpwriter.h"
+#include "dlog.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// O_DIRECT要求内存地址、文件偏移和长度都按块对齐，4096覆盖常见的磁盘
+#define DUMP_ALIGN 4096
+
+DumpWriter::DumpWriter()
+{
+
+}
+
+DumpWriter::~DumpWriter()
+{
+    DeInit();
+}
+
+RET_CODE DumpWriter::Init(const Properties &properties)
+{
+    buffer_size_    = properties.GetProperty("buffer_size", 1024 * 1024);
+    buffers_        = properties.GetProperty("buffers", 4);
+    flush_interval_ = properties.GetProperty("flush_interval", 1000);
+    direct_io_      = properties.GetProperty("direct_io", false);
+    if(buffer_size_ <= 0 || buffers_ <= 0 || flush_interval_ <= 0) {
+        LogError("buffer_size:%d, buffers:%d, flush_interval:%d", buffer_size_, buffers_, flush_interval_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    buffer_size_ = (buffer_size_ + DUMP_ALIGN - 1) / DUMP_ALIGN * DUMP_ALIGN;
+#ifndef __linux__
+    if(direct_io_) {
+        LogWarn("direct_io only support linux, use buffered io");
+        direct_io_ = false;
+    }
+#endif
+    return RET_OK;
+}
+
+int DumpWriter::Open(const std::string &file_name)
+{
+    DumpFile *file = new DumpFile();
+    file->name = file_name;
+    file->fd = -1;
+    file->fp = NULL;
+    file->active.data = NULL;
+    file->active.size = 0;
+    memset(&file->stats, 0, sizeof(DumpStats));
+    file->drop_logged = false;
+#ifdef __linux__
+    if(direct_io_) {
+        file->fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if(file->fd < 0) {
+            // tmpfs等文件系统不支持O_DIRECT
+            LogWarn("open %s with O_DIRECT failed, use buffered io", file_name.c_str());
+        }
+    }
+#endif
+    if(file->fd < 0) {
+        file->fp = fopen(file_name.c_str(), "wb");
+        if(!file->fp) {
+            LogError("fopen %s failed", file_name.c_str());
+            delete file;
+            return -1;
+        }
+    }
+    for(int i = 0; i < buffers_; i++) {
+        uint8_t *buf = alignedAlloc(buffer_size_);
+        if(!buf) {
+            LogError("alloc dump buffer failed");
+            closeFile(file);
+            return -1;
+        }
+        file->free_buffers.push_back(buf);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_.push_back(file);
+    return (int)files_.size() - 1;
+}
+
+bool DumpWriter::Write(int file, const uint8_t *data, int size, const uint8_t *data2, int size2)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(file < 0 || file >= (int)files_.size()) {
+        return false;
+    }
+    DumpFile *f = files_[file];
+    // 1. 空间不够时整体丢掉，不等待dump线程
+    int64_t available = (int64_t)f->free_buffers.size() * buffer_size_;
+    if(f->active.data) {
+        available += buffer_size_ - f->active.size;
+    }
+    int64_t total = (int64_t)size + size2;
+    if(total > available) {
+        f->stats.dropped_bytes += total;
+        f->stats.dropped_writes++;
+        if(!f->drop_logged) {
+            LogWarn("dump %s too slow, drop data", f->name.c_str());
+            f->drop_logged = true;
+        }
+        return false;
+    }
+    f->drop_logged = false;
+
+    // 2. 拷贝到缓冲区，写满的交给dump线程
+    size_t full = f->full.size();
+    copyLocked(f, data, size);
+    if(data2 && size2 > 0) {
+        copyLocked(f, data2, size2);
+    }
+    if(f->full.size() != full) {
+        cond_.notify_one();
+    }
+    return true;
+}
+
+void DumpWriter::copyLocked(DumpFile *file, const uint8_t *data, int size)
+{
+    while(size > 0) {
+        if(!file->active.data) {
+            file->active.data = file->free_buffers.back();
+            file->active.size = 0;
+            file->free_buffers.pop_back();
+        }
+        int n = buffer_size_ - file->active.size;
+        if(n > size) {
+            n = size;
+        }
+        memcpy(file->active.data + file->active.size, data, n);
+        file->active.size += n;
+        data += n;
+        size -= n;
+        if(file->active.size == buffer_size_) {
+            file->full.push_back(file->active);
+            file->active.data = NULL;
+            file->active.size = 0;
+        }
+    }
+}
+
+void DumpWriter::GetStats(int file, DumpStats *stats)
+{
+    if(!stats) {
+        LogError("stats is null");
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(file < 0 || file >= (int)files_.size()) {
+        memset(stats, 0, sizeof(DumpStats));
+        return;
+    }
+    *stats = files_[file]->stats;
+}
+
+void DumpWriter::Loop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::chrono::steady_clock::time_point last_flush = std::chrono::steady_clock::now();
+    while(!request_abort_) {
+        cond_.wait_for(lock, std::chrono::milliseconds(flush_interval_), [this] {
+            if(request_abort_) {
+                return true;
+            }
+            for(size_t i = 0; i < files_.size(); i++) {
+                if(!files_[i]->full.empty()) {
+                    return true;
+                }
+            }
+            return false;
+        });
+        if(request_abort_) {
+            break;      // 剩余数据在DeInit里写
+        }
+        // 到了flush间隔，没写满的缓冲区也写出去，dump文件能及时看到数据
+        // O_DIRECT只能写整块，等写满或者关闭
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        bool flush = now - last_flush >= std::chrono::milliseconds(flush_interval_);
+        if(flush) {
+            last_flush = now;
+        }
+        for(size_t i = 0; i < files_.size(); i++) {
+            DumpFile *file = files_[i];
+            if(flush && file->fd < 0 && file->active.data && file->active.size > 0) {
+                file->full.push_back(file->active);
+                file->active.data = NULL;
+                file->active.size = 0;
+            }
+            while(!file->full.empty()) {
+                DumpBuffer buffer = file->full.front();
+                file->full.pop_front();
+                // 写文件时不持有锁，采集线程可以继续往其他缓冲区拷贝
+                lock.unlock();
+                writeBuffer(file, buffer, false);
+                lock.lock();
+                file->stats.written_bytes += buffer.size;
+                file->free_buffers.push_back(buffer.data);
+            }
+        }
+    }
+}
+
+void DumpWriter::writeBuffer(DumpFile *file, const DumpBuffer &buffer, bool last)
+{
+#ifdef __linux__
+    if(file->fd >= 0) {
+        // 最后一块补齐到对齐大小再写，关闭前截断
+        int size = buffer.size;
+        if(last && size % DUMP_ALIGN != 0) {
+            int aligned = (size + DUMP_ALIGN - 1) / DUMP_ALIGN * DUMP_ALIGN;
+            memset(buffer.data + size, 0, aligned - size);
+            size = aligned;
+        }
+        int offset = 0;
+        while(offset < size) {
+            ssize_t n = write(file->fd, buffer.data + offset, size - offset);
+            if(n <= 0) {
+                LogError("write %s failed", file->name.c_str());
+                return;
+            }
+            offset += (int)n;
+        }
+        return;
+    }
+#endif
+    if(fwrite(buffer.data, 1, buffer.size, file->fp) != (size_t)buffer.size) {
+        LogError("fwrite %s failed", file->name.c_str());
+    }
+    fflush(file->fp);
+}
+
+void DumpWriter::DeInit()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        request_abort_ = true;
+    }
+    cond_.notify_all();
+    Stop();
+
+    // 线程已经退出，不用加锁
+    for(size_t i = 0; i < files_.size(); i++) {
+        DumpFile *file = files_[i];
+        while(!file->full.empty()) {
+            writeBuffer(file, file->full.front(), false);
+            file->stats.written_bytes += file->full.front().size;
+            file->free_buffers.push_back(file->full.front().data);
+            file->full.pop_front();
+        }
+        if(file->active.data) {
+            writeBuffer(file, file->active, true);
+            file->stats.written_bytes += file->active.size;
+            file->free_buffers.push_back(file->active.data);
+            file->active.data = NULL;
+        }
+        LogInfo("dump %s written:%lld, dropped:%lld", file->name.c_str(),
+                file->stats.written_bytes, file->stats.dropped_bytes);
+        closeFile(file);
+    }
+    files_.clear();
+}
+
+void DumpWriter::closeFile(DumpFile *file)
+{
+#ifdef __linux__
+    if(file->fd >= 0) {
+        // 去掉最后一块补齐的数据
+        if(ftruncate(file->fd, file->stats.written_bytes) < 0) {
+            LogError("ftruncate %s failed", file->name.c_str());
+        }
+        close(file->fd);
+    }
+#endif
+    if(file->fp) {
+        fclose(file->fp);
+    }
+    for(size_t i = 0; i < file->free_buffers.size(); i++) {
+        alignedFree(file->free_buffers[i]);
+    }
+    delete file;
+}
+
+uint8_t *DumpWriter::alignedAlloc(int size)
+{
+#ifdef _WIN32
+    return (uint8_t *)_aligned_malloc(size, DUMP_ALIGN);
+#else
+    void *p = NULL;
+    if(posix_memalign(&p, DUMP_ALIGN, size) != 0) {
+        return NULL;
+    }
+    return (uint8_t *)p;
+#endif
+}
+
+void DumpWriter::alignedFree(uint8_t *p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
@@ -0,0 +1,85 @@
+#ifndef DUMPWRITER_H
+#define DUMPWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "commonlooper.h"
+#include "mediabase.h"
+
+typedef struct dump_stats {
+    int64_t written_bytes;  // 已经写到文件的字节数
+    int64_t dropped_bytes;  // 磁盘太慢缓冲区用完时丢掉的字节数
+    int64_t dropped_writes; // 丢掉的写入次数
+}DumpStats;
+
+// 后台dump: 采集/编码线程只把数据拷贝到对齐的大缓冲区，写满后交给dump线程写文件
+// 缓冲区用完(磁盘跟不上)时直接丢掉这次写入，不阻塞调用者
+class DumpWriter: public CommonLooper
+{
+public:
+    DumpWriter();
+    virtual ~DumpWriter();
+    /**
+     * @brief Init
+     * @param "buffer_size", 每个缓冲区的大小，默认1MB，按4096对齐
+     *        "buffers", 每个文件的缓冲区个数，默认4
+     *        "flush_interval", 没写满的缓冲区最多多久写一次文件ms，默认1000
+     *        "direct_io", 1使用O_DIRECT绕过page cache(只有linux)，默认0
+     *                     只写整块缓冲区，关闭时补齐最后一块再截断到实际大小
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    // 关闭: 停止线程，写完剩余数据并关闭所有文件
+    void DeInit();
+    /**
+     * @brief Open 打开一个dump文件，在Start之前调用
+     * @return 文件的编号，失败返回-1
+     */
+    int Open(const std::string &file_name);
+    /**
+     * @brief Write 写入一段数据，两段数据(比如ADTS头和AAC数据)作为整体写入或者整体丢掉
+     * @return false代表缓冲区不够，数据被丢掉
+     */
+    bool Write(int file, const uint8_t *data, int size,
+               const uint8_t *data2 = NULL, int size2 = 0);
+    void GetStats(int file, DumpStats *stats);
+
+    virtual void Loop();
+private:
+    typedef struct dump_buffer {
+        uint8_t *data;
+        int size;           // 已经写入的字节数
+    }DumpBuffer;
+
+    typedef struct dump_file {
+        std::string name;
+        int fd;
+        FILE *fp;
+        std::vector<uint8_t *> free_buffers;
+        DumpBuffer active;              // 正在拷贝的缓冲区，data为NULL代表没有
+        std::deque<DumpBuffer> full;    // 等待写文件的缓冲区
+        DumpStats stats;
+        bool drop_logged;
+    }DumpFile;
+
+    void copyLocked(DumpFile *file, const uint8_t *data, int size);
+    // 把缓冲区写到文件，在dump线程调用，不加锁
+    void writeBuffer(DumpFile *file, const DumpBuffer &buffer, bool last);
+    void closeFile(DumpFile *file);
+    static uint8_t *alignedAlloc(int size);
+    static void alignedFree(uint8_t *p);
+
+    int buffer_size_ = 1024 * 1024;
+    int buffers_ = 4;
+    int flush_interval_ = 1000;
+    bool direct_io_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<DumpFile *> files_;
+};
+
+#endif // DUMPWRITER_H
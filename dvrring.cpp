@@ -0,0 +1,549 @@
+#include <algorithm>
+#include <chrono>
+#include "dvrring.h"
+#include "dlog.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+#define DVR_MAGIC 0x31525644        // "DVR1"
+
+DvrRing::DvrRing()
+{
+    active_.data = NULL;
+    active_.size = 0;
+}
+
+DvrRing::~DvrRing()
+{
+    DeInit();
+}
+
+RET_CODE DvrRing::Init(const Properties &properties)
+{
+    // 1.读取参数
+    dir_                = properties.GetProperty("dir", ".");
+    segment_count_      = properties.GetProperty("segments", 10);
+    segment_size_       = properties.GetProperty("segment_size", 32 * 1024 * 1024);
+    segment_duration_   = properties.GetProperty("segment_duration", 60000);
+    max_keyframes_      = properties.GetProperty("max_keyframes", 1024);
+    buffer_size_        = properties.GetProperty("buffer_size", 512 * 1024);
+    buffers_            = properties.GetProperty("buffers", 8);
+    flush_interval_     = properties.GetProperty("flush_interval", 1000);
+    if(segment_count_ < 2 || segment_size_ <= buffer_size_ || segment_size_ > 1024 * 1024 * 1024
+            || segment_duration_ <= 0 || max_keyframes_ <= 0 || buffer_size_ <= (int)sizeof(DvrRecordHeader)
+            || buffers_ <= 0 || flush_interval_ <= 0) {
+        LogError("segments:%d, segment_size:%lld, segment_duration:%d, max_keyframes:%d, buffer_size:%d, "
+                 "buffers:%d, flush_interval:%d", segment_count_, (long long)segment_size_, segment_duration_,
+                 max_keyframes_, buffer_size_, buffers_, flush_interval_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+
+    // 2.创建并预分配段文件，写的时候不再扩展文件
+    segments_.resize(segment_count_);
+    for(int i = 0; i < segment_count_; i++) {
+        DvrSegment &seg = segments_[i];
+        char name[32];
+        snprintf(name, sizeof(name), "/dvr_%02d.seg", i);
+        seg.name = dir_ + name;
+        seg.sequence = 0;
+        seg.size = 0;
+        seg.flushed = 0;
+        seg.first_pts = -1;
+        seg.last_pts = -1;
+        seg.index.resize(max_keyframes_);
+        seg.index_count = 0;
+        seg.pinned = 0;
+        seg.video_par = avcodec_parameters_alloc();
+        if(!seg.video_par) {
+            LogError("avcodec_parameters_alloc failed");
+            return RET_ERR_OUTOFMEMORY;
+        }
+        seg.fp = fopen(seg.name.c_str(), "wb+");
+        if(!seg.fp) {
+            LogError("fopen %s failed", seg.name.c_str());
+            return RET_ERR_OPEN_FILE;
+        }
+#ifdef __linux__
+        if(posix_fallocate(fileno(seg.fp), 0, segment_size_) != 0) {
+            LogError("posix_fallocate %s failed", seg.name.c_str());
+            return RET_FAIL;
+        }
+#else
+        if(fseek(seg.fp, (long)(segment_size_ - 1), SEEK_SET) != 0 || fputc(0, seg.fp) == EOF) {
+            LogError("preallocate %s failed", seg.name.c_str());
+            return RET_FAIL;
+        }
+        fflush(seg.fp);
+#endif
+    }
+
+    // 3.分配缓冲区，之后每个包只做拷贝
+    for(int i = 0; i < buffers_; i++) {
+        uint8_t *buf = (uint8_t *)malloc(buffer_size_);
+        if(!buf) {
+            LogError("malloc dvr buffer failed");
+            return RET_ERR_OUTOFMEMORY;
+        }
+        free_buffers_.push_back(buf);
+    }
+    LogInfo("dvr %s: %d segments x %lldMB, %dms per segment", dir_.c_str(), segment_count_,
+            (long long)(segment_size_ / (1024 * 1024)), segment_duration_);
+    return RET_OK;
+}
+
+void DvrRing::DeInit()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        request_abort_ = true;
+    }
+    cond_.notify_all();
+    Stop();
+
+    // 线程已经退出，不用加锁
+    handoffLocked();
+    while(!full_.empty()) {
+        DvrBuffer buffer = full_.front();
+        full_.pop_front();
+        if(segments_[buffer.segment].sequence == buffer.sequence) {
+            writeBuffer(buffer);
+        }
+        free_buffers_.push_back(buffer.data);
+    }
+    for(size_t i = 0; i < segments_.size(); i++) {
+        if(segments_[i].fp) {
+            fclose(segments_[i].fp);
+            segments_[i].fp = NULL;
+        }
+        avcodec_parameters_free(&segments_[i].video_par);
+    }
+    for(size_t i = 0; i < free_buffers_.size(); i++) {
+        free(free_buffers_[i]);
+    }
+    free_buffers_.clear();
+    if(video_par_) {
+        avcodec_parameters_free(&video_par_);
+    }
+    if(audio_par_) {
+        avcodec_parameters_free(&audio_par_);
+    }
+}
+
+RET_CODE DvrRing::ConfigVideoStream(const AVCodecContext *ctx)
+{
+    if(!ctx || !ctx->extradata || ctx->extradata_size <= 0) {
+        LogError("video ctx or extradata is null");
+        return RET_FAIL;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!video_par_) {
+        video_par_ = avcodec_parameters_alloc();
+    }
+    if(!video_par_ || avcodec_parameters_from_context(video_par_, ctx) < 0) {
+        LogError("copy video parameters failed");
+        return RET_FAIL;
+    }
+    video_changed_ = true;
+    return RET_OK;
+}
+
+RET_CODE DvrRing::ConfigAudioStream(const AVCodecContext *ctx)
+{
+    if(!ctx) {
+        LogError("audio ctx is null");
+        return RET_FAIL;
+    }
+    audio_par_ = avcodec_parameters_alloc();
+    if(!audio_par_ || avcodec_parameters_from_context(audio_par_, ctx) < 0) {
+        LogError("copy audio parameters failed");
+        return RET_FAIL;
+    }
+    return RET_OK;
+}
+
+bool DvrRing::Push(const AVPacket *pkt, MediaType media_type)
+{
+    if(!pkt || (media_type != E_AUDIO_TYPE && media_type != E_VIDEO_TYPE)) {
+        return false;
+    }
+    int record_size = (int)sizeof(DvrRecordHeader) + pkt->size;
+    bool key = E_VIDEO_TYPE == media_type && (pkt->flags & AV_PKT_FLAG_KEY);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(segments_.empty() || request_abort_) {
+        return false;
+    }
+    bool dropped = record_size > buffer_size_;
+
+    // 1.切段: 时长到了或者视频参数变了在关键帧切，当前段放不下时马上切
+    if(!dropped) {
+        bool full = cur_segment_ < 0 || segments_[cur_segment_].size + record_size > segment_size_;
+        bool roll = key && cur_segment_ >= 0 && segments_[cur_segment_].first_pts >= 0
+                && (video_changed_ || pkt->pts - segments_[cur_segment_].first_pts >= segment_duration_);
+        if((full || roll) && !nextSegmentLocked(pkt->pts) && full) {
+            dropped = true;     // 下一段正在导出
+        }
+    }
+
+    // 2.缓冲区剩余空间不够时换一个，缓冲区用完说明磁盘跟不上
+    if(!dropped) {
+        if(active_.data && active_.size + record_size > buffer_size_) {
+            handoffLocked();
+        }
+        if(!active_.data) {
+            if(free_buffers_.empty()) {
+                dropped = true;
+            } else {
+                active_.data = free_buffers_.back();
+                free_buffers_.pop_back();
+                active_.size = 0;
+                active_.segment = cur_segment_;
+                active_.sequence = segments_[cur_segment_].sequence;
+                active_.offset = segments_[cur_segment_].size;
+            }
+        }
+    }
+    if(dropped) {
+        dropped_packets_++;
+        if(!drop_logged_) {
+            LogWarn("dvr drop %s packet, size:%d", E_VIDEO_TYPE == media_type ? "video" : "audio", pkt->size);
+            drop_logged_ = true;
+        }
+        return false;
+    }
+    drop_logged_ = false;
+
+    // 3.拷贝包头和数据，关键帧记录到索引
+    DvrSegment &seg = segments_[cur_segment_];
+    DvrRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DVR_MAGIC;
+    header.size = pkt->size;
+    header.pts = pkt->pts;
+    header.dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    header.media_type = (uint8_t)media_type;
+    header.key = key ? 1 : 0;
+    memcpy(active_.data + active_.size, &header, sizeof(header));
+    memcpy(active_.data + active_.size + sizeof(header), pkt->data, pkt->size);
+    active_.size += record_size;
+    if(key && seg.index_count < max_keyframes_) {
+        seg.index[seg.index_count].pts = pkt->pts;
+        seg.index[seg.index_count].offset = seg.size;
+        seg.index_count++;
+    }
+    seg.size += record_size;
+    if(seg.first_pts < 0) {
+        seg.first_pts = pkt->pts;
+        // 段是循环使用的，每次开始新的一段都用当前的参数
+        if(video_par_) {
+            avcodec_parameters_copy(seg.video_par, video_par_);
+            video_changed_ = false;
+        }
+    }
+    seg.last_pts = pkt->pts;
+    return true;
+}
+
+bool DvrRing::nextSegmentLocked(int64_t pts)
+{
+    int next = (cur_segment_ + 1) % segment_count_;
+    if(segments_[next].pinned > 0) {
+        return false;
+    }
+    handoffLocked();
+    // 覆盖最旧的段，缓冲区里还没写的旧数据按sequence丢掉
+    DvrSegment &seg = segments_[next];
+    seg.sequence = ++sequence_;
+    seg.size = 0;
+    seg.flushed = 0;
+    seg.first_pts = -1;
+    seg.last_pts = -1;
+    seg.index_count = 0;
+    cur_segment_ = next;
+    LogDebug("dvr switch to segment %d at pts:%lld", next, (long long)pts);
+    return true;
+}
+
+void DvrRing::handoffLocked()
+{
+    if(active_.data) {
+        if(active_.size > 0) {
+            full_.push_back(active_);
+            cond_.notify_one();
+        } else {
+            free_buffers_.push_back(active_.data);
+        }
+        active_.data = NULL;
+        active_.size = 0;
+    }
+}
+
+void DvrRing::writeBuffer(const DvrBuffer &buffer)
+{
+    DvrSegment &seg = segments_[buffer.segment];
+    if(fseek(seg.fp, (long)buffer.offset, SEEK_SET) != 0
+            || fwrite(buffer.data, 1, buffer.size, seg.fp) != (size_t)buffer.size) {
+        LogError("write %s failed", seg.name.c_str());
+        return;
+    }
+    fflush(seg.fp);
+}
+
+void DvrRing::Loop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::chrono::steady_clock::time_point last_flush = std::chrono::steady_clock::now();
+    while(!request_abort_) {
+        cond_.wait_for(lock, std::chrono::milliseconds(flush_interval_), [this] {
+            return request_abort_ || !full_.empty();
+        });
+        if(request_abort_) {
+            break;      // 剩余数据在DeInit里写
+        }
+        // 到了flush间隔，没写满的缓冲区也写出去，导出时能拿到最近的数据
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if(now - last_flush >= std::chrono::milliseconds(flush_interval_)) {
+            last_flush = now;
+            handoffLocked();
+        }
+        while(!full_.empty()) {
+            DvrBuffer buffer = full_.front();
+            full_.pop_front();
+            // 段已经被覆盖，旧数据不用写了
+            if(segments_[buffer.segment].sequence == buffer.sequence) {
+                // 写文件时不持有锁，编码线程可以继续往其他缓冲区拷贝
+                lock.unlock();
+                writeBuffer(buffer);
+                lock.lock();
+                DvrSegment &seg = segments_[buffer.segment];
+                if(seg.sequence == buffer.sequence) {
+                    seg.flushed = buffer.offset + buffer.size;
+                }
+            }
+            free_buffers_.push_back(buffer.data);
+        }
+    }
+}
+
+RET_CODE DvrRing::ExportClip(int64_t start_pts, int64_t end_pts, const std::string &file_name)
+{
+    std::vector<int> segments;
+    std::vector<int64_t> end_offsets;
+    int64_t start_offset = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 1.有数据的段按从旧到新排序
+        std::vector<int> order;
+        for(int i = 0; i < (int)segments_.size(); i++) {
+            if(segments_[i].sequence > 0) {
+                order.push_back(i);
+            }
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return segments_[a].sequence < segments_[b].sequence;
+        });
+        // 2.在索引里找start_pts之前最近的关键帧，没有时用最早的关键帧
+        int first = -1;
+        for(size_t i = 0; i < order.size(); i++) {
+            const DvrSegment &seg = segments_[order[i]];
+            for(int k = 0; k < seg.index_count; k++) {
+                if(seg.index[k].offset >= seg.flushed) {
+                    break;      // 还没写到文件
+                }
+                if(first < 0 || seg.index[k].pts <= start_pts) {
+                    first = (int)i;
+                    start_offset = seg.index[k].offset;
+                }
+                if(seg.index[k].pts > start_pts) {
+                    break;
+                }
+            }
+        }
+        if(first < 0) {
+            LogError("dvr has no keyframe to export");
+            return RET_FAIL;
+        }
+        // 3.占用涉及的段，导出期间不被覆盖
+        for(size_t i = first; i < order.size(); i++) {
+            DvrSegment &seg = segments_[order[i]];
+            seg.pinned++;
+            segments.push_back(order[i]);
+            end_offsets.push_back(seg.flushed);
+        }
+    }
+
+    RET_CODE ret = exportRange(segments, start_offset, end_offsets, end_pts, file_name);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(size_t i = 0; i < segments.size(); i++) {
+        segments_[segments[i]].pinned--;
+    }
+    return ret;
+}
+
+RET_CODE DvrRing::ExportTail(int64_t duration, const std::string &file_name)
+{
+    int64_t last_pts = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(cur_segment_ >= 0) {
+            last_pts = segments_[cur_segment_].last_pts;
+        }
+    }
+    if(last_pts < 0) {
+        LogError("dvr is empty");
+        return RET_FAIL;
+    }
+    return ExportClip(last_pts - duration, -1, file_name);
+}
+
+RET_CODE DvrRing::exportRange(const std::vector<int> &segments, int64_t start_offset,
+                              const std::vector<int64_t> &end_offsets, int64_t end_pts,
+                              const std::string &file_name)
+{
+    // 1.创建mp4，视频参数用起始段的，段被占用期间不会变
+    AVFormatContext *fmt_ctx = NULL;
+    if(avformat_alloc_output_context2(&fmt_ctx, NULL, "mp4", file_name.c_str()) < 0) {
+        LogError("avformat_alloc_output_context2 failed");
+        return RET_FAIL;
+    }
+    AVStream *streams[2] = {NULL, NULL};      // 按MediaType索引
+    AVCodecParameters *video_par = segments_[segments[0]].video_par;
+    AVCodecParameters *pars[2] = {audio_par_, video_par->codec_id != AV_CODEC_ID_NONE ? video_par : NULL};
+    MediaType types[2] = {E_AUDIO_TYPE, E_VIDEO_TYPE};
+    for(int i = 0; i < 2; i++) {
+        if(!pars[i]) {
+            continue;
+        }
+        AVStream *st = avformat_new_stream(fmt_ctx, NULL);
+        if(!st) {
+            avformat_free_context(fmt_ctx);
+            return RET_FAIL;
+        }
+        avcodec_parameters_copy(st->codecpar, pars[i]);
+        st->codecpar->codec_tag = 0;
+        st->time_base = E_AUDIO_TYPE == types[i] ? av_make_q(1, pars[i]->sample_rate) : av_make_q(1, 1000);
+        if(pars[i]->codec_id == AV_CODEC_ID_OPUS) {
+            fmt_ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+        }
+        streams[types[i]] = st;
+    }
+    if(avio_open(&fmt_ctx->pb, file_name.c_str(), AVIO_FLAG_WRITE) < 0) {
+        LogError("avio_open %s failed", file_name.c_str());
+        avformat_free_context(fmt_ctx);
+        return RET_ERR_OPEN_FILE;
+    }
+    if(avformat_write_header(fmt_ctx, NULL) < 0) {
+        LogError("avformat_write_header failed");
+        avio_closep(&fmt_ctx->pb);
+        avformat_free_context(fmt_ctx);
+        return RET_FAIL;
+    }
+
+    // 2.从起始关键帧开始顺序读包，直到end_pts
+    AVRational src_time_base = {1, 1000};
+    std::vector<uint8_t> payload;
+    int64_t key_pts = -1;
+    int64_t base_dts = 0;   // 时间戳从起始关键帧的dts开始，mp4不会在前面插一段空的edit list
+    int64_t packets = 0;
+    bool done = false;
+    for(size_t i = 0; i < segments.size() && !done; i++) {
+        const DvrSegment &seg = segments_[segments[i]];
+        FILE *fp = fopen(seg.name.c_str(), "rb");
+        if(!fp) {
+            LogError("fopen %s failed", seg.name.c_str());
+            break;
+        }
+        int64_t offset = i == 0 ? start_offset : 0;
+        if(fseek(fp, (long)offset, SEEK_SET) != 0) {
+            fclose(fp);
+            break;
+        }
+        DvrRecordHeader header;
+        while(offset + (int64_t)sizeof(header) <= end_offsets[i]) {
+            if(fread(&header, 1, sizeof(header), fp) != sizeof(header) || header.magic != DVR_MAGIC
+                    || offset + (int64_t)sizeof(header) + header.size > end_offsets[i]) {
+                LogWarn("dvr %s broken at %lld", seg.name.c_str(), (long long)offset);
+                break;
+            }
+            payload.resize(header.size);
+            if(header.size > 0 && fread(payload.data(), 1, header.size, fp) != header.size) {
+                break;
+            }
+            offset += sizeof(header) + header.size;
+            if(end_pts >= 0 && header.pts > end_pts) {
+                done = true;
+                break;
+            }
+            if(key_pts < 0) {
+                key_pts = header.pts;   // 第一个包就是起始关键帧
+                base_dts = header.dts;
+            }
+            AVStream *st = header.media_type < 2 ? streams[header.media_type] : NULL;
+            // 关键帧之前的音频解码出来也没有画面
+            if(!st || (E_AUDIO_TYPE == header.media_type && header.pts < key_pts)) {
+                continue;
+            }
+            AVPacket pkt;
+            av_init_packet(&pkt);
+            pkt.data = payload.data();
+            pkt.size = header.size;
+            pkt.stream_index = st->index;
+            pkt.pts = av_rescale_q(header.pts - base_dts, src_time_base, st->time_base);
+            pkt.dts = av_rescale_q(header.dts - base_dts, src_time_base, st->time_base);
+            pkt.flags = header.key ? AV_PKT_FLAG_KEY : 0;
+            if(av_write_frame(fmt_ctx, &pkt) < 0) {
+                LogWarn("av_write_frame failed, pts:%lld", (long long)header.pts);
+                continue;
+            }
+            packets++;
+        }
+        fclose(fp);
+    }
+
+    // 3.写文件尾
+    int ret = av_write_trailer(fmt_ctx);
+    avio_closep(&fmt_ctx->pb);
+    avformat_free_context(fmt_ctx);
+    if(ret < 0 || packets == 0) {
+        LogError("export %s failed, packets:%lld", file_name.c_str(), (long long)packets);
+        return RET_FAIL;
+    }
+    LogInfo("export %s, pts:%lld~%lld, packets:%lld", file_name.c_str(), (long long)key_pts,
+            (long long)end_pts, (long long)packets);
+    return RET_OK;
+}
+
+void DvrRing::GetStats(DvrStats *stats)
+{
+    if(!stats) {
+        LogError("stats is null");
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    memset(stats, 0, sizeof(DvrStats));
+    stats->first_pts = -1;
+    stats->last_pts = -1;
+    int64_t oldest = 0;
+    for(size_t i = 0; i < segments_.size(); i++) {
+        const DvrSegment &seg = segments_[i];
+        if(seg.sequence == 0 || seg.first_pts < 0) {
+            continue;
+        }
+        stats->segments++;
+        stats->bytes += seg.size;
+        if(oldest == 0 || seg.sequence < oldest) {
+            oldest = seg.sequence;
+            stats->first_pts = seg.first_pts;
+        }
+    }
+    if(cur_segment_ >= 0) {
+        stats->last_pts = segments_[cur_segment_].last_pts;
+    }
+    stats->dropped_packets = dropped_packets_;
+}
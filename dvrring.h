@@ -0,0 +1,141 @@
+#ifndef DVRRING_H
+#define DVRRING_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "commonlooper.h"
+#include "mediabase.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+typedef struct dvr_stats {
+    int64_t first_pts;      // 环里最早的包ms，没有数据时为-1
+    int64_t last_pts;       // 环里最新的包ms
+    int64_t bytes;          // 环里的数据量
+    int segments;           // 有数据的段数
+    int64_t dropped_packets;// 缓冲区用完、包太大或者段被导出占用时丢掉的包
+}DvrStats;
+
+// 时移环: 最近N分钟的编码包按段写在预分配的定长文件里，环满后覆盖最旧的段
+// 每段在内存里维护关键帧索引，可以在不重新编码的情况下导出任意一段或者最后几秒到mp4
+// 编码线程只把包拷贝到预分配的缓冲区，由dvr线程按整块写文件; 缓冲区用完时丢包，不阻塞调用者
+class DvrRing: public CommonLooper
+{
+public:
+    DvrRing();
+    virtual ~DvrRing();
+    /**
+     * @brief Init 创建并预分配段文件dvr_00.seg ~ dvr_NN.seg，退出时保留，方便事后分析
+     * @param "dir", 段文件的目录，默认"."
+     *        "segments", 段数，默认10
+     *        "segment_size", 每段的大小，默认32MB，最大1GB
+     *        "segment_duration", 每段的时长ms，到了之后在下一个关键帧切段，默认60000
+     *        "max_keyframes", 每段最多索引的关键帧数，默认1024
+     *        "buffer_size", 写文件的缓冲区大小，默认512KB，比它大的包会被丢掉
+     *        "buffers", 缓冲区个数，默认8
+     *        "flush_interval", 没写满的缓冲区最多多久写一次文件ms，默认1000
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    // 停止线程，写完剩余数据并关闭段文件
+    void DeInit();
+    // 导出时用的编码参数，在Push之前设置
+    // 视频参数可以在运行中重新设置(降级阶梯切换分辨率)，下一个关键帧开始新的一段，每段导出时用自己的参数
+    RET_CODE ConfigVideoStream(const AVCodecContext *ctx);
+    RET_CODE ConfigAudioStream(const AVCodecContext *ctx);
+    /**
+     * @brief Push 把包拷贝到缓冲区，不持有pkt，pts/dts单位为ms
+     * @return 丢包时返回false
+     */
+    bool Push(const AVPacket *pkt, MediaType media_type);
+    /**
+     * @brief ExportClip 导出[start_pts, end_pts]之间的包到mp4，从start_pts之前最近的关键帧开始
+     *        在调用者线程读文件，期间涉及的段不会被覆盖
+     * @param start_pts     ms
+     * @param end_pts       ms，小于0代表到最新
+     * @return
+     */
+    RET_CODE ExportClip(int64_t start_pts, int64_t end_pts, const std::string &file_name);
+    // 导出最后duration毫秒
+    RET_CODE ExportTail(int64_t duration, const std::string &file_name);
+    void GetStats(DvrStats *stats);
+
+    virtual void Loop();
+private:
+    typedef struct dvr_record_header {
+        uint32_t magic;
+        uint32_t size;      // payload大小
+        int64_t pts;
+        int64_t dts;
+        uint8_t media_type;
+        uint8_t key;
+        uint8_t reserved[6];
+    }DvrRecordHeader;      // 32字节，段文件里每个包前面一个，索引丢失时可以顺序扫描恢复
+
+    typedef struct dvr_index_entry {
+        int64_t pts;
+        int64_t offset;
+    }DvrIndexEntry;
+
+    typedef struct dvr_segment {
+        std::string name;
+        FILE *fp;
+        int64_t sequence;   // 第几次使用，越大越新，0代表没有数据
+        int64_t size;       // 已经分配出去的大小
+        int64_t flushed;    // 已经写到文件的大小，导出只读到这里
+        int64_t first_pts;
+        int64_t last_pts;
+        std::vector<DvrIndexEntry> index;   // Init时分配max_keyframes个
+        int index_count;
+        int pinned;         // 正在导出的次数，大于0时不能被覆盖
+        AVCodecParameters *video_par;       // 开始这一段时的视频参数
+    }DvrSegment;
+
+    typedef struct dvr_buffer {
+        uint8_t *data;
+        int size;
+        int segment;
+        int64_t sequence;   // 写文件时段已经被覆盖就丢掉
+        int64_t offset;     // 在段文件里的偏移
+    }DvrBuffer;
+
+    // 切到下一段，下一段正在导出时返回false
+    bool nextSegmentLocked(int64_t pts);
+    // 把正在拷贝的缓冲区交给dvr线程
+    void handoffLocked();
+    void writeBuffer(const DvrBuffer &buffer);
+    RET_CODE exportRange(const std::vector<int> &segments, int64_t start_offset,
+                         const std::vector<int64_t> &end_offsets, int64_t end_pts,
+                         const std::string &file_name);
+
+    std::string dir_ = ".";
+    int segment_count_ = 10;
+    int64_t segment_size_ = 32 * 1024 * 1024;
+    int segment_duration_ = 60000;
+    int max_keyframes_ = 1024;
+    int buffer_size_ = 512 * 1024;
+    int buffers_ = 8;
+    int flush_interval_ = 1000;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<DvrSegment> segments_;
+    int cur_segment_ = -1;
+    int64_t sequence_ = 0;
+    std::vector<uint8_t *> free_buffers_;
+    DvrBuffer active_;                  // 正在拷贝的缓冲区，data为NULL代表没有
+    std::deque<DvrBuffer> full_;        // 等待写文件的缓冲区
+    int64_t dropped_packets_ = 0;
+    bool drop_logged_ = false;
+
+    AVCodecParameters *video_par_ = NULL;
+    bool video_changed_ = false;        // 视频参数变了，下一个关键帧切段
+    AVCodecParameters *audio_par_ = NULL;
+};
+
+#endif // DVRRING_H
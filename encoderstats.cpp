@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <chrono>
+#include "encoderstats.h"
+#include "dlog.h"
+
+extern "C" {
+#include <libavutil/intreadwrite.h>
+}
+
+// 送帧时间最多保留的个数，编码器缓存的帧(lookahead、frame多线程)不会超过这个数
+#define MAX_SEND_TIMES 512
+
+static int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 值落在哪个2的幂的桶里，base是第0个桶的上限
+static int bucket(int64_t value, int64_t base)
+{
+    int i = 0;
+    while(value >= base && i < ENCODER_HIST_BUCKETS - 1) {
+        base <<= 1;
+        i++;
+    }
+    return i;
+}
+
+EncoderStats::EncoderStats()
+{
+    Reset();
+}
+
+EncoderStats::~EncoderStats()
+{
+
+}
+
+void EncoderStats::Init(int window, bool reorder)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_ = window > 0 ? window : 300;
+    reorder_ = reorder;
+}
+
+void EncoderStats::Reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    send_times_.clear();
+    for(int i = 0; i < ENCODER_FRAME_TYPES; i++) {
+        samples_[i].clear();
+        sample_pos_[i] = 0;
+        frames_[i] = 0;
+    }
+    total_bytes_ = 0;
+}
+
+void EncoderStats::OnSend(int64_t pts)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(send_times_.size() >= MAX_SEND_TIMES) {
+        send_times_.pop_front();
+    }
+    send_times_.push_back(std::make_pair(pts, now_us()));
+}
+
+void EncoderStats::OnPacket(const AVPacket *packet, bool audio)
+{
+    int64_t now = now_us();
+    // 1. 帧类型和qp，libx264通过AV_PKT_DATA_QUALITY_STATS带出来: quality(qp*FF_QP2LAMBDA) + pict_type
+    int type = ENCODER_FRAME_OTHER;
+    float qp = -1;
+    if(!audio) {
+        int sd_size = 0;
+        uint8_t *sd = av_packet_get_side_data(packet, AV_PKT_DATA_QUALITY_STATS, &sd_size);
+        int pict_type = AV_PICTURE_TYPE_NONE;
+        if(sd && sd_size >= 5) {
+            qp = (float)AV_RL32(sd) / FF_QP2LAMBDA;
+            pict_type = sd[4];
+        }
+        if(pict_type == AV_PICTURE_TYPE_I || (packet->flags & AV_PKT_FLAG_KEY)) {
+            type = ENCODER_FRAME_I;
+        } else if(pict_type == AV_PICTURE_TYPE_B) {
+            type = ENCODER_FRAME_B;
+        } else if(pict_type == AV_PICTURE_TYPE_P) {
+            type = ENCODER_FRAME_P;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 2. 找到对应的送帧时间，有重排序时按pts找，否则取最早的
+    int64_t latency = 0;
+    if(reorder_) {
+        for(std::deque<std::pair<int64_t, int64_t> >::iterator it = send_times_.begin();
+            it != send_times_.end(); ++it) {
+            if(it->first == packet->pts) {
+                latency = now - it->second;
+                send_times_.erase(it);
+                break;
+            }
+        }
+    } else if(!send_times_.empty()) {
+        latency = now - send_times_.front().second;
+        send_times_.pop_front();
+    }
+
+    // 3. 写入这种帧类型的环形缓冲
+    Sample sample = {latency, packet->size, qp};
+    std::vector<Sample> &samples = samples_[type];
+    if((int)samples.size() < window_) {
+        samples.push_back(sample);
+    } else {
+        samples[sample_pos_[type]] = sample;
+        sample_pos_[type] = (sample_pos_[type] + 1) % window_;
+    }
+    frames_[type]++;
+    total_bytes_ += packet->size;
+}
+
+void EncoderStats::GetStats(EncoderStatsInfo *info)
+{
+    if(!info) {
+        LogError("info is null");
+        return;
+    }
+    memset(info, 0, sizeof(EncoderStatsInfo));
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(int t = 0; t < ENCODER_FRAME_TYPES; t++) {
+        EncoderFrameStats &stats = info->types[t];
+        const std::vector<Sample> &samples = samples_[t];
+        stats.frames = frames_[t];
+        stats.window_frames = (int)samples.size();
+        stats.avg_qp = -1;
+        info->total_frames += frames_[t];
+        if(samples.empty()) {
+            continue;
+        }
+        std::vector<int64_t> latencies;
+        std::vector<int> sizes;
+        latencies.reserve(samples.size());
+        sizes.reserve(samples.size());
+        double sum_latency = 0;
+        double sum_size = 0;
+        double sum_qp = 0;
+        int qp_count = 0;
+        for(size_t i = 0; i < samples.size(); i++) {
+            const Sample &s = samples[i];
+            latencies.push_back(s.latency);
+            sizes.push_back(s.size);
+            sum_latency += s.latency;
+            sum_size += s.size;
+            if(s.qp >= 0) {
+                sum_qp += s.qp;
+                qp_count++;
+            }
+            stats.latency_hist[bucket(s.latency, 1000)]++;
+            stats.size_hist[bucket(s.size, 256)]++;
+        }
+        // 分位数用nth_element，窗口只有几百帧
+        size_t p95 = samples.size() * 95 / 100;
+        std::nth_element(latencies.begin(), latencies.begin() + p95, latencies.end());
+        stats.p95_latency = latencies[p95];
+        stats.max_latency = *std::max_element(latencies.begin(), latencies.end());
+        std::nth_element(sizes.begin(), sizes.begin() + p95, sizes.end());
+        stats.p95_size = sizes[p95];
+        stats.max_size = *std::max_element(sizes.begin(), sizes.end());
+        stats.avg_latency = sum_latency / samples.size();
+        stats.avg_size = sum_size / samples.size();
+        stats.avg_qp = qp_count > 0 ? sum_qp / qp_count : -1;
+    }
+    info->total_bytes = total_bytes_;
+}
+
+const char *EncoderStats::GetTypeName(int type)
+{
+    switch(type) {
+    case ENCODER_FRAME_I:   return "I";
+    case ENCODER_FRAME_P:   return "P";
+    case ENCODER_FRAME_B:   return "B";
+    default:                return "other";
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef ENCODERSTATS_H
+#define ENCODERSTATS_H
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "mediabase.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+// 统计按帧类型分开，音频和拿不到类型的帧算OTHER
+enum ENCODER_FRAME_TYPE {
+    ENCODER_FRAME_I = 0,
+    ENCODER_FRAME_P,
+    ENCODER_FRAME_B,
+    ENCODER_FRAME_OTHER,
+    ENCODER_FRAME_TYPES
+};
+
+// 直方图按2的幂分桶: 大小第i个桶是[256<<(i-1), 256<<i)字节，延迟第i个桶是[1<<(i-1), 1<<i)ms
+// 第0个桶是小于256字节/1ms，最后一个桶包含所有更大的值
+#define ENCODER_HIST_BUCKETS 12
+
+typedef struct encoder_frame_stats {
+    int64_t frames;         // 累计帧数
+    int     window_frames;  // 统计窗口内的帧数，下面的值都按窗口计算
+    double  avg_latency;    // 送帧到出包的平均延迟us
+    int64_t p95_latency;
+    int64_t max_latency;
+    double  avg_size;       // 平均包大小字节
+    int     p95_size;
+    int     max_size;
+    double  avg_qp;         // 平均qp，编码器没有输出AV_PKT_DATA_QUALITY_STATS时为-1
+    int     latency_hist[ENCODER_HIST_BUCKETS];
+    int     size_hist[ENCODER_HIST_BUCKETS];
+}EncoderFrameStats;
+
+typedef struct encoder_stats_info {
+    EncoderFrameStats types[ENCODER_FRAME_TYPES];   // 按ENCODER_FRAME_TYPE索引
+    int64_t total_frames;
+    int64_t total_bytes;
+}EncoderStatsInfo;
+
+// 编码器每帧的埋点: 送帧时记录时间，出包时计算延迟，并记录大小、帧类型和qp
+// 每种帧类型保留最近window帧，查询时计算直方图和分位数
+class EncoderStats
+{
+public:
+    EncoderStats();
+    ~EncoderStats();
+    /**
+     * @brief Init
+     * @param window    每种帧类型保留的帧数
+     * @param reorder   编码器是否会重排序(b帧)，是则按pts匹配送帧时间，否则按先进先出匹配
+     *                  音频编码器输出的pts会减去priming的采样数，不能按pts匹配
+     */
+    void Init(int window, bool reorder);
+    void Reset();
+    // 在avcodec_send_frame成功之后调用
+    void OnSend(int64_t pts);
+    // 在avcodec_receive_packet拿到包之后调用
+    void OnPacket(const AVPacket *packet, bool audio);
+    void GetStats(EncoderStatsInfo *info);
+
+    static const char *GetTypeName(int type);
+private:
+    typedef struct sample {
+        int64_t latency;
+        int     size;
+        float   qp;
+    }Sample;
+
+    std::mutex mutex_;
+    int window_ = 300;
+    bool reorder_ = false;
+    std::deque<std::pair<int64_t, int64_t> > send_times_;   // pts, 送帧时间us
+    std::vector<Sample> samples_[ENCODER_FRAME_TYPES];      // 环形缓冲
+    int sample_pos_[ENCODER_FRAME_TYPES];
+    int64_t frames_[ENCODER_FRAME_TYPES];
+    int64_t total_bytes_ = 0;
+};
+
+#endif // ENCODERSTATS_H
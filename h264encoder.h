@@ -1,61 +1,45 @@
 #ifndef H264ENCODER_H
 #define H264ENCODER_H
 
-#include "mediabase.h"
+#include "videoencoder.h"
 
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libavutil/opt.h>
-#include <libavutil/imgutils.h>//图像处理相关的功能
-}
-
-class H264Encoder
+class H264Encoder: public VideoEncoder
 {
 public:
     H264Encoder();
-    ~H264Encoder();
-
-    RET_CODE Init(const Properties &properties);
-
-    virtual AVPacket *Encode(uint8_t *yuv,int size, const int64_t pts, int *pkt_frame, RET_CODE *ret);
+    virtual ~H264Encoder();
+
+    /**
+     * @brief Init
+     * @param "width"/"height"/"fps"/"bitrate"/"gop"/"b_frames", 基本编码参数
+     *        "threads", 线程数，0为自动，默认1
+     *        "thread_type", frame或者slice，默认由x264决定
+     *        "sliced_threads", 1/0，通过x264-params设置，默认不设置
+     *        "rc_lookahead", 码控lookahead帧数，默认由preset/tune决定
+     *        "preset"/"tune"/"profile", 默认medium/zerolatency/high，tune为none时不设置
+     *        "x264_params", 直接传给x264的参数，比如"keyint=50:scenecut=0"
+     *        "vbv", VBV缓冲区时长ms，0为不限制(默认)，码率自适应时建议设置，否则x264对码率变化反应很慢
+     *        "intra_refresh", 1使用周期性帧内刷新代替IDR，刷新周期为gop，默认0
+     *                         没有设置vbv时VBV取一帧的时长，使每帧大小平稳
+     *        "temporal_layers", 时间层数量1~3，默认1
+     *                         2层: I/P + 不参考的b，3层: I/P + 被参考的B + 不参考的b
+     *                         注意这不是分层P: x264没有不参考的P帧，只能用固定位置的B帧实现，
+     *                         即使丢层也要付出1(2层)或者3(3层)帧的重排序延迟，交互场景慎用;
+     *                         输出的dts和pts不同，下游的队列和发送必须按dts处理
+     * @return
+     */
+    virtual RET_CODE Init(const Properties &properties);
 
-    inline uint8_t *get_sps_data() {
-        return (uint8_t *)sps_.c_str();
-    }
-    inline int get_sps_size(){
-        return sps_.size();
-    }
-    inline uint8_t *get_pps_data() {
-        return (uint8_t *)pps_.c_str();
-    }
-    inline int get_pps_size(){
-        return pps_.size();
-    }
-    inline int GetFps() {
-        return fps_;
-    }
-    inline AVCodecContext *get_codec_context() { 
-        return ctx_;
-    }
 private:
-    int width_;
-    int height_;
-    int fps_;
-    int b_frames_;
-    int bitrate_;
-    int gop_;
     bool annexb_  = false;
-    int threads_;
-    int pix_fmt_;
-
-    std::string sps_;
-    std::string pps_;
+    std::string thread_type_;
+    int sliced_threads_ = -1;
+    int rc_lookahead_ = -1;
+    std::string preset_;
+    std::string tune_;
+    std::string profile_;
+    std::string x264_params_;
     std::string codec_name_;
-
-    AVCodec *codec_ = NULL;
-    AVCodecContext *ctx_ = NULL;
-    AVDictionary *dict_ = NULL; //用于传递各种参数，例如编解码器的选项、过滤器的参数、容器格式的选项等等
-    AVFrame *frame_ = NULL;
 };
 
 #endif // H264ENCODER_H
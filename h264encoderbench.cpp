@@ -0,0 +1,182 @@
+#include <chrono>
+#include <map>
+#include <sstream>
+#include "h264encoderbench.h"
+#include "h264encoder.h"
+#include "dlog.h"
+
+// 把"1,2,4"拆分成列表
+static std::vector<std::string> split_list(const std::string &str)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(str);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        if(!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+H264EncoderBench::H264EncoderBench()
+{
+
+}
+
+H264EncoderBench::~H264EncoderBench()
+{
+
+}
+
+RET_CODE H264EncoderBench::Init(const Properties &properties)
+{
+    // 1. 读取参数
+    input_yuv_name_ = properties.GetProperty("input_yuv_name", "");
+    width_      = properties.GetProperty("width", 1920);
+    height_     = properties.GetProperty("height", 1080);
+    fps_        = properties.GetProperty("fps", 60);
+    bitrate_    = properties.GetProperty("bitrate", 4*1024*1024);
+    gop_        = properties.GetProperty("gop", fps_);
+    frames_     = properties.GetProperty("frames", 300);
+    threads_        = split_list(properties.GetProperty("threads", "1,2,4"));
+    thread_types_   = split_list(properties.GetProperty("thread_types", "frame,slice"));
+    presets_        = split_list(properties.GetProperty("presets", "veryfast"));
+    tunes_          = split_list(properties.GetProperty("tunes", "zerolatency"));
+    rc_lookaheads_  = split_list(properties.GetProperty("rc_lookaheads", "-1"));
+    if(threads_.empty() || thread_types_.empty() || presets_.empty()
+            || tunes_.empty() || rc_lookaheads_.empty() || frames_ <= 0) {
+        LogError("bench list is empty");
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+
+    // 2. 读入yuv, 最多读frames_帧，不够时循环使用
+    frame_size_ = width_ * height_ * 3 / 2;
+    FILE *fp = fopen(input_yuv_name_.c_str(), "rb");
+    if(!fp) {
+        LogError("open %s failed", input_yuv_name_.c_str());
+        return RET_ERR_OPEN_FILE;
+    }
+    yuv_.resize((size_t)frame_size_ * frames_);
+    nb_yuv_frames_ = 0;
+    while(nb_yuv_frames_ < frames_) {
+        size_t ret = fread(&yuv_[(size_t)frame_size_ * nb_yuv_frames_], 1, frame_size_, fp);
+        if(ret != (size_t)frame_size_) {
+            break;
+        }
+        nb_yuv_frames_++;
+    }
+    fclose(fp);
+    if(nb_yuv_frames_ == 0) {
+        LogError("%s is smaller than one %dx%d frame", input_yuv_name_.c_str(), width_, height_);
+        return RET_FAIL;
+    }
+    yuv_.resize((size_t)frame_size_ * nb_yuv_frames_);
+    LogInfo("bench input:%s, %d frames loaded", input_yuv_name_.c_str(), nb_yuv_frames_);
+    return RET_OK;
+}
+
+RET_CODE H264EncoderBench::Run(std::vector<H264BenchResult> &results)
+{
+    for(size_t p = 0; p < presets_.size(); p++) {
+        for(size_t t = 0; t < tunes_.size(); t++) {
+            for(size_t y = 0; y < thread_types_.size(); y++) {
+                for(size_t n = 0; n < threads_.size(); n++) {
+                    for(size_t r = 0; r < rc_lookaheads_.size(); r++) {
+                        H264BenchResult result;
+                        if(runOne(presets_[p], tunes_[t], thread_types_[y],
+                                  atoi(threads_[n].c_str()), atoi(rc_lookaheads_[r].c_str()),
+                                  result) != RET_OK) {
+                            continue;
+                        }
+                        LogInfo("bench preset:%s tune:%s %s x%d lookahead:%d -> %.1ffps,"
+                                " latency avg:%.1fms max:%.1fms, %.0fkbps",
+                                result.preset.c_str(), result.tune.c_str(),
+                                result.thread_type.c_str(), result.threads, result.rc_lookahead,
+                                result.fps, result.avg_latency, result.max_latency,
+                                result.bytes * 8.0 * fps_ / result.frames / 1000);
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
+    }
+    return results.empty() ? RET_FAIL : RET_OK;
+}
+
+RET_CODE H264EncoderBench::runOne(const std::string &preset, const std::string &tune,
+                                  const std::string &thread_type, int threads, int rc_lookahead,
+                                  H264BenchResult &result)
+{
+    // 1. 按组合初始化编码器
+    H264Encoder encoder;
+    Properties properties;
+    properties.SetProperty("width", width_);
+    properties.SetProperty("height", height_);
+    properties.SetProperty("fps", fps_);
+    properties.SetProperty("bitrate", bitrate_);
+    properties.SetProperty("gop", gop_);
+    properties.SetProperty("threads", threads);
+    properties.SetProperty("thread_type", thread_type);
+    properties.SetProperty("rc_lookahead", rc_lookahead);
+    properties.SetProperty("preset", preset);
+    properties.SetProperty("tune", tune);
+    if(encoder.Init(properties) != RET_OK) {
+        LogError("bench H264Encoder Init failed");
+        return RET_FAIL;
+    }
+
+    // 2. 记录每帧送入的时间，出包时按pts计算延迟
+    std::map<int64_t, int64_t> send_time;
+    int64_t total_latency = 0;
+    int64_t max_latency = 0;
+    result.frames = 0;
+    result.bytes = 0;
+    PacketCallback callback = [&](AVPacket *pkt) {
+        int64_t latency = 0;
+        std::map<int64_t, int64_t>::iterator it = send_time.find(pkt->pts);
+        if(it != send_time.end()) {
+            latency = now_us() - it->second;
+            send_time.erase(it);
+        }
+        total_latency += latency;
+        if(latency > max_latency) {
+            max_latency = latency;
+        }
+        result.frames++;
+        result.bytes += pkt->size;
+        av_packet_free(&pkt);
+    };
+
+    // 3. 全速编码
+    int64_t start = now_us();
+    for(int i = 0; i < frames_; i++) {
+        uint8_t *yuv = &yuv_[(size_t)frame_size_ * (i % nb_yuv_frames_)];
+        send_time[i] = now_us();
+        if(encoder.Encode(yuv, frame_size_, i, callback) != RET_OK) {
+            LogError("bench Encode failed");
+            return RET_FAIL;
+        }
+    }
+    encoder.Flush(callback);
+    int64_t elapsed = now_us() - start;
+    if(result.frames == 0 || elapsed <= 0) {
+        return RET_FAIL;
+    }
+
+    result.preset       = preset;
+    result.tune         = tune;
+    result.thread_type  = thread_type;
+    result.threads      = threads;
+    result.rc_lookahead = rc_lookahead;
+    result.fps          = result.frames * 1000000.0 / elapsed;
+    result.avg_latency  = total_latency / 1000.0 / result.frames;
+    result.max_latency  = max_latency / 1000.0;
+    return RET_OK;
+}
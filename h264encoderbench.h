@@ -0,0 +1,67 @@
+#ifndef H264ENCODERBENCH_H
+#define H264ENCODERBENCH_H
+
+#include <string>
+#include <vector>
+#include "mediabase.h"
+
+typedef struct h264_bench_result {
+    std::string preset;
+    std::string tune;
+    std::string thread_type;
+    int threads;
+    int rc_lookahead;
+    int frames;             // 输出的帧数
+    double fps;             // 编码速度
+    double avg_latency;     // 送帧到出包的平均延迟 ms
+    double max_latency;     // 最大延迟 ms
+    int64_t bytes;          // 输出总字节数
+}H264BenchResult;
+
+// 在给定的yuv输入上遍历线程/preset等组合，统计每种组合的编码速度和延迟
+class H264EncoderBench
+{
+public:
+    H264EncoderBench();
+    ~H264EncoderBench();
+    /**
+     * @brief Init
+     * @param "input_yuv_name", yuv420p输入文件
+     *        "width"/"height"/"fps"/"bitrate"/"gop", 编码参数
+     *        "frames", 每种组合编码的帧数，默认300
+     *        "threads", 逗号分隔的列表，默认"1,2,4"
+     *        "thread_types", 默认"frame,slice"
+     *        "presets", 默认"veryfast"
+     *        "tunes", 默认"zerolatency"
+     *        "rc_lookaheads", 默认"-1"，-1代表使用preset/tune的缺省值
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    // 跑完所有组合，结果通过日志输出
+    RET_CODE Run(std::vector<H264BenchResult> &results);
+private:
+    RET_CODE runOne(const std::string &preset, const std::string &tune,
+                    const std::string &thread_type, int threads, int rc_lookahead,
+                    H264BenchResult &result);
+
+    std::string input_yuv_name_;
+    int width_ = 1920;
+    int height_ = 1080;
+    int fps_ = 60;
+    int bitrate_ = 4*1024*1024;
+    int gop_ = 60;
+    int frames_ = 300;
+
+    std::vector<std::string> threads_;
+    std::vector<std::string> thread_types_;
+    std::vector<std::string> presets_;
+    std::vector<std::string> tunes_;
+    std::vector<std::string> rc_lookaheads_;
+
+    // 预先读入内存的yuv帧，避免磁盘io影响测试结果
+    std::vector<uint8_t> yuv_;
+    int frame_size_ = 0;
+    int nb_yuv_frames_ = 0;
+};
+
+#endif // H264ENCODERBENCH_H
@@ -0,0 +1,154 @@
+#include "h265encoder.h"
+#include "dlog.h"
+#include "timesutil.h"
+
+H265Encoder::H265Encoder():
+    VideoEncoder("H265")
+{
+
+}
+
+H265Encoder::~H265Encoder()
+{
+    if(opts_) {
+        av_dict_free(&opts_);
+    }
+}
+
+RET_CODE H265Encoder::Init(const Properties &properties)
+{
+    RET_CODE ret = RET_OK;
+
+    // 1.读取视频属性
+    ret = readProperties(properties);
+    if(ret != RET_OK) {
+        return ret;
+    }
+    preset_         = properties.GetProperty("preset", "medium");
+    tune_           = properties.GetProperty("tune", "zerolatency");
+    profile_        = properties.GetProperty("profile", "main");
+    x265_params_    = properties.GetProperty("x265_params", "");
+    codec_name_     = properties.GetProperty("codec_name", "default");
+    reopen_interval_    = properties.GetProperty("reopen_interval", 5000);
+    reopen_min_change_  = properties.GetProperty("reopen_min_change", 20);
+    if(reopen_interval_ < 0 || reopen_min_change_ < 0) {
+        LogError("reopen_interval:%d, reopen_min_change:%d", reopen_interval_, reopen_min_change_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    if(temporal_layers_ < 1 || temporal_layers_ > 2) {
+        LogError("temporal_layers:%d, use 1~2", temporal_layers_);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    if(temporal_layers_ > 1) {
+        b_frames_ = 1;
+    }
+
+    // 2.x265的参数，ffmpeg只映射了preset/tune/profile/forced-idr，其他的通过x265-params传
+    av_dict_set(&opts_, "preset", preset_.c_str(), 0);
+    if(tune_ != "" && tune_ != "none") {
+        av_dict_set(&opts_, "tune", tune_.c_str(), 0);
+    }
+    av_dict_set(&opts_, "profile", profile_.c_str(), 0);
+    std::string x265_params = x265_params_;
+    // libx265不使用thread_count，frame线程数通过frame-threads设置
+    if(threads_ > 0) {
+        if(!x265_params.empty()) {
+            x265_params += ":";
+        }
+        x265_params += "frame-threads=" + std::to_string(threads_);
+    }
+    // 时间层: 每隔一帧一个不参考的b，temporal-layers让它的temporal_id为1
+    if(temporal_layers_ > 1) {
+        if(!x265_params.empty()) {
+            x265_params += ":";
+        }
+        x265_params += "bframes=1:b-adapt=0:b-pyramid=0:temporal-layers=1";
+    }
+    if(intra_refresh_) {
+        if(!x265_params.empty()) {
+            x265_params += ":";
+        }
+        x265_params += "intra-refresh=1";
+    }
+    if(!x265_params.empty()) {
+        av_dict_set(&opts_, "x265-params", x265_params.c_str(), 0);
+    }
+
+    // 3.初始化编码器，读取VPS/SPS/PPS
+    ret = open();
+    if(ret != RET_OK) {
+        return ret;
+    }
+    last_reopen_time_ = TimesUtil::GetTimeMillisecond();
+    LogInfo("H265: %dx%d@%d, preset:%s, tune:%s, x265-params:%s, vbv:%dms, intra_refresh:%d, temporal_layers:%d",
+            width_, height_, fps_, preset_.c_str(), tune_.c_str(), x265_params.c_str(),
+            vbv_, intra_refresh_, temporal_layers_);
+    return RET_OK;
+}
+
+RET_CODE H265Encoder::open()
+{
+    RET_CODE ret = allocContext(AV_CODEC_ID_HEVC, codec_name_);
+    if(ret != RET_OK) {
+        return ret;
+    }
+    // avcodec_open2会消耗掉dict_，保留一份opts_给重新打开时用
+    if(dict_) {
+        av_dict_free(&dict_);
+    }
+    av_dict_copy(&dict_, opts_, 0);
+    return openContext();
+}
+
+void H265Encoder::applyBitrate(const PacketCallback &callback)
+{
+    int bitrate = pending_bitrate_.exchange(0);
+    if(bitrate <= 0 || bitrate == bitrate_) {
+        small_change_time_ = 0;
+        return;
+    }
+    // 1.间隔太短的先留着，期间有更新的码率时用新的，码率控制器设置的码率最终一定会生效
+    //   变化太小的不值得马上插一个IDR，持续reopen_interval之后再生效，连续的小步调整合并成一次
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    int64_t change = (int64_t)(bitrate > bitrate_ ? bitrate - bitrate_ : bitrate_ - bitrate) * 100;
+    bool small = change < (int64_t)bitrate_ * reopen_min_change_;
+    if(small && small_change_time_ == 0) {
+        small_change_time_ = now;
+    }
+    if(now - last_reopen_time_ < reopen_interval_
+            || (small && now - small_change_time_ < reopen_interval_)) {
+        int expected = 0;
+        pending_bitrate_.compare_exchange_strong(expected, bitrate);
+        return;
+    }
+    small_change_time_ = 0;
+    LogInfo("H265: bitrate %d -> %d, reopen encoder", (int)bitrate_, bitrate);
+
+    // 2.先用新码率打开新的编码器，失败时继续用旧的，参数集不变(分辨率和profile没变)，第一帧是IDR
+    AVCodecContext *old_ctx = ctx_;
+    int old_bitrate = bitrate_;
+    ctx_ = NULL;
+    bitrate_ = bitrate;
+    if(open() != RET_OK) {
+        LogError("H265: reopen failed, keep bitrate:%d", old_bitrate);
+        if(ctx_) {
+            avcodec_free_context(&ctx_);
+        }
+        ctx_ = old_ctx;
+        bitrate_ = old_bitrate;
+        last_reopen_time_ = now;    // 不要每帧都重试，过了reopen_interval再试
+        int expected = 0;
+        pending_bitrate_.compare_exchange_strong(expected, bitrate);
+        return;
+    }
+    last_reopen_time_ = now;
+
+    // 3.把旧编码器里面缓存的包取出来，避免丢帧
+    AVCodecContext *new_ctx = ctx_;
+    ctx_ = old_ctx;
+    if(avcodec_send_frame(ctx_, NULL) >= 0) {
+        receivePackets(callback);
+    }
+    avcodec_free_context(&ctx_);
+    ctx_ = new_ctx;
+}
@@ -0,0 +1,46 @@
+#ifndef H265ENCODER_H
+#define H265ENCODER_H
+
+#include "videoencoder.h"
+
+class H265Encoder: public VideoEncoder
+{
+public:
+    H265Encoder();
+    virtual ~H265Encoder();
+
+    /**
+     * @brief Init
+     * @param "width"/"height"/"fps"/"bitrate"/"gop"/"b_frames"/"vbv", 和H264Encoder一样
+     *        "threads", frame线程数，0为自动，默认1
+     *        "preset"/"tune"/"profile", 默认medium/zerolatency/main，tune为none时不设置
+     *        "x265_params", 直接传给x265的参数，比如"keyint=50:scenecut=0"
+     *        "intra_refresh", 1使用周期性帧内刷新代替IDR，默认0
+     *        "temporal_layers", 时间层数量1~2，默认1，2层时不参考的b帧temporal_id为1
+     *                         同样是用B帧实现的，有1帧的重排序延迟
+     *        "reopen_interval", 码率自适应两次重新打开编码器的最小间隔ms，默认5000
+     *        "reopen_min_change", 码率变化不到这个百分比时先不重新打开，默认20
+     *                         小的变化不会丢掉，持续reopen_interval之后仍然生效，期间的调整合并成一次
+     * @return
+     */
+    virtual RET_CODE Init(const Properties &properties);
+protected:
+    // ffmpeg 4.2的libx265不支持运行时修改码率，只能重新打开编码器，之后第一帧是IDR
+    // 拥塞时每次调整都插一个IDR只会更堵，所以限制重新打开的频率和最小变化
+    virtual void applyBitrate(const PacketCallback &callback);
+private:
+    RET_CODE open();
+
+    std::string preset_;
+    std::string tune_;
+    std::string profile_;
+    std::string x265_params_;
+    std::string codec_name_;
+    AVDictionary *opts_ = NULL;     // 重新打开编码器时使用的参数
+    int reopen_interval_ = 5000;
+    int reopen_min_change_ = 20;
+    int64_t last_reopen_time_ = 0;
+    int64_t small_change_time_ = 0; // 小的码率变化开始等待的时间，0代表没有
+};
+
+#endif // H265ENCODER_H
@@ -0,0 +1,139 @@
+#include "interleaver.h"
+#include "dlog.h"
+
+Interleaver::Interleaver(int max_hold):
+    max_hold_(max_hold)
+{
+
+}
+
+Interleaver::~Interleaver()
+{
+    Clear();
+}
+
+int64_t Interleaver::packetDts(const AVPacket *pkt)
+{
+    return pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+}
+
+void Interleaver::Push(AVPacket *pkt, MediaType media_type, int64_t now)
+{
+    if(media_type != E_AUDIO_TYPE && media_type != E_VIDEO_TYPE) {
+        LogError("media_type:%d is unknown", media_type);
+        av_packet_free(&pkt);
+        return;
+    }
+    HeldPacket held;
+    held.packet = pkt;
+    held.dts = packetDts(pkt);
+    held.arrive_time = now;
+    queues_[media_type].push_back(held);
+    last_arrive_dts_[media_type] = held.dts;
+
+    // 到达时两路dts的差，反映采集/编码线程之间的偏差
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    held_++;
+    if(last_arrive_dts_[E_AUDIO_TYPE] != AV_NOPTS_VALUE && last_arrive_dts_[E_VIDEO_TYPE] != AV_NOPTS_VALUE) {
+        int64_t skew = last_arrive_dts_[E_AUDIO_TYPE] - last_arrive_dts_[E_VIDEO_TYPE];
+        avg_skew_ += (skew - avg_skew_) / 16;
+        int64_t abs_skew = skew < 0 ? -skew : skew;
+        if(abs_skew > max_skew_) {
+            max_skew_ = abs_skew;
+        }
+    }
+}
+
+bool Interleaver::Pop(AVPacket **pkt, MediaType &media_type, int64_t now, bool flush)
+{
+    std::deque<HeldPacket> &audio = queues_[E_AUDIO_TYPE];
+    std::deque<HeldPacket> &video = queues_[E_VIDEO_TYPE];
+    int type = -1;
+    bool forced = false;
+    if(!audio.empty() && !video.empty()) {
+        // 1.两路都有包，dts小的先走
+        type = audio.front().dts <= video.front().dts ? E_AUDIO_TYPE : E_VIDEO_TYPE;
+    } else if(!audio.empty() || !video.empty()) {
+        // 2.只有一路有包: 另一路已经到过更大的dts，不会再有更早的包，直接走; 否则最多等max_hold
+        type = !audio.empty() ? E_AUDIO_TYPE : E_VIDEO_TYPE;
+        if(!flush && !isReady(type)) {
+            if(now - queues_[type].front().arrive_time < max_hold_) {
+                return false;
+            }
+            forced = true;
+        }
+    } else {
+        return false;
+    }
+
+    HeldPacket held = queues_[type].front();
+    queues_[type].pop_front();
+    *pkt = held.packet;
+    media_type = (MediaType)type;
+    int other = E_AUDIO_TYPE == type ? E_VIDEO_TYPE : E_AUDIO_TYPE;
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    held_--;
+    if(forced) {
+        forced_++;
+    }
+    if(last_sent_dts_[other] != AV_NOPTS_VALUE && held.dts < last_sent_dts_[other]) {
+        out_of_order_++;
+    }
+    last_sent_dts_[type] = held.dts;
+    return true;
+}
+
+int Interleaver::GetWaitTime(int64_t now, int max_wait)
+{
+    std::deque<HeldPacket> &audio = queues_[E_AUDIO_TYPE];
+    std::deque<HeldPacket> &video = queues_[E_VIDEO_TYPE];
+    if(!audio.empty() && !video.empty()) {
+        return 0;
+    }
+    if(audio.empty() && video.empty()) {
+        return max_wait;
+    }
+    int type = !audio.empty() ? E_AUDIO_TYPE : E_VIDEO_TYPE;
+    if(isReady(type)) {
+        return 0;
+    }
+    const HeldPacket &front = queues_[type].front();
+    int64_t wait = front.arrive_time + max_hold_ - now;
+    if(wait < 0) {
+        wait = 0;
+    }
+    return wait < max_wait ? (int)wait : max_wait;
+}
+
+bool Interleaver::isReady(int type)
+{
+    int other = E_AUDIO_TYPE == type ? E_VIDEO_TYPE : E_AUDIO_TYPE;
+    return last_arrive_dts_[other] != AV_NOPTS_VALUE && queues_[type].front().dts <= last_arrive_dts_[other];
+}
+
+void Interleaver::GetStats(InterleaveStats *stats)
+{
+    if(!stats) {
+        LogError("stats is null");
+        return;
+    }
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats->avg_skew = (int64_t)avg_skew_;
+    stats->max_skew = max_skew_;
+    stats->forced = forced_;
+    stats->out_of_order = out_of_order_;
+    stats->held = held_;
+    max_skew_ = 0;
+}
+
+void Interleaver::Clear()
+{
+    for(int i = 0; i < 2; i++) {
+        while(!queues_[i].empty()) {
+            av_packet_free(&queues_[i].front().packet);
+            queues_[i].pop_front();
+        }
+    }
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    held_ = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef INTERLEAVER_H
+#define INTERLEAVER_H
+
+#include <deque>
+#include <mutex>
+#include "mediabase.h"
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+typedef struct interleave_stats {
+    int64_t avg_skew;       // 音视频到达时dts的平均差ms(音频减视频)，正数代表音频超前
+    int64_t max_skew;       // 上次获取之后差值绝对值的最大值
+    int64_t forced;         // 另一路等不到、超过max_hold被放行的包
+    int64_t out_of_order;   // 放行时dts比另一路已经发出的包还小
+    int held;               // 当前等待中的包
+}InterleaveStats;
+
+// 音视频交织: 音频和视频来自不同线程，pop顺序是任意的，部分服务器要自己缓存重排
+// 两路都有包时按dts从小到大放行; 只有一路有包时最多等max_hold毫秒，超时直接放行
+// 和av_interleaved_write_frame一样按dts排序，但是等待时间有上限，一路断了不会卡住另一路
+// 只在发送线程使用，统计可以在任意线程获取
+class Interleaver
+{
+public:
+    Interleaver(int max_hold);
+    ~Interleaver();
+    // 放入一个包，转移所有权，同一路的dts必须递增
+    void Push(AVPacket *pkt, MediaType media_type, int64_t now);
+    /**
+     * @brief Pop 取出下一个可以发送的包
+     * @param now   当前时间ms
+     * @param flush 为true时不等待，按dts顺序取出所有包
+     * @return false代表没有可以发送的包
+     */
+    bool Pop(AVPacket **pkt, MediaType &media_type, int64_t now, bool flush = false);
+    // 下一个包还要等多久ms，没有等待的包时返回max_wait
+    int GetWaitTime(int64_t now, int max_wait);
+    // 获取统计，max_skew从头开始
+    void GetStats(InterleaveStats *stats);
+    void Clear();
+private:
+    typedef struct held_packet {
+        AVPacket *packet;
+        int64_t dts;
+        int64_t arrive_time;
+    }HeldPacket;
+
+    static int64_t packetDts(const AVPacket *pkt);
+    // 只有type一路有包时，队头的dts不大于另一路最后到达的dts，不用再等
+    bool isReady(int type);
+
+    int max_hold_;
+    std::deque<HeldPacket> queues_[2];      // 按MediaType索引
+    int64_t last_arrive_dts_[2] = {AV_NOPTS_VALUE, AV_NOPTS_VALUE};
+    int64_t last_sent_dts_[2] = {AV_NOPTS_VALUE, AV_NOPTS_VALUE};
+
+    std::mutex stats_mutex_;
+    double avg_skew_ = 0;
+    int64_t max_skew_ = 0;
+    int64_t forced_ = 0;
+    int64_t out_of_order_ = 0;
+    int held_ = 0;
+};
+
+#endif // INTERLEAVER_H
@@ -3,6 +3,8 @@
 #include "dlog.h"
 #include "pushwork.h"
 #include "messagequeue.h"
+#include "h264encoderbench.h"
+#include "rtpsenderbench.h"
 
 using namespace std;
 
@@ -17,11 +19,76 @@ using namespace std;
 
 #define RTSP_URL "rtsp://192.168.159.129/live/livestream"
 
-int main()
+// 编码参数测试: rtsp-publish bench_h264 input.yuv width height fps [threads] [thread_types] [presets]
+static int run_h264_bench(int argc, char *argv[])
+{
+    if(argc < 6) {
+        cout << "usage: " << argv[0] << " bench_h264 input.yuv width height fps"
+             << " [threads=1,2,4] [thread_types=frame,slice] [presets=veryfast]" << endl;
+        return -1;
+    }
+    Properties properties;
+    properties.SetProperty("input_yuv_name", argv[2]);
+    properties.SetProperty("width", atoi(argv[3]));
+    properties.SetProperty("height", atoi(argv[4]));
+    properties.SetProperty("fps", atoi(argv[5]));
+    properties.SetProperty("gop", atoi(argv[5]));
+    if(argc > 6) properties.SetProperty("threads", argv[6]);
+    if(argc > 7) properties.SetProperty("thread_types", argv[7]);
+    if(argc > 8) properties.SetProperty("presets", argv[8]);
+
+    H264EncoderBench bench;
+    if(bench.Init(properties) != RET_OK) {
+        LogError("H264EncoderBench init failed");
+        return -1;
+    }
+    std::vector<H264BenchResult> results;
+    bench.Run(results);
+    for(size_t i = 0; i < results.size(); i++) {
+        const H264BenchResult &r = results[i];
+        printf("%-10s %-12s %-6s x%-2d lookahead:%-3d %8.1ffps  latency avg:%6.1fms max:%6.1fms\n",
+               r.preset.c_str(), r.tune.c_str(), r.thread_type.c_str(), r.threads,
+               r.rc_lookahead, r.fps, r.avg_latency, r.max_latency);
+    }
+    return 0;
+}
+
+// rtp发送方式测试: rtsp-publish bench_rtp [host] [port] [bitrate] [frames]
+static int run_rtp_bench(int argc, char *argv[])
+{
+    Properties properties;
+    if(argc > 2) properties.SetProperty("host", argv[2]);
+    if(argc > 3) properties.SetProperty("port", atoi(argv[3]));
+    if(argc > 4) properties.SetProperty("bitrate", atoi(argv[4]));
+    if(argc > 5) properties.SetProperty("frames", atoi(argv[5]));
+
+    RtpSenderBench bench;
+    if(bench.Init(properties) != RET_OK) {
+        LogError("RtpSenderBench init failed");
+        return -1;
+    }
+    std::vector<RtpBenchResult> results;
+    bench.Run(results);
+    for(size_t i = 0; i < results.size(); i++) {
+        const RtpBenchResult &r = results[i];
+        printf("%-8s packets:%-8lld syscalls:%-8lld %6.1f pkts/call %8.0fMbps %8.1fus/Mbit\n",
+               r.mode.c_str(), (long long)r.packets, (long long)r.syscalls,
+               r.packets_per_syscall, r.mbps, r.cpu_us_per_mbit);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
 {
     cout << "Hello World!" << endl;
 
     init_logger("rtsp_push.log", S_INFO);
+    if(argc > 1 && strcmp(argv[1], "bench_h264") == 0) {
+        return run_h264_bench(argc, argv);
+    }
+    if(argc > 1 && strcmp(argv[1], "bench_rtp") == 0) {
+        return run_rtp_bench(argc, argv);
+    }
     MessageQueue *msg_queue_ = new MessageQueue();
     if(!msg_queue_) {
         LogError("new MessageQueue() failed");
@@ -43,6 +110,11 @@ int main()
         properties.SetProperty("audio_sample_rate", 48000);
         properties.SetProperty("audio_bitrate", 64*1024);
         properties.SetProperty("audio_channels", 2);
+        properties.SetProperty("audio_codec", "aac");      // aac或者opus，opus延迟更低
+        properties.SetProperty("opus_frame_duration", "10");  // opus帧长ms, 2.5/5/10/20
+        properties.SetProperty("audio_dtx", 0);             // opus DTX
+        properties.SetProperty("audio_silence_detect", 0);  // 静音检测，静音期间不编码
+        properties.SetProperty("audio_silence_threshold", -60); // 静音门限dBFS
 
         // 视频test模式
         properties.SetProperty("video_test", 1);    // 视频测试模式
@@ -57,11 +129,38 @@ int main()
         
         // 视频编码属性
         properties.SetProperty("video_bitrate", 512*1024);  // 设置码率
+//        properties.SetProperty("video_threads", 2);         // 编码线程数，0为自动
+//        properties.SetProperty("video_thread_type", "slice"); // frame或者slice，slice不增加延迟
+//        properties.SetProperty("video_preset", "veryfast");   // 缺省medium
+//        properties.SetProperty("video_codec", "h265");        // 缺省h264，h265同样画质码率更低
+//        properties.SetProperty("video_roi_auto", 1);          // 变化区域(活动窗口、光标)多分配码率
+//        properties.SetProperty("video_roi", "0,0,640,360,-0.5"); // 屏幕坐标x,y,w,h[,qoffset]，多个用;分隔
+//        properties.SetProperty("video_skip_static", 1);       // 画面不变时跳过编码，每秒一帧保活
+//        properties.SetProperty("video_vfr", 1);               // 可变帧率，只在内容变化时出帧
+//        properties.SetProperty("video_vfr_min_interval", 100); // 两帧最小间隔ms，最大间隔video_vfr_max_interval缺省1000
+//        properties.SetProperty("dump_video", 1);              // 后台dump编码后的视频，dump_pcm/dump_audio同理
+//        properties.SetProperty("record_file", "record.mp4");  // 同时录制分片mp4，崩溃也能播放
+//        properties.SetProperty("dvr_dir", ".");               // 时移环，保留最近10段，PushWork::ExportDvr导出
+//        properties.SetProperty("rtsp_spill_file", "spill.dat"); // 断流时积压写到磁盘，恢复后2倍速补发
+//        properties.SetProperty("rtsp_interleave_max_hold", 100); // 按dts交织音视频，另一路最多等100ms
+//        properties.SetProperty("rtsp_reconnect_max_delay", 10000); // 断线后指数退避重连，rtsp_reconnect为0时关闭
+//        properties.SetProperty("rtsp_pacing", 1);             // 视频帧的rtp包按码率的125%分批发出，只支持rtsp_transport为udp
+//        properties.SetProperty("destinations.length", 2);     // 同时推到备用服务器，每个目的地单独排队和丢包
+//        properties.SetProperty("destinations.0.url", "rtsp://backup/live/livestream");
+//        properties.SetProperty("destinations.1.type", "rtp");  // 自己打包直接推rtp/udp，sendmmsg/GSO批量发送，接收端打开sdp
+//        properties.SetProperty("destinations.1.url", "rtp://192.168.159.129:5004");
+//        properties.SetProperty("destinations.1.sdp_file", "stream.sdp");
+//        properties.SetProperty("destinations.1.pacing", 1);   // 关键帧的rtp包按码率的125%分批发出，缺省关闭
 
         properties.SetProperty("rtsp_url", RTSP_URL);
         properties.SetProperty("rtsp_transport", "udp");
         properties.SetProperty("rtsp_timeout", 10000);
         properties.SetProperty("rtsp_max_queue_duration", 1000);
+        // properties.SetProperty("abr_enable", 1);                // 根据发送队列自动调整视频码率，缺省关闭
+        // properties.SetProperty("abr_min_bitrate", 128*1024);
+        // properties.SetProperty("video_temporal_layers", 2);      // 拥塞时丢弃不参考的帧，帧率减半; 用B帧实现，多1帧重排序延迟
+        // properties.SetProperty("video_intra_refresh", 1);        // 帧内刷新代替周期IDR，每帧大小平稳
+        // properties.SetProperty("video_ladder", "1280x720@30,1280x720@15,854x480@15,audio"); // 码率最低仍然拥塞时逐档降级
         if(push_work.Init(properties) != RET_OK) {
             LogError("PushWork init failed");
             return -1;
@@ -81,15 +180,44 @@ int main()
                 case MSG_RTSP_QUEUE_DURATION:
                     LogError("MSG_RTSP_QUEUE_DURATION a:%d, v:%d", msg.arg1, msg.arg2);
                     break;
+                case MSG_RTSP_BITRATE_CHANGE:
+                    LogInfo("MSG_RTSP_BITRATE_CHANGE bitrate:%d, reason:%d", msg.arg1, msg.arg2);
+                    break;
+                case MSG_RTSP_LADDER_CHANGE:
+                    LogInfo("MSG_RTSP_LADDER_CHANGE step:%d, bitrate:%d", msg.arg1, msg.arg2);
+                    break;
+                case MSG_RTSP_LAYER_CHANGE:
+                    LogInfo("MSG_RTSP_LAYER_CHANGE layers:%d, dropped:%d", msg.arg1, msg.arg2);
+                    break;
+                case MSG_RTSP_RECONNECTING:
+                    LogWarn("MSG_RTSP_RECONNECTING failed:%d, retry in %dms", msg.arg1, msg.arg2);
+                    break;
+                case MSG_RTSP_RECONNECTED:
+                    LogInfo("MSG_RTSP_RECONNECTED attempts:%d, outage:%dms", msg.arg1, msg.arg2);
+                    break;
                 default:
                     break;
                 }
             }
             LogInfo("count:%d, ret:%d", count, ret);
+            // 每10秒打印一次视频编码器按帧类型的统计，IDR过大是队列丢包的常见原因
+            EncoderStatsInfo enc_stats;
+            if(count % 10 == 0 && push_work.GetEncoderStats(E_VIDEO_TYPE, &enc_stats) == RET_OK) {
+                for(int t = 0; t < ENCODER_FRAME_TYPES; t++) {
+                    const EncoderFrameStats &fs = enc_stats.types[t];
+                    if(fs.window_frames == 0) {
+                        continue;
+                    }
+                    LogInfo("video %s: frames:%lld, latency avg:%0.1lfms p95:%0.1lfms, size avg:%0.0lf p95:%d max:%d, qp:%0.1lf",
+                            EncoderStats::GetTypeName(t), fs.frames, fs.avg_latency / 1000,
+                            fs.p95_latency / 1000.0, fs.avg_size, fs.p95_size, fs.max_size, fs.avg_qp);
+                }
+            }
             
             if(count++ > 100)
                 break;
         }
+        push_work.DeInit();     // 停止采集，drain编码器
         msg_queue_->msg_queue_abort();
 
     }
@@ -4,8 +4,11 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <functional>
 #include <string.h>
 
+struct AVPacket;
+
 enum RET_CODE
 {
     RET_ERR_UNKNOWN = -2,                   // 未知错误
@@ -29,6 +32,19 @@ typedef enum media_type {
     E_VIDEO_TYPE
 }MediaType;
 
+// 编码器输出包的回调，包的所有权交给回调方
+typedef std::function<void(AVPacket *pkt)> PacketCallback;
+
+// 视频画面上的矩形区域，单位像素
+// qoffset用于ROI编码，范围-1~1，负数代表降低该区域的qp(提高质量)，正数代表提高qp
+typedef struct video_region {
+    int x;
+    int y;
+    int width;
+    int height;
+    float qoffset;
+}VideoRegion;
+
 class Properties: public std::map<std::string,std::string>
 {
 public:
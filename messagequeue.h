@@ -12,6 +12,11 @@ extern "C"
 #define MSG_FLUSH                   1
 #define MSG_RTSP_ERROR              100
 #define MSG_RTSP_QUEUE_DURATION     101
+#define MSG_RTSP_BITRATE_CHANGE     102     // arg1: 新码率bps, arg2: BITRATE_REASON
+#define MSG_RTSP_LADDER_CHANGE      103     // arg1: 新档位, arg2: 起始码率bps
+#define MSG_RTSP_LAYER_CHANGE       104     // arg1: 发送的时间层数量, arg2: 队列里丢掉的包数量
+#define MSG_RTSP_RECONNECTING       105     // arg1: 已经失败的次数, arg2: 下次重连的等待时间ms
+#define MSG_RTSP_RECONNECTED        106     // arg1: 重连的次数, arg2: 断开的时长ms
 typedef struct AVMessage
 {
     int what;           // 消息类型
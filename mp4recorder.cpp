@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include "mp4recorder.h"
+#include "dlog.h"
+
+Mp4Recorder::Mp4Recorder():
+    dropped_packets_(0),
+    written_bytes_(0),
+    written_packets_(0)
+{
+    LogInfo("Mp4Recorder create");
+}
+
+Mp4Recorder::~Mp4Recorder()
+{
+    DeInit();
+}
+
+RET_CODE Mp4Recorder::Init(const Properties &properties)
+{
+    // 1.读取参数
+    file_name_              = properties.GetProperty("file_name", "record.mp4");
+    max_queue_duration_     = properties.GetProperty("max_queue_duration", 3000);
+    frag_duration_          = properties.GetProperty("frag_duration", 1000);
+    audio_frame_duration_   = atof(properties.GetProperty("audio_frame_duration", "0"));
+    video_frame_duration_   = properties.GetProperty("video_frame_duration", 0);
+    video_max_interval_     = properties.GetProperty("video_max_interval", 0);
+    intra_refresh_          = properties.GetProperty("intra_refresh", false);
+    if(file_name_.empty() || max_queue_duration_ <= 0 || frag_duration_ <= 0) {
+        LogError("file_name:%s, max_queue_duration:%d, frag_duration:%d",
+                 file_name_.c_str(), max_queue_duration_, frag_duration_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+
+    // 2.创建输出上下文
+    int ret = avformat_alloc_output_context2(&fmt_ctx_, NULL, "mp4", file_name_.c_str());
+    if(ret < 0) {
+        char str_error[512] = {0};
+        av_strerror(ret, str_error, sizeof(str_error) -1);
+        LogError("avformat_alloc_output_context2 failed:%s", str_error);
+        return RET_FAIL;
+    }
+
+    // 3.创建待写队列，和推流的队列相互独立
+    queue_ = new PacketQueue(audio_frame_duration_, video_frame_duration_);
+    queue_->SetRecoveryPoint(intra_refresh_);
+    queue_->SetVideoMaxInterval(video_max_interval_);
+    return RET_OK;
+}
+
+void Mp4Recorder::DeInit()
+{
+    // 线程退出前会写完队列里剩余的包
+    Stop();
+    if(fmt_ctx_) {
+        if(opened_) {
+            int ret = av_write_trailer(fmt_ctx_);
+            if(ret < 0) {
+                char str_error[512] = {0};
+                av_strerror(ret, str_error, sizeof(str_error) -1);
+                LogError("av_write_trailer failed:%s", str_error);
+            }
+            avio_closep(&fmt_ctx_->pb);
+            opened_ = false;
+            LogInfo("record %s finished, dropped packets:%lld", file_name_.c_str(),
+                    (long long)dropped_packets_);
+        }
+        avformat_free_context(fmt_ctx_);
+        fmt_ctx_ = NULL;
+    }
+    if(queue_) {
+        queue_->Abort();
+        queue_->Drop(true, 0);
+        delete queue_;
+        queue_ = NULL;
+    }
+}
+
+RET_CODE Mp4Recorder::ConfigVideoStream(const AVCodecContext *ctx)
+{
+    if(!fmt_ctx_ || !ctx) {
+        LogError("fmt_ctx or ctx is null");
+        return RET_FAIL;
+    }
+    // mp4的avcC/hvcC从extradata生成
+    if(!ctx->extradata || ctx->extradata_size <= 0) {
+        LogError("video extradata is empty");
+        return RET_FAIL;
+    }
+    AVStream *vs = avformat_new_stream(fmt_ctx_, NULL);
+    if(!vs) {
+        LogError("avformat_new_stream failed");
+        return RET_FAIL;
+    }
+    avcodec_parameters_from_context(vs->codecpar, ctx);
+    vs->codecpar->codec_tag = 0;
+    vs->time_base = av_make_q(1, 1000);
+    video_stream_ = vs;
+    queue_->SetVideoCodec(ctx->codec_id == AV_CODEC_ID_HEVC);
+    return RET_OK;
+}
+
+RET_CODE Mp4Recorder::ConfigAudioStream(const AVCodecContext *ctx)
+{
+    if(!fmt_ctx_ || !ctx) {
+        LogError("fmt_ctx or ctx is null");
+        return RET_FAIL;
+    }
+    AVStream *as = avformat_new_stream(fmt_ctx_, NULL);
+    if(!as) {
+        LogError("avformat_new_stream failed");
+        return RET_FAIL;
+    }
+    avcodec_parameters_from_context(as->codecpar, ctx);
+    as->codecpar->codec_tag = 0;
+    as->time_base = av_make_q(1, ctx->sample_rate);
+    if(ctx->codec_id == AV_CODEC_ID_OPUS) {
+        // ffmpeg 4.2的mov muxer把opus in mp4当作实验性的
+        fmt_ctx_->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    }
+    audio_stream_ = as;
+    return RET_OK;
+}
+
+RET_CODE Mp4Recorder::Open()
+{
+    if(!fmt_ctx_ || (!audio_stream_ && !video_stream_)) {
+        LogError("no stream to record");
+        return RET_FAIL;
+    }
+    // 1.打开文件
+    int ret = avio_open(&fmt_ctx_->pb, file_name_.c_str(), AVIO_FLAG_WRITE);
+    if(ret < 0) {
+        char str_error[512] = {0};
+        av_strerror(ret, str_error, sizeof(str_error) -1);
+        LogError("avio_open %s failed:%s", file_name_.c_str(), str_error);
+        return RET_FAIL;
+    }
+    // 2.分片mp4: 开头写空的moov，之后每个关键帧或者frag_duration写一个moof+mdat
+    //   不需要结束时回写moov，写到一半崩溃文件也能播放
+    AVDictionary *opts = NULL;
+    av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    av_dict_set_int(&opts, "frag_duration", (int64_t)frag_duration_ * 1000, 0);  // us
+    ret = avformat_write_header(fmt_ctx_, &opts);
+    av_dict_free(&opts);
+    if(ret < 0) {
+        char str_error[512] = {0};
+        av_strerror(ret, str_error, sizeof(str_error) -1);
+        LogError("avformat_write_header failed:%s", str_error);
+        avio_closep(&fmt_ctx_->pb);
+        return RET_FAIL;
+    }
+    avio_flush(fmt_ctx_->pb);
+    opened_ = true;
+    LogInfo("record to %s, frag_duration:%dms", file_name_.c_str(), frag_duration_);
+    // 3.启动写文件线程
+    return Start();
+}
+
+RET_CODE Mp4Recorder::Push(const AVPacket *pkt, MediaType media_type)
+{
+    if(!opened_ || !pkt) {
+        return RET_FAIL;
+    }
+    if((E_VIDEO_TYPE == media_type && !video_stream_) || (E_AUDIO_TYPE == media_type && !audio_stream_)) {
+        return RET_OK;
+    }
+    // 1.磁盘跟不上时丢掉旧的包，只保留一半时长并从关键帧开始，不阻塞编码线程
+    if(queue_->GetVideoDuration() > max_queue_duration_ || queue_->GetAudioDuration() > max_queue_duration_) {
+        int before = queue_->GetAudioPackets() + queue_->GetVideoPackets();
+        queue_->Drop(false, max_queue_duration_ / 2);
+        int dropped = before - queue_->GetAudioPackets() - queue_->GetVideoPackets();
+        dropped_packets_ += dropped;
+        LogWarn("record queue is full, drop %d packets", dropped);
+    }
+    // 2.共享数据: 只增加buffer的引用
+    AVPacket *ref = av_packet_alloc();
+    if(!ref) {
+        LogError("av_packet_alloc failed");
+        return RET_ERR_OUTOFMEMORY;
+    }
+    if(av_packet_ref(ref, pkt) < 0) {
+        LogError("av_packet_ref failed");
+        av_packet_free(&ref);
+        return RET_FAIL;
+    }
+    if(queue_->Push(ref, media_type) < 0) {
+        av_packet_free(&ref);
+        return RET_FAIL;
+    }
+    return RET_OK;
+}
+
+int64_t Mp4Recorder::GetDroppedPackets()
+{
+    return dropped_packets_;
+}
+
+RET_CODE Mp4Recorder::GetStats(Mp4RecorderStats *stats)
+{
+    if(!stats || !queue_) {
+        return RET_FAIL;
+    }
+    queue_->GetStats(&stats->queue);
+    stats->written_bytes = written_bytes_;
+    stats->written_packets = written_packets_;
+    stats->dropped_packets = dropped_packets_;
+    return RET_OK;
+}
+
+void Mp4Recorder::Loop()
+{
+    LogInfo("Loop into");
+    AVPacket *pkt = NULL;
+    MediaType media_type;
+    while(true) {
+        int ret = queue_->PopWithTimeout(&pkt, media_type, 100);
+        if(1 == ret) {
+            if(writePacket(pkt, media_type) < 0) {
+                LogError("write %s packet failed", E_VIDEO_TYPE == media_type ? "video" : "audio");
+            }
+            av_packet_free(&pkt);
+            continue;
+        }
+        // 请求退出时先把队列写完
+        if(ret < 0 || request_abort_) {
+            break;
+        }
+    }
+    LogInfo("Loop leave");
+}
+
+int Mp4Recorder::writePacket(AVPacket *pkt, MediaType media_type)
+{
+    AVStream *st = E_VIDEO_TYPE == media_type ? video_stream_ : audio_stream_;
+    AVRational src_time_base = {1, 1000};      // 采集、编码的时间戳单位都是ms
+    pkt->stream_index = st->index;
+    int64_t pts = pkt->pts;
+    pkt->pts = av_rescale_q(pkt->pts, src_time_base, st->time_base);
+    if(pkt->dts != AV_NOPTS_VALUE) {
+        pkt->dts = av_rescale_q(pkt->dts, src_time_base, st->time_base);
+    }
+    pkt->duration = 0;
+    bool key = E_VIDEO_TYPE == media_type && (pkt->flags & AV_PKT_FLAG_KEY);
+    int size = pkt->size;
+    // mov muxer按轨道缓存到分片结束，不需要av_interleaved_write_frame再排一次
+    int ret = av_write_frame(fmt_ctx_, pkt);
+    if(ret < 0) {
+        char str_error[512] = {0};
+        av_strerror(ret, str_error, sizeof(str_error) -1);
+        LogError("av_write_frame failed:%s", str_error);
+        return -1;
+    }
+    written_bytes_ += size;
+    written_packets_++;
+    // 关键帧触发上一个分片输出，马上刷到文件; 按frag_duration切的分片(比如只有音频)按时间刷
+    if(key || pts - last_flush_pts_ >= frag_duration_) {
+        avio_flush(fmt_ctx_->pb);
+        last_flush_pts_ = pts;
+    }
+    return 0;
+}
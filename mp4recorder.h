@@ -0,0 +1,81 @@
+#ifndef MP4RECORDER_H
+#define MP4RECORDER_H
+
+#include <atomic>
+#include "mediabase.h"
+#include "commonlooper.h"
+#include "packetqueue.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+}
+
+typedef struct mp4_recorder_stats {
+    PacketQueueStats queue;     // 当前待写队列
+    int64_t written_bytes;      // 累计写入的字节数
+    int64_t written_packets;    // 累计写入的包数量
+    int64_t dropped_packets;    // 队列超过上限丢掉的包
+}Mp4RecorderStats;
+
+// 本地录制: 和RtspPusher收到同样的编码包，只增加引用不拷贝数据，在自己的线程写分片mp4
+// 每个分片(moof+mdat)写完就是完整可播放的，进程崩溃也只丢最后一个分片
+// 磁盘慢时队列超过上限就丢掉旧的包，不会反过来阻塞推流
+class Mp4Recorder: public CommonLooper
+{
+public:
+    Mp4Recorder();
+    virtual ~Mp4Recorder();
+    /**
+     * @brief Init
+     * @param "file_name", 录制文件，默认record.mp4
+     *        "max_queue_duration", 待写队列的最大时长ms，超过时丢到关键帧，默认3000
+     *        "frag_duration", 分片的最大时长ms，关键帧也会切分片，默认1000
+     *        "audio_frame_duration"/"video_frame_duration", 估算队列时长用，单位ms，音频可以是小数(opus 2.5ms)
+     *        "video_max_interval", 可变帧率时两帧的最大间隔ms
+     *        "intra_refresh", 视频没有IDR时以recovery point作为丢包的起点
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    // 停止线程，写完队列里剩余的包和文件尾
+    void DeInit();
+    // 在Open之前添加音视频流
+    RET_CODE ConfigVideoStream(const AVCodecContext *ctx);
+    RET_CODE ConfigAudioStream(const AVCodecContext *ctx);
+    // 打开文件写头部，成功后启动线程
+    RET_CODE Open();
+    /**
+     * @brief Push 录制一个包，pts/dts单位为ms
+     *        只调用av_packet_ref增加引用，调用者仍然拥有pkt，可以继续交给RtspPusher
+     * @return 没有打开时返回RET_FAIL
+     */
+    RET_CODE Push(const AVPacket *pkt, MediaType media_type);
+    // 队列超限时累计丢掉的包数量
+    int64_t GetDroppedPackets();
+    // 队列、写入和丢包统计，可以在任意线程调用
+    RET_CODE GetStats(Mp4RecorderStats *stats);
+
+    virtual void Loop();
+private:
+    int writePacket(AVPacket *pkt, MediaType media_type);
+
+    std::string file_name_;
+    int max_queue_duration_ = 3000;
+    int frag_duration_ = 1000;
+    double audio_frame_duration_ = 0;
+    double video_frame_duration_ = 0;
+    int video_max_interval_ = 0;
+    bool intra_refresh_ = false;
+
+    AVFormatContext *fmt_ctx_ = NULL;
+    AVStream *video_stream_ = NULL;
+    AVStream *audio_stream_ = NULL;
+    PacketQueue *queue_ = NULL;
+    bool opened_ = false;
+    int64_t last_flush_pts_ = 0;           // 上次刷文件时包的pts
+    std::atomic<int64_t> dropped_packets_;
+    std::atomic<int64_t> written_bytes_;
+    std::atomic<int64_t> written_packets_;
+};
+
+#endif // MP4RECORDER_H
@@ -0,0 +1,226 @@
+#include <cstddef>
+#include <vector>
+#include "nalutil.h"
+
+const uint8_t *NaluUtil::FindStartCode(const uint8_t *data, const uint8_t *end, int *sc_len)
+{
+    const uint8_t *p = data;
+    while(p + 3 <= end) {
+        if(p[2] > 1) {
+            p += 3;         // 第3个字节大于1时，p、p+1、p+2都不可能是起始码的开头
+        } else if(p[2] == 1 && p[1] == 0 && p[0] == 0) {
+            if(p > data && p[-1] == 0) {
+                *sc_len = 4;
+                return p - 1;
+            }
+            *sc_len = 3;
+            return p;
+        } else {
+            p++;
+        }
+    }
+    *sc_len = 0;
+    return end;
+}
+
+bool NaluUtil::NextNal(const uint8_t **data, const uint8_t *end, const uint8_t **nal, int *nal_size)
+{
+    int sc_len = 0;
+    const uint8_t *start = FindStartCode(*data, end, &sc_len);
+    if(start == end) {
+        *data = end;
+        return false;
+    }
+    start += sc_len;
+    const uint8_t *next = FindStartCode(start, end, &sc_len);
+    *nal = start;
+    *nal_size = (int)(next - start);
+    *data = next;
+    return true;
+}
+
+bool NaluUtil::H264HasRecoveryPoint(const uint8_t *data, int size)
+{
+    return hasRecoveryPoint(data, size, false);
+}
+
+bool NaluUtil::H265HasRecoveryPoint(const uint8_t *data, int size)
+{
+    return hasRecoveryPoint(data, size, true);
+}
+
+bool NaluUtil::HasRecoveryPoint(const uint8_t *data, int size, bool hevc)
+{
+    return hasRecoveryPoint(data, size, hevc);
+}
+
+bool NaluUtil::hasRecoveryPoint(const uint8_t *data, int size, bool hevc)
+{
+    const uint8_t *end = data + size;
+    int header_size = hevc ? 2 : 1;
+    int sc_len = 0;
+    const uint8_t *p = FindStartCode(data, end, &sc_len);
+    while(p != end) {
+        const uint8_t *nal = p + sc_len;
+        if(nal + header_size > end) {
+            break;
+        }
+        int type = hevc ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+        bool vcl = hevc ? type < 32 : (type >= H264_NAL_SLICE && type <= H264_NAL_IDR);
+        if(vcl) {
+            break;          // SEI在slice前面，不用扫描slice
+        }
+        p = FindStartCode(nal, end, &sc_len);
+        int nal_size = (int)(p - nal);
+        if(type != (hevc ? H265_NAL_PREFIX_SEI : H264_NAL_SEI) || nal_size <= header_size) {
+            continue;
+        }
+        // payload的大小可能被防竞争字节打乱，先去掉再解析
+        std::vector<uint8_t> rbsp(nal_size);
+        int rbsp_size = unescape(nal + header_size, nal_size - header_size, rbsp.data());
+        int pos = 0;
+        while(pos < rbsp_size && rbsp[pos] != 0x80) {   // 0x80是rbsp_trailing_bits
+            int payload_type = 0;
+            while(pos < rbsp_size && rbsp[pos] == 0xff) {
+                payload_type += 255;
+                pos++;
+            }
+            if(pos >= rbsp_size) {
+                break;
+            }
+            payload_type += rbsp[pos++];
+            int payload_size = 0;
+            while(pos < rbsp_size && rbsp[pos] == 0xff) {
+                payload_size += 255;
+                pos++;
+            }
+            if(pos >= rbsp_size) {
+                break;
+            }
+            payload_size += rbsp[pos++];
+            if(payload_type == SEI_RECOVERY_POINT) {    // H264和H265的recovery point都是6
+                return true;
+            }
+            pos += payload_size;
+        }
+    }
+    return false;
+}
+
+bool NaluUtil::H264SliceInfo(const uint8_t *data, int size, int *nal_ref_idc, int *slice_type)
+{
+    // 只找到slice的起始码，不去扫描整个slice
+    const uint8_t *p = data;
+    const uint8_t *end = data + size;
+    int sc_len = 0;
+    while((p = FindStartCode(p, end, &sc_len)) != end) {
+        p += sc_len;
+        if(p >= end) {
+            break;
+        }
+        int type = p[0] & 0x1f;
+        if(type < H264_NAL_SLICE || type > H264_NAL_IDR) {
+            continue;
+        }
+        *nal_ref_idc = (p[0] >> 5) & 0x03;
+        // first_mb_in_slice和slice_type都在slice头的开头，16个字节足够
+        uint8_t header[16];
+        int header_size = unescape(p + 1, end - p - 1 < 16 ? (int)(end - p - 1) : 16, header);
+        int pos = 0;
+        int first_mb = 0;
+        if(!readUe(header, header_size, &pos, &first_mb) || !readUe(header, header_size, &pos, slice_type)) {
+            return false;
+        }
+        *slice_type %= 5;
+        return true;
+    }
+    return false;
+}
+
+int NaluUtil::H264TemporalLayer(const uint8_t *data, int size, int layers)
+{
+    int nal_ref_idc = 0;
+    int slice_type = 0;
+    if(layers <= 1 || !H264SliceInfo(data, size, &nal_ref_idc, &slice_type)) {
+        return 0;
+    }
+    if(nal_ref_idc == 0) {
+        return layers - 1;
+    }
+    if(slice_type == H264_SLICE_B && layers > 2) {
+        return 1;
+    }
+    return 0;
+}
+
+// H265的nal头里面直接有temporal_id，取第一个slice的
+int NaluUtil::H265TemporalLayer(const uint8_t *data, int size, int layers)
+{
+    const uint8_t *end = data + size;
+    int sc_len = 0;
+    const uint8_t *p = data;
+    while(layers > 1 && (p = FindStartCode(p, end, &sc_len)) != end) {
+        p += sc_len;
+        if(p + 2 > end) {
+            break;
+        }
+        int type = (p[0] >> 1) & 0x3f;
+        if(type >= 32) {
+            continue;
+        }
+        int temporal_id = (p[1] & 0x07) - 1;
+        if(temporal_id < 0) {
+            return 0;
+        }
+        return temporal_id < layers ? temporal_id : layers - 1;
+    }
+    return 0;
+}
+
+int NaluUtil::TemporalLayer(const uint8_t *data, int size, int layers, bool hevc)
+{
+    return hevc ? H265TemporalLayer(data, size, layers) : H264TemporalLayer(data, size, layers);
+}
+
+bool NaluUtil::readUe(const uint8_t *data, int size, int *pos, int *value)
+{
+    int zeros = 0;
+    while(true) {
+        if(*pos >= size * 8) {
+            return false;
+        }
+        int bit = (data[*pos / 8] >> (7 - *pos % 8)) & 1;
+        (*pos)++;
+        if(bit) {
+            break;
+        }
+        if(++zeros > 31) {
+            return false;
+        }
+    }
+    unsigned int v = 0;
+    for(int i = 0; i < zeros; i++) {
+        if(*pos >= size * 8) {
+            return false;
+        }
+        v = (v << 1) | ((data[*pos / 8] >> (7 - *pos % 8)) & 1);
+        (*pos)++;
+    }
+    *value = (int)((1u << zeros) - 1 + v);
+    return true;
+}
+
+int NaluUtil::unescape(const uint8_t *src, int size, uint8_t *dst)
+{
+    int n = 0;
+    int zeros = 0;
+    for(int i = 0; i < size; i++) {
+        if(zeros >= 2 && src[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = src[i] == 0 ? zeros + 1 : 0;
+        dst[n++] = src[i];
+    }
+    return n;
+}
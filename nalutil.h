@@ -0,0 +1,80 @@
+#ifndef NALUTIL_H
+#define NALUTIL_H
+
+#include <stdint.h>
+
+// H264 nal类型
+#define H264_NAL_SLICE      1
+#define H264_NAL_IDR        5
+#define H264_NAL_SEI        6
+#define H264_NAL_SPS        7
+#define H264_NAL_PPS        8
+
+// slice_type % 5
+#define H264_SLICE_P        0
+#define H264_SLICE_B        1
+#define H264_SLICE_I        2
+
+// H265 nal类型
+#define H265_NAL_VPS        32
+#define H265_NAL_SPS        33
+#define H265_NAL_PPS        34
+#define H265_NAL_PREFIX_SEI 39
+
+// SEI payload类型，H264和H265一样
+#define SEI_RECOVERY_POINT  6
+
+// annexb码流(00 00 01 / 00 00 00 01分隔)的解析工具
+class NaluUtil
+{
+public:
+    /**
+     * @brief FindStartCode 查找下一个起始码
+     * @param data      查找的起点
+     * @param end       数据的末尾
+     * @param sc_len    返回起始码的长度3或者4
+     * @return 起始码的位置，找不到时返回end
+     */
+    static const uint8_t *FindStartCode(const uint8_t *data, const uint8_t *end, int *sc_len);
+    /**
+     * @brief NextNal 遍历annexb数据里面的nal
+     * @param data      当前位置，第一次调用时传入数据的开头，每次调用后更新
+     * @param end       数据的末尾
+     * @param nal       返回nal的起始位置(不含起始码)
+     * @param nal_size  返回nal的大小，连续两个起始码时为0，调用者跳过
+     * @return false代表已经没有起始码了
+     */
+    static bool NextNal(const uint8_t **data, const uint8_t *end, const uint8_t **nal, int *nal_size);
+    /**
+     * @brief H264HasRecoveryPoint 包里面是否有recovery point SEI
+     *        intra-refresh模式下没有IDR，解码端可以从带recovery point的帧开始解码，刷新一轮之后画面完整
+     *        SEI在slice前面，遇到第一个slice就停止查找
+     * @return
+     */
+    static bool H264HasRecoveryPoint(const uint8_t *data, int size);
+    static bool H265HasRecoveryPoint(const uint8_t *data, int size);
+    static bool HasRecoveryPoint(const uint8_t *data, int size, bool hevc);
+    /**
+     * @brief H264SliceInfo 解析第一个slice的nal_ref_idc和slice_type，只读slice头的前几个字节
+     * @return false代表包里没有slice
+     */
+    static bool H264SliceInfo(const uint8_t *data, int size, int *nal_ref_idc, int *slice_type);
+    /**
+     * @brief H264TemporalLayer 按参考关系划分时间层
+     *        0: I/P帧; 1: 被参考的B帧(b-pyramid); layers-1: 不被参考的帧，丢掉不影响其他帧解码
+     * @param layers    时间层数量，1~3
+     * @return 时间层，没有slice时返回0
+     */
+    static int H264TemporalLayer(const uint8_t *data, int size, int layers);
+    // H265按nal头里面的temporal_id
+    static int H265TemporalLayer(const uint8_t *data, int size, int layers);
+    static int TemporalLayer(const uint8_t *data, int size, int layers, bool hevc);
+private:
+    static bool hasRecoveryPoint(const uint8_t *data, int size, bool hevc);
+    // 去掉防竞争字节00 00 03，返回去掉之后的大小
+    static int unescape(const uint8_t *src, int size, uint8_t *dst);
+    // 读无符号指数哥伦布编码，pos为bit位置
+    static bool readUe(const uint8_t *data, int size, int *pos, int *value);
+};
+
+#endif // NALUTIL_H
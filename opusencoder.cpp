@@ -0,0 +1,103 @@
+#include "opusencoder.h"
+#include "dlog.h"
+
+OpusEncoder::OpusEncoder()
+{
+
+}
+
+OpusEncoder::~OpusEncoder()
+{
+
+}
+
+RET_CODE OpusEncoder::Init(const Properties &properties)
+{
+    // 1. 获取参数
+    sample_rate_    = properties.GetProperty("sample_rate",48000);
+    bitrate_        = properties.GetProperty("bitrate",64*1024);
+    channels_       = properties.GetProperty("channels",2);
+    channel_layout_ = properties.GetProperty("channel_layout",(int)av_get_default_channel_layout(channels_));
+    frame_duration_ = properties.GetProperty("frame_duration","10");
+    application_    = properties.GetProperty("application","lowdelay");
+    dtx_            = properties.GetProperty("dtx",false);
+
+    // 1.1 参数检查
+    if(sample_rate_ != 48000 && sample_rate_ != 24000 && sample_rate_ != 16000
+            && sample_rate_ != 12000 && sample_rate_ != 8000) {
+        LogError("Opus: can't support sample_rate:%d", sample_rate_);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    if(channels_ != 1 && channels_ != 2) {
+        LogError("Opus: can't support channels:%d", channels_);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    double duration = atof(frame_duration_.c_str());
+    if(duration != 2.5 && duration != 5 && duration != 10 && duration != 20) {
+        LogError("Opus: can't support frame_duration:%s", frame_duration_.c_str());
+        return RET_ERR_NOT_SUPPORT;
+    }
+
+    // 2. 查找编码器，优先libopus，没有则用ffmpeg自带的opus编码器
+    bool native = false;
+    codec_ = avcodec_find_encoder_by_name("libopus");
+    if(!codec_) {
+        codec_ = avcodec_find_encoder(AV_CODEC_ID_OPUS);
+        native = true;
+    }
+    if(!codec_) return RET_ERR_MISMATCH_CODE;
+
+    // 3. 分配编码器上下文
+    ctx_ = avcodec_alloc_context3(codec_);
+    if(!ctx_){
+        LogError("Opus: avcodec_alloc_context3 failed");
+        return RET_ERR_OUTOFMEMORY;
+    }
+
+    // 4. 设置编码器参数
+    // libopus支持s16，采集的数据可以直接送编码器; 自带的编码器只支持fltp
+    ctx_->sample_fmt            = AV_SAMPLE_FMT_FLTP;
+    if(codec_->sample_fmts) {
+        ctx_->sample_fmt = codec_->sample_fmts[0];
+        for(const enum AVSampleFormat *fmt = codec_->sample_fmts; *fmt != AV_SAMPLE_FMT_NONE; fmt++) {
+            if(*fmt == AV_SAMPLE_FMT_S16) {
+                ctx_->sample_fmt = AV_SAMPLE_FMT_S16;
+                break;
+            }
+        }
+    }
+    ctx_->channels              = channels_;
+    ctx_->channel_layout        = channel_layout_;
+    ctx_->sample_rate           = sample_rate_;
+    ctx_->bit_rate              = bitrate_;
+    ctx_->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;   // 自带的opus编码器还是experimental
+
+    AVDictionary *dict = NULL;
+    if(native) {
+        // 自带的编码器根据最大延迟选择帧长
+        av_dict_set(&dict, "opus_delay", frame_duration_.c_str(), 0);
+    } else {
+        av_dict_set(&dict, "frame_duration", frame_duration_.c_str(), 0);
+        av_dict_set(&dict, "application", application_.c_str(), 0);
+    }
+    // dtx是比较新的libopus选项，设置失败时由上层用缓存的静音包代替
+    if(dtx_ && (native || av_opt_set(ctx_->priv_data, "dtx", "1", 0) < 0)) {
+        LogWarn("Opus: %s can't support dtx", codec_->name);
+        dtx_ = false;
+    }
+
+    // 5. 打开编码器
+    int ret = avcodec_open2(ctx_, codec_, &dict);
+    av_dict_free(&dict);
+    if(ret < 0) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("Opus: can't avcodec_open2:%s", buf);
+        avcodec_free_context(&ctx_);
+        return RET_FAIL;
+    }
+    LogInfo("Opus: %s, frame_size:%d, sample_fmt:%s, initial_padding:%d, dtx:%d",
+            codec_->name, ctx_->frame_size,
+            av_get_sample_fmt_name(ctx_->sample_fmt), ctx_->initial_padding, dtx_);
+    return RET_OK;
+}
@@ -0,0 +1,42 @@
+#ifndef OPUSENCODER_H
+#define OPUSENCODER_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+}
+#include "audioencoder.h"
+
+// Opus编码器，帧长可以做到2.5~20ms，比AAC-LC的1024个采样点延迟小很多
+class OpusEncoder: public AudioEncoder
+{
+public:
+    OpusEncoder();
+    virtual ~OpusEncoder();
+    /**
+     * @brief Init
+     * @param "sample_rate", 采样率，默认48000，只支持8000/12000/16000/24000/48000
+     *        "channels",通道数量 ，默认2，RTP只支持1或者2
+     *        "bitrate"， 比特率，默认64*1024
+     *        "frame_duration"， 帧长(ms)，默认10，只支持2.5/5/10/20
+     *        "application"， voip/audio/lowdelay，默认lowdelay
+     *        "dtx"， 是否打开DTX，默认0，当前ffmpeg不支持时自动关闭
+     * @return
+     */
+    virtual RET_CODE Init(const Properties &properties);
+
+    virtual bool IsDtx() {
+        return dtx_;
+    }
+
+private:
+    int sample_rate_ = 48000;
+    int channels_    = 2;
+    int bitrate_     = 64*1024;
+    int channel_layout_ = AV_CH_LAYOUT_STEREO;
+    std::string frame_duration_ = "10";
+    std::string application_ = "lowdelay";
+    bool dtx_ = false;
+};
+
+#endif // OPUSENCODER_H
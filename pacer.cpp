@@ -0,0 +1,151 @@
+#include "pacer.h"
+#include "dlog.h"
+
+#define PACER_MIN_BURST 3000        // 至少两个MTU大小的rtp包
+
+Pacer::Pacer()
+{
+
+}
+
+Pacer::~Pacer()
+{
+
+}
+
+RET_CODE Pacer::Init(const Properties &properties)
+{
+    bitrate_        = properties.GetProperty("bitrate", 0);
+    headroom_       = properties.GetProperty("headroom", 25);
+    burst_          = properties.GetProperty("burst", 5);
+    frame_duration_ = properties.GetProperty("frame_duration", 40);
+    frame_fraction_ = properties.GetProperty("frame_fraction", 50);
+    if(bitrate_ <= 0 || headroom_ < 0 || burst_ <= 0 || frame_duration_ <= 0
+            || frame_fraction_ <= 0 || frame_fraction_ > 100) {
+        LogError("bitrate:%d, headroom:%d%%, burst:%dms, frame:%.1fms*%d%%", bitrate_, headroom_, burst_,
+                 frame_duration_, frame_fraction_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    updateRate();
+    tokens_ = burst_bytes_;
+    return RET_OK;
+}
+
+void Pacer::SetBitrate(int bitrate)
+{
+    if(bitrate <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(bitrate == bitrate_) {
+        return;
+    }
+    bitrate_ = bitrate;
+    updateRate();
+}
+
+void Pacer::SetFrameDuration(double frame_duration)
+{
+    if(frame_duration <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame_duration_ = frame_duration;
+    updateRate();
+}
+
+void Pacer::updateRate()
+{
+    rate_ = (double)bitrate_ * (100 + headroom_) / 100 / 8 / 1000000;
+    burst_bytes_ = rate_ * burst_ * 1000;
+    if(burst_bytes_ < PACER_MIN_BURST) {
+        burst_bytes_ = PACER_MIN_BURST;
+    }
+    max_wait_ = (int64_t)(frame_duration_ * frame_fraction_ / 100 * 1000);
+}
+
+int64_t Pacer::Acquire(int64_t now, int size, int64_t deadline, int64_t remaining)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 1. 按经过的时间补充令牌，最多攒burst_bytes_
+    if(last_time_ < 0) {
+        last_time_ = now;
+    }
+    if(now > last_time_) {
+        tokens_ += (now - last_time_) * rate_;
+        if(tokens_ > burst_bytes_) {
+            tokens_ = burst_bytes_;
+        }
+        last_time_ = now;
+    }
+
+    // 2. 前面的包欠下的令牌先还上，最多等max_wait_，剩下的欠账不再追
+    int64_t wait = 0;
+    if(tokens_ < 0) {
+        double rate = rate_;
+        if(deadline > now && remaining > 0) {
+            double need = (-tokens_ + remaining) / (deadline - now);
+            if(need > rate) {
+                rate = need;
+            }
+        }
+        wait = (int64_t)(-tokens_ / rate) + 1;
+        if(wait > max_wait_) {
+            wait = max_wait_;
+        }
+        if(deadline > 0 && now + wait > deadline) {
+            wait = deadline > now ? deadline - now : 0;
+        }
+        tokens_ = 0;
+        last_time_ = now + wait;
+    }
+
+    // 3. 先发后扣，关键帧这种大包之后的包被错开
+    tokens_ -= size;
+    packets_++;
+    if(wait > 0) {
+        delayed_++;
+        total_delay_ += wait;
+        if(wait > max_delay_) {
+            max_delay_ = wait;
+        }
+    }
+    if(size > max_write_) {
+        max_write_ = size;
+    }
+    if(size > burst_bytes_) {
+        oversize_++;
+    }
+    return wait;
+}
+
+int Pacer::GetBurstBytes()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (int)burst_bytes_;
+}
+
+int64_t Pacer::GetMaxSpread()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_wait_;
+}
+
+void Pacer::GetStats(PacerStats *stats)
+{
+    if(!stats) {
+        LogError("stats is null");
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats->rate = (int)(rate_ * 8 * 1000000);
+    stats->packets = packets_;
+    stats->delayed = delayed_;
+    stats->avg_delay = delayed_ > 0 ? total_delay_ / delayed_ : 0;
+    stats->max_delay = max_delay_;
+    stats->max_write = max_write_;
+    stats->oversize = oversize_;
+    max_delay_ = 0;
+    max_write_ = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <mutex>
+#include "mediabase.h"
+
+typedef struct pacer_stats {
+    int rate;               // 当前的发送速率bps，目标码率加上余量
+    int64_t packets;        // 累计发送的批次
+    int64_t delayed;        // 累计被推迟的批次
+    int64_t avg_delay;      // 被推迟的批次平均等待us
+    int64_t max_delay;      // 上次获取之后单次最长的等待us
+    int max_write;          // 上次获取之后单次写入最大的字节数，超过桶深的部分以线速发出
+    int64_t oversize;       // 累计超过桶深的写入次数
+}PacerStats;
+
+// 令牌桶发送节奏: 令牌按rate积累，最多攒burst字节; 先发后扣，欠下的令牌由后面的包等待偿还
+// 调用者把一帧的rtp包按桶深分成几批，每批之前等待，关键帧就分散到帧间隔里
+// 每次最多等max_delay，还不完的部分不再追，发送线程不会越拖越晚
+// 只在发送线程调用Acquire，其他接口可以在任意线程调用
+class Pacer
+{
+public:
+    Pacer();
+    ~Pacer();
+    /**
+     * @brief Init
+     * @param "bitrate", 目标码率bps
+     *        "headroom", 发送速率比目标码率高的百分比，默认25
+     *        "burst", 桶深，按发送速率折算的时长ms，默认5
+     *        "frame_duration", 视频帧间隔ms，默认40
+     *        "frame_fraction", 一帧的数据最多分散到帧间隔的百分之几，默认50
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    // 码率自适应或者降级之后更新目标码率
+    void SetBitrate(int bitrate);
+    void SetFrameDuration(double frame_duration);
+    /**
+     * @brief Acquire 发送size字节之前调用
+     * @param now       当前时间us，单调递增
+     * @param deadline  这一帧最晚发完的时间us; 0代表只受max_delay限制
+     * @param remaining 这一帧包括这一批还没发的字节，按速率在deadline之前发不完时提高速率，整帧均匀分散到deadline
+     * @return 需要先等待的时间us
+     */
+    int64_t Acquire(int64_t now, int size, int64_t deadline = 0, int64_t remaining = 0);
+    // 一批最多发多少字节
+    int GetBurstBytes();
+    // 一帧的数据最多分散多久us
+    int64_t GetMaxSpread();
+    // 获取统计，max_delay和max_write从头开始
+    void GetStats(PacerStats *stats);
+private:
+    // 调用者已经加锁
+    void updateRate();
+
+    std::mutex mutex_;
+    int bitrate_ = 0;
+    int headroom_ = 25;
+    int burst_ = 5;
+    double frame_duration_ = 40;
+    int frame_fraction_ = 50;
+
+    double rate_ = 0;               // 字节/us
+    double burst_bytes_ = 0;
+    int64_t max_wait_ = 0;          // 单个包最多等待us
+    double tokens_ = 0;
+    int64_t last_time_ = -1;
+
+    int64_t packets_ = 0;
+    int64_t delayed_ = 0;
+    int64_t total_delay_ = 0;
+    int64_t max_delay_ = 0;
+    int max_write_ = 0;
+    int64_t oversize_ = 0;
+};
+
+#endif // PACER_H
@@ -7,6 +7,8 @@
 #include <condition_variable>
 #include <queue>
 #include "mediabase.h"
+#include "nalutil.h"
+#include "spilllog.h"
 #include "dlog.h"
 
 extern "C"
@@ -21,11 +23,16 @@ typedef struct packet_queue_stats {
     int video_size;         // 视频总大小 字节
     int64_t audio_duration; //音频持续时长
     int64_t video_duration; //视频持续时长
+    int spill_nb_packets;   // 溢出到磁盘的包数量
+    int64_t spill_size;     // 溢出到磁盘的字节数
+    int64_t spill_duration; // 溢出到磁盘的时长
 }PacketQueueStats;
 
 typedef struct my_avpacket {
     AVPacket *packet;
     MediaType media_type;
+    int random_access;      // 视频包是否可以作为解码起点: IDR或者带recovery point SEI
+    int temporal_layer;     // 视频包的时间层，0是基础层
 }MyAVPacket;
 
 class PacketQueue
@@ -44,7 +51,32 @@ public:
         memset(&stats_, 0, sizeof(PacketQueueStats));
     }
     ~PacketQueue(){
+        if(spill_) {
+            delete spill_;
+        }
+    }
 
+    /**
+     * @brief EnableSpill 打开溢出模式: 内存里的时长超过memory_duration时，把最旧的包追加到磁盘文件而不是丢掉
+     *        出队时先按顺序读回磁盘上的包，pts不变; 文件写满之后不再溢出，由调用者的Drop兜底
+     * @param file_name         溢出文件
+     * @param max_size          溢出文件的最大字节数
+     * @param memory_duration   内存里最多保留的时长ms
+     * @return 0成功 -1失败
+     */
+    int EnableSpill(const std::string &file_name, int64_t max_size, int64_t memory_duration) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(spill_) {
+            return -1;
+        }
+        spill_ = new SpillLog();
+        if(spill_->Open(file_name, max_size) != RET_OK) {
+            delete spill_;
+            spill_ = NULL;
+            return -1;
+        }
+        spill_memory_duration_ = memory_duration;
+        return 0;
     }
 
     // 数据包的入队操作 - Push 方法
@@ -87,35 +119,70 @@ public:
         }
         mypkt->media_type = media_type;
         mypkt->packet = pkt;
+        mypkt->random_access = 0;
+        mypkt->temporal_layer = 0;
         // 步骤 3: 根据媒体类型更新统计信息
         if(E_AUDIO_TYPE == media_type) {
             stats_.audio_nb_packets++;      // 包数量
             stats_.audio_size += pkt->size;
             // 持续时长怎么统计，不是用pkt->duration
-            audio_back_pts_ = pkt->pts;
+            audio_back_dts_ = packetDts(pkt);
             if(audio_first_packet) {
                 audio_first_packet  = 0;
-                audio_front_pts_ = pkt->pts;
+                audio_front_dts_ = packetDts(pkt);
             }
         }
         if(E_VIDEO_TYPE == media_type) {
             stats_.video_nb_packets++;      // 包数量
             stats_.video_size += pkt->size;
+            // intra-refresh模式没有IDR，以recovery point作为解码起点
+            if((pkt->flags & AV_PKT_FLAG_KEY)
+                    || (recovery_point_ && NaluUtil::HasRecoveryPoint(pkt->data, pkt->size, hevc_))) {
+                mypkt->random_access = 1;
+                random_access_count_++;
+            }
+            // 等待解码起点时，前面的视频接收端解不了，直接丢掉
+            if(wait_random_access_) {
+                if(!mypkt->random_access) {
+                    stats_.video_nb_packets--;
+                    stats_.video_size -= pkt->size;
+                    dropped_packets_++;
+                    av_packet_free(&pkt);
+                    free(mypkt);
+                    return 0;
+                }
+                wait_random_access_ = false;
+            }
+            // 时间层: 正在丢弃的层直接丢掉，不影响其他帧解码
+            if(temporal_layers_ > 1) {
+                mypkt->temporal_layer = NaluUtil::TemporalLayer(pkt->data, pkt->size, temporal_layers_, hevc_);
+                if(mypkt->temporal_layer >= shed_layer_) {
+                    stats_.video_nb_packets--;
+                    stats_.video_size -= pkt->size;
+                    shed_packets_++;
+                    av_packet_free(&pkt);
+                    free(mypkt);
+                    return 0;
+                }
+            }
             // 持续时长怎么统计，不是用pkt->duration
-            video_back_pts_ = pkt->pts;
+            video_back_dts_ = packetDts(pkt);
             if(video_first_packet) {
                 video_first_packet  = 0;
-                video_front_pts_ = pkt->pts;
+                video_front_dts_ = packetDts(pkt);
             }
         }
 
-        // 步骤 4: 将处理好的包加入队列
+        // 步骤 4: 将处理好的包加入队列，超过内存预算时把最旧的包溢出到磁盘
         queue_.push(mypkt);
+        if(spill_) {
+            spillLocked();
+        }
         return 0;
     }
 
     //  数据包的出队操作 - Pop 和 PopWithTimeout 方法
-    // 返回值: -1 abort; 1 获取到消息
+    // 返回值: -1 abort; 0 没有消息(溢出文件读失败并且内存里没有包); 1 获取到消息
     int Pop(AVPacket **pkt,MediaType &media_type) {
         // 步骤 1: 参数检查和锁定互斥量
         if(!pkt) {
@@ -128,9 +195,9 @@ public:
             LogWarn("abort request");
             return -1;
         }
-        if(queue_.empty()) {
+        if(emptyLocked()) {
             cond_.wait(lock,[this] {
-                return !queue_.empty() || abort_request_;
+                return !emptyLocked() || abort_request_;
             });
         }
         // 再次检查中断请求
@@ -139,6 +206,14 @@ public:
             return -1;
         }
 
+        // 磁盘上的包比内存里的旧，先发
+        if(popSpillLocked(pkt, media_type)) {
+            return 1;
+        }
+        if(queue_.empty()) {
+            return 0;
+        }
+
         // 步骤 3: 处理队列中的数据包
         MyAVPacket *mypkt = queue_.front();
         *pkt        = mypkt->packet;
@@ -147,12 +222,12 @@ public:
         if(media_type == E_AUDIO_TYPE) {
             stats_.audio_nb_packets--;
             stats_.audio_size -= mypkt->packet->size;
-            audio_front_pts_ = mypkt->packet->pts;
+            audio_front_dts_ = packetDts(mypkt->packet);
         }
         if(media_type == E_VIDEO_TYPE) {
             stats_.video_nb_packets--;
             stats_.video_size -= mypkt->packet->size;
-            video_front_pts_ = mypkt->packet->pts;
+            video_front_dts_ = packetDts(mypkt->packet);
         }
         
         queue_.pop();
@@ -177,9 +252,9 @@ public:
         }
 
         // 如果队列为空，则等待条件变量，但带有超时时间
-        if(queue_.empty()) {
+        if(emptyLocked()) {
             cond_.wait_for(lock, std::chrono::milliseconds(timeout), [this] {
-                return !queue_.empty() || abort_request_;
+                return !emptyLocked() || abort_request_;
             });
         }
 
@@ -189,6 +264,15 @@ public:
             return -1;
         }
 
+        // 磁盘上的包比内存里的旧，先发
+        if(popSpillLocked(pkt, media_type)) {
+            return 1;
+        }
+        // 超时了队列还是空的
+        if(queue_.empty()) {
+            return 0;
+        }
+
         // 步骤 3: 从队列中取出数据包并更新统计信息
         MyAVPacket *mypkt = queue_.front(); // 读取队列首部元素
         *pkt        = mypkt->packet;
@@ -198,12 +282,12 @@ public:
         if(E_AUDIO_TYPE == media_type) {
             stats_.audio_nb_packets--;      // 减少音频包计数
             stats_.audio_size -= mypkt->packet->size;
-            audio_front_pts_ = mypkt->packet->pts;
+            audio_front_dts_ = packetDts(mypkt->packet);
         }
         if(E_VIDEO_TYPE == media_type) {
             stats_.video_nb_packets--;      // 减少视频包计数
             stats_.video_size -= mypkt->packet->size;
-            video_front_pts_ = mypkt->packet->pts;
+            video_front_dts_ = packetDts(mypkt->packet);
         }
 
         // 移除队列首部元素并释放内存
@@ -215,7 +299,7 @@ public:
 
     bool Empty() {
         std::lock_guard<std::mutex> lock(mutex_);
-        return queue_.empty();
+        return emptyLocked();
     }
 
     // 唤醒在等待的线程
@@ -226,41 +310,54 @@ public:
     }
 
     // all为true:清空队列;
-    // all为false: drop数据，直到遇到I帧, 最大保留remain_max_duration时长;
+    // all为false: drop数据，直到遇到I帧(或者recovery point), 最大保留remain_max_duration时长;
+    // 返回值: 1 丢了视频包并且队列里没有剩下以关键帧开头的视频，接收端的参考帧断了，需要编码器尽快出一个IDR; 0 其他
     int Drop(bool all, int64_t remain_max_duration) {
         // 步骤 1: 加锁和初始化循环
         std::lock_guard<std::mutex> lock(mutex_);
+        bool video_dropped = false;
+        bool stop_at_key = false;
+        // 磁盘上的积压只在清空时丢掉，只丢内存里的包时从关键帧继续，解码不受影响
+        if(all && spill_) {
+            spill_->Clear();
+        }
 
         while (!queue_.empty()) {
             MyAVPacket *mypkt = queue_.front();
             // 步骤 2: 处理非“全部删除”情况
-            if (!all && mypkt->media_type == E_VIDEO_TYPE && (mypkt->packet->flags & AV_PKT_FLAG_KEY))
+            if (!all && mypkt->media_type == E_VIDEO_TYPE && mypkt->random_access)
             {
-                int64_t duration = video_back_pts_ - video_front_pts_; // 以 pts 为准计算持续时间
+                int64_t duration = video_back_dts_ - video_front_dts_; // 以 dts 为准计算持续时间，有b帧时pts不是递增的
 
                 // 检查 PTS 回绕或持续时间异常
-                if (duration < 0 || duration > video_frame_duration_ * stats_.video_nb_packets * 2)
+                if (duration < 0 || duration > videoMaxFrameDuration() * stats_.video_nb_packets * 2)
                 {
                     duration = video_frame_duration_ * stats_.video_nb_packets;
                 }
                 LogInfo("video duration:%lld", duration);
                 // 如果持续时间小于等于最大保留时长，则退出循环
-                if(duration <= remain_max_duration)
+                if(duration <= remain_max_duration) {
+                    stop_at_key = true;
                     break;
+                }
             }
 
             // 步骤 3: 更新统计信息并删除数据包
             if(E_AUDIO_TYPE == mypkt->media_type) {
                 stats_.audio_nb_packets--;      // 减少音频包计数
                 stats_.audio_size -= mypkt->packet->size;
-                audio_front_pts_ = mypkt->packet->pts;
+                audio_front_dts_ = packetDts(mypkt->packet);
             }
             if(E_VIDEO_TYPE == mypkt->media_type) {
                 stats_.video_nb_packets--;      // 减少视频包计数
                 stats_.video_size -= mypkt->packet->size;
-                video_front_pts_ = mypkt->packet->pts;
+                video_front_dts_ = packetDts(mypkt->packet);
+                video_dropped = true;
             }
 
+            if(!all) {
+                dropped_packets_++;
+            }
             // 释放 AVPacket
             av_packet_free(&mypkt->packet);
             // 从队列中移除并释放 MyAVPacket
@@ -268,33 +365,145 @@ public:
             free(mypkt);
         }
 
-        return 0;
+        return (video_dropped && !stop_at_key) ? 1 : 0;
     }
 
-    int64_t GetAudioDuration() {
+    // 只保留最后一个解码起点开始的包，前面的音视频都丢掉; 有视频但没有解码起点时全部丢掉
+    // 断线重连时使用: 新连接只能从解码起点开始，旧的GOP没必要再发; 返回丢掉的包数量
+    int DropToLastRandomAccess() {
         std::lock_guard<std::mutex> lock(mutex_);
-        int64_t duration = audio_back_pts_ - audio_front_pts_;
-        // 也参考帧（包）持续 *帧(包)数
-        if(duration < 0     // pts回绕
-                || duration > audio_frame_duration_ * stats_.audio_nb_packets * 2) {
-            duration =  audio_frame_duration_ * stats_.audio_nb_packets;
-        } else {
-            duration += audio_frame_duration_;
+        return dropToLastRandomAccessLocked();
+    }
+
+    // 参考帧断了又不能让编码器出IDR时(备用目的地)，从下一个解码起点继续，不发接收端解不了的帧
+    // 队列里有解码起点时同DropToLastRandomAccess; 没有时丢掉队列里的视频，之后入队的视频也丢掉，
+    // 直到下一个IDR或者recovery point入队，音频照常发送; 返回这次丢掉的包数量
+    int DropToNextRandomAccess() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 步骤 1: 队列里有解码起点
+        bool has_random_access = false;
+        size_t count = queue_.size();
+        for(size_t i = 0; i < count; i++) {
+            MyAVPacket *mypkt = queue_.front();
+            queue_.pop();
+            if(E_VIDEO_TYPE == mypkt->media_type && mypkt->random_access) {
+                has_random_access = true;
+            }
+            queue_.push(mypkt);
         }
-        return duration;
+        if(has_random_access) {
+            return dropToLastRandomAccessLocked();
+        }
+
+        // 步骤 2: 没有解码起点，丢掉所有视频，等待下一个起点
+        int dropped = 0;
+        std::queue<MyAVPacket *> remain;
+        while(!queue_.empty()) {
+            MyAVPacket *mypkt = queue_.front();
+            queue_.pop();
+            if(E_VIDEO_TYPE == mypkt->media_type) {
+                stats_.video_nb_packets--;
+                stats_.video_size -= mypkt->packet->size;
+                video_front_dts_ = packetDts(mypkt->packet);
+                av_packet_free(&mypkt->packet);
+                free(mypkt);
+                dropped++;
+                continue;
+            }
+            remain.push(mypkt);
+        }
+        queue_.swap(remain);
+        dropped_packets_ += dropped;
+        wait_random_access_ = true;
+        return dropped;
+    }
+
+    int64_t GetAudioDuration() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return audioDuration();
     }
 
     int64_t GetVideoDuration() {
         std::lock_guard<std::mutex> lock(mutex_);
-        int64_t duration = video_back_pts_ - video_front_pts_;  //以pts为准
-        // 也参考帧（包）持续 *帧(包)数
-        if(duration < 0     // pts回绕
-                || duration > video_frame_duration_ * stats_.video_nb_packets * 2) {
-            duration =  video_frame_duration_ * stats_.video_nb_packets;
-        }else {
-            duration += video_frame_duration_;
+        return videoDuration();
+    }
+
+    // 视频使用intra-refresh时打开，入队时检查recovery point SEI
+    void SetRecoveryPoint(bool enable) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        recovery_point_ = enable;
+    }
+
+    // 视频是否是H265，决定recovery point和时间层按哪种nal头解析
+    void SetVideoCodec(bool hevc) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hevc_ = hevc;
+    }
+
+    // 视频的时间层数量，大于1时入队时解析每个包的时间层
+    void SetTemporalLayers(int layers) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        temporal_layers_ = layers;
+        shed_layer_ = layers;
+    }
+
+    // 只保留时间层小于layer的视频包: 队列里已有的高层包马上删除，之后入队的也直接丢掉
+    // layer等于时间层数量时恢复全部发送; 返回这次删除的包数量
+    int ShedLayer(int layer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(layer < 1) {
+            layer = 1;      // 基础层不能丢
         }
-        return duration;
+        shed_layer_ = layer;
+        int dropped = 0;
+        std::queue<MyAVPacket *> remain;
+        while(!queue_.empty()) {
+            MyAVPacket *mypkt = queue_.front();
+            queue_.pop();
+            if(mypkt->media_type == E_VIDEO_TYPE && mypkt->temporal_layer >= shed_layer_) {
+                stats_.video_nb_packets--;
+                stats_.video_size -= mypkt->packet->size;
+                av_packet_free(&mypkt->packet);
+                free(mypkt);
+                dropped++;
+                continue;
+            }
+            remain.push(mypkt);
+        }
+        queue_.swap(remain);
+        shed_packets_ += dropped;
+        return dropped;
+    }
+
+    // 累计因为时间层丢弃的包数量
+    int64_t GetShedPackets() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return shed_packets_;
+    }
+
+    // 累计Drop(false)丢掉的包数量
+    int64_t GetDroppedPackets() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_packets_;
+    }
+
+    // 累计入队的可解码起点(IDR/recovery point)数量，用于判断丢包之后是否已经有新的起点
+    int64_t GetRandomAccessCount() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return random_access_count_;
+    }
+
+    // 帧率变化之后更新，用于估算队列时长
+    void SetVideoFrameDuration(double video_frame_duration) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        video_frame_duration_ = video_frame_duration > 0 ? video_frame_duration : 0;
+    }
+
+    // 可变帧率时两帧之间最长的间隔ms，0为固定帧率
+    // 可变帧率的pts间隔远大于video_frame_duration_，按固定帧率判断会被当成异常
+    void SetVideoMaxInterval(int max_interval) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        video_max_interval_ = max_interval > 0 ? max_interval : 0;
     }
 
     int GetAudioPackets() {
@@ -314,22 +523,8 @@ public:
         }
         std::lock_guard<std::mutex> lock(mutex_);
 
-        int64_t audio_duration = audio_back_pts_ - audio_front_pts_;  //以pts为准
-        // 也参考帧（包）持续 *帧(包)数
-        if(audio_duration < 0     // pts回绕
-                || audio_duration > audio_frame_duration_ * stats_.audio_nb_packets * 2) {
-            audio_duration =  audio_frame_duration_ * stats_.audio_nb_packets;
-        }else {
-            audio_duration += audio_frame_duration_;
-        }
-        int64_t video_duration = video_back_pts_ - video_front_pts_;  //以pts为准
-        // 也参考帧（包）持续 *帧(包)数
-        if(video_duration < 0     // pts回绕
-                || video_duration > video_frame_duration_ * stats_.video_nb_packets * 2) {
-            video_duration =  video_frame_duration_ * stats_.video_nb_packets;
-        }else {
-            video_duration += video_frame_duration_;
-        }
+        int64_t audio_duration = audioDuration();
+        int64_t video_duration = videoDuration();
 
         stats->audio_duration   = audio_duration;
         stats->audio_nb_packets = stats_.audio_nb_packets;
@@ -337,9 +532,147 @@ public:
         stats->video_duration   = video_duration;
         stats->video_nb_packets = stats_.video_nb_packets;
         stats->video_size       = stats_.video_size;
+        stats->spill_nb_packets = spill_ ? spill_->Packets() : 0;
+        stats->spill_size       = spill_ ? spill_->Size() : 0;
+        stats->spill_duration   = spill_ ? spill_->Duration() : 0;
+    }
+
+    // 溢出到磁盘还没有读回的包数量，大于0说明在补发积压
+    int GetSpillPackets() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return spill_ ? spill_->Packets() : 0;
     }
 
 private:
+    // 调用者已经加锁
+    int dropToLastRandomAccessLocked() {
+        // 步骤 1: 转一圈找到最后一个解码起点，顺序不变
+        size_t count = queue_.size();
+        size_t last = count;
+        bool has_video = false;
+        for(size_t i = 0; i < count; i++) {
+            MyAVPacket *mypkt = queue_.front();
+            queue_.pop();
+            if(E_VIDEO_TYPE == mypkt->media_type) {
+                has_video = true;
+                if(mypkt->random_access) {
+                    last = i;
+                }
+            }
+            queue_.push(mypkt);
+        }
+        if(!has_video) {
+            return 0;       // 只有音频时由Drop按时长限制
+        }
+
+        // 步骤 2: 丢掉解码起点前面的包
+        for(size_t i = 0; i < last; i++) {
+            MyAVPacket *mypkt = queue_.front();
+            if(E_AUDIO_TYPE == mypkt->media_type) {
+                stats_.audio_nb_packets--;
+                stats_.audio_size -= mypkt->packet->size;
+                audio_front_dts_ = packetDts(mypkt->packet);
+            }
+            if(E_VIDEO_TYPE == mypkt->media_type) {
+                stats_.video_nb_packets--;
+                stats_.video_size -= mypkt->packet->size;
+                video_front_dts_ = packetDts(mypkt->packet);
+            }
+            av_packet_free(&mypkt->packet);
+            queue_.pop();
+            free(mypkt);
+        }
+        dropped_packets_ += last;
+        return (int)last;
+    }
+
+    // 队列时长按dts计算: 出队顺序就是解码顺序，有b帧时dts递增而pts不是
+    static int64_t packetDts(const AVPacket *pkt) {
+        return pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    }
+
+    // 两帧之间正常的最大间隔，超过包数的2倍认为pts异常
+    double videoMaxFrameDuration() {
+        return video_max_interval_ > video_frame_duration_ ? video_max_interval_ : video_frame_duration_;
+    }
+
+    // 调用者已经加锁
+    int64_t audioDuration() {
+        int64_t duration = audio_back_dts_ - audio_front_dts_;  //以dts为准，有b帧时pts不是递增的
+        // 也参考帧（包）持续 *帧(包)数
+        if(duration < 0     // pts回绕
+                || duration > audio_frame_duration_ * stats_.audio_nb_packets * 2) {
+            duration =  audio_frame_duration_ * stats_.audio_nb_packets;
+        } else {
+            duration += audio_frame_duration_;
+        }
+        return duration;
+    }
+
+    // 调用者已经加锁
+    int64_t videoDuration() {
+        int64_t duration = video_back_dts_ - video_front_dts_;  //以dts为准，有b帧时pts不是递增的
+        // 也参考帧（包）持续 *帧(包)数
+        if(duration < 0     // pts回绕
+                || duration > videoMaxFrameDuration() * stats_.video_nb_packets * 2) {
+            duration =  video_frame_duration_ * stats_.video_nb_packets;
+        }else {
+            duration += video_frame_duration_;
+        }
+        return duration;
+    }
+
+    // 调用者已经加锁
+    bool emptyLocked() {
+        return queue_.empty() && !(spill_ && spill_->Packets() > 0);
+    }
+
+    // 调用者已经加锁: 内存里的时长超过预算时，把最旧的包按顺序写到磁盘
+    void spillLocked() {
+        while(!queue_.empty()
+              && (audioDuration() > spill_memory_duration_ || videoDuration() > spill_memory_duration_)) {
+            MyAVPacket *mypkt = queue_.front();
+            if(!spill_->Append(mypkt->packet, mypkt->media_type, mypkt->random_access, mypkt->temporal_layer)) {
+                if(!spill_full_) {
+                    LogWarn("spill file is full, packets:%d", spill_->Packets());
+                    spill_full_ = true;
+                }
+                return;
+            }
+            spill_full_ = false;
+            if(E_AUDIO_TYPE == mypkt->media_type) {
+                stats_.audio_nb_packets--;
+                stats_.audio_size -= mypkt->packet->size;
+                audio_front_dts_ = packetDts(mypkt->packet);
+            }
+            if(E_VIDEO_TYPE == mypkt->media_type) {
+                stats_.video_nb_packets--;
+                stats_.video_size -= mypkt->packet->size;
+                video_front_dts_ = packetDts(mypkt->packet);
+            }
+            av_packet_free(&mypkt->packet);
+            queue_.pop();
+            free(mypkt);
+        }
+    }
+
+    // 调用者已经加锁: 从磁盘读回最早的包，没有积压或者读失败时返回false
+    bool popSpillLocked(AVPacket **pkt, MediaType &media_type) {
+        if(!spill_ || spill_->Packets() <= 0) {
+            return false;
+        }
+        int random_access = 0;
+        int temporal_layer = 0;
+        *pkt = spill_->Read(&media_type, &random_access, &temporal_layer);
+        if(!*pkt) {
+            // 文件坏了，后面的积压也读不出来，从内存里的包继续
+            LogError("read spill failed, drop %d packets", spill_->Packets());
+            spill_->Clear();
+            return false;
+        }
+        return true;
+    }
+
     std::mutex mutex_;
     std::condition_variable cond_;
     std::queue<MyAVPacket *> queue_;
@@ -350,12 +683,25 @@ private:
     PacketQueueStats stats_;
     double audio_frame_duration_ = 23.21995649; // 默认23.2ms 44.1khz  1024*1000ms/44100=23.21995649ms
     double video_frame_duration_ = 40;  // 40ms 视频帧率为25的  ， 1000ms/25=40ms
-    // pts记录
-    int64_t audio_front_pts_    = 0;
-    int64_t audio_back_pts_     = 0;
+    double video_max_interval_ = 0;     // 可变帧率时两帧的最大间隔
+    bool recovery_point_ = false;
+    bool hevc_ = false;
+    int64_t random_access_count_ = 0;
+    int temporal_layers_ = 1;
+    int shed_layer_ = 1;            // 大于等于这个时间层的视频包丢掉
+    int64_t shed_packets_ = 0;
+    int64_t dropped_packets_ = 0;
+    bool wait_random_access_ = false;   // 入队的视频丢到下一个解码起点
+    // 溢出到磁盘
+    SpillLog *spill_ = NULL;
+    int64_t spill_memory_duration_ = 0;
+    bool spill_full_ = false;
+    // dts记录，没有dts时用pts
+    int64_t audio_front_dts_    = 0;
+    int64_t audio_back_dts_     = 0;
     int     audio_first_packet  = 1;
-    int64_t video_front_pts_    = 0;
-    int64_t video_back_pts_     = 0;
+    int64_t video_front_dts_    = 0;
+    int64_t video_back_dts_     = 0;
     int     video_first_packet  = 1;
 };
 
@@ -2,6 +2,7 @@
 #include "pushwork.h"
 #include "dlog.h"
 #include "avpublishtime.h"
+#include "timesutil.h"
 
 PushWork:: PushWork(MessageQueue *msg_queue):
     msg_queue_(msg_queue)
@@ -20,10 +21,28 @@ PushWork::~PushWork()
         delete video_capturer_;
     }
 
+    // 再停掉发送线程: 码率自适应和IDR请求会回调到编码器，必须在编码器释放之前退出
+    for(size_t i = 0; i < dest_pushers_.size(); i++) {
+        delete dest_pushers_[i];
+    }
+
+    for(size_t i = 0; i < dest_rtp_pushers_.size(); i++) {
+        delete dest_rtp_pushers_[i];
+    }
+
+    if(rtsp_pusher_) {
+        delete rtsp_pusher_;
+        rtsp_pusher_ = NULL;
+    }
+
     if(audio_encoder_) {
         delete audio_encoder_;
     }
 
+    if(silence_detector_) {
+        delete silence_detector_;
+    }
+
     if(fltp_buf_) {
         av_free(fltp_buf_);
     }
@@ -32,20 +51,40 @@ PushWork::~PushWork()
         av_frame_free(&audio_frame_);
     }
 
-    if(pcm_s16le_fp_) {
-        fclose(pcm_s16le_fp_);
+    if(dump_writer_) {
+        delete dump_writer_;    // 写完剩余的dump数据
     }
 
-    if(aac_fp_) {
-        fclose(aac_fp_);
+    {
+        std::lock_guard<std::mutex> lock(video_mutex_);
+        if(video_encoder_) {
+            delete video_encoder_;
+            video_encoder_ = NULL;
+        }
     }
 
-    if(video_encoder_) {
-        delete video_encoder_;
+    if(sws_ctx_) {
+        sws_freeContext(sws_ctx_);
     }
 
-    if(rtsp_pusher_) {
-        delete rtsp_pusher_;
+    if(region_detector_) {
+        delete region_detector_;
+    }
+
+    if(scaled_frame_) {
+        av_frame_free(&scaled_frame_);
+    }
+
+    if(recorder_) {
+        delete recorder_;
+    }
+
+    if(dvr_) {
+        delete dvr_;
+    }
+
+    for(size_t i = 0; i < dest_recorders_.size(); i++) {
+        delete dest_recorders_[i];
     }
     LogInfo("~PushWork()");
 }
@@ -69,32 +108,64 @@ RET_CODE PushWork::Init(const Properties &properties)
     audio_bitrate_      =  properties.GetProperty("audio_bitrate",  128*1024);
     audio_channels_     =  properties.GetProperty("audio_channels", 2);
     audio_ch_layout_    =  av_get_default_channel_layout(audio_channels_);
+    audio_codec_        =  properties.GetProperty("audio_codec", "aac");
+    opus_frame_duration_ = properties.GetProperty("opus_frame_duration", "10");
+    audio_dtx_          =  properties.GetProperty("audio_dtx", 0);
+    audio_silence_detect_    = properties.GetProperty("audio_silence_detect", 0);
+    audio_silence_threshold_ = properties.GetProperty("audio_silence_threshold", -60);
+    audio_silence_hangover_  = properties.GetProperty("audio_silence_hangover", 500);
 
     // 初始化publish time
     AVPublishTime::GetInstance()->Rest();
 
-    // 初始化AAC音频编码器，如果失败则记录错误并返回
-    audio_encoder_ = new AACEncoder();
+    // 初始化音频编码器，如果失败则记录错误并返回
+    if(audio_codec_ == "opus") {
+        audio_encoder_ = new OpusEncoder();
+    } else {
+        audio_encoder_ = new AACEncoder();
+    }
     if(!audio_encoder_){
-        LogError("new AACEncoder() failed");
+        LogError("new AudioEncoder() failed");
         return RET_FAIL;        
     }
 
     // 使用设置的属性初始化音频编码器，如果失败则记录错误并返回
     // 需要什么样的采样格式是从编码器读取出来的
     Properties aud_codec_properties;
-    aud_codec_properties.SetProperty("audio_sample_rate",audio_sample_rate_);
-    aud_codec_properties.SetProperty("audio_bitrate",audio_bitrate_);
-    aud_codec_properties.SetProperty("audio_channels",audio_channels_);
+    aud_codec_properties.SetProperty("sample_rate",audio_sample_rate_);
+    aud_codec_properties.SetProperty("bitrate",audio_bitrate_);
+    aud_codec_properties.SetProperty("channels",audio_channels_);
+    aud_codec_properties.SetProperty("frame_duration",opus_frame_duration_);
+    aud_codec_properties.SetProperty("dtx",audio_dtx_);
 
     if(audio_encoder_->Init(aud_codec_properties) != RET_OK) {
-        LogError("AACEncoder  Init failed");
+        LogError("%s encoder Init failed", audio_codec_.c_str());
+        return RET_FAIL;
+    }
+    // pts按编码器的帧长做修正
+    AVPublishTime::GetInstance()->set_audio_frame_duration(audio_encoder_->GetFrameDuration());
+
+    // 静音检测, 编码器不支持DTX时需要预先准备静音包
+    if(audio_silence_detect_) {
+        silence_detector_ = new SilenceDetector();
+        Properties silence_properties;
+        silence_properties.SetProperty("threshold", audio_silence_threshold_);
+        silence_properties.SetProperty("hangover", audio_silence_hangover_);
+        silence_properties.SetProperty("frame_duration", std::to_string(audio_encoder_->GetFrameDuration()));
+        if(silence_detector_->Init(silence_properties) != RET_OK) {
+            LogError("SilenceDetector Init failed");
+            return RET_FAIL;
+        }
+        if(!audio_encoder_->IsDtx() && audio_encoder_->PrepareSilencePacket() != RET_OK) {
+            LogError("PrepareSilencePacket failed");
+            return RET_FAIL;
+        }
     }
 
     // 音频重采样和帧配置
     int frame_bytes2 = 0;
-    // 默认读取出来的数据是s16的，编码器需要的是fltp, 需要做重采样
-    // 手动把s16转成fltp
+    // 默认读取出来的数据是s16的，aac编码器需要的是fltp, 需要做重采样
+    // 手动把s16转成fltp; libopus直接支持s16，不需要转换
     fltp_buf_size_ = av_samples_get_buffer_size(NULL,audio_encoder_->GetChannels(),
                                                     audio_encoder_->GetFrameSamples(),
                                                     (enum AVSampleFormat)audio_encoder_->GetFormat(),1);
@@ -145,10 +216,15 @@ RET_CODE PushWork::Init(const Properties &properties)
     video_fps_ = properties.GetProperty("video_fps", desktop_fps_);             // 帧率
     video_gop_ = properties.GetProperty("video_gop", video_fps_);
     video_bitrate_ = properties.GetProperty("video_bitrate", 1024*1024);   // 先默认1M fixedme
-    video_b_frames_ = properties.GetProperty("video_b_frames", 0);   // b帧数量
+    video_b_frames_ = properties.GetProperty("video_b_frames", 0);   // b帧数量，同样画质码率更低，但增加延迟，适合非交互的流
+    video_codec_ = properties.GetProperty("video_codec", "h264");   // h265同样码率下画质更好，编码更耗cpu
+    if(video_codec_ != "h264" && video_codec_ != "h265") {
+        LogError("video_codec:%s, use h264 or h265", video_codec_.c_str());
+        return RET_ERR_NOT_SUPPORT;
+    }
 
     // 初始化视频编码器
-    video_encoder_ = new H264Encoder();
+    video_encoder_ = createVideoEncoder();
     Properties  vid_codec_properties;
     vid_codec_properties.SetProperty("width", video_width_);
     vid_codec_properties.SetProperty("height", video_height_);
@@ -156,31 +232,265 @@ RET_CODE PushWork::Init(const Properties &properties)
     vid_codec_properties.SetProperty("b_frames", video_b_frames_);
     vid_codec_properties.SetProperty("bitrate", video_bitrate_);    // 码率
     vid_codec_properties.SetProperty("gop", video_gop_);            // gop
+    vid_codec_properties.SetProperty("time_base", 1000);            // pts单位是ms，可变帧率时码控按真实的帧间隔
+    // 线程和x264参数, 没有设置时使用编码器的缺省值
+    const char *video_keys[][2] = {
+        {"video_threads",        "threads"},
+        {"video_thread_type",    "thread_type"},
+        {"video_sliced_threads", "sliced_threads"},
+        {"video_rc_lookahead",   "rc_lookahead"},
+        {"video_preset",         "preset"},
+        {"video_tune",           "tune"},
+        {"video_profile",        "profile"},
+        {"video_x264_params",    "x264_params"},
+        {"video_x265_params",    "x265_params"},
+        {"video_vbv",            "vbv"},
+        {"video_intra_refresh",  "intra_refresh"},
+        {"video_temporal_layers", "temporal_layers"},
+    };
+    for(size_t i = 0; i < sizeof(video_keys) / sizeof(video_keys[0]); i++) {
+        if(properties.HasProperty(video_keys[i][0])) {
+            vid_codec_properties.SetProperty(video_keys[i][1], properties.GetProperty(video_keys[i][0]));
+        }
+    }
+    // 码率自适应时默认1秒的VBV，否则码率调整要很久才能体现出来; intra-refresh由编码器按一帧设置
+    abr_enable_ = properties.GetProperty("abr_enable", false);
+    video_intra_refresh_ = properties.GetProperty("video_intra_refresh", false);
+    if(abr_enable_ && !video_intra_refresh_) {
+        vid_codec_properties.SetProperty("vbv", 1000);
+    }
+    if(abr_enable_ && video_codec_ == "h265") {
+        LogWarn("libx265 reopens on every bitrate change, each change costs an IDR");
+    }
     if(video_encoder_->Init(vid_codec_properties) != RET_OK)
     {
-        LogError("H264Encoder Init failed");
+        LogError("%s encoder Init failed", video_codec_.c_str());
         return RET_FAIL;
     }
+    vid_codec_properties_ = vid_codec_properties;  // 切换档位时在此基础上修改宽高、帧率和码率
+
+    // ROI: 调用者指定的区域，以及自动检测的变化区域(活动窗口、光标附近)
+    roi_qoffset_ = (float)atof(properties.GetProperty("video_roi_qoffset", "-0.3"));
+    if(properties.HasProperty("video_roi")
+            && !parseRegions(properties.GetProperty("video_roi"), roi_qoffset_, &roi_regions_)) {
+        LogError("video_roi:%s, use x,y,w,h[,qoffset];...", properties.GetProperty("video_roi"));
+        return RET_ERR_NOT_SUPPORT;
+    }
+    // 静止画面跳过编码，桌面大部分时间不变
+    roi_auto_ = properties.GetProperty("video_roi_auto", false);
+    skip_static_ = properties.GetProperty("video_skip_static", false);
+    keepalive_interval_ = properties.GetProperty("video_keepalive_interval", 1000);
+    // 可变帧率: 只在内容变化时出帧，两帧间隔在[min_interval, max_interval]之间，pts用真实时间
+    video_vfr_ = properties.GetProperty("video_vfr", false);
+    if(video_vfr_) {
+        skip_static_ = true;
+        keepalive_interval_ = properties.GetProperty("video_vfr_max_interval", 1000);
+        vfr_min_interval_ = properties.GetProperty("video_vfr_min_interval", 0);
+        if(vfr_min_interval_ < 0 || keepalive_interval_ <= vfr_min_interval_) {
+            LogError("video_vfr_min_interval:%d, video_vfr_max_interval:%d",
+                     vfr_min_interval_, keepalive_interval_);
+            return RET_ERR_ARGUMENTOUTOFRANGE;
+        }
+        // PTS_RECTIFY会把半帧以内的间隔拉回固定帧间隔
+        AVPublishTime::GetInstance()->set_video_pts_strategy(AVPublishTime::PTS_REAL_TIME);
+    }
+    if(roi_auto_ || skip_static_) {
+        region_detector_ = new RegionDetector();
+        Properties region_properties;
+        region_properties.SetProperty("width", desktop_width_);
+        region_properties.SetProperty("height", desktop_height_);
+        region_properties.SetProperty("format", desktop_format_);
+        region_properties.SetProperty("qoffset", properties.GetProperty("video_roi_qoffset", "-0.3"));
+        region_properties.SetProperty("hold_frames", properties.GetProperty("video_roi_hold_frames", video_fps_));
+        if(region_detector_->Init(region_properties) != RET_OK) {
+            LogError("RegionDetector Init failed");
+            return RET_FAIL;
+        }
+    }
+    video_cur_fps_ = video_fps_;
+    video_cur_gop_ = video_gop_ > 0 ? video_gop_ : 1;
+
+    /*================================dump===============================================*/
+    // 每路dump单独打开，缺省都不dump; 数据拷贝到缓冲区后由dump线程写文件，磁盘慢时丢掉dump数据
+    bool dump_pcm   = properties.GetProperty("dump_pcm", false);
+    bool dump_audio = properties.GetProperty("dump_audio", false);
+    bool dump_video = properties.GetProperty("dump_video", false);
+    if(dump_pcm || dump_audio || dump_video) {
+        std::string dump_dir = properties.GetProperty("dump_dir", ".");
+        dump_writer_ = new DumpWriter();
+        Properties dump_properties;
+        const char *dump_keys[][2] = {
+            {"dump_buffer_size",    "buffer_size"},
+            {"dump_buffers",        "buffers"},
+            {"dump_flush_interval", "flush_interval"},
+            {"dump_direct_io",      "direct_io"},
+        };
+        for(size_t i = 0; i < sizeof(dump_keys) / sizeof(dump_keys[0]); i++) {
+            if(properties.HasProperty(dump_keys[i][0])) {
+                dump_properties.SetProperty(dump_keys[i][1], properties.GetProperty(dump_keys[i][0]));
+            }
+        }
+        if(dump_writer_->Init(dump_properties) != RET_OK) {
+            LogError("DumpWriter Init failed");
+            return RET_FAIL;
+        }
+        if(dump_pcm) {
+            pcm_dump_ = dump_writer_->Open(dump_dir + "/push_dump_s16le.pcm");
+        }
+        if(dump_audio && audio_encoder_->GetCodecId() == AV_CODEC_ID_AAC) {
+            aac_dump_ = dump_writer_->Open(dump_dir + "/push_dump.aac");
+        }
+        if(dump_video) {
+            video_dump_ = dump_writer_->Open(dump_dir + "/push_dump." + video_codec_);
+        }
+        if(dump_writer_->Start() != RET_OK) {
+            LogError("DumpWriter Start failed");
+            return RET_FAIL;
+        }
+    }
+
+    /*================================record=============================================*/
+    // 本地录制分片mp4，record_file为空时不录制; 编码包只增加引用，写文件在录制线程
+    std::string record_file = properties.GetProperty("record_file", "");
+    if(!record_file.empty()) {
+        Properties record_properties;
+        record_properties.SetProperty("file_name", record_file);
+        const char *record_keys[][2] = {
+            {"record_max_queue_duration",   "max_queue_duration"},
+            {"record_frag_duration",        "frag_duration"},
+        };
+        for(size_t i = 0; i < sizeof(record_keys) / sizeof(record_keys[0]); i++) {
+            if(properties.HasProperty(record_keys[i][0])) {
+                record_properties.SetProperty(record_keys[i][1], properties.GetProperty(record_keys[i][0]));
+            }
+        }
+        recorder_ = createRecorder(record_properties);
+        if(!recorder_) {
+            return RET_FAIL;
+        }
+    }
+
+    /*================================dvr================================================*/
+    // 时移环，dvr_dir为空时不打开; 段文件预分配，编码包拷贝到缓冲区后由dvr线程写
+    std::string dvr_dir = properties.GetProperty("dvr_dir", "");
+    if(!dvr_dir.empty()) {
+        dvr_ = new DvrRing();
+        Properties dvr_properties;
+        dvr_properties.SetProperty("dir", dvr_dir);
+        const char *dvr_keys[][2] = {
+            {"dvr_segments",            "segments"},
+            {"dvr_segment_size",        "segment_size"},
+            {"dvr_segment_duration",    "segment_duration"},
+            {"dvr_buffer_size",         "buffer_size"},
+            {"dvr_buffers",             "buffers"},
+        };
+        for(size_t i = 0; i < sizeof(dvr_keys) / sizeof(dvr_keys[0]); i++) {
+            if(properties.HasProperty(dvr_keys[i][0])) {
+                dvr_properties.SetProperty(dvr_keys[i][1], properties.GetProperty(dvr_keys[i][0]));
+            }
+        }
+        if(dvr_->Init(dvr_properties) != RET_OK
+                || dvr_->ConfigAudioStream(audio_encoder_->get_codec_context()) != RET_OK
+                || dvr_->ConfigVideoStream(video_encoder_->get_codec_context()) != RET_OK
+                || dvr_->Start() != RET_OK) {
+            LogError("DvrRing init failed");
+            return RET_FAIL;
+        }
+    }
 
     /*================================rtsp===============================================*/
     rtsp_url_                   = properties.GetProperty("rtsp_url", "");
     rtsp_transport_             = properties.GetProperty("rtsp_transport", "");
     rtsp_timeout_               = properties.GetProperty("rtsp_timeout",5000);
     rtsp_max_queue_duration_    = properties.GetProperty("rtsp_max_queue_duration",1000);
+    drain_timeout_              = properties.GetProperty("drain_timeout",1000);
     rtsp_pusher_                = new RtspPusher(msg_queue_);
     Properties rtsp_properties;
     rtsp_properties.SetProperty("rtsp_url",rtsp_url_);
     rtsp_properties.SetProperty("rtsp_transport",rtsp_transport_);
     rtsp_properties.SetProperty("rtsp_timeout",rtsp_timeout_);
-     rtsp_properties.SetProperty("max_queue_duration", rtsp_max_queue_duration_);
+    rtsp_properties.SetProperty("rtsp_max_queue_duration", rtsp_max_queue_duration_);
+    if(skip_static_) {
+        rtsp_properties.SetProperty("video_max_interval", keepalive_interval_);
+    }
+    rtsp_properties.SetProperty("intra_refresh", video_intra_refresh_ ? 1 : 0);
+    rtsp_properties.SetProperty("temporal_layers", video_encoder_->GetTemporalLayers());
+    rtsp_properties.SetProperty("keyframe_request_interval",
+                                properties.GetProperty("keyframe_request_interval", 1000));
+    // 按dts交织音视频，只有一路有包时最多等多少ms，0为不交织
+    rtsp_properties.SetProperty("interleave_max_hold", properties.GetProperty("rtsp_interleave_max_hold", 0));
+    // 溢出模式: 断流时积压写到磁盘而不是丢掉，适合需要完整录制的流
+    const char *spill_keys[][2] = {
+        {"rtsp_spill_file",             "spill_file"},
+        {"rtsp_spill_max_size",         "spill_max_size"},
+        {"rtsp_spill_memory_duration",  "spill_memory_duration"},
+        {"rtsp_spill_catchup_rate",     "spill_catchup_rate"},
+    };
+    for(size_t i = 0; i < sizeof(spill_keys) / sizeof(spill_keys[0]); i++) {
+        if(properties.HasProperty(spill_keys[i][0])) {
+            rtsp_properties.SetProperty(spill_keys[i][1], properties.GetProperty(spill_keys[i][0]));
+        }
+    }
+    // 发送节奏，只在rtsp_transport为udp时生效，平滑关键帧的突发
+    const char *pacing_keys[][2] = {
+        {"rtsp_pacing",                 "pacing"},
+        {"rtsp_pacing_headroom",        "pacing_headroom"},
+        {"rtsp_pacing_burst",           "pacing_burst"},
+        {"rtsp_pacing_frame_fraction",  "pacing_frame_fraction"},
+    };
+    for(size_t i = 0; i < sizeof(pacing_keys) / sizeof(pacing_keys[0]); i++) {
+        if(properties.HasProperty(pacing_keys[i][0])) {
+            rtsp_properties.SetProperty(pacing_keys[i][1], properties.GetProperty(pacing_keys[i][0]));
+        }
+    }
+    // 断线重连，rtsp_reconnect为0时发送失败后不再重连
+    const char *reconnect_keys[][2] = {
+        {"rtsp_reconnect",              "reconnect"},
+        {"rtsp_reconnect_min_delay",    "reconnect_min_delay"},
+        {"rtsp_reconnect_max_delay",    "reconnect_max_delay"},
+        {"rtsp_reconnect_max_attempts", "reconnect_max_attempts"},
+    };
+    for(size_t i = 0; i < sizeof(reconnect_keys) / sizeof(reconnect_keys[0]); i++) {
+        if(properties.HasProperty(reconnect_keys[i][0])) {
+            rtsp_properties.SetProperty(reconnect_keys[i][1], properties.GetProperty(reconnect_keys[i][0]));
+        }
+    }
     if(audio_encoder_) {
-        rtsp_properties.SetProperty("audio_frame_duration",
-                                    audio_encoder_->GetFrameSamples()*1000/audio_encoder_->GetFrameSampleRate());
+        rtsp_properties.SetProperty("audio_frame_duration", std::to_string(audio_encoder_->GetFrameDuration()));
     }
     if(video_encoder_) {
         rtsp_properties.SetProperty("video_frame_duration",
                                     1000/video_encoder_->GetFps());
     }
+    // 备用目的地共用这些参数，不做码率自适应
+    Properties dest_properties = rtsp_properties;
+    if(abr_enable_) {
+        rtsp_properties.SetProperty("abr_enable", 1);
+        rtsp_properties.SetProperty("abr_start_bitrate", video_bitrate_);
+        rtsp_properties.SetProperty("abr_min_bitrate", properties.GetProperty("abr_min_bitrate", video_bitrate_/4));
+        rtsp_properties.SetProperty("abr_max_bitrate", properties.GetProperty("abr_max_bitrate", video_bitrate_));
+        const char *abr_keys[] = {"abr_high_water", "abr_low_water", "abr_growth_threshold",
+                                  "abr_decrease_percent", "abr_increase_percent",
+                                  "abr_hold_time", "abr_interval"};
+        for(size_t i = 0; i < sizeof(abr_keys) / sizeof(abr_keys[0]); i++) {
+            if(properties.HasProperty(abr_keys[i])) {
+                rtsp_properties.SetProperty(abr_keys[i], properties.GetProperty(abr_keys[i]));
+            }
+        }
+        // 降级阶梯，比如"1280x720@30,1280x720@15,854x480@15,audio"
+        if(properties.HasProperty("video_ladder")) {
+            rtsp_properties.SetProperty("video_ladder", properties.GetProperty("video_ladder"));
+            rtsp_properties.SetProperty("video_width", video_width_);
+            rtsp_properties.SetProperty("video_height", video_height_);
+            rtsp_properties.SetProperty("video_fps", video_fps_);
+            const char *ladder_keys[] = {"ladder_down_time", "ladder_up_time"};
+            for(size_t i = 0; i < sizeof(ladder_keys) / sizeof(ladder_keys[0]); i++) {
+                if(properties.HasProperty(ladder_keys[i])) {
+                    rtsp_properties.SetProperty(ladder_keys[i], properties.GetProperty(ladder_keys[i]));
+                }
+            }
+        }
+    }
     if(rtsp_pusher_->Init(rtsp_properties) != RET_OK)
     {
         LogError("rtsp_pusher_ Init failed");
@@ -199,11 +509,55 @@ RET_CODE PushWork::Init(const Properties &properties)
             return RET_FAIL;
         }
     }
+    if(abr_enable_ && video_encoder_) {
+        // 在发送线程回调，编码器在编码线程送下一帧前生效
+        rtsp_pusher_->AddBitrateCallback(std::bind(&PushWork::onBitrateChange, this,
+                                                   std::placeholders::_1));
+        rtsp_pusher_->AddLadderCallback(std::bind(&PushWork::onLadderChange, this,
+                                                  std::placeholders::_1));
+    }
+    rtsp_pusher_->AddKeyframeCallback(std::bind(&PushWork::onKeyframeRequest, this));
     if(rtsp_pusher_->Connect() != RET_OK) {
         LogError("rtsp_pusher Connect() failed");
         return RET_FAIL;
     }
 
+    /*================================destinations=======================================*/
+    // 同一份编码输出扇出到多个目的地，比如destinations.0.url为备用服务器、destinations.1.type为mp4
+    // 备用目的地连不上时只告警，不影响主目的地
+    std::vector<Properties> destinations;
+    properties.GetChildrenArray("destinations", destinations);
+    for(size_t i = 0; i < destinations.size(); i++) {
+        std::string type = destinations[i].GetProperty("type", "rtsp");
+        if(type == "mp4") {
+            Mp4Recorder *recorder = createRecorder(destinations[i]);
+            if(!recorder) {
+                LogWarn("destination %d: mp4 %s failed, skip it", (int)i,
+                        destinations[i].GetProperty("file_name", ""));
+                continue;
+            }
+            dest_recorders_.push_back(recorder);
+        } else if(type == "rtsp") {
+            RtspPusher *pusher = createDestination(destinations[i], dest_properties);
+            if(!pusher) {
+                LogWarn("destination %d: %s failed, skip it", (int)i,
+                        destinations[i].GetProperty("url", ""));
+                continue;
+            }
+            dest_pushers_.push_back(pusher);
+        } else if(type == "rtp") {
+            RtpPusher *pusher = createRtpDestination(destinations[i]);
+            if(!pusher) {
+                LogWarn("destination %d: rtp %s failed, skip it", (int)i,
+                        destinations[i].GetProperty("url", ""));
+                continue;
+            }
+            dest_rtp_pushers_.push_back(pusher);
+        } else {
+            LogWarn("destination %d: unknown type:%s", (int)i, type.c_str());
+        }
+    }
+
     /*================================start===============================================*/
 
     // 设置音频捕获
@@ -211,9 +565,10 @@ RET_CODE PushWork::Init(const Properties &properties)
     Properties aud_cap_properties;
     aud_cap_properties.SetProperty("audio_test",1);
     aud_cap_properties.SetProperty("input_pcm_name",input_pcm_name_);
-    aud_cap_properties.SetProperty("sample_rate",48000);
-    aud_cap_properties.SetProperty("nb_samples",1024);
-    aud_cap_properties.SetProperty("channels",2);
+    // 按编码器的采样率、通道数和帧长采集，s16
+    aud_cap_properties.SetProperty("sample_rate",audio_encoder_->GetFrameSampleRate());
+    aud_cap_properties.SetProperty("nb_samples",audio_encoder_->GetFrameSamples());
+    aud_cap_properties.SetProperty("channels",audio_encoder_->GetChannels());
     if(audio_capturer_->Init(aud_cap_properties) != RET_OK) {
         LogError("AudioCapturer Init failed");
         return RET_FAIL;
@@ -243,8 +598,7 @@ RET_CODE PushWork::Init(const Properties &properties)
         return RET_FAIL;
     }
 
-    video_capturer_->AddCallback(std::bind(&PushWork::YuvCallback,this,std::placeholders::_1,
-                                                                        std::placeholders::_2));
+    video_capturer_->AddFrameCallback(std::bind(&PushWork::YuvCallback,this,std::placeholders::_1));
 
     if(video_capturer_->Start() != RET_OK) {
         LogError("VideoCapturer Start failed");
@@ -267,36 +621,166 @@ RET_CODE PushWork::DeInit()
         delete video_capturer_;
         video_capturer_ = NULL;
     }
+
+    // 采集停止后drain编码器，把缓存在编码器里面的尾部数据也推出去
+    if(rtsp_pusher_) {
+        if(audio_encoder_) {
+            audio_encoder_->Flush(std::bind(&PushWork::onAudioPacket, this, std::placeholders::_1));
+        }
+        {
+            // 发送线程的码率和IDR回调也要拿video_mutex_，drain队列之前必须释放
+            std::lock_guard<std::mutex> lock(video_mutex_);
+            if(video_encoder_) {
+                video_encoder_->Flush(std::bind(&PushWork::onVideoPacket, this, std::placeholders::_1));
+            }
+        }
+        // 各个目的地的发送线程同时在发，最多再等drain_timeout_
+        int64_t drain_start = TimesUtil::GetTimeMillisecond();
+        rtsp_pusher_->Drain(drain_timeout_);
+        for(size_t i = 0; i < dest_pushers_.size(); i++) {
+            int64_t remain = drain_timeout_ - (TimesUtil::GetTimeMillisecond() - drain_start);
+            dest_pushers_[i]->Drain(remain > 0 ? (int)remain : 0);
+        }
+    }
+    // 编码器drain出来的包也已经进了录制队列，写完后关闭文件
+    if(recorder_) {
+        recorder_->DeInit();
+    }
+    for(size_t i = 0; i < dest_recorders_.size(); i++) {
+        dest_recorders_[i]->DeInit();
+    }
+    // 线程退出前发完队列，udp发送不会阻塞
+    for(size_t i = 0; i < dest_rtp_pushers_.size(); i++) {
+        dest_rtp_pushers_[i]->DeInit();
+    }
+    if(dvr_) {
+        dvr_->DeInit();
+    }
+    // 编码器drain出来的包也已经写进dump缓冲区
+    if(dump_writer_) {
+        dump_writer_->DeInit();
+    }
+    return RET_OK;
+}
+
+RET_CODE PushWork::GetVadStats(VadStats *stats)
+{
+    if(!silence_detector_) {
+        return RET_FAIL;
+    }
+    silence_detector_->GetStats(stats);
+    return RET_OK;
+}
+
+RET_CODE PushWork::GetEncoderStats(MediaType media_type, EncoderStatsInfo *info)
+{
+    if(media_type == E_AUDIO_TYPE) {
+        if(!audio_encoder_) {
+            return RET_FAIL;
+        }
+        audio_encoder_->GetStats(info);
+        return RET_OK;
+    }
+    std::lock_guard<std::mutex> lock(video_mutex_);
+    if(!video_encoder_) {
+        return RET_FAIL;
+    }
+    video_encoder_->GetStats(info);
     return RET_OK;
 }
 
-// 将s16le（16位有符号小端格式）音频数据转换为fltp（浮点平面）格式
-void s16le_convert_to_fltp(short *s16le, float *fltp, int nb_samples)
+RET_CODE PushWork::ExportDvr(int64_t duration, const std::string &file_name)
+{
+    if(!dvr_) {
+        return RET_FAIL;
+    }
+    return dvr_->ExportTail(duration, file_name);
+}
+
+int PushWork::GetDestinationCount()
+{
+    return rtsp_pusher_ ? 1 + (int)dest_pushers_.size() : 0;
+}
+
+RET_CODE PushWork::GetDestinationStats(int index, RtspPusherStats *stats)
+{
+    if(index < 0 || index >= GetDestinationCount()) {
+        LogError("destination index:%d is out of range", index);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    RtspPusher *pusher = 0 == index ? rtsp_pusher_ : dest_pushers_[index - 1];
+    return pusher->GetStats(stats);
+}
+
+int PushWork::GetRtpDestinationCount()
+{
+    return (int)dest_rtp_pushers_.size();
+}
+
+RET_CODE PushWork::GetRtpDestinationStats(int index, RtpPusherStats *stats)
+{
+    if(index < 0 || index >= GetRtpDestinationCount()) {
+        LogError("rtp destination index:%d is out of range", index);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    return dest_rtp_pushers_[index]->GetStats(stats);
+}
+
+RET_CODE PushWork::GetRecorderStats(Mp4RecorderStats *stats)
+{
+    if(!recorder_) {
+        return RET_FAIL;
+    }
+    return recorder_->GetStats(stats);
+}
+
+RET_CODE PushWork::GetDvrStats(DvrStats *stats)
 {
-    float *fltp_l = fltp;
-    float *fltp_r = fltp + nb_samples;
+    if(!dvr_) {
+        return RET_FAIL;
+    }
+    dvr_->GetStats(stats);
+    return RET_OK;
+}
 
-    for (int i = 0; i < nb_samples; i++) {
-        fltp_l[i] = s16le[i * 2] / 32768.0;
-        fltp_r[i] = s16le[i * 2 + 1] / 32768.0;
+// 将s16le（16位有符号小端格式，通道交错）音频数据转换为fltp（浮点平面）格式，每个通道一个平面
+void s16le_convert_to_fltp(short *s16le, float *fltp, int nb_samples, int channels)
+{
+    for (int ch = 0; ch < channels; ch++) {
+        float *plane = fltp + ch * nb_samples;
+        for (int i = 0; i < nb_samples; i++) {
+            plane[i] = s16le[i * channels + ch] / 32768.0;
+        }
     }
 }
 
 void PushWork::PcmCallback(uint8_t *pcm, int32_t size)
 {
     int ret = 0;
-    // 1 写入PCM数据到文件
-    if (!pcm_s16le_fp_) {
-        pcm_s16le_fp_ = fopen("push_dump_s16le.pcm", "wb");
+    // 1 写入PCM数据到dump缓冲区
+    if (pcm_dump_ >= 0) {
+        dump_writer_->Write(pcm_dump_, pcm, size);
     }
 
-    if (pcm_s16le_fp_) {
-        fwrite(pcm, 1, size, pcm_s16le_fp_);
-        fflush(pcm_s16le_fp_);
+    // 1.1 静音检测, 静音期间直接发送缓存的静音包, 省掉格式转换和编码
+    //     opus打开了DTX时由编码器自己处理静音
+    bool silent = false;
+    if(silence_detector_) {
+        silent = silence_detector_->Process((int16_t *)pcm, audio_frame_->nb_samples * audio_frame_->channels);
+    }
+    if(silent && !audio_encoder_->IsDtx()) {
+        if(audio_encoder_->EncodeSilence((int64_t)AVPublishTime::GetInstance()->get_audio_pts(),
+                                         std::bind(&PushWork::onAudioPacket, this, std::placeholders::_1)) == RET_OK) {
+            return;
+        }
     }
 
-    // 2 转换PCM格式
-    s16le_convert_to_fltp((short *)pcm, (float *)fltp_buf_, audio_frame_->nb_samples);
+    // 2 转换PCM格式, 编码器要s16的时候直接使用采集的数据
+    uint8_t *samples = pcm;
+    if(audio_frame_->format != AV_SAMPLE_FMT_S16) {
+        s16le_convert_to_fltp((short *)pcm, (float *)fltp_buf_, audio_frame_->nb_samples, audio_frame_->channels);
+        samples = fltp_buf_;
+    }
 
     // 3 准备音频帧
     if(av_frame_make_writable(audio_frame_) != 0) {
@@ -306,7 +790,7 @@ void PushWork::PcmCallback(uint8_t *pcm, int32_t size)
 
     ret = av_samples_fill_arrays(audio_frame_->data,
                                 audio_frame_->linesize,
-                                fltp_buf_,
+                                samples,
                                 audio_frame_->channels,
                                 audio_frame_->nb_samples,
                                 (enum AVSampleFormat)audio_frame_->format,
@@ -316,83 +800,504 @@ void PushWork::PcmCallback(uint8_t *pcm, int32_t size)
         return;
     }
 
-    // 4 音频编码
+    // 4 音频编码, 编码器能输出的包全部取出来
     int64_t pts = (int64_t)AVPublishTime::GetInstance()->get_audio_pts();
-    int ptk_frame = 0;
-    RET_CODE encode_ret = RET_OK;
-    AVPacket *packet = audio_encoder_->Encode(audio_frame_, pts, 0, &ptk_frame, &encode_ret);
-    if(encode_ret == RET_OK && packet) {
-        // 5 写入AAC数据到文件
-        // 5.1初始化文件指针，用于写入AAC数据
-        if(!aac_fp_) {
-            aac_fp_ = fopen("push_dump.aac", "wb");
-            if(!aac_fp_) {
-                LogError("fopen push_dump.aac failed");
-                return;
-            }
+    RET_CODE encode_ret = audio_encoder_->Encode(audio_frame_, pts,
+                                                 std::bind(&PushWork::onAudioPacket, this, std::placeholders::_1));
+    if(encode_ret != RET_OK) {
+        LogError("audio Encode failed:%d", encode_ret);
+    }
+}
+
+void PushWork::onAudioPacket(AVPacket *packet)
+{
+    // 5 写入AAC数据到dump缓冲区，ADTS头和数据一起写入或者一起丢掉
+    if(aac_dump_ >= 0) {
+        uint8_t adts_header[7];
+        if (((AACEncoder *)audio_encoder_)->GetAdtsHeader(adts_header,packet->size) == RET_OK) {
+            dump_writer_->Write(aac_dump_, adts_header, sizeof(adts_header), packet->data, packet->size);
+        } else {
+            LogError("GetAdtsHeader failed");
+        }
+    }
+
+    // 6 录制只增加引用，时移环拷贝到缓冲区，然后推送
+    // LogInfo("PcmCallback packet->pts:%ld", packet->pts);
+    dispatchPacket(packet, E_AUDIO_TYPE);
+}
+
+void PushWork::YuvCallback(AVFrame *frame)
+{
+    std::lock_guard<std::mutex> lock(video_mutex_);
+    // 步骤1: 有待切换的档位时在GOP边界切换，只推音频时直接切换
+    if(ladder_pending_ && (!video_encoder_ || video_frame_count_ % video_cur_gop_ == 0)) {
+        switchVideoStep();
+    }
+    if(!video_encoder_) {
+        return;     // 只推音频
+    }
+
+    // 步骤1.1: 降帧率，按采集帧率均匀抽帧
+    if(video_cur_fps_ < video_fps_) {
+        video_fps_acc_ += video_cur_fps_;
+        if(video_fps_acc_ < video_fps_) {
+            return;
         }
+        video_fps_acc_ -= video_fps_;
+    }
 
-        if(aac_fp_) {
-            uint8_t adts_header[7];
-            if (audio_encoder_->GetAdtsHeader(adts_header,packet->size) != RET_OK) {
-                LogError("GetAdtsHeader failed");
-                return;
+    // 步骤1.2: 和上一帧比较，得到变化区域
+    std::vector<VideoRegion> detected;
+    bool changed = true;
+    if(region_detector_) {
+        changed = region_detector_->Detect(frame, &detected);
+        if(!roi_auto_) {
+            detected.clear();
+        }
+    }
+
+    // 步骤1.3: 画面没有变化时跳过编码，只按保活间隔送帧; 有IDR请求时照常编码
+    //        可变帧率时变化的帧也要离上一帧至少vfr_min_interval_，期间的变化记下来，到时间再编码
+    if(skip_static_) {
+        int64_t now = AVPublishTime::GetInstance()->getCurrenTime();
+        if(changed) {
+            video_dirty_ = true;
+        }
+        int64_t elapsed = now - last_encode_time_;
+        bool due = last_encode_time_ < 0 || elapsed >= keepalive_interval_
+                || video_encoder_->IsKeyframePending();
+        if(!due && !(video_dirty_ && elapsed >= vfr_min_interval_)) {
+            if(!video_dirty_ && static_skipped_++ == 0) {
+                LogInfo("video static, skip encoding");
             }
-            fwrite(adts_header, 1, sizeof(adts_header), aac_fp_);
-            fwrite(packet->data, 1, packet->size, aac_fp_);
-            fflush(aac_fp_);
+            return;
         }
+        if(video_dirty_ && static_skipped_ > 0) {
+            LogInfo("video changed after %lld skipped frames, blocks:%d",
+                    static_skipped_, region_detector_->GetChangedBlocks());
+            static_skipped_ = 0;
+        }
+        video_dirty_ = false;
+        last_encode_time_ = now;
     }
 
-    // 6 处理结束与日志记录
-    // LogInfo("PcmCallback pts:%ld", pts);
-    if(packet) {
-        // LogInfo("PcmCallback packet->pts:%ld", packet->pts);
-        // av_packet_free(&packet);
-        rtsp_pusher_->Push(packet,E_AUDIO_TYPE);
-    } else {
-        LogInfo("packet is null");
+    // 步骤1.4: ROI区域换算到编码分辨率
+    if(!detected.empty() || !roi_regions_.empty()) {
+        updateRegions(frame, detected);
+    } else if(roi_auto_) {
+        video_encoder_->SetRegionsOfInterest(detected);     // 变化停止后取消ROI
+    }
+
+    // 步骤1.5: 获取当前视频的演示时间戳（PTS）
+    frame->pts = (int64_t)AVPublishTime::GetInstance()->get_video_pts();
+
+    // 步骤1.6: 采集分辨率和编码分辨率不一致时先缩放
+    AVFrame *encode_frame = frame;
+    if(scaleFrame(frame, &encode_frame) != RET_OK) {
+        return;
     }
 
+    // 步骤2: 采集的帧直接送编码器，不拷贝; 编码器能输出的包全部取出来
+    RET_CODE encode_ret = video_encoder_->Encode(encode_frame,
+                                                 std::bind(&PushWork::onVideoPacket, this, std::placeholders::_1));
+    if(encode_ret != RET_OK) {
+        LogError("video Encode failed:%d", encode_ret);
+    }
+    video_frame_count_++;
 }
 
-void PushWork::YuvCallback(uint8_t *yuv, int32_t size)
+// 发送线程回调
+void PushWork::onBitrateChange(int bitrate)
 {
-    
-    // 步骤1.1: 获取当前音频的演示时间戳（PTS）
-    int64_t pts = (int64_t)AVPublishTime::GetInstance()->get_video_pts();
-    // 步骤2.1: 初始化编码过程中需要的变量
-    int pkt_frame = 0;
-    RET_CODE encode_ret = RET_OK;
-    // 步骤2.2: 将YUV格式的数据编码为视频编码包
-    AVPacket *packet =video_encoder_->Encode(yuv,size,pts,&pkt_frame,&encode_ret);    
-    if(packet){     // 步骤3.1: 检查编码后的数据包是否存在
-        // 步骤3.2: 如果文件指针为空，打开文件并写入SPS和PPS数据
-        if(!h264_fp_) {
-            h264_fp_ = fopen("push_dump.h264", "wb");
-            if(!h264_fp_) {
-                LogError("fopen push_dump.aac failed");
-                return;
-            }
+    std::lock_guard<std::mutex> lock(video_mutex_);
+    if(video_encoder_) {
+        video_encoder_->SetBitrate(bitrate);
+    }
+    // rtp目的地的发送节奏跟随主目的地的码率
+    for(size_t i = 0; i < dest_rtp_pushers_.size(); i++) {
+        dest_rtp_pushers_[i]->SetBitrate(bitrate);
+    }
+}
+
+// 发送线程回调
+void PushWork::onKeyframeRequest()
+{
+    std::lock_guard<std::mutex> lock(video_mutex_);
+    if(video_encoder_) {
+        video_encoder_->RequestKeyframe();
+    }
+}
+
+// 发送线程回调，只记录，由采集线程在GOP边界切换
+void PushWork::onLadderChange(const VideoLadderStep &step)
+{
+    std::lock_guard<std::mutex> lock(video_mutex_);
+    ladder_step_ = step;
+    ladder_pending_ = true;
+}
+
+Mp4Recorder *PushWork::createRecorder(Properties record_properties)
+{
+    record_properties.SetProperty("audio_frame_duration", std::to_string(audio_encoder_->GetFrameDuration()));
+    record_properties.SetProperty("video_frame_duration", 1000/video_encoder_->GetFps());
+    if(skip_static_) {
+        record_properties.SetProperty("video_max_interval", keepalive_interval_);
+    }
+    record_properties.SetProperty("intra_refresh", video_intra_refresh_ ? 1 : 0);
+    Mp4Recorder *recorder = new Mp4Recorder();
+    if(recorder->Init(record_properties) != RET_OK
+            || recorder->ConfigAudioStream(audio_encoder_->get_codec_context()) != RET_OK
+            || recorder->ConfigVideoStream(video_encoder_->get_codec_context()) != RET_OK
+            || recorder->Open() != RET_OK) {
+        LogError("Mp4Recorder init failed");
+        delete recorder;
+        return NULL;
+    }
+    return recorder;
+}
+
+RtspPusher *PushWork::createDestination(const Properties &destination, Properties rtsp_properties)
+{
+    // 1. 溢出文件不能和主目的地共用，没有单独设置时不溢出
+    const char *dest_keys[][2] = {
+        {"url",                     "rtsp_url"},
+        {"transport",               "rtsp_transport"},
+        {"timeout",                 "rtsp_timeout"},
+        {"max_queue_duration",      "rtsp_max_queue_duration"},
+        {"interleave_max_hold",     "interleave_max_hold"},
+        {"spill_file",              "spill_file"},
+        {"spill_max_size",          "spill_max_size"},
+        {"spill_memory_duration",   "spill_memory_duration"},
+        {"spill_catchup_rate",      "spill_catchup_rate"},
+    };
+    rtsp_properties.erase("spill_file");
+    for(size_t i = 0; i < sizeof(dest_keys) / sizeof(dest_keys[0]); i++) {
+        if(destination.HasProperty(dest_keys[i][0])) {
+            rtsp_properties.erase(dest_keys[i][1]);
+            rtsp_properties.SetProperty(dest_keys[i][1], destination.GetProperty(dest_keys[i][0]));
+        }
+    }
+    if(rtsp_properties.GetProperty("rtsp_url", "") == rtsp_url_) {
+        LogError("destination url is the same as rtsp_url");
+        return NULL;
+    }
+
+    // 2. 和主目的地一样配置音视频流
+    //    只有主目的地驱动编码器出IDR，备用目的地丢包后从自己队列里的下一个解码起点继续，
+    //    慢的备用目的地不会让所有目的地都插IDR、码率跟着冲高
+    RtspPusher *pusher = new RtspPusher(msg_queue_);
+    if(pusher->Init(rtsp_properties) != RET_OK
+            || (audio_encoder_ && pusher->ConfigAudioStream(audio_encoder_->get_codec_context()) != RET_OK)
+            || (video_encoder_ && pusher->ConfigVideoStream(video_encoder_->get_codec_context()) != RET_OK)) {
+        delete pusher;
+        return NULL;
+    }
+    if(pusher->Connect() != RET_OK) {
+        delete pusher;
+        return NULL;
+    }
+    LogInfo("destination %s connected", pusher->GetUrl().c_str());
+    return pusher;
+}
+
+RtpPusher *PushWork::createRtpDestination(const Properties &destination)
+{
+    // 1. rtsp握手仍然走libavformat，这里只是额外的rtp/udp输出，参数按目的地单独设置
+    const char *rtp_keys[] = {"url", "sdp_file", "mtu", "send_mode", "max_queue_duration", "rtcp_interval",
+                              "pacing", "pacing_headroom", "pacing_burst", "pacing_frame_fraction"};
+    Properties rtp_properties;
+    for(size_t i = 0; i < sizeof(rtp_keys) / sizeof(rtp_keys[0]); i++) {
+        if(destination.HasProperty(rtp_keys[i])) {
+            rtp_properties.SetProperty(rtp_keys[i], destination.GetProperty(rtp_keys[i]));
+        }
+    }
+    if(audio_encoder_) {
+        rtp_properties.SetProperty("audio_frame_duration", std::to_string(audio_encoder_->GetFrameDuration()));
+    }
+    if(video_encoder_) {
+        rtp_properties.SetProperty("video_frame_duration", 1000/video_encoder_->GetFps());
+    }
+    if(skip_static_) {
+        rtp_properties.SetProperty("video_max_interval", keepalive_interval_);
+    }
+    rtp_properties.SetProperty("intra_refresh", video_intra_refresh_ ? 1 : 0);
+
+    // 2. 视频H264或者H265，音频aac或者opus
+    //    和备用rtsp目的地一样不驱动编码器出IDR，丢包后从自己队列里的下一个解码起点继续
+    RtpPusher *pusher = new RtpPusher();
+    if(pusher->Init(rtp_properties) != RET_OK
+            || (audio_encoder_ && pusher->ConfigAudioStream(audio_encoder_->get_codec_context()) != RET_OK)
+            || (video_encoder_ && pusher->ConfigVideoStream(video_encoder_->get_codec_context()) != RET_OK)
+            || pusher->Connect() != RET_OK) {
+        delete pusher;
+        return NULL;
+    }
+    LogInfo("destination %s connected", rtp_properties.GetProperty("url", ""));
+    return pusher;
+}
+
+VideoEncoder *PushWork::createVideoEncoder()
+{
+    if(video_codec_ == "h265") {
+        return new H265Encoder();
+    }
+    return new H264Encoder();
+}
+
+// 在采集线程调用，已经持有video_mutex_
+RET_CODE PushWork::switchVideoStep()
+{
+    ladder_pending_ = false;
+    // 1. drain旧的编码器，尾部的包照常推送
+    if(video_encoder_) {
+        video_encoder_->Flush(std::bind(&PushWork::onVideoPacket, this, std::placeholders::_1));
+        delete video_encoder_;
+        video_encoder_ = NULL;
+    }
+    if(ladder_step_.width == 0) {
+        LogInfo("ladder: audio only");
+        return RET_OK;
+    }
+
+    // 2. 用新的宽高、帧率和码率创建编码器，gop的时长保持不变
+    int gop = video_gop_ * ladder_step_.fps / video_fps_;
+    if(gop < 1) {
+        gop = 1;
+    }
+    Properties properties = vid_codec_properties_;
+    const char *keys[] = {"width", "height", "fps", "gop", "bitrate"};
+    for(size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        properties.erase(keys[i]);
+    }
+    properties.SetProperty("width", ladder_step_.width);
+    properties.SetProperty("height", ladder_step_.height);
+    properties.SetProperty("fps", ladder_step_.fps);
+    properties.SetProperty("gop", gop);
+    properties.SetProperty("bitrate", ladder_step_.bitrate);
+    VideoEncoder *encoder = createVideoEncoder();
+    if(encoder->Init(properties) != RET_OK) {
+        LogError("ladder: %s encoder Init %dx%d@%d failed", video_codec_.c_str(), ladder_step_.width,
+                 ladder_step_.height, ladder_step_.fps);
+        delete encoder;
+        return RET_FAIL;
+    }
+    video_encoder_ = encoder;
+    video_cur_gop_ = gop;
+    video_cur_fps_ = ladder_step_.fps;
+    video_fps_acc_ = 0;
+    video_frame_count_ = 0;
+    last_encode_time_ = -1;     // 新编码器的第一帧不跳过
+    // 3. SDP里面是最初的参数集，之后每个关键帧前带上新的参数集
+    inband_headers_ = true;
+    // 时移环从新编码器的第一个关键帧开始新的一段，导出的片段带上新的宽高和参数集
+    if(dvr_ && dvr_->ConfigVideoStream(video_encoder_->get_codec_context()) != RET_OK) {
+        LogError("ladder: dvr ConfigVideoStream failed");
+    }
+    rtsp_pusher_->SetVideoFrameDuration(1000.0 / video_cur_fps_);
+    for(size_t i = 0; i < dest_pushers_.size(); i++) {
+        dest_pushers_[i]->SetVideoFrameDuration(1000.0 / video_cur_fps_);
+    }
+    for(size_t i = 0; i < dest_rtp_pushers_.size(); i++) {
+        dest_rtp_pushers_[i]->SetVideoFrameDuration(1000.0 / video_cur_fps_);
+        dest_rtp_pushers_[i]->SetBitrate(ladder_step_.bitrate);
+    }
+    LogInfo("ladder: %dx%d@%d, gop:%d, bitrate:%d", ladder_step_.width, ladder_step_.height,
+            ladder_step_.fps, gop, ladder_step_.bitrate);
+    return RET_OK;
+}
+
+void PushWork::SetRegionsOfInterest(const std::vector<VideoRegion> &regions)
+{
+    std::lock_guard<std::mutex> lock(video_mutex_);
+    roi_regions_ = regions;
+    if(roi_regions_.empty() && !roi_auto_ && video_encoder_) {
+        video_encoder_->SetRegionsOfInterest(roi_regions_);
+    }
+}
+
+// 在采集线程调用，已经持有video_mutex_
+void PushWork::updateRegions(AVFrame *frame, const std::vector<VideoRegion> &detected)
+{
+    // 1. 调用者的区域是屏幕坐标，减去采集区域的起点
+    std::vector<VideoRegion> regions;
+    for(size_t i = 0; i < roi_regions_.size(); i++) {
+        VideoRegion region = roi_regions_[i];
+        region.x -= desktop_x_;
+        region.y -= desktop_y_;
+        regions.push_back(region);
+    }
+    // 2. 检测到的变化区域，已经是帧坐标
+    regions.insert(regions.end(), detected.begin(), detected.end());
+    // 3. 降级档位的编码分辨率可能比采集小，按比例换算
+    AVCodecContext *ctx = video_encoder_->get_codec_context();
+    if(ctx->width != frame->width || ctx->height != frame->height) {
+        for(size_t i = 0; i < regions.size(); i++) {
+            VideoRegion &r = regions[i];
+            int right  = (int)((int64_t)(r.x + r.width) * ctx->width / frame->width);
+            int bottom = (int)((int64_t)(r.y + r.height) * ctx->height / frame->height);
+            r.x = (int)((int64_t)r.x * ctx->width / frame->width);
+            r.y = (int)((int64_t)r.y * ctx->height / frame->height);
+            r.width  = right - r.x;
+            r.height = bottom - r.y;
+        }
+    }
+    video_encoder_->SetRegionsOfInterest(regions);
+}
+
+bool PushWork::parseRegions(const std::string &str, float qoffset, std::vector<VideoRegion> *regions)
+{
+    regions->clear();
+    size_t pos = 0;
+    while(pos < str.size()) {
+        size_t end = str.find(';', pos);
+        if(end == std::string::npos) {
+            end = str.size();
+        }
+        std::string item = str.substr(pos, end - pos);
+        pos = end + 1;
+        if(item.empty()) {
+            continue;
+        }
+        VideoRegion region = {0, 0, 0, 0, qoffset};
+        int n = sscanf(item.c_str(), "%d,%d,%d,%d,%f", &region.x, &region.y,
+                       &region.width, &region.height, &region.qoffset);
+        if(n < 4 || region.width <= 0 || region.height <= 0
+                || region.qoffset < -1 || region.qoffset > 1) {
+            return false;
+        }
+        regions->push_back(region);
+    }
+    return true;
+}
+
+// 采集帧和编码器宽高不一致时缩放到scaled_frame_，一致时直接使用采集帧
+RET_CODE PushWork::scaleFrame(AVFrame *frame, AVFrame **out)
+{
+    AVCodecContext *ctx = video_encoder_->get_codec_context();
+    if(frame->width == ctx->width && frame->height == ctx->height) {
+        *out = frame;
+        return RET_OK;
+    }
+    sws_ctx_ = sws_getCachedContext(sws_ctx_, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                    ctx->width, ctx->height, ctx->pix_fmt,
+                                    SWS_BILINEAR, NULL, NULL, NULL);
+    if(!sws_ctx_) {
+        LogError("sws_getCachedContext failed");
+        return RET_FAIL;
+    }
+    if(scaled_frame_ && (scaled_frame_->width != ctx->width || scaled_frame_->height != ctx->height)) {
+        av_frame_free(&scaled_frame_);
+    }
+    if(!scaled_frame_) {
+        scaled_frame_ = av_frame_alloc();
+        scaled_frame_->width = ctx->width;
+        scaled_frame_->height = ctx->height;
+        scaled_frame_->format = ctx->pix_fmt;
+        if(av_frame_get_buffer(scaled_frame_, 0) < 0) {
+            LogError("av_frame_get_buffer failed");
+            av_frame_free(&scaled_frame_);
+            return RET_ERR_OUTOFMEMORY;
+        }
+    }
+    // 编码器可能还持有上一帧的引用
+    if(av_frame_make_writable(scaled_frame_) < 0) {
+        LogError("av_frame_make_writable failed");
+        return RET_ERR_OUTOFMEMORY;
+    }
+    sws_scale(sws_ctx_, frame->data, frame->linesize, 0, frame->height,
+              scaled_frame_->data, scaled_frame_->linesize);
+    scaled_frame_->pts = frame->pts;
+    *out = scaled_frame_;
+    return RET_OK;
+}
+
+void PushWork::onVideoPacket(AVPacket *packet)
+{
+    // 步骤3.1: dts必须递增，muxer按dts检查。有b帧时编码器输出的dts比pts早几帧，
+    //         切换档位或者H265改码率重开编码器后，新编码器的第一个dts可能小于旧编码器最后的dts
+    //         新帧的pts晚于旧编码器所有的帧，抬高之后仍然不大于pts
+    if(packet->dts == AV_NOPTS_VALUE) {
+        packet->dts = packet->pts;
+    }
+    if(last_video_dts_ != AV_NOPTS_VALUE && packet->dts <= last_video_dts_) {
+        packet->dts = last_video_dts_ + 1;
+    }
+    last_video_dts_ = packet->dts;
+
+    // 步骤3.2: 解码起点: 关键帧，intra-refresh时是recovery point
+    bool hevc = video_encoder_->GetCodecId() == AV_CODEC_ID_HEVC;
+    bool random_access = (packet->flags & AV_PKT_FLAG_KEY)
+            || (video_intra_refresh_ && NaluUtil::HasRecoveryPoint(packet->data, packet->size, hevc));
+
+    // 步骤3.3: 写入dump缓冲区，参数集(H264: SPS PPS, H265: VPS SPS PPS)只写在解码起点前面
+    if(video_dump_ >= 0) {
+        if(random_access) {
+            const std::string &parameter_sets = video_encoder_->GetParameterSets();
+            dump_writer_->Write(video_dump_, (const uint8_t *)parameter_sets.data(), (int)parameter_sets.size(),
+                                packet->data, packet->size);
+        } else {
+            dump_writer_->Write(video_dump_, packet->data, packet->size);
         }
-        // 步骤3.3: 写入SPS和PPS数据到文件
-        uint8_t start_code[4] = {0, 0, 0, 1};
-        fwrite(start_code, 1, 4, h264_fp_);
-        fwrite(video_encoder_->get_sps_data(), 1, video_encoder_->get_sps_size(), h264_fp_);
-        fwrite(start_code, 1, 4, h264_fp_);
-        fwrite(video_encoder_->get_pps_data(), 1, video_encoder_->get_pps_size(), h264_fp_);
+    }
 
-        // 步骤3.4: 将编码后的视频数据写入文件
-        fwrite(packet->data, 1, packet->size, h264_fp_);
-        fflush(h264_fp_);
+    // 步骤3.4: 切换过档位之后解码起点前面带上参数集，解码端按新的分辨率重新初始化
+    if(inband_headers_ && random_access) {
+        if(prependParameterSets(packet) != RET_OK) {
+            LogError("prepend parameter sets failed");
+        }
+    }
+
+    // 步骤3.5: 录制只增加引用，时移环拷贝到缓冲区，然后推送
+    // LogInfo("YuvCallback packet->pts:%ld", packet->pts);
+    dispatchPacket(packet, E_VIDEO_TYPE);
+}
+
+// 扇出到录制、时移环和各个目的地，转移packet的所有权
+void PushWork::dispatchPacket(AVPacket *packet, MediaType media_type)
+{
+    if(recorder_) {
+        recorder_->Push(packet, media_type);
+    }
+    for(size_t i = 0; i < dest_recorders_.size(); i++) {
+        dest_recorders_[i]->Push(packet, media_type);
+    }
+    if(dvr_) {
+        dvr_->Push(packet, media_type);
     }
+    for(size_t i = 0; i < dest_rtp_pushers_.size(); i++) {
+        dest_rtp_pushers_[i]->Push(packet, media_type);
+    }
+    // 只增加数据的引用计数，每个目的地按自己的进度发送和丢包
+    for(size_t i = 0; i < dest_pushers_.size(); i++) {
+        AVPacket *ref = av_packet_clone(packet);
+        if(!ref) {
+            LogError("av_packet_clone failed");
+            continue;
+        }
+        if(dest_pushers_[i]->Push(ref, media_type) != RET_OK) {
+            av_packet_free(&ref);
+        }
+    }
+    if(rtsp_pusher_->Push(packet, media_type) != RET_OK) {
+        av_packet_free(&packet);
+    }
+}
 
-    // 步骤3.5: 记录日志并释放资源
-    // LogInfo("size:%d", size);
-    if(packet) {
-        // LogInfo("YuvCallback packet->pts:%ld", packet->pts);
-         rtsp_pusher_->Push(packet,E_VIDEO_TYPE);
-    }else {
-        LogInfo("packet is null");
+// 在packet前面插入annexb格式的参数集
+RET_CODE PushWork::prependParameterSets(AVPacket *packet)
+{
+    const std::string &parameter_sets = video_encoder_->GetParameterSets();
+    int header_size = (int)parameter_sets.size();
+    AVPacket *out = av_packet_alloc();
+    if(!out || av_new_packet(out, header_size + packet->size) < 0) {
+        av_packet_free(&out);
+        return RET_ERR_OUTOFMEMORY;
     }
+    memcpy(out->data, parameter_sets.data(), header_size);
+    memcpy(out->data + header_size, packet->data, packet->size);
+    av_packet_copy_props(out, packet);
+    av_packet_unref(packet);
+    av_packet_move_ref(packet, out);
+    av_packet_free(&out);
+    return RET_OK;
 }
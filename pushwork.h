@@ -2,11 +2,20 @@
 #define PUSHWORK_H
 
 #include <string>
+#include <mutex>
 #include "audiocapturer.h"
 #include "videocapturer.h"
 #include "aacencoder.h"
+#include "opusencoder.h"
+#include "silencedetector.h"
+#include "regiondetector.h"
+#include "dumpwriter.h"
+#include "mp4recorder.h"
+#include "dvrring.h"
 #include "h264encoder.h"
+#include "h265encoder.h"
 #include "rtsppusher.h"
+#include "rtppusher.h"
 #include "messagequeue.h"
 
 extern "C" {
@@ -14,6 +23,7 @@ extern "C" {
 #include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 #include <libavutil/audio_fifo.h>
+#include <libswscale/swscale.h>
 }
 
 class PushWork
@@ -23,9 +33,64 @@ public:
     ~PushWork();
     RET_CODE Init(const Properties &properties);
     RET_CODE DeInit();
+    // 静音检测的统计信息，没有打开静音检测时返回RET_FAIL
+    RET_CODE GetVadStats(VadStats *stats);
+    /**
+     * @brief GetEncoderStats 编码器每帧的延迟、大小、qp统计，按帧类型分开
+     *        切换降级档位时视频编码器重新创建，统计从头开始
+     * @param media_type    E_AUDIO_TYPE或者E_VIDEO_TYPE
+     * @return 没有对应的编码器时返回RET_FAIL
+     */
+    RET_CODE GetEncoderStats(MediaType media_type, EncoderStatsInfo *info);
+    /**
+     * @brief ExportDvr 把时移环里最后duration毫秒导出到mp4，不重新编码，可以在任意线程调用
+     * @return 没有打开时移环(dvr_dir)时返回RET_FAIL
+     */
+    RET_CODE ExportDvr(int64_t duration, const std::string &file_name);
+    // 各个目的地的统计按类型分开，都可以在任意线程调用
+    // rtsp目的地的数量，0是rtsp_url，之后按destinations里rtsp目的地的顺序
+    int GetDestinationCount();
+    // 每个rtsp目的地自己的队列、发送和丢包统计
+    RET_CODE GetDestinationStats(int index, RtspPusherStats *stats);
+    // rtp目的地的数量，按destinations里rtp目的地的顺序
+    int GetRtpDestinationCount();
+    // 每个rtp目的地的队列、每路包数和系统调用次数、pacing统计
+    RET_CODE GetRtpDestinationStats(int index, RtpPusherStats *stats);
+    // 本地录制的待写队列、写入和丢包统计，没有打开录制(record_file)时返回RET_FAIL
+    RET_CODE GetRecorderStats(Mp4RecorderStats *stats);
+    // 时移环的时间范围、数据量和丢包统计，没有打开时移环(dvr_dir)时返回RET_FAIL
+    RET_CODE GetDvrStats(DvrStats *stats);
+    /**
+     * @brief SetRegionsOfInterest 设置桌面上需要重点保证质量的区域(比如活动窗口)，可以在任意线程调用
+     * @param regions   屏幕坐标，和desktop_x/desktop_y同一个坐标系; 为空时取消
+     */
+    void SetRegionsOfInterest(const std::vector<VideoRegion> &regions);
 private:
     void PcmCallback(uint8_t *pcm, int32_t size);
-    void YuvCallback(uint8_t *yuv, int32_t size);
+    void YuvCallback(AVFrame *frame);     // 采集缓冲池的帧，引用计数
+    // 编码器输出的包，dump后推送
+    void onAudioPacket(AVPacket *packet);
+    void onVideoPacket(AVPacket *packet);
+    // 扇出: 录制和备用目的地各自增加一份引用，主目的地拿走原来的包
+    void dispatchPacket(AVPacket *packet, MediaType media_type);
+    // 码率自适应和降级阶梯的回调，来自发送线程
+    void onBitrateChange(int bitrate);
+    void onLadderChange(const VideoLadderStep &step);
+    void onKeyframeRequest();
+    VideoEncoder *createVideoEncoder();     // 按video_codec_创建H264或者H265编码器
+    // 补上编码参数后创建并打开录制，失败时返回NULL
+    Mp4Recorder *createRecorder(Properties record_properties);
+    // 在主目的地的参数上覆盖destinations.N.*，连接成功后返回
+    RtspPusher *createDestination(const Properties &destination, Properties rtsp_properties);
+    // 直接推rtp/udp的目的地，打开socket并写sdp后返回
+    RtpPusher *createRtpDestination(const Properties &destination);
+    RET_CODE switchVideoStep();
+    RET_CODE scaleFrame(AVFrame *frame, AVFrame **out);
+    RET_CODE prependParameterSets(AVPacket *packet);
+    // 合并调用者设置的区域和检测到的变化区域，换算到编码器坐标
+    void updateRegions(AVFrame *frame, const std::vector<VideoRegion> &detected);
+    // 解析"x,y,w,h[,qoffset];x,y,w,h[,qoffset]"格式的区域列表
+    static bool parseRegions(const std::string &str, float qoffset, std::vector<VideoRegion> *regions);
     
 private:
     AudioCapturer *audio_capturer_ = NULL;
@@ -40,8 +105,17 @@ private:
     int mic_sample_fmt_ = AV_SAMPLE_FMT_S16;
     int mic_channels_ = 2;
 
-    AACEncoder *audio_encoder_;
+    AudioEncoder *audio_encoder_ = NULL;
     // 音频编码参数
+    std::string audio_codec_ = "aac";     // aac或者opus
+    std::string opus_frame_duration_ = "10";  // opus帧长ms, 2.5/5/10/20
+    int audio_dtx_ = 0;             // opus DTX
+
+    // 静音检测
+    int audio_silence_detect_ = 0;
+    int audio_silence_threshold_ = -60;     // dBFS
+    int audio_silence_hangover_ = 500;      // ms
+    SilenceDetector *silence_detector_ = NULL;
     int audio_sample_rate_ = 48000;
     int audio_bitrate_ = 128*1024;
     int audio_channels_ = 2;
@@ -59,6 +133,7 @@ private:
     int video_gop_ = 25;
     int video_bitrate_ = 1024*1024;   // 先默认1M fixedme
     int video_b_frames_ = 0;
+    std::string video_codec_ = "h264";    // h264或者h265
 
     // 桌面采样属性
     int desktop_x_ = 0;
@@ -70,20 +145,62 @@ private:
 
     //视频相关
     VideoCapturer *video_capturer_ = NULL;
-    H264Encoder *video_encoder_ = NULL;
+    VideoEncoder *video_encoder_ = NULL;
+    std::mutex video_mutex_;        // 保护video_encoder_，切换档位时会重新创建
+    Properties vid_codec_properties_;
+
+    // 降级阶梯
+    VideoLadderStep ladder_step_;
+    bool ladder_pending_ = false;   // 有待切换的档位，等到GOP边界
+    int video_cur_fps_ = 25;        // 当前档位的帧率
+    int video_cur_gop_ = 25;
+    int video_fps_acc_ = 0;         // 降帧率时的抽帧累加器
+    int64_t video_frame_count_ = 0; // 当前编码器已经送入的帧数
+    bool inband_headers_ = false;   // 关键帧前面是否带上SPS/PPS
+    int64_t last_video_dts_ = AV_NOPTS_VALUE;   // 上一个视频包的dts，保证重开编码器之后也递增
+    SwsContext *sws_ctx_ = NULL;
+    AVFrame *scaled_frame_ = NULL;
 
-    // dump 数据
-    FILE *pcm_s16le_fp_ = NULL;
-    FILE *aac_fp_ = NULL;
-    FILE *h264_fp_ = NULL;
+    // ROI编码
+    std::vector<VideoRegion> roi_regions_;      // 调用者设置的区域，屏幕坐标
+    float roi_qoffset_ = -0.3f;
+    RegionDetector *region_detector_ = NULL;    // 变化检测，ROI和静止画面跳过共用
+    bool roi_auto_ = false;                     // 变化区域作为ROI
+    // 静止画面跳过编码，每keepalive_interval送一帧保活(编码出来几乎全是skip宏块)
+    bool skip_static_ = false;
+    int keepalive_interval_ = 1000;
+    int64_t last_encode_time_ = -1;
+    int64_t static_skipped_ = 0;                // 连续跳过的帧数
+    bool video_vfr_ = false;                    // 可变帧率
+    int vfr_min_interval_ = 0;                  // 两帧的最小间隔ms
+    bool video_dirty_ = false;                  // 上次编码之后画面有变化
+
+    // dump 数据，在dump线程写文件，-1代表没有打开
+    DumpWriter *dump_writer_ = NULL;
+    int pcm_dump_ = -1;
+    int aac_dump_ = -1;
+    int video_dump_ = -1;
     AVFrame *audio_frame_ = NULL;
 
+    // 本地录制，和推流共享编码包
+    Mp4Recorder *recorder_ = NULL;
+    // 时移环，最近N分钟的编码包
+    DvrRing *dvr_ = NULL;
+
     // rtsp
     std::string rtsp_url_;
     std::string rtsp_transport_ = "";
     int rtsp_timeout_ = 5000;
     int rtsp_max_queue_duration_ = 1000;
+    bool abr_enable_ = false;       // 根据发送队列调整视频码率
+    bool video_intra_refresh_ = false;  // 帧内刷新代替周期IDR
+    int drain_timeout_ = 1000;      // DeInit时等待队列发送完的最长时间ms
     RtspPusher *rtsp_pusher_ = NULL;
+    // 扇出的其他目的地，每个有自己的队列、发送线程和丢包策略，只在Init里创建
+    // 码率自适应和降级只跟随主目的地，备用目的地跟不上时丢自己的包
+    std::vector<RtspPusher *> dest_pushers_;
+    std::vector<Mp4Recorder *> dest_recorders_;
+    std::vector<RtpPusher *> dest_rtp_pushers_;
     MessageQueue *msg_queue_ = NULL;
 
 };
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include "regiondetector.h"
+#include "dlog.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REGION_USE_SSE2 1
+#endif
+
+RegionDetector::RegionDetector()
+{
+
+}
+
+RegionDetector::~RegionDetector()
+{
+
+}
+
+RET_CODE RegionDetector::Init(const Properties &properties)
+{
+    width_          = properties.GetProperty("width", 0);
+    height_         = properties.GetProperty("height", 0);
+    int format      = properties.GetProperty("format", AV_PIX_FMT_YUV420P);
+    block_size_     = properties.GetProperty("block_size", 16);
+    margin_         = properties.GetProperty("margin", 1);
+    max_regions_    = properties.GetProperty("max_regions", 4);
+    hold_frames_    = properties.GetProperty("hold_frames", 25);
+    qoffset_        = (float)atof(properties.GetProperty("qoffset", "-0.3"));
+    if(width_ <= 0 || height_ <= 0 || block_size_ <= 0 || margin_ < 0
+            || max_regions_ <= 0 || hold_frames_ < 0 || qoffset_ < -1 || qoffset_ > 1) {
+        LogError("width:%d, height:%d, block_size:%d, margin:%d, max_regions:%d, hold_frames:%d, qoffset:%0.2f",
+                 width_, height_, block_size_, margin_, max_regions_, hold_frames_, qoffset_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    row_bytes_ = av_image_get_linesize((AVPixelFormat)format, width_, 0);
+    if(row_bytes_ <= 0) {
+        LogError("format:%d not support", format);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    pixel_bytes_ = row_bytes_ / width_ > 0 ? row_bytes_ / width_ : 1;
+    blocks_x_ = (width_ + block_size_ - 1) / block_size_;
+    blocks_y_ = (height_ + block_size_ - 1) / block_size_;
+    prev_.assign((size_t)row_bytes_ * height_, 0);
+    has_prev_ = false;
+    held_.clear();
+    held_frames_ = 0;
+    return RET_OK;
+}
+
+bool RegionDetector::Detect(const AVFrame *frame, std::vector<VideoRegion> *regions)
+{
+    regions->clear();
+    if(frame->width != width_ || frame->height != height_) {
+        LogError("frame %dx%d != %dx%d", frame->width, frame->height, width_, height_);
+        return true;
+    }
+
+    // 1. 逐行比较，每行按块分段，已经变化的块不再比较
+    //    参考帧里没变化的块和当前帧相同，只需要把变化块从变化的那一行开始拷贝过去
+    std::vector<int> row_min(blocks_y_, blocks_x_);     // 每个块行变化块的范围
+    std::vector<int> row_max(blocks_y_, -1);
+    std::vector<uint8_t> changed(blocks_x_);
+    int block_bytes = block_size_ * pixel_bytes_;
+    bool any_changed = !has_prev_;
+    int row_changed = 0;        // 当前块行已经变化的块数
+    changed_blocks_ = 0;
+    for(int y = 0; y < height_; y++) {
+        int by = y / block_size_;
+        if(y % block_size_ == 0) {
+            std::fill(changed.begin(), changed.end(), 0);
+            row_changed = 0;
+        }
+        const uint8_t *cur = frame->data[0] + (int64_t)y * frame->linesize[0];
+        uint8_t *prev = prev_.data() + (int64_t)y * row_bytes_;
+        if(!has_prev_) {
+            memcpy(prev, cur, row_bytes_);
+            continue;
+        }
+        // 静止画面的快速路径: 块行里还没有变化时先整行比较
+        if(row_changed == 0 && IsEqual(cur, prev, row_bytes_)) {
+            continue;
+        }
+        for(int bx = 0; bx < blocks_x_; bx++) {
+            int offset = bx * block_bytes;
+            int bytes = std::min(block_bytes, row_bytes_ - offset);
+            if(!changed[bx]) {
+                if(IsEqual(cur + offset, prev + offset, bytes)) {
+                    continue;
+                }
+                changed[bx] = 1;
+                changed_blocks_++;
+                row_changed++;
+                row_min[by] = std::min(row_min[by], bx);
+                row_max[by] = std::max(row_max[by], bx);
+                any_changed = true;
+            }
+            memcpy(prev + offset, cur + offset, bytes);
+        }
+    }
+    if(!has_prev_) {
+        has_prev_ = true;
+        return true;        // 第一帧整个画面都是新的，不输出区域
+    }
+
+    // 2. 连续有变化的块行合并成一个矩形(块坐标)
+    if(any_changed) {
+        std::vector<VideoRegion> bands;
+        for(int by = 0; by < blocks_y_; by++) {
+            if(row_max[by] < 0) {
+                continue;
+            }
+            if(!bands.empty() && bands.back().y + bands.back().height == by) {
+                VideoRegion &band = bands.back();
+                int right = std::max(band.x + band.width, row_max[by] + 1);
+                band.x = std::min(band.x, row_min[by]);
+                band.width = right - band.x;
+                band.height++;
+            } else {
+                VideoRegion band = {row_min[by], by, row_max[by] - row_min[by] + 1, 1, qoffset_};
+                bands.push_back(band);
+            }
+        }
+        // 区域太多时合并垂直间隔最小的相邻两个
+        while((int)bands.size() > max_regions_) {
+            size_t best = 0;
+            int best_gap = blocks_y_;
+            for(size_t i = 0; i + 1 < bands.size(); i++) {
+                int gap = bands[i + 1].y - (bands[i].y + bands[i].height);
+                if(gap < best_gap) {
+                    best_gap = gap;
+                    best = i;
+                }
+            }
+            VideoRegion &a = bands[best];
+            const VideoRegion &b = bands[best + 1];
+            int right = std::max(a.x + a.width, b.x + b.width);
+            a.x = std::min(a.x, b.x);
+            a.width = right - a.x;
+            a.height = b.y + b.height - a.y;
+            bands.erase(bands.begin() + best + 1);
+        }
+
+        // 3. 向外扩展margin个块，转成像素坐标
+        held_.clear();
+        for(size_t i = 0; i < bands.size(); i++) {
+            int x0 = std::max(bands[i].x - margin_, 0) * block_size_;
+            int y0 = std::max(bands[i].y - margin_, 0) * block_size_;
+            int x1 = std::min((bands[i].x + bands[i].width + margin_) * block_size_, width_);
+            int y1 = std::min((bands[i].y + bands[i].height + margin_) * block_size_, height_);
+            VideoRegion region = {x0, y0, x1 - x0, y1 - y0, qoffset_};
+            held_.push_back(region);
+        }
+        held_frames_ = hold_frames_;
+        *regions = held_;
+        return true;
+    }
+
+    // 4. 没有变化时，最近的区域再保留hold_frames帧
+    if(held_frames_ > 0) {
+        held_frames_--;
+        *regions = held_;
+    }
+    return false;
+}
+
+bool RegionDetector::IsEqual(const uint8_t *a, const uint8_t *b, int size)
+{
+    int i = 0;
+#ifdef REGION_USE_SSE2
+    // 每次比较64字节，四组cmpeq的结果and起来只做一次movemask
+    for(; i + 64 <= size; i += 64) {
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                    _mm_loadu_si128((const __m128i *)(b + i)));
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+                                    _mm_loadu_si128((const __m128i *)(b + i + 16)));
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)),
+                                    _mm_loadu_si128((const __m128i *)(b + i + 32)));
+        __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)),
+                                    _mm_loadu_si128((const __m128i *)(b + i + 48)));
+        __m128i e = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if(_mm_movemask_epi8(e) != 0xffff) {
+            return false;
+        }
+    }
+    for(; i + 16 <= size; i += 16) {
+        __m128i e = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                   _mm_loadu_si128((const __m128i *)(b + i)));
+        if(_mm_movemask_epi8(e) != 0xffff) {
+            return false;
+        }
+    }
+#endif
+    // 剩余的字节(或者没有SSE2时全部)用标量比较
+    return memcmp(a + i, b + i, size - i) == 0;
+}
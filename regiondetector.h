@@ -0,0 +1,64 @@
+#ifndef REGIONDETECTOR_H
+#define REGIONDETECTOR_H
+
+#include <vector>
+#include "mediabase.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// 桌面画面的变化区域检测: 和上一帧按块比较第一个平面(yuv的亮度，rgb的像素)，
+// 变化的块按行合并成若干矩形，给ROI编码用; 没有变化的帧可以直接跳过编码
+// 参考帧只更新变化的块，静止画面每帧只读一遍，不写内存
+class RegionDetector
+{
+public:
+    RegionDetector();
+    ~RegionDetector();
+    /**
+     * @brief Init
+     * @param "width"/"height"/"format", 采集帧的宽高和像素格式
+     *        "block_size", 比较的块大小(像素)，默认16，和宏块对齐
+     *        "margin", 变化区域向外扩展的块数，默认1，光标和文字边缘的运动也能覆盖到
+     *        "max_regions", 最多输出的区域数，默认4，多出来的相邻区域合并
+     *        "hold_frames", 变化停止后区域继续保留的帧数，默认25，让编码器把静止下来的内容补清楚
+     *        "qoffset", 输出区域的qoffset，默认-0.3
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    /**
+     * @brief Detect 检测一帧，并把这一帧保存为下一次比较的参考
+     * @param frame     宽高和像素格式必须和Init一致
+     * @param regions   返回变化的区域(含保留中的区域)，帧坐标
+     * @return 这一帧和上一帧相比是否有变化，第一帧返回true
+     */
+    bool Detect(const AVFrame *frame, std::vector<VideoRegion> *regions);
+    // 上一次检测中变化的块数
+    inline int GetChangedBlocks() {
+        return changed_blocks_;
+    }
+
+    // 比较两段内存是否相同，SSE2加速，遇到不同马上返回
+    static bool IsEqual(const uint8_t *a, const uint8_t *b, int size);
+private:
+    int width_ = 0;
+    int height_ = 0;
+    int row_bytes_ = 0;         // 第一个平面一行的有效字节数
+    int pixel_bytes_ = 1;       // 第一个平面每个像素的字节数
+    int block_size_ = 16;
+    int margin_ = 1;
+    int max_regions_ = 4;
+    int hold_frames_ = 25;
+    float qoffset_ = -0.3f;
+
+    int blocks_x_ = 0;
+    int blocks_y_ = 0;
+    std::vector<uint8_t> prev_;         // 上一帧的第一个平面，紧凑排列
+    bool has_prev_ = false;
+    std::vector<VideoRegion> held_;     // 最近一次变化的区域
+    int held_frames_ = 0;
+    int changed_blocks_ = 0;
+};
+
+#endif // REGIONDETECTOR_H
@@ -0,0 +1,283 @@
+#include <random>
+#include <string.h>
+#include "rtppacketizer.h"
+#include "nalutil.h"
+#include "timesutil.h"
+#include "dlog.h"
+
+#define RTP_H264_STAP_A 24
+#define RTP_H264_FU_A   28
+#define RTP_H265_AP     48
+#define RTP_H265_FU     49
+#define RTCP_SR         200
+#define RTCP_SDES       202
+#define RTP_AAC_MAX_AU  8191        // AU-header里13bit的大小
+
+RtpPacketizer::RtpPacketizer()
+{
+
+}
+
+RtpPacketizer::~RtpPacketizer()
+{
+
+}
+
+RET_CODE RtpPacketizer::Init(const Properties &properties)
+{
+    // ssrc和起始序号随机，避免和之前的会话混淆
+    std::mt19937 rand((unsigned int)(TimesUtil::GetTimeMillisecond() ^ (intptr_t)this));
+    codec_          = properties.GetProperty("codec", "h264");
+    payload_type_   = properties.GetProperty("payload_type", 96);
+    ssrc_           = properties.HasProperty("ssrc") ? (uint32_t)properties.GetProperty("ssrc", 0) : rand();
+    sequence_       = (uint16_t)rand();
+    mtu_            = properties.GetProperty("mtu", 1400);
+    cname_          = properties.GetProperty("cname", "rtsp-publish");
+    if(codec_ != "h264" && codec_ != "h265" && codec_ != "aac" && codec_ != "opus") {
+        LogError("rtp packetizer can't support codec:%s", codec_.c_str());
+        return RET_ERR_NOT_SUPPORT;
+    }
+    if(payload_type_ < 96 || payload_type_ > 127 || mtu_ < 256 || mtu_ > 65000) {
+        LogError("payload_type:%d, mtu:%d is out of range", payload_type_, mtu_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    if(cname_.empty() || cname_.size() > 255) {
+        LogError("cname:%s is invalid", cname_.c_str());
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    max_payload_ = mtu_ - RTP_HEADER_SIZE;
+    hevc_ = codec_ == "h265";
+    nal_header_size_ = hevc_ ? 2 : 1;
+    return RET_OK;
+}
+
+int RtpPacketizer::Packetize(const uint8_t *data, int size, uint32_t timestamp,
+                             std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices)
+{
+    if(!data || size <= 0) {
+        LogError("data is empty");
+        return -1;
+    }
+    if(codec_ == "h264" || codec_ == "h265") {
+        return packetizeVideo(data, size, timestamp, buffer, slices);
+    }
+    if(codec_ == "aac") {
+        return packetizeAac(data, size, timestamp, buffer, slices);
+    }
+    // opus: 一个包就是一帧，不分片
+    if(size > max_payload_) {
+        LogError("opus packet size:%d is larger than mtu", size);
+        return -1;
+    }
+    int offset = addPacket(size, timestamp, false, buffer, slices);
+    memcpy(&buffer[offset], data, size);
+    return 1;
+}
+
+int RtpPacketizer::packetizeVideo(const uint8_t *data, int size, uint32_t timestamp,
+                                  std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices)
+{
+    // 1. 取出所有nal，整帧最后一个包带marker; 不够一个nal头的跳过
+    std::vector<std::pair<const uint8_t *, int> > nals;
+    const uint8_t *p = data;
+    const uint8_t *nal = NULL;
+    int nal_size = 0;
+    while(NaluUtil::NextNal(&p, data + size, &nal, &nal_size)) {
+        if(nal_size >= nal_header_size_) {
+            nals.push_back(std::make_pair(nal, nal_size));
+        }
+    }
+    if(nals.empty()) {
+        LogError("no nal in %s packet, size:%d", codec_.c_str(), size);
+        return -1;
+    }
+
+    // 2. 小的nal(参数集/SEI)合并到STAP-A/AP，放不下一个包的nal拆成FU-A/FU
+    size_t count = slices.size();
+    std::vector<std::pair<const uint8_t *, int> > group;
+    int group_size = nal_header_size_;     // STAP-A/AP头
+    for(size_t i = 0; i < nals.size(); i++) {
+        nal = nals[i].first;
+        nal_size = nals[i].second;
+        bool last = i == nals.size() - 1;
+        if(nal_size > max_payload_) {
+            flushNals(group, timestamp, false, buffer, slices);
+            group.clear();
+            group_size = nal_header_size_;
+            // H264: FU indicator沿用nal头的F和NRI，FU header带原来的nal类型
+            // H265: 2字节的负载头沿用nal头的F、LayerId和TID，类型换成49，FU header带原来的nal类型
+            uint8_t header[3];
+            int header_size = nal_header_size_ + 1;
+            if(hevc_) {
+                header[0] = (nal[0] & 0x81) | (RTP_H265_FU << 1);
+                header[1] = nal[1];
+                header[2] = (nal[0] >> 1) & 0x3f;
+            } else {
+                header[0] = (nal[0] & 0xe0) | RTP_H264_FU_A;
+                header[1] = nal[0] & 0x1f;
+            }
+            const uint8_t *payload = nal + nal_header_size_;
+            int remain = nal_size - nal_header_size_;
+            int chunk = max_payload_ - header_size;
+            bool start = true;
+            while(remain > 0) {
+                int len = remain < chunk ? remain : chunk;
+                bool end = len == remain;
+                int offset = addPacket(header_size + len, timestamp, last && end, buffer, slices);
+                memcpy(&buffer[offset], header, header_size - 1);
+                buffer[offset + header_size - 1] = (start ? 0x80 : 0) | (end ? 0x40 : 0) | header[header_size - 1];
+                memcpy(&buffer[offset + header_size], payload, len);
+                payload += len;
+                remain -= len;
+                start = false;
+            }
+            continue;
+        }
+        if(!group.empty() && group_size + 2 + nal_size > max_payload_) {
+            flushNals(group, timestamp, false, buffer, slices);
+            group.clear();
+            group_size = nal_header_size_;
+        }
+        group.push_back(nals[i]);
+        group_size += 2 + nal_size;
+    }
+    flushNals(group, timestamp, true, buffer, slices);
+    return (int)(slices.size() - count);
+}
+
+void RtpPacketizer::flushNals(const std::vector<std::pair<const uint8_t *, int> > &nals, uint32_t timestamp,
+                              bool marker, std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices)
+{
+    if(nals.empty()) {
+        return;
+    }
+    if(nals.size() == 1) {
+        int offset = addPacket(nals[0].second, timestamp, marker, buffer, slices);
+        memcpy(&buffer[offset], nals[0].first, nals[0].second);
+        return;
+    }
+    // STAP-A: F取或，NRI取最大值; AP: F取或，LayerId和TID取最小值; 每个nal前面是16bit的大小
+    int payload_size = nal_header_size_;
+    uint8_t f = 0;
+    uint8_t nri = 0;
+    int layer_id = 63;
+    int tid = 7;
+    for(size_t i = 0; i < nals.size(); i++) {
+        const uint8_t *nal = nals[i].first;
+        payload_size += 2 + nals[i].second;
+        f |= nal[0] & 0x80;
+        if(hevc_) {
+            int nal_layer_id = ((nal[0] & 0x01) << 5) | (nal[1] >> 3);
+            layer_id = nal_layer_id < layer_id ? nal_layer_id : layer_id;
+            tid = (nal[1] & 0x07) < tid ? (nal[1] & 0x07) : tid;
+        } else if((nal[0] & 0x60) > nri) {
+            nri = nal[0] & 0x60;
+        }
+    }
+    int offset = addPacket(payload_size, timestamp, marker, buffer, slices);
+    uint8_t *dst = &buffer[offset];
+    if(hevc_) {
+        *dst++ = f | (RTP_H265_AP << 1) | (layer_id >> 5);
+        *dst++ = (uint8_t)(((layer_id & 0x1f) << 3) | tid);
+    } else {
+        *dst++ = f | nri | RTP_H264_STAP_A;
+    }
+    for(size_t i = 0; i < nals.size(); i++) {
+        *dst++ = (uint8_t)(nals[i].second >> 8);
+        *dst++ = (uint8_t)nals[i].second;
+        memcpy(dst, nals[i].first, nals[i].second);
+        dst += nals[i].second;
+    }
+}
+
+int RtpPacketizer::packetizeAac(const uint8_t *data, int size, uint32_t timestamp,
+                                std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices)
+{
+    if(size > RTP_AAC_MAX_AU) {
+        LogError("aac frame size:%d is too large", size);
+        return -1;
+    }
+    // AU-headers-length(16bit，按bit计) + AU-header(13bit AU大小 + 3bit AU-index)
+    // 放不下时分片，每片带同样的AU-header，最后一片带marker
+    size_t count = slices.size();
+    int chunk = max_payload_ - 4;
+    const uint8_t *payload = data;
+    int remain = size;
+    while(remain > 0) {
+        int len = remain < chunk ? remain : chunk;
+        int offset = addPacket(4 + len, timestamp, len == remain, buffer, slices);
+        buffer[offset] = 0;
+        buffer[offset + 1] = 16;
+        buffer[offset + 2] = (uint8_t)(size >> 5);
+        buffer[offset + 3] = (uint8_t)((size & 0x1f) << 3);
+        memcpy(&buffer[offset + 4], payload, len);
+        payload += len;
+        remain -= len;
+    }
+    return (int)(slices.size() - count);
+}
+
+int RtpPacketizer::addPacket(int payload_size, uint32_t timestamp, bool marker,
+                             std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices)
+{
+    int offset = (int)buffer.size();
+    buffer.resize(offset + RTP_HEADER_SIZE + payload_size);
+    uint8_t *header = &buffer[offset];
+    header[0] = 0x80;       // V=2
+    header[1] = (marker ? 0x80 : 0) | (payload_type_ & 0x7f);
+    header[2] = (uint8_t)(sequence_ >> 8);
+    header[3] = (uint8_t)sequence_;
+    header[4] = (uint8_t)(timestamp >> 24);
+    header[5] = (uint8_t)(timestamp >> 16);
+    header[6] = (uint8_t)(timestamp >> 8);
+    header[7] = (uint8_t)timestamp;
+    header[8] = (uint8_t)(ssrc_ >> 24);
+    header[9] = (uint8_t)(ssrc_ >> 16);
+    header[10] = (uint8_t)(ssrc_ >> 8);
+    header[11] = (uint8_t)ssrc_;
+    sequence_++;
+    packet_count_++;
+    octet_count_ += payload_size;
+    RtpSlice slice;
+    slice.offset = offset;
+    slice.size = RTP_HEADER_SIZE + payload_size;
+    slices.push_back(slice);
+    return offset + RTP_HEADER_SIZE;
+}
+
+int RtpPacketizer::BuildSenderReport(uint64_t ntp_time, uint32_t timestamp, uint8_t *buf, int size)
+{
+    // SR 28字节 + SDES: 头4字节、ssrc 4字节、CNAME项、结束的0，补齐到4字节
+    int sdes_size = (8 + 2 + (int)cname_.size() + 1 + 3) & ~3;
+    if(size < 28 + sdes_size) {
+        return -1;
+    }
+    uint32_t words[6] = {ssrc_, (uint32_t)(ntp_time >> 32), (uint32_t)ntp_time, timestamp,
+                         packet_count_, octet_count_};
+    // 1. SR，没有接收报告块
+    uint8_t *p = buf;
+    *p++ = 0x80;
+    *p++ = RTCP_SR;
+    *p++ = 0;
+    *p++ = 6;               // 32bit字数减1
+    for(int i = 0; i < 6; i++) {
+        *p++ = (uint8_t)(words[i] >> 24);
+        *p++ = (uint8_t)(words[i] >> 16);
+        *p++ = (uint8_t)(words[i] >> 8);
+        *p++ = (uint8_t)words[i];
+    }
+    // 2. SDES，一个chunk只有CNAME
+    memset(p, 0, sdes_size);
+    p[0] = 0x81;
+    p[1] = RTCP_SDES;
+    p[2] = (uint8_t)((sdes_size / 4 - 1) >> 8);
+    p[3] = (uint8_t)(sdes_size / 4 - 1);
+    p[4] = (uint8_t)(ssrc_ >> 24);
+    p[5] = (uint8_t)(ssrc_ >> 16);
+    p[6] = (uint8_t)(ssrc_ >> 8);
+    p[7] = (uint8_t)ssrc_;
+    p[8] = 1;               // CNAME
+    p[9] = (uint8_t)cname_.size();
+    memcpy(p + 10, cname_.data(), cname_.size());
+    return 28 + sdes_size;
+}
@@ -0,0 +1,83 @@
+#ifndef RTPPACKETIZER_H
+#define RTPPACKETIZER_H
+
+#include <string>
+#include <vector>
+#include "mediabase.h"
+
+#define RTP_HEADER_SIZE 12
+
+typedef struct rtp_slice {
+    int offset;             // 在缓冲区里的偏移
+    int size;               // rtp头加负载的字节数
+}RtpSlice;
+
+// rtp打包: H264按RFC 6184(packetization-mode=1，小nal合并成STAP-A，大nal拆成FU-A)
+// H265按RFC 7798(小nal合并成AP，大nal拆成FU，不带DONL)
+// AAC按RFC 3640 mpeg4-generic AAC-hbr(每个包一个AU-header), opus按RFC 7587直接作为负载
+// 一帧打出来的包连续放在同一个缓冲区里，由UdpBatchSender一次系统调用发出
+// FU分片除了最后一片都是同样大小，方便按UDP_SEGMENT分段发送
+class RtpPacketizer
+{
+public:
+    RtpPacketizer();
+    ~RtpPacketizer();
+    /**
+     * @brief Init
+     * @param "codec", h264、h265、aac或者opus
+     *        "payload_type", 动态负载类型，默认96
+     *        "ssrc", 默认随机
+     *        "mtu", rtp包(含12字节头)的最大字节数，默认1400
+     *        "cname", rtcp SDES里的CNAME，默认rtsp-publish
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    /**
+     * @brief Packetize 把一帧打包，追加到buffer后面
+     * @param data      H264/H265是annexb格式，AAC是不带ADTS头的raw数据
+     * @param timestamp rtp时间戳，按codec的时钟
+     * @param slices    追加每个rtp包在buffer里的位置
+     * @return 打出来的包数，失败时返回-1
+     */
+    int Packetize(const uint8_t *data, int size, uint32_t timestamp,
+                  std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices);
+    inline uint32_t GetSsrc() {
+        return ssrc_;
+    }
+    inline uint16_t GetSequence() {
+        return sequence_;
+    }
+    /**
+     * @brief BuildSenderReport 生成rtcp SR + SDES(CNAME)复合包，接收端用它把rtp时间戳对到ntp时间，做音视频同步
+     * @param ntp_time  64位ntp格式的当前时间
+     * @param timestamp 和ntp_time对应的rtp时间戳
+     * @return 写入buf的字节数，size不够时返回-1
+     */
+    int BuildSenderReport(uint64_t ntp_time, uint32_t timestamp, uint8_t *buf, int size);
+private:
+    int packetizeVideo(const uint8_t *data, int size, uint32_t timestamp,
+                       std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices);
+    int packetizeAac(const uint8_t *data, int size, uint32_t timestamp,
+                     std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices);
+    // 单个nal或者合并的STAP-A/AP; nals是待合并的nal，只有一个时按单个nal发送
+    void flushNals(const std::vector<std::pair<const uint8_t *, int> > &nals, uint32_t timestamp, bool marker,
+                   std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices);
+    // 写rtp头，返回负载在buffer里的偏移
+    int addPacket(int payload_size, uint32_t timestamp, bool marker,
+                  std::vector<uint8_t> &buffer, std::vector<RtpSlice> &slices);
+
+    std::string codec_;
+    bool hevc_ = false;
+    int nal_header_size_ = 1;   // H264是1字节，H265是2字节
+    std::string cname_;
+    int payload_type_ = 96;
+    uint32_t ssrc_ = 0;
+    uint16_t sequence_ = 0;
+    int mtu_ = 1400;
+    int max_payload_ = 1400 - RTP_HEADER_SIZE;
+    // SR里的发送统计
+    uint32_t packet_count_ = 0;
+    uint32_t octet_count_ = 0;  // 只算负载，不含rtp头
+};
+
+#endif // RTPPACKETIZER_H
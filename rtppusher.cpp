@@ -0,0 +1,506 @@
+#include <chrono>
+#include <random>
+#include <thread>
+#include <stdlib.h>
+#include <string.h>
+#include "rtppusher.h"
+#include "timesutil.h"
+#include "dlog.h"
+
+RtpPusher::RtpPusher():
+    reference_lost_(false), dropped_packets_(0), sender_reports_(0)
+{
+    memset(streams_, 0, sizeof(streams_));
+    memset(send_stats_, 0, sizeof(send_stats_));
+    LogInfo("RtpPusher create");
+}
+
+RtpPusher::~RtpPusher()
+{
+    DeInit();
+}
+
+RET_CODE RtpPusher::Init(const Properties &properties)
+{
+    // 1.读取参数
+    std::string url         = properties.GetProperty("url", "");
+    sdp_file_               = properties.GetProperty("sdp_file", "");
+    mtu_                    = properties.GetProperty("mtu", 1400);
+    rtcp_interval_          = properties.GetProperty("rtcp_interval", 5000);
+    max_queue_duration_     = properties.GetProperty("max_queue_duration", 1000);
+    audio_frame_duration_   = atof(properties.GetProperty("audio_frame_duration", "0"));
+    video_frame_duration_   = properties.GetProperty("video_frame_duration", 0);
+    video_max_interval_     = properties.GetProperty("video_max_interval", 0);
+    intra_refresh_          = properties.GetProperty("intra_refresh", false);
+    keyframe_request_interval_ = properties.GetProperty("keyframe_request_interval", 1000);
+    pacing_                 = properties.GetProperty("pacing", false);
+    std::string send_mode   = properties.GetProperty("send_mode", "gso");
+    if(send_mode == "sendto") {
+        send_mode_ = UDP_SEND_SENDTO;
+    } else if(send_mode == "sendmmsg") {
+        send_mode_ = UDP_SEND_SENDMMSG;
+    } else {
+        send_mode_ = UDP_SEND_GSO;
+    }
+
+    // 2.解析rtp://host:port
+    char proto[16] = {0};
+    char host[256] = {0};
+    av_url_split(proto, sizeof(proto), NULL, 0, host, sizeof(host), &port_, NULL, 0, url.c_str());
+    host_ = host;
+    if(strcmp(proto, "rtp") != 0 || host_.empty() || port_ <= 0 || port_ > 65532 || max_queue_duration_ <= 0
+            || rtcp_interval_ < 0) {
+        LogError("url:%s, max_queue_duration:%d, rtcp_interval:%d is invalid", url.c_str(),
+                 max_queue_duration_, rtcp_interval_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    // windows上由它初始化winsock
+    avformat_network_init();
+
+    // 3.创建待发队列，和其他目的地的队列相互独立
+    queue_ = new PacketQueue(audio_frame_duration_, video_frame_duration_);
+    queue_->SetRecoveryPoint(intra_refresh_);
+    queue_->SetVideoMaxInterval(video_max_interval_);
+
+    // 4.发送节奏，目标码率在配置流的时候从编码器读取
+    if(pacing_) {
+        Properties pacer_properties;
+        const char *pacer_keys[][2] = {
+            {"pacing_headroom",         "headroom"},
+            {"pacing_burst",            "burst"},
+            {"pacing_frame_fraction",   "frame_fraction"},
+        };
+        for(size_t i = 0; i < sizeof(pacer_keys) / sizeof(pacer_keys[0]); i++) {
+            if(properties.HasProperty(pacer_keys[i][0])) {
+                pacer_properties.SetProperty(pacer_keys[i][1], properties.GetProperty(pacer_keys[i][0]));
+            }
+        }
+        pacer_properties.SetProperty("bitrate", 1024*1024);
+        pacer_properties.SetProperty("frame_duration", video_frame_duration_ > 0 ? (int)video_frame_duration_ : 40);
+        pacer_ = new Pacer();
+        if(pacer_->Init(pacer_properties) != RET_OK) {
+            LogError("Pacer Init failed");
+            return RET_FAIL;
+        }
+    }
+    return RET_OK;
+}
+
+void RtpPusher::DeInit()
+{
+    // 线程退出前会发完队列里剩余的包
+    Stop();
+    for(int i = 0; i < 2; i++) {
+        if(streams_[i].packetizer) {
+            delete streams_[i].packetizer;
+        }
+        if(streams_[i].sender) {
+            delete streams_[i].sender;
+        }
+        if(streams_[i].rtcp_sender) {
+            delete streams_[i].rtcp_sender;
+        }
+        avcodec_parameters_free(&streams_[i].par);
+    }
+    memset(streams_, 0, sizeof(streams_));
+    if(connected_) {
+        LogInfo("rtp %s:%d finished, dropped packets:%lld", host_.c_str(), port_, (long long)dropped_packets_);
+        connected_ = false;
+    }
+    if(queue_) {
+        queue_->Abort();
+        queue_->Drop(true, 0);
+        delete queue_;
+        queue_ = NULL;
+    }
+    if(pacer_) {
+        delete pacer_;
+        pacer_ = NULL;
+    }
+}
+
+RET_CODE RtpPusher::ConfigVideoStream(const AVCodecContext *ctx)
+{
+    if(!ctx) {
+        LogError("ctx is null");
+        return RET_FAIL;
+    }
+    // sdp里面的sprop参数集从extradata生成
+    if(ctx->codec_id != AV_CODEC_ID_H264 && ctx->codec_id != AV_CODEC_ID_HEVC) {
+        LogError("rtp packetizer can't support video codec:%s", avcodec_get_name(ctx->codec_id));
+        return RET_ERR_NOT_SUPPORT;
+    }
+    if(!ctx->extradata || ctx->extradata_size <= 0) {
+        LogError("video extradata is empty");
+        return RET_FAIL;
+    }
+    return configStream(ctx, E_VIDEO_TYPE, ctx->codec_id == AV_CODEC_ID_HEVC ? "h265" : "h264", 90000);
+}
+
+RET_CODE RtpPusher::ConfigAudioStream(const AVCodecContext *ctx)
+{
+    if(!ctx) {
+        LogError("ctx is null");
+        return RET_FAIL;
+    }
+    if(ctx->codec_id == AV_CODEC_ID_AAC) {
+        // sdp的config从AudioSpecificConfig生成
+        if(!ctx->extradata || ctx->extradata_size <= 0) {
+            LogError("aac extradata is empty");
+            return RET_FAIL;
+        }
+        return configStream(ctx, E_AUDIO_TYPE, "aac", ctx->sample_rate);
+    }
+    if(ctx->codec_id == AV_CODEC_ID_OPUS && ctx->channels <= 2) {
+        return configStream(ctx, E_AUDIO_TYPE, "opus", 48000);     // opus的rtp时钟总是48khz
+    }
+    LogError("rtp packetizer can't support audio codec:%s", avcodec_get_name(ctx->codec_id));
+    return RET_ERR_NOT_SUPPORT;
+}
+
+RET_CODE RtpPusher::configStream(const AVCodecContext *ctx, MediaType media_type, const char *codec, int clock_rate)
+{
+    if(!queue_) {
+        LogError("RtpPusher is not initialized");
+        return RET_FAIL;
+    }
+    RtpStream &stream = streams_[media_type];
+    if(stream.par) {
+        LogError("%s stream is configured", codec);
+        return RET_FAIL;
+    }
+    stream.par = avcodec_parameters_alloc();
+    if(!stream.par || avcodec_parameters_from_context(stream.par, ctx) < 0) {
+        LogError("save %s parameters failed", codec);
+        return RET_FAIL;
+    }
+    stream.codec = codec;
+    stream.clock_rate = clock_rate;
+    if(E_VIDEO_TYPE == media_type) {
+        video_bitrate_ = (int)ctx->bit_rate;
+    } else {
+        audio_bitrate_ = (int)ctx->bit_rate;
+    }
+    std::mt19937 rand((unsigned int)(TimesUtil::GetTimeMillisecond() ^ (intptr_t)&stream));
+    stream.timestamp_offset = rand();
+    if(E_VIDEO_TYPE == media_type) {
+        queue_->SetVideoCodec(ctx->codec_id == AV_CODEC_ID_HEVC);
+    }
+    return RET_OK;
+}
+
+RET_CODE RtpPusher::Connect()
+{
+    // 1.负载类型和端口按sdp里的顺序: 视频在前
+    int index = 0;
+    for(int type = E_VIDEO_TYPE; type >= E_AUDIO_TYPE; type--) {
+        RtpStream &stream = streams_[type];
+        if(!stream.par) {
+            continue;
+        }
+        stream.payload_type = 96 + index;
+        stream.port = port_ + index * 2;
+        Properties properties;
+        properties.SetProperty("codec", stream.codec);
+        properties.SetProperty("payload_type", stream.payload_type);
+        properties.SetProperty("mtu", mtu_);
+        stream.packetizer = new RtpPacketizer();
+        if(stream.packetizer->Init(properties) != RET_OK) {
+            LogError("RtpPacketizer Init failed");
+            return RET_FAIL;
+        }
+        stream.sender = new UdpBatchSender();
+        if(stream.sender->Open(host_, stream.port, send_mode_) != RET_OK) {
+            LogError("UdpBatchSender Open failed");
+            return RET_FAIL;
+        }
+        // rtcp按RFC 3550用rtp端口+1，sdp里不用另外写a=rtcp
+        if(rtcp_interval_ > 0) {
+            stream.rtcp_sender = new UdpBatchSender();
+            if(stream.rtcp_sender->Open(host_, stream.port + 1, UDP_SEND_SENDTO) != RET_OK) {
+                LogError("rtcp UdpBatchSender Open failed");
+                return RET_FAIL;
+            }
+        }
+        index++;
+    }
+    if(0 == index) {
+        LogError("no stream configured");
+        return RET_FAIL;
+    }
+
+    // 2.接收端按sdp打开
+    if(!sdp_file_.empty() && writeSdp() != RET_OK) {
+        return RET_FAIL;
+    }
+    if(pacer_) {
+        pacer_->SetBitrate(video_bitrate_ + audio_bitrate_);
+    }
+    connected_ = true;
+    return Start();     // 启动线程
+}
+
+// 用libavformat生成sdp，sprop参数集、AAC的config和rtp muxer完全一样
+RET_CODE RtpPusher::writeSdp()
+{
+    AVFormatContext *ctxs[2] = {NULL, NULL};
+    int nb_ctxs = 0;
+    RET_CODE result = RET_FAIL;
+    char sdp[4096] = {0};
+    FILE *fp = NULL;
+    for(int type = E_VIDEO_TYPE; type >= E_AUDIO_TYPE; type--) {
+        RtpStream &stream = streams_[type];
+        if(!stream.par) {
+            continue;
+        }
+        char url[512] = {0};
+        snprintf(url, sizeof(url), "rtp://%s:%d", host_.c_str(), stream.port);
+        if(avformat_alloc_output_context2(&ctxs[nb_ctxs], NULL, "rtp", url) < 0) {
+            LogError("alloc rtp context for sdp failed");
+            goto end;
+        }
+        AVStream *st = avformat_new_stream(ctxs[nb_ctxs], NULL);
+        nb_ctxs++;
+        if(!st || avcodec_parameters_copy(st->codecpar, stream.par) < 0) {
+            LogError("create stream for sdp failed");
+            goto end;
+        }
+    }
+    if(av_sdp_create(ctxs, nb_ctxs, sdp, sizeof(sdp)) < 0) {
+        LogError("av_sdp_create failed");
+        goto end;
+    }
+    fp = fopen(sdp_file_.c_str(), "wb");
+    if(!fp) {
+        LogError("fopen %s failed", sdp_file_.c_str());
+        goto end;
+    }
+    fwrite(sdp, 1, strlen(sdp), fp);
+    fclose(fp);
+    LogInfo("sdp %s:\n%s", sdp_file_.c_str(), sdp);
+    result = RET_OK;
+end:
+    for(int i = 0; i < nb_ctxs; i++) {
+        avformat_free_context(ctxs[i]);
+    }
+    return result;
+}
+
+RET_CODE RtpPusher::Push(const AVPacket *pkt, MediaType media_type)
+{
+    if(!connected_ || !pkt) {
+        return RET_FAIL;
+    }
+    if((media_type != E_VIDEO_TYPE && media_type != E_AUDIO_TYPE) || !streams_[media_type].sender) {
+        return RET_OK;
+    }
+    // 1.网络跟不上时丢掉旧的包，只保留一半时长并从关键帧开始，不阻塞编码线程
+    //   队列里没有剩下关键帧时接收端的参考帧断了，由发送线程处理
+    if(queue_->GetVideoDuration() > max_queue_duration_ || queue_->GetAudioDuration() > max_queue_duration_) {
+        int before = queue_->GetAudioPackets() + queue_->GetVideoPackets();
+        if(queue_->Drop(false, max_queue_duration_ / 2) == 1) {
+            reference_lost_ = true;
+        }
+        int dropped = before - queue_->GetAudioPackets() - queue_->GetVideoPackets();
+        dropped_packets_ += dropped;
+        LogWarn("rtp queue is full, drop %d packets", dropped);
+    }
+    // 2.共享数据: 只增加buffer的引用
+    AVPacket *ref = av_packet_alloc();
+    if(!ref) {
+        LogError("av_packet_alloc failed");
+        return RET_ERR_OUTOFMEMORY;
+    }
+    if(av_packet_ref(ref, pkt) < 0) {
+        LogError("av_packet_ref failed");
+        av_packet_free(&ref);
+        return RET_FAIL;
+    }
+    if(queue_->Push(ref, media_type) < 0) {
+        av_packet_free(&ref);
+        return RET_FAIL;
+    }
+    return RET_OK;
+}
+
+void RtpPusher::SetBitrate(int video_bitrate)
+{
+    video_bitrate_ = video_bitrate;
+    if(pacer_) {
+        pacer_->SetBitrate(video_bitrate + audio_bitrate_);
+    }
+}
+
+void RtpPusher::SetVideoFrameDuration(double video_frame_duration)
+{
+    if(pacer_) {
+        pacer_->SetFrameDuration(video_frame_duration);
+    }
+    if(queue_) {
+        queue_->SetVideoFrameDuration(video_frame_duration);
+    }
+}
+
+void RtpPusher::AddKeyframeCallback(std::function<void ()> callback)
+{
+    keyframe_callback_ = callback;
+}
+
+RET_CODE RtpPusher::GetStats(RtpPusherStats *stats)
+{
+    if(!stats || !queue_) {
+        return RET_FAIL;
+    }
+    queue_->GetStats(&stats->queue);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats->video = send_stats_[E_VIDEO_TYPE];
+    stats->audio = send_stats_[E_AUDIO_TYPE];
+    stats->dropped_packets = dropped_packets_;
+    stats->sender_reports = sender_reports_;
+    memset(&stats->pacer, 0, sizeof(stats->pacer));
+    if(pacer_) {
+        pacer_->GetStats(&stats->pacer);
+    }
+    return RET_OK;
+}
+
+void RtpPusher::Loop()
+{
+    LogInfo("Loop into");
+    AVPacket *pkt = NULL;
+    MediaType media_type;
+    while(true) {
+        checkKeyframeRequest();
+        int ret = queue_->PopWithTimeout(&pkt, media_type, 100);
+        if(1 == ret) {
+            if(sendPacket(pkt, media_type) < 0) {
+                LogError("send %s packet failed", E_VIDEO_TYPE == media_type ? "video" : "audio");
+            }
+            av_packet_free(&pkt);
+            continue;
+        }
+        // 请求退出时先把队列发完
+        if(ret < 0 || request_abort_) {
+            break;
+        }
+    }
+    LogInfo("Loop leave");
+}
+
+// 丢包后请求IDR，两次请求至少间隔keyframe_request_interval_，被限制的请求延后发出
+// 丢包之后编码器已经自然出了关键帧(或者recovery point)的话就不用再请求
+// 没有设置keyframe_callback_时不驱动编码器，从队列里的下一个解码起点继续
+void RtpPusher::checkKeyframeRequest()
+{
+    if(reference_lost_.exchange(false) && !keyframe_pending_) {
+        keyframe_pending_ = true;
+        random_access_count_ = queue_->GetRandomAccessCount();
+    }
+    if(!keyframe_pending_) {
+        return;
+    }
+    if(!keyframe_callback_) {
+        keyframe_pending_ = false;
+        int dropped = queue_->DropToNextRandomAccess();
+        dropped_packets_ += dropped;
+        LogInfo("rtp %s:%d reference lost, resume at next random access, dropped:%d", host_.c_str(), port_, dropped);
+        return;
+    }
+    if(queue_->GetRandomAccessCount() > random_access_count_) {
+        keyframe_pending_ = false;
+        return;
+    }
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    if(now - last_keyframe_request_time_ < keyframe_request_interval_) {
+        return;
+    }
+    keyframe_pending_ = false;
+    last_keyframe_request_time_ = now;
+    LogInfo("reference lost, request keyframe");
+    keyframe_callback_();
+}
+
+int RtpPusher::sendPacket(AVPacket *pkt, MediaType media_type)
+{
+    RtpStream &stream = streams_[media_type];
+    // 1.rtp时间戳按pts，有b帧时也是显示时间
+    uint32_t timestamp = stream.timestamp_offset
+            + (uint32_t)av_rescale(pkt->pts, stream.clock_rate, 1000);
+    buffer_.clear();
+    slices_.clear();
+    if(stream.packetizer->Packetize(pkt->data, pkt->size, timestamp, buffer_, slices_) < 0) {
+        return -1;
+    }
+    // 2.视频按令牌桶分批，音频整帧一次发出
+    RET_CODE ret = pacer_ && E_VIDEO_TYPE == media_type ? sendPaced(stream.sender)
+                                                        : stream.sender->Send(buffer_.data(), slices_);
+    // 3.第一个包确定pts和墙上时间的对应关系，之后按间隔发SR
+    if(AV_NOPTS_VALUE == clock_base_) {
+        clock_base_ = av_gettime() - pkt->pts * 1000;
+    }
+    sendSenderReport(stream);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stream.sender->GetStats(&send_stats_[media_type]);
+    return ret == RET_OK ? 0 : -1;
+}
+
+void RtpPusher::sendSenderReport(RtpStream &stream)
+{
+    if(!stream.rtcp_sender) {
+        return;
+    }
+    int64_t now = av_gettime();
+    if(stream.last_report_time > 0 && now - stream.last_report_time < (int64_t)rtcp_interval_ * 1000) {
+        return;
+    }
+    stream.last_report_time = now;
+    // 1.ntp时间从1900年开始，低32位是秒的小数部分
+    uint64_t ntp_time = ((uint64_t)(now / 1000000 + 2208988800LL) << 32)
+            | (uint64_t)((now % 1000000) * 4294967296LL / 1000000);
+    // 2.现在对应的pts换成rtp时间戳，音视频用同一个clock_base_，接收端才能同步
+    uint32_t timestamp = stream.timestamp_offset
+            + (uint32_t)av_rescale(now - clock_base_, stream.clock_rate, 1000000);
+    uint8_t report[128];
+    int size = stream.packetizer->BuildSenderReport(ntp_time, timestamp, report, sizeof(report));
+    if(size < 0) {
+        return;
+    }
+    std::vector<RtpSlice> slices(1);
+    slices[0].offset = 0;
+    slices[0].size = size;
+    if(stream.rtcp_sender->Send(report, slices) == RET_OK) {
+        sender_reports_++;
+    }
+}
+
+RET_CODE RtpPusher::sendPaced(UdpBatchSender *sender)
+{
+    RET_CODE ret = RET_OK;
+    int burst_bytes = pacer_->GetBurstBytes();
+    int64_t deadline = av_gettime_relative() + pacer_->GetMaxSpread();
+    int64_t remaining = 0;
+    for(size_t i = 0; i < slices_.size(); i++) {
+        remaining += slices_[i].size;
+    }
+    size_t i = 0;
+    while(i < slices_.size()) {
+        // 1.凑一批，不超过桶深，至少一个包
+        batch_.clear();
+        int bytes = 0;
+        while(i < slices_.size() && (batch_.empty() || bytes + slices_[i].size <= burst_bytes)) {
+            bytes += slices_[i].size;
+            batch_.push_back(slices_[i]);
+            i++;
+        }
+        // 2.先还上前面欠的令牌再发
+        int64_t wait = pacer_->Acquire(av_gettime_relative(), bytes, deadline, remaining);
+        if(wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+        remaining -= bytes;
+        if(sender->Send(buffer_.data(), batch_) != RET_OK) {
+            ret = RET_FAIL;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,140 @@
+#ifndef RTPPUSHER_H
+#define RTPPUSHER_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "mediabase.h"
+#include "commonlooper.h"
+#include "packetqueue.h"
+#include "rtppacketizer.h"
+#include "udpbatchsender.h"
+#include "pacer.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "libavutil/time.h"
+}
+
+typedef struct rtp_pusher_stats {
+    PacketQueueStats queue;     // 当前队列
+    UdpSendStats video;         // 每一路的包数和系统调用次数
+    UdpSendStats audio;
+    int64_t dropped_packets;    // 队列超过上限丢掉的包
+    int64_t sender_reports;     // 发出的rtcp SR
+    PacerStats pacer;           // 关闭pacing时全是0
+}RtpPusherStats;
+
+// 直接推rtp/udp: 自己打包，一帧的rtp包用sendmmsg/UDP_SEGMENT一次发出，不经过libavformat的rtp muxer
+// 没有rtsp握手，接收端用sdp_file打开(比如ffplay -protocol_whitelist file,udp,rtp stream.sdp)
+// 视频发到url的端口，音频发到端口+2，rtcp SR发到各自的端口+1; 负载类型和sdp一致，视频96，音频97
+class RtpPusher: public CommonLooper
+{
+public:
+    RtpPusher();
+    virtual ~RtpPusher();
+    /**
+     * @brief Init
+     * @param "url", rtp://host:port
+     *        "sdp_file", 给接收端的sdp，为空时不写
+     *        "mtu", rtp包的最大字节数，默认1400
+     *        "rtcp_interval", rtcp SR的发送间隔ms，默认5000，0不发
+     *        "send_mode", gso、sendmmsg或者sendto，默认gso，不支持时降级
+     *        "max_queue_duration", 待发队列的最大时长ms，超过时丢到关键帧，默认1000
+     *        "audio_frame_duration"/"video_frame_duration", 估算队列时长用，单位ms，音频可以是小数(opus 2.5ms)
+     *        "video_max_interval", 可变帧率时两帧的最大间隔ms
+     *        "intra_refresh", 视频没有IDR时以recovery point作为丢包的起点
+     *        "keyframe_request_interval", 两次IDR请求的最小间隔ms，默认1000，设置了AddKeyframeCallback才用到
+     *        "pacing", 视频帧的rtp包按令牌桶分批发送，默认0
+     *        "pacing_headroom"/"pacing_burst"/"pacing_frame_fraction", 见Pacer
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    void DeInit();
+    // 在Connect之前添加音视频流，视频H264或者H265
+    RET_CODE ConfigVideoStream(const AVCodecContext *ctx);
+    RET_CODE ConfigAudioStream(const AVCodecContext *ctx);
+    // 打开socket并写sdp，成功后启动线程
+    RET_CODE Connect();
+    /**
+     * @brief Push 发送一个包，pts单位为ms
+     *        只调用av_packet_ref增加引用，调用者仍然拥有pkt
+     */
+    RET_CODE Push(const AVPacket *pkt, MediaType media_type);
+    // 码率自适应或者降级之后更新视频码率，可以在任意线程调用
+    void SetBitrate(int video_bitrate);
+    void SetVideoFrameDuration(double video_frame_duration);
+    // 丢包导致接收端参考帧丢失时回调，请求编码器出IDR，在发送线程里执行
+    // 不设置时不请求IDR，丢掉解不了的视频，从队列里的下一个解码起点继续
+    void AddKeyframeCallback(std::function<void()> callback);
+    // 可以在任意线程获取
+    RET_CODE GetStats(RtpPusherStats *stats);
+
+    virtual void Loop();
+private:
+    typedef struct rtp_stream {
+        RtpPacketizer *packetizer;
+        UdpBatchSender *sender;
+        UdpBatchSender *rtcp_sender;
+        AVCodecParameters *par;
+        const char *codec;
+        int clock_rate;
+        int payload_type;
+        int port;
+        uint32_t timestamp_offset;      // 随机的时间戳起点
+        int64_t last_report_time;       // 上次发SR的时间us
+    }RtpStream;
+
+    RET_CODE configStream(const AVCodecContext *ctx, MediaType media_type, const char *codec, int clock_rate);
+    RET_CODE writeSdp();
+    int sendPacket(AVPacket *pkt, MediaType media_type);
+    // 按桶深分批发出一帧，每批之前等令牌，整帧不超过帧间隔的frame_fraction
+    RET_CODE sendPaced(UdpBatchSender *sender);
+    // 到了间隔时发rtcp SR，音视频的时间戳按同一个时钟对到ntp时间
+    void sendSenderReport(RtpStream &stream);
+    void checkKeyframeRequest();
+
+    std::string host_;
+    int port_ = 0;
+    std::string sdp_file_;
+    int mtu_ = 1400;
+    int rtcp_interval_ = 5000;
+    int send_mode_ = UDP_SEND_GSO;
+    int max_queue_duration_ = 1000;
+    double audio_frame_duration_ = 0;
+    double video_frame_duration_ = 0;
+    int video_max_interval_ = 0;
+    bool intra_refresh_ = false;
+
+    RtpStream streams_[2];              // 按MediaType索引
+    int64_t clock_base_ = AV_NOPTS_VALUE;   // 墙上时间us减去pts，发第一个包时确定，所有流共用
+    PacketQueue *queue_ = NULL;
+    bool connected_ = false;
+    // 一帧打出来的rtp包，只在发送线程使用，保留容量避免每帧分配
+    std::vector<uint8_t> buffer_;
+    std::vector<RtpSlice> slices_;
+    std::vector<RtpSlice> batch_;
+
+    // 发送节奏: 速率是音视频码率加上余量，只有视频等待，音频包小并且对延迟敏感
+    bool pacing_ = false;
+    int audio_bitrate_ = 0;
+    int video_bitrate_ = 0;
+    Pacer *pacer_ = NULL;
+
+    // IDR请求，和RtspPusher一样: 参考帧断了先记下来，由发送线程请求IDR或者跳到下一个解码起点
+    std::function<void()> keyframe_callback_ = NULL;
+    int keyframe_request_interval_ = 1000;
+    int64_t last_keyframe_request_time_ = 0;
+    bool keyframe_pending_ = false;         // 丢包后还没有发出的请求
+    int64_t random_access_count_ = 0;       // 参考帧丢失时队列累计的解码起点数量
+    std::atomic<bool> reference_lost_;      // Push里丢包时参考帧断了
+
+    std::mutex stats_mutex_;
+    UdpSendStats send_stats_[2];
+    std::atomic<int64_t> dropped_packets_;
+    std::atomic<int64_t> sender_reports_;
+};
+
+#endif // RTPPUSHER_H
@@ -0,0 +1,186 @@
+#include <chrono>
+#include <ctime>
+#include <sstream>
+#include <string.h>
+#include "rtpsenderbench.h"
+#include "dlog.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+static int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+RtpSenderBench::RtpSenderBench()
+{
+
+}
+
+RtpSenderBench::~RtpSenderBench()
+{
+    if(receiver_ != INVALID_SOCKET) {
+        closesocket(receiver_);
+    }
+}
+
+RET_CODE RtpSenderBench::Init(const Properties &properties)
+{
+    // 1. 读取参数
+    host_       = properties.GetProperty("host", "127.0.0.1");
+    port_       = properties.GetProperty("port", 5004);
+    bitrate_    = properties.GetProperty("bitrate", 4*1024*1024);
+    fps_        = properties.GetProperty("fps", 30);
+    gop_        = properties.GetProperty("gop", fps_);
+    frames_     = properties.GetProperty("frames", 300);
+    mtu_        = properties.GetProperty("mtu", 1400);
+    std::stringstream ss(properties.GetProperty("modes", "sendto,sendmmsg,gso"));
+    std::string item;
+    modes_.clear();
+    while(std::getline(ss, item, ',')) {
+        if(item == "sendto") {
+            modes_.push_back(UDP_SEND_SENDTO);
+        } else if(item == "sendmmsg") {
+            modes_.push_back(UDP_SEND_SENDMMSG);
+        } else if(item == "gso") {
+            modes_.push_back(UDP_SEND_GSO);
+        } else if(!item.empty()) {
+            LogWarn("unknown send mode:%s", item.c_str());
+        }
+    }
+    if(modes_.empty() || bitrate_ <= 0 || fps_ <= 0 || gop_ <= 0 || frames_ <= 0) {
+        LogError("bitrate:%d, fps:%d, gop:%d, frames:%d is invalid", bitrate_, fps_, gop_, frames_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+
+    // 2. 本机地址时绑定接收socket，不读取，缓冲区满了由内核丢弃; windows上由avformat初始化winsock
+    avformat_network_init();
+    if(host_ == "127.0.0.1" || host_ == "localhost") {
+        receiver_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)port_);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(receiver_ == INVALID_SOCKET
+                || bind(receiver_, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            LogError("bind 127.0.0.1:%d failed:%d", port_, GetSockError());
+            return RET_FAIL;
+        }
+    }
+
+    // 3. 合成一个gop: 1个IDR + (gop-1)个P，平均码率等于bitrate
+    int frame_bytes = bitrate_ / 8 / fps_;
+    int p_size = (int)((int64_t)frame_bytes * gop_ / (gop_ + 7));
+    if(p_size < 16) {
+        p_size = 16;
+    }
+    Properties packetizer_properties;
+    packetizer_properties.SetProperty("codec", "h264");
+    packetizer_properties.SetProperty("mtu", mtu_);
+    RtpPacketizer packetizer;
+    if(packetizer.Init(packetizer_properties) != RET_OK) {
+        LogError("RtpPacketizer Init failed");
+        return RET_FAIL;
+    }
+    buffers_.resize(frames_);
+    slices_.resize(frames_);
+    total_bytes_ = 0;
+    std::vector<uint8_t> frame;
+    for(int i = 0; i < frames_; i++) {
+        bool idr = (i % gop_) == 0;
+        makeFrame(idr, idr ? p_size * 8 : p_size, frame);
+        uint32_t timestamp = (uint32_t)((int64_t)i * 90000 / fps_);
+        if(packetizer.Packetize(frame.data(), (int)frame.size(), timestamp, buffers_[i], slices_[i]) < 0) {
+            LogError("Packetize frame %d failed", i);
+            return RET_FAIL;
+        }
+        total_bytes_ += buffers_[i].size();
+    }
+    LogInfo("bench rtp %s:%d, %d frames, p frame:%d bytes, idr:%d bytes", host_.c_str(), port_,
+            frames_, p_size, p_size * 8);
+    return RET_OK;
+}
+
+// annexb格式，IDR前面带SPS/PPS，负载填充伪随机数据避免出现起始码
+void RtpSenderBench::makeFrame(bool idr, int size, std::vector<uint8_t> &frame)
+{
+    static const uint8_t sps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27};
+    static const uint8_t pps[] = {0, 0, 0, 1, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+    frame.clear();
+    if(idr) {
+        frame.insert(frame.end(), sps, sps + sizeof(sps));
+        frame.insert(frame.end(), pps, pps + sizeof(pps));
+    }
+    const uint8_t header[] = {0, 0, 0, 1, (uint8_t)(idr ? 0x65 : 0x41)};
+    frame.insert(frame.end(), header, header + sizeof(header));
+    uint32_t seed = (uint32_t)size;
+    for(int i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        frame.push_back((uint8_t)((seed >> 16) | 0x01));
+    }
+}
+
+RET_CODE RtpSenderBench::Run(std::vector<RtpBenchResult> &results)
+{
+    for(size_t i = 0; i < modes_.size(); i++) {
+        RtpBenchResult result;
+        if(runOne(modes_[i], result) != RET_OK) {
+            continue;
+        }
+        LogInfo("bench rtp %s: %lld packets, %lld syscalls, %.1f packets/syscall, %.0fMbps,"
+                " cpu %.1fms, %.1fus/Mbit, %.2f%% cpu at %.1fMbps",
+                result.mode.c_str(), (long long)result.packets, (long long)result.syscalls,
+                result.packets_per_syscall, result.mbps, result.cpu_ms, result.cpu_us_per_mbit,
+                result.cpu_percent, bitrate_ / 1000000.0);
+        results.push_back(result);
+    }
+    return results.empty() ? RET_FAIL : RET_OK;
+}
+
+RET_CODE RtpSenderBench::runOne(int mode, RtpBenchResult &result)
+{
+    // 1. 每种方式一个新的socket
+    UdpBatchSender sender;
+    if(sender.Open(host_, port_, mode) != RET_OK) {
+        LogError("UdpBatchSender Open failed");
+        return RET_FAIL;
+    }
+    if(sender.GetMode() != mode) {
+        LogWarn("%s is not supported, bench as %s",
+                UdpBatchSender::ModeName(mode), UdpBatchSender::ModeName(sender.GetMode()));
+    }
+
+    // 2. 全速发送，一帧一次Send
+    std::clock_t cpu_start = std::clock();
+    int64_t start = now_us();
+    for(int i = 0; i < frames_; i++) {
+        sender.Send(buffers_[i].data(), slices_[i]);
+    }
+    int64_t elapsed = now_us() - start;
+    double cpu_ms = (std::clock() - cpu_start) * 1000.0 / CLOCKS_PER_SEC;
+    UdpSendStats stats;
+    sender.GetStats(&stats);
+    sender.Close();
+    if(stats.syscalls <= 0 || stats.bytes <= 0 || elapsed <= 0) {
+        LogError("%s sent nothing", UdpBatchSender::ModeName(sender.GetMode()));
+        return RET_FAIL;
+    }
+
+    // 3. cpu按发送的数据量归一化
+    double mbit = stats.bytes * 8.0 / 1000000;
+    result.mode                 = UdpBatchSender::ModeName(sender.GetMode());
+    result.frames               = frames_;
+    result.packets              = stats.packets;
+    result.syscalls             = stats.syscalls;
+    result.errors               = stats.errors;
+    result.packets_per_syscall  = (double)stats.packets / stats.syscalls;
+    result.mbps                 = mbit * 1000000 / elapsed;
+    result.cpu_ms               = cpu_ms;
+    result.cpu_us_per_mbit      = cpu_ms * 1000 / mbit;
+    result.cpu_percent          = result.cpu_us_per_mbit * (bitrate_ / 1000000.0) / 10000;
+    return RET_OK;
+}
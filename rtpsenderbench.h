@@ -0,0 +1,63 @@
+#ifndef RTPSENDERBENCH_H
+#define RTPSENDERBENCH_H
+
+#include <string>
+#include <vector>
+#include "mediabase.h"
+#include "rtppacketizer.h"
+#include "udpbatchsender.h"
+
+typedef struct rtp_bench_result {
+    std::string mode;           // 实际使用的发送方式，不支持时是降级后的
+    int frames;
+    int64_t packets;            // 发出的rtp包
+    int64_t syscalls;           // 系统调用次数
+    int64_t errors;
+    double packets_per_syscall;
+    double mbps;                // 全速发送的吞吐
+    double cpu_ms;              // 进程cpu时间
+    double cpu_us_per_mbit;     // 每发送1Mbit的cpu时间
+    double cpu_percent;         // 按目标码率实时发送时估算的cpu占用
+}RtpBenchResult;
+
+// 用合成的H264帧比较sendto/sendmmsg/GSO: 每种方式发送同样的rtp包，统计每次系统调用发出的包数和cpu
+// 打包在计时之前完成，只测发送; 本地绑定一个不读的接收socket，避免发到没有监听的端口
+class RtpSenderBench
+{
+public:
+    RtpSenderBench();
+    ~RtpSenderBench();
+    /**
+     * @brief Init
+     * @param "host"/"port", 目的地址，默认127.0.0.1:5004，是本机地址时绑定接收socket
+     *        "bitrate", 合成码流的码率bps，默认4M
+     *        "fps"/"gop", 帧率和关键帧间隔，IDR是P帧大小的8倍
+     *        "frames", 帧数，默认300
+     *        "mtu", 默认1400
+     *        "modes", 逗号分隔的列表，默认"sendto,sendmmsg,gso"
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    // 跑完所有方式，结果通过日志输出
+    RET_CODE Run(std::vector<RtpBenchResult> &results);
+private:
+    RET_CODE runOne(int mode, RtpBenchResult &result);
+    void makeFrame(bool idr, int size, std::vector<uint8_t> &frame);
+
+    std::string host_ = "127.0.0.1";
+    int port_ = 5004;
+    int bitrate_ = 4*1024*1024;
+    int fps_ = 30;
+    int gop_ = 30;
+    int frames_ = 300;
+    int mtu_ = 1400;
+    std::vector<int> modes_;
+
+    // 预先打好的rtp包，每帧一组
+    std::vector<std::vector<uint8_t> > buffers_;
+    std::vector<std::vector<RtpSlice> > slices_;
+    int64_t total_bytes_ = 0;
+    SOCKET receiver_ = INVALID_SOCKET;
+};
+
+#endif // RTPSENDERBENCH_H
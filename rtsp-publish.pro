@@ -12,7 +12,8 @@ LIBS += $$PWD/ffmpeg-4.2.1-win32-dev/lib/avformat.lib   \
         $$PWD/ffmpeg-4.2.1-win32-dev/lib/avutil.lib     \
         $$PWD/ffmpeg-4.2.1-win32-dev/lib/postproc.lib   \
         $$PWD/ffmpeg-4.2.1-win32-dev/lib/swresample.lib \
-        $$PWD/ffmpeg-4.2.1-win32-dev/lib/swscale.lib
+        $$PWD/ffmpeg-4.2.1-win32-dev/lib/swscale.lib    \
+        -lws2_32
 #INCLUDEPATH += $$PWD/SDL2/include
 #LIBS += $$PWD/SDL2/lib/x86/SDL2.lib
 }
@@ -24,8 +25,29 @@ SOURCES += main.cpp \
     pushwork.cpp \
     avpublishtime.cpp \
     videocapturer.cpp \
+    audioencoder.cpp \
     aacencoder.cpp \
+    opusencoder.cpp \
+    silencedetector.cpp \
+    dumpwriter.cpp \
+    mp4recorder.cpp \
+    dvrring.cpp \
+    spilllog.cpp \
+    interleaver.cpp \
+    pacer.cpp \
+    encoderstats.cpp \
+    regiondetector.cpp \
+    videoencoder.cpp \
     h264encoder.cpp \
+    h265encoder.cpp \
+    h264encoderbench.cpp \
+    rtppacketizer.cpp \
+    udpbatchsender.cpp \
+    rtppusher.cpp \
+    rtpsenderbench.cpp \
+    bitratecontroller.cpp \
+    nalutil.cpp \
+    videoladder.cpp \
     rtsppusher.cpp
 
 HEADERS += \
@@ -37,8 +59,29 @@ HEADERS += \
     timesutil.h \
     avpublishtime.h \
     videocapturer.h \
+    audioencoder.h \
     aacencoder.h \
+    opusencoder.h \
+    silencedetector.h \
+    dumpwriter.h \
+    mp4recorder.h \
+    dvrring.h \
+    spilllog.h \
+    interleaver.h \
+    pacer.h \
+    encoderstats.h \
+    regiondetector.h \
+    videoencoder.h \
     h264encoder.h \
+    h265encoder.h \
+    h264encoderbench.h \
+    rtppacketizer.h \
+    udpbatchsender.h \
+    rtppusher.h \
+    rtpsenderbench.h \
     packetqueue.h \
+    bitratecontroller.h \
+    nalutil.h \
+    videoladder.h \
     rtsppusher.h \
     messagequeue.h
@@ -1,9 +1,33 @@
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <mutex>
 #include "rtsppusher.h"
 #include "timesutil.h"
 #include "dlog.h"
 
+// ffmpeg 4.2.1 libavformat/rtsp.h里RTSPState和RTSPStream开头的几个字段，公开的头文件里没有
+// 推流时每个RTSPStream的transport_priv是rtp muxer的AVFormatContext，udp时它的pb直接写rtp socket
+// 只在avformat 58、muxer的class是"RTSP muxer"时按这个布局读，否则不挂发送节奏
+typedef struct rtsp_state_head {
+    const AVClass *av_class;
+    void *rtsp_hd;
+    int nb_rtsp_streams;
+    void **rtsp_streams;
+}RtspStateHead;
+
+typedef struct rtsp_stream_head {
+    void *rtp_handle;
+    void *transport_priv;
+}RtspStreamHead;
+
+// rtp muxer的AVIOContext -> 挂在上面的RtspPusher，write_packet只给了opaque
+static std::mutex s_rtp_hooks_mutex;
+static std::map<void *, RtspPusher *> s_rtp_hooks;
+
 RtspPusher::RtspPusher( MessageQueue *msg_queue)
-    :msg_queue_(msg_queue)
+    :sent_bytes_(0), sent_packets_(0), reference_lost_(false),
+      rand_((unsigned int)(TimesUtil::GetTimeMillisecond() ^ (intptr_t)this)), msg_queue_(msg_queue)
 {
     LogInfo("RtspPusher create");
 }
@@ -36,9 +60,27 @@ RET_CODE RtspPusher::Init(const Properties &properties)
     url_                    = properties.GetProperty("rtsp_url","");
     rtsp_transport_         = properties.GetProperty("rtsp_transport","");
     rtsp_timeout_           = properties.GetProperty("rtsp_timeout",5000);
+    trailer_timeout_        = properties.GetProperty("rtsp_trailer_timeout",1000);
     max_queue_duration_     = properties.GetProperty("rtsp_max_queue_duration",1000);
-    audio_frame_duration_   = properties.GetProperty("audio_frame_duration",0);
+    audio_frame_duration_   = atof(properties.GetProperty("audio_frame_duration", "0"));
     video_frame_duration_   = properties.GetProperty("video_frame_duration",0);
+    video_max_interval_     = properties.GetProperty("video_max_interval", 0);
+    abr_enable_             = properties.GetProperty("abr_enable", false);
+    keyframe_request_interval_ = properties.GetProperty("keyframe_request_interval", 1000);
+    intra_refresh_          = properties.GetProperty("intra_refresh", false);
+    temporal_layers_        = properties.GetProperty("temporal_layers", 1);
+    shed_high_water_        = properties.GetProperty("shed_high_water", max_queue_duration_*6/10);
+    shed_low_water_         = properties.GetProperty("shed_low_water", max_queue_duration_*3/10);
+    shed_hold_time_         = properties.GetProperty("shed_hold_time", 2000);
+    spill_file_             = properties.GetProperty("spill_file", "");
+    spill_catchup_rate_     = properties.GetProperty("spill_catchup_rate", 200);
+    interleave_max_hold_    = properties.GetProperty("interleave_max_hold", 0);
+    pacing_                 = properties.GetProperty("pacing", false);
+    reconnect_enable_       = properties.GetProperty("reconnect", true);
+    reconnect_min_delay_    = properties.GetProperty("reconnect_min_delay", 500);
+    reconnect_max_delay_    = properties.GetProperty("reconnect_max_delay", 10000);
+    reconnect_max_attempts_ = properties.GetProperty("reconnect_max_attempts", 0);
+    send_layers_            = temporal_layers_;
 
     // Step 2: 检查必要的参数是否为空，如果为空则输出错误日志并返回错误码
     if(url_ == "") {
@@ -60,7 +102,130 @@ RET_CODE RtspPusher::Init(const Properties &properties)
         return RET_FAIL;
     }
 
-    // Step 4: 分配 AVFormatContext 结构体（使用 FFmpeg 的 avformat_alloc_output_context2 函数）
+    // Step 4: 分配 AVFormatContext 结构体，指定 rtsp_transport 的值
+    if(allocOutput() != RET_OK) {
+        return RET_FAIL;
+    }
+    if(reconnect_min_delay_ <= 0 || reconnect_max_delay_ < reconnect_min_delay_) {
+        LogError("reconnect delay:%d~%dms is invalid", reconnect_min_delay_, reconnect_max_delay_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+
+    // Step 6: 创建 PacketQueue 对象（用于存储音视频帧的队列）
+    queue_ = new PacketQueue(audio_frame_duration_,video_frame_duration_);
+    if(!queue_) {
+        LogError("new PacketQueue failed");
+        return RET_ERR_OUTOFMEMORY;
+    }
+    queue_->SetVideoMaxInterval(video_max_interval_);
+    // 溢出模式: 超过内存预算的旧包写到磁盘，恢复后按catchup_rate倍速补发
+    // 内存预算低于max_queue_duration，文件写满之后才会走到丢包
+    if(!spill_file_.empty()) {
+        int64_t spill_max_size = (int64_t)properties.GetProperty("spill_max_size", 1024) * 1024 * 1024;
+        int spill_memory_duration = properties.GetProperty("spill_memory_duration", max_queue_duration_/2);
+        if(spill_catchup_rate_ <= 100) {
+            LogError("spill_catchup_rate:%d%%, must be greater than 100", spill_catchup_rate_);
+            return RET_ERR_ARGUMENTOUTOFRANGE;
+        }
+        if(queue_->EnableSpill(spill_file_, spill_max_size, spill_memory_duration) < 0) {
+            LogError("EnableSpill %s failed", spill_file_.c_str());
+            return RET_FAIL;
+        }
+        LogInfo("spill to %s, memory:%dms, catchup:%d%%", spill_file_.c_str(), spill_memory_duration,
+                spill_catchup_rate_);
+    }
+
+    // Step 7: 码率自适应，水位按max_queue_duration计算，保证先降码率，丢包只是最后手段
+    if(abr_enable_) {
+        Properties abr_properties;
+        abr_properties.SetProperty("start_bitrate", properties.GetProperty("abr_start_bitrate", 1024*1024));
+        abr_properties.SetProperty("high_water", properties.GetProperty("abr_high_water", max_queue_duration_*3/10));
+        abr_properties.SetProperty("low_water", properties.GetProperty("abr_low_water", max_queue_duration_/10));
+        const char *abr_keys[][2] = {
+            {"abr_min_bitrate",      "min_bitrate"},
+            {"abr_max_bitrate",      "max_bitrate"},
+            {"abr_growth_threshold", "growth_threshold"},
+            {"abr_decrease_percent", "decrease_percent"},
+            {"abr_increase_percent", "increase_percent"},
+            {"abr_hold_time",        "hold_time"},
+            {"abr_interval",         "interval"},
+        };
+        for(size_t i = 0; i < sizeof(abr_keys) / sizeof(abr_keys[0]); i++) {
+            if(properties.HasProperty(abr_keys[i][0])) {
+                abr_properties.SetProperty(abr_keys[i][1], properties.GetProperty(abr_keys[i][0]));
+            }
+        }
+        bitrate_controller_ = new BitrateController();
+        if(bitrate_controller_->Init(abr_properties) != RET_OK) {
+            LogError("BitrateController Init failed");
+            return RET_FAIL;
+        }
+    }
+
+    // Step 8: 降级阶梯，在码率自适应的基础上工作
+    std::string ladder = properties.GetProperty("video_ladder", "");
+    if(ladder != "") {
+        if(!bitrate_controller_) {
+            LogWarn("video_ladder need abr_enable, ignore it");
+        } else {
+            Properties ladder_properties;
+            ladder_properties.SetProperty("ladder", ladder);
+            ladder_properties.SetProperty("width", properties.GetProperty("video_width", 1920));
+            ladder_properties.SetProperty("height", properties.GetProperty("video_height", 1080));
+            ladder_properties.SetProperty("fps", properties.GetProperty("video_fps", 25));
+            ladder_properties.SetProperty("bitrate", bitrate_controller_->GetMaxBitrate());
+            ladder_properties.SetProperty("down_time", properties.GetProperty("ladder_down_time", 3000));
+            ladder_properties.SetProperty("up_time", properties.GetProperty("ladder_up_time", 15000));
+            video_ladder_ = new VideoLadder();
+            if(video_ladder_->Init(ladder_properties) != RET_OK) {
+                LogError("VideoLadder Init failed");
+                return RET_FAIL;
+            }
+        }
+    }
+
+    // Step 9: 按dts交织音视频，0代表按出队顺序直接发送
+    if(interleave_max_hold_ > 0) {
+        interleaver_ = new Interleaver(interleave_max_hold_);
+    }
+
+    // Step 10: 发送节奏，目标码率在配置流的时候从编码器读取
+    //         rtp包是libavformat在av_write_frame里面发的，挂在rtp muxer的写回调上，只有udp时能逐包控制
+    if(pacing_ && rtsp_transport_ != "udp") {
+        LogWarn("pacing needs rtsp_transport=udp, transport:%s", rtsp_transport_.c_str());
+        pacing_ = false;
+    }
+    if(pacing_) {
+        Properties pacer_properties;
+        const char *pacer_keys[][2] = {
+            {"pacing_headroom",         "headroom"},
+            {"pacing_burst",            "burst"},
+            {"pacing_frame_fraction",   "frame_fraction"},
+        };
+        for(size_t i = 0; i < sizeof(pacer_keys) / sizeof(pacer_keys[0]); i++) {
+            if(properties.HasProperty(pacer_keys[i][0])) {
+                pacer_properties.SetProperty(pacer_keys[i][1], properties.GetProperty(pacer_keys[i][0]));
+            }
+        }
+        pacer_properties.SetProperty("bitrate", properties.GetProperty("pacing_bitrate", 1024*1024));
+        pacer_properties.SetProperty("frame_duration", video_frame_duration_ > 0 ? (int)video_frame_duration_ : 40);
+        pacer_ = new Pacer();
+        if(pacer_->Init(pacer_properties) != RET_OK) {
+            LogError("Pacer Init failed");
+            return RET_FAIL;
+        }
+    }
+
+    queue_->SetRecoveryPoint(intra_refresh_);
+    queue_->SetTemporalLayers(temporal_layers_);
+    return RET_OK;
+}
+
+RET_CODE RtspPusher::allocOutput()
+{
+    int ret = 0;
+    char str_error[512] = {0};
+    // Step 1: 分配 AVFormatContext 结构体（使用 FFmpeg 的 avformat_alloc_output_context2 函数）
     ret = avformat_alloc_output_context2(&fmt_ctx_, NULL, "rtsp", url_.c_str());
     if(ret < 0) {
         av_strerror(ret,str_error,sizeof(str_error) - 1);
@@ -68,21 +233,13 @@ RET_CODE RtspPusher::Init(const Properties &properties)
         return RET_FAIL;
     }
 
-    // Step 5: 设置 AVFormatContext 的私有数据，指定 rtsp_transport 的值
+    // Step 2: 设置 AVFormatContext 的私有数据，指定 rtsp_transport 的值
     ret = av_opt_set(fmt_ctx_->priv_data,"rtsp_transport",rtsp_transport_.c_str(),0);
     if(ret < 0) {
         av_strerror(ret,str_error,sizeof(str_error) - 1);
         LogError("av_opt_set failed:%s", str_error);
         return RET_FAIL;
     }
-
-    // Step 6: 创建 PacketQueue 对象（用于存储音视频帧的队列）
-    queue_ = new PacketQueue(audio_frame_duration_,video_frame_duration_);
-    if(!queue_) {
-        LogError("new PacketQueue failed");
-        return RET_ERR_OUTOFMEMORY;
-    }
-
     fmt_ctx_->interrupt_callback.callback = decode_interrupt_cb;
     fmt_ctx_->interrupt_callback.opaque = this;
     return RET_OK;
@@ -94,6 +251,7 @@ void RtspPusher::DeInit()
         queue_->Abort();
     }
     Stop();
+    unhookRtpOutput();
     if(fmt_ctx_) {
         avformat_free_context(fmt_ctx_);
         fmt_ctx_ = NULL;
@@ -102,6 +260,50 @@ void RtspPusher::DeInit()
         delete queue_;
         queue_ = NULL;
     }
+    if(bitrate_controller_) {
+        delete bitrate_controller_;
+        bitrate_controller_ = NULL;
+    }
+    if(video_ladder_) {
+        delete video_ladder_;
+        video_ladder_ = NULL;
+    }
+    if(interleaver_) {
+        delete interleaver_;
+        interleaver_ = NULL;
+    }
+    if(pacer_) {
+        delete pacer_;
+        pacer_ = NULL;
+    }
+    avcodec_parameters_free(&video_par_);
+    avcodec_parameters_free(&audio_par_);
+}
+
+RET_CODE RtspPusher::GetInterleaveStats(InterleaveStats *stats)
+{
+    if(!interleaver_) {
+        return RET_FAIL;
+    }
+    interleaver_->GetStats(stats);
+    return RET_OK;
+}
+
+RET_CODE RtspPusher::GetStats(RtspPusherStats *stats)
+{
+    if(!stats || !queue_) {
+        return RET_FAIL;
+    }
+    queue_->GetStats(&stats->queue);
+    stats->sent_bytes = sent_bytes_;
+    stats->sent_packets = sent_packets_;
+    stats->dropped_packets = queue_->GetDroppedPackets();
+    stats->shed_packets = queue_->GetShedPackets();
+    memset(&stats->pacer, 0, sizeof(stats->pacer));
+    if(pacer_) {
+        pacer_->GetStats(&stats->pacer);
+    }
+    return RET_OK;
 }
 
 RET_CODE RtspPusher::Push(AVPacket *pkt, MediaType media_type)
@@ -109,9 +311,33 @@ RET_CODE RtspPusher::Push(AVPacket *pkt, MediaType media_type)
     int ret = queue_->Push(pkt, media_type);
     if(ret < 0) {
         return RET_FAIL;
-    } else {
-        return RET_OK;
     }
+    // 发送线程卡在av_write_frame里时checkPacketQueueDuration不会运行，在入队时兜底
+    // 上限是max_queue_duration的2倍，正常情况由发送线程丢包; 慢的目的地只丢自己队列里的包，不会阻塞编码线程
+    int64_t limit = (int64_t)max_queue_duration_ * 2;
+    if(queue_->GetAudioDuration() > limit || queue_->GetVideoDuration() > limit) {
+        LogWarn("%s sender blocked, drop packet", url_.c_str());
+        if(queue_->Drop(false, max_queue_duration_) == 1) {
+            reference_lost_ = true;
+        }
+    }
+    return RET_OK;
+}
+
+RET_CODE RtspPusher::Drain(int timeout)
+{
+    if(!queue_) {
+        return RET_FAIL;
+    }
+    int64_t start_time = TimesUtil::GetTimeMillisecond();
+    while(!queue_->Empty()) {
+        if(!Running() || TimesUtil::GetTimeMillisecond() - start_time > timeout) {
+            LogWarn("drain timeout, a:%d, v:%d", queue_->GetAudioPackets(), queue_->GetVideoPackets());
+            return RET_FAIL;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return RET_OK;
 }
 
 RET_CODE RtspPusher::Connect()
@@ -119,6 +345,19 @@ RET_CODE RtspPusher::Connect()
     if(!audio_stream_ && !video_stream_) {
         return RET_FAIL;
     }
+    // 目标码率按编码器的码率，打开码率自适应后视频部分跟随调整
+    if(pacer_) {
+        int bitrate = audio_bitrate_;
+        if(video_par_) {
+            bitrate += bitrate_controller_ ? bitrate_controller_->GetBitrate() : (int)video_par_->bit_rate;
+        }
+        pacer_->SetBitrate(bitrate);
+    }
+    // 只有一路时不需要交织
+    if(interleaver_ && (!audio_stream_ || !video_stream_)) {
+        delete interleaver_;
+        interleaver_ = NULL;
+    }
     // 连接服务器
     RestTimeout();
     int ret = avformat_write_header(fmt_ctx_, NULL);
@@ -129,6 +368,8 @@ RET_CODE RtspPusher::Connect()
         return RET_FAIL;
     }
     LogInfo("avformat_write_header ok");
+    connected_ = true;
+    hookRtpOutput();
     return Start();     // 启动线程
 }
 
@@ -146,6 +387,16 @@ RET_CODE RtspPusher::ConfigVideoStream(const AVCodecContext *ctx)
         return RET_FAIL;
     }
 
+    // Step 2.1: 检查rtp是否支持该视频编码，sdp里面的sprop参数集从extradata生成
+    if(ctx->codec_id != AV_CODEC_ID_H264 && ctx->codec_id != AV_CODEC_ID_HEVC) {
+        LogError("rtp can't support video codec_id:%d", ctx->codec_id);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    if(!ctx->extradata || ctx->extradata_size <= 0) {
+        LogError("video extradata is empty, open encoder with AV_CODEC_FLAG_GLOBAL_HEADER");
+        return RET_FAIL;
+    }
+
     // Step 3: 添加视频流
     AVStream *vs = avformat_new_stream(fmt_ctx_,NULL);
     if(!vs) {
@@ -156,12 +407,21 @@ RET_CODE RtspPusher::ConfigVideoStream(const AVCodecContext *ctx)
     vs->codecpar->codec_tag = 0;
     // Step 5: 从编码器拷贝信息到视频流
     avcodec_parameters_from_context(vs->codecpar,ctx);
+    // 重连时重建流，切换档位之后编码器上下文会变，保存一份参数
+    video_par_ = avcodec_parameters_alloc();
+    if(!video_par_ || avcodec_parameters_copy(video_par_, vs->codecpar) < 0) {
+        LogError("save video parameters failed");
+        return RET_FAIL;
+    }
 
 
     // Step 6: 设置video_ctx_, video_stream_, video_index_等成员变量
     video_ctx_ = (AVCodecContext *) ctx;
     video_stream_ = vs;
     video_index_  =  vs->index;       // 整个索引非常重要 fmt_ctx_根据index判别 音视频包
+    if(queue_) {
+        queue_->SetVideoCodec(ctx->codec_id == AV_CODEC_ID_HEVC);
+    }
     // Step 7: 返回成功标志
     return RET_OK;
 }
@@ -180,6 +440,23 @@ RET_CODE RtspPusher::ConfigAudioStream(const AVCodecContext *ctx)
         return RET_FAIL;
     }
 
+    // Step 2.1: 检查rtp是否支持该音频编码
+    if(ctx->codec_id == AV_CODEC_ID_OPUS) {
+        // RFC 7587: rtpmap固定为opus/48000/2，多声道(multistream)的opus不支持
+        if(ctx->channels > 2) {
+            LogError("rtp opus can't support channels:%d", ctx->channels);
+            return RET_ERR_NOT_SUPPORT;
+        }
+        // OpusHead，带pre-skip信息
+        if(!ctx->extradata || ctx->extradata_size < 19) {
+            LogError("opus extradata is invalid");
+            return RET_FAIL;
+        }
+    } else if(ctx->codec_id != AV_CODEC_ID_AAC) {
+        LogError("rtp can't support audio codec:%s", avcodec_get_name(ctx->codec_id));
+        return RET_ERR_NOT_SUPPORT;
+    }
+
     // Step 3: 添加音频流
     AVStream *as = avformat_new_stream(fmt_ctx_,NULL);
     if(!as) {
@@ -190,6 +467,16 @@ RET_CODE RtspPusher::ConfigAudioStream(const AVCodecContext *ctx)
     as->codecpar->codec_tag = 0;
     // Step 5: 从编码器拷贝信息到视频流
     avcodec_parameters_from_context(as->codecpar,ctx);
+    if(ctx->codec_id == AV_CODEC_ID_OPUS) {
+        // opus的rtp时钟总是48khz，和实际采样率无关
+        as->time_base = av_make_q(1, 48000);
+    }
+    audio_bitrate_ = (int)ctx->bit_rate;
+    audio_par_ = avcodec_parameters_alloc();
+    if(!audio_par_ || avcodec_parameters_copy(audio_par_, as->codecpar) < 0) {
+        LogError("save audio parameters failed");
+        return RET_FAIL;
+    }
 
 
     // Step 6: 设置video_ctx_, video_stream_, video_index_等成员变量
@@ -200,6 +487,32 @@ RET_CODE RtspPusher::ConfigAudioStream(const AVCodecContext *ctx)
     return RET_OK;
 }
 
+void RtspPusher::AddBitrateCallback(std::function<void (int)> callback)
+{
+    bitrate_callback_ = callback;
+}
+
+void RtspPusher::AddLadderCallback(std::function<void (const VideoLadderStep &)> callback)
+{
+    ladder_callback_ = callback;
+}
+
+void RtspPusher::AddKeyframeCallback(std::function<void ()> callback)
+{
+    keyframe_callback_ = callback;
+}
+
+void RtspPusher::SetVideoFrameDuration(double video_frame_duration)
+{
+    video_frame_duration_ = video_frame_duration;
+    if(pacer_) {
+        pacer_->SetFrameDuration(video_frame_duration);
+    }
+    if(queue_) {
+        queue_->SetVideoFrameDuration(video_frame_duration);
+    }
+}
+
 void RtspPusher::Loop()
 {
     LogInfo("Loop into");
@@ -216,12 +529,40 @@ void RtspPusher::Loop()
             LogInfo("abort request");
             break;
         }
+        // 断线期间不调码率，只管重连
+        if(!connected_) {
+            if(!reconnect_enable_) {
+                break;      // 放弃重连，Push里按上限丢包
+            }
+            debugQueue(debug_interval_);
+            checkReconnect();
+            continue;
+        }
 
         debugQueue(debug_interval_);
+        checkBitrate();
+        checkTemporalLayers();
         checkPacketQueueDuration();
+        checkKeyframeRequest();
         // std::this_thread::sleep_for(std::chrono::milliseconds(100));  //人为制造延迟
 
-        ret = queue_->PopWithTimeout(&pkt, media_type, 1000);
+        // 交织器里有包在等另一路时，按它的剩余等待时间出队
+        int timeout = 1000;
+        if(interleaver_) {
+            timeout = interleaver_->GetWaitTime(TimesUtil::GetTimeMillisecond(), timeout);
+        }
+        ret = queue_->PopWithTimeout(&pkt, media_type, timeout);
+        if(1 == ret) {
+            paceCatchup(pkt->pts);
+        }
+        // 交织: 放入交织器，每次放行一个dts最小的包
+        if(interleaver_) {
+            int64_t now = TimesUtil::GetTimeMillisecond();
+            if(1 == ret) {
+                interleaver_->Push(pkt, media_type, now);
+            }
+            ret = interleaver_->Pop(&pkt, media_type, now) ? 1 : 0;
+        }
         if(1 == ret) {
             switch (media_type) {
                 if(request_abort_) {
@@ -248,7 +589,24 @@ void RtspPusher::Loop()
             }
         }
     }
+    if(!connected_) {
+        LogWarn("%s is disconnected, skip trailer", url_.c_str());
+        return;
+    }
+    // 交织器里等待的包按dts顺序发完
+    while(connected_ && interleaver_ && interleaver_->Pop(&pkt, media_type, 0, true)) {
+        sendPacket(pkt, media_type);
+        av_packet_free(&pkt);
+    }
+    if(!connected_) {
+        return;
+    }
+    // 正常退出时连接还在，av_write_trailer发TEARDOWN; 只给trailer_timeout的时间，服务器不回也不会卡住退出
+    RestTimeout();
+    trailer_deadline_ = pre_time_ + trailer_timeout_;
+    unhookRtpOutput();
     ret = av_write_trailer(fmt_ctx_);
+    trailer_deadline_ = 0;
     if(ret < 0) {
         char str_error[512] = {0};
         av_strerror(ret, str_error, sizeof(str_error) -1);
@@ -272,15 +630,112 @@ void RtspPusher::debugQueue(int64_t interval)
         queue_->GetStats(&stats);
         // 打印音视频队列持续时间的调试信息
         LogInfo("duration:a=%lldms, v=%lldms", stats.audio_duration, stats.video_duration);
+        if(interleaver_) {
+            InterleaveStats interleave;
+            interleaver_->GetStats(&interleave);
+            LogInfo("interleave skew:avg=%lldms, max=%lldms, forced:%lld, out_of_order:%lld, held:%d",
+                    interleave.avg_skew, interleave.max_skew, interleave.forced,
+                    interleave.out_of_order, interleave.held);
+        }
+        if(stats.spill_nb_packets > 0) {
+            LogInfo("spill:%d packets, %lldKB, %lldms", stats.spill_nb_packets,
+                    stats.spill_size / 1024, stats.spill_duration);
+        }
+        if(pacer_) {
+            PacerStats pacer;
+            pacer_->GetStats(&pacer);
+            LogInfo("pacer rate:%dkbps, delayed:%lld/%lld, delay:avg=%lldus, max=%lldus, max_write:%d, oversize:%lld",
+                    pacer.rate / 1000, pacer.delayed, pacer.packets, pacer.avg_delay, pacer.max_delay,
+                    pacer.max_write, pacer.oversize);
+        }
         // 更新上一次调试打印的时间为当前时间，为下一次打印准备
         pre_debug_time_ = cur_time;
     }
 }  
 
+// 码率自适应: 队列堆积时降码率，队列排空并稳定后慢慢升码率
+void RtspPusher::checkBitrate()
+{
+    if(!bitrate_controller_) {
+        return;
+    }
+    PacketQueueStats stats;
+    queue_->GetStats(&stats);
+    int64_t duration = stats.audio_duration > stats.video_duration ?
+                stats.audio_duration : stats.video_duration;
+    int reason = BITRATE_REASON_NONE;
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    int bitrate = bitrate_controller_->Update(now, duration, sent_bytes_, &reason);
+    if(bitrate > 0 && pacer_) {
+        pacer_->SetBitrate(bitrate + audio_bitrate_);
+    }
+    if(bitrate > 0) {
+        msg_queue_->notify_msg3(MSG_RTSP_BITRATE_CHANGE, bitrate, reason);
+        if(bitrate_callback_) {
+            bitrate_callback_(bitrate);
+        }
+    }
+
+    // 码率调整不够用时切换档位，新档位从当前码率开始，范围按新档位重新设置
+    if(!video_ladder_) {
+        return;
+    }
+    int index = video_ladder_->Update(now, bitrate_controller_->IsCongested(),
+                                      bitrate_controller_->GetBitrate() <= bitrate_controller_->GetMinBitrate(),
+                                      bitrate_controller_->GetBitrate() >= bitrate_controller_->GetMaxBitrate());
+    if(index < 0) {
+        return;
+    }
+    VideoLadderStep step = video_ladder_->GetStep(index);
+    if(step.width != 0) {
+        bitrate_controller_->SetRange(step.bitrate / 4, step.bitrate);
+        step.bitrate = bitrate_controller_->GetBitrate();
+        if(pacer_) {
+            pacer_->SetBitrate(step.bitrate + audio_bitrate_);
+        }
+    }
+    msg_queue_->notify_msg3(MSG_RTSP_LADDER_CHANGE, index, step.bitrate);
+    if(ladder_callback_) {
+        ladder_callback_(step);
+    }
+}
+
+// 丢掉不被参考的时间层帧率减半，不影响解码也不用等关键帧
+void RtspPusher::checkTemporalLayers()
+{
+    if(temporal_layers_ <= 1) {
+        return;
+    }
+    PacketQueueStats stats;
+    queue_->GetStats(&stats);
+    int64_t duration = stats.audio_duration > stats.video_duration ?
+                stats.audio_duration : stats.video_duration;
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    int send_layers = send_layers_;
+    if(duration > shed_high_water_ && send_layers_ > 1 && now - last_shed_time_ > shed_hold_time_ / 4) {
+        send_layers = send_layers_ - 1;
+    } else if(duration < shed_low_water_ && send_layers_ < temporal_layers_
+              && now - last_shed_time_ > shed_hold_time_) {
+        send_layers = send_layers_ + 1;
+    }
+    if(send_layers == send_layers_) {
+        return;
+    }
+    int dropped = queue_->ShedLayer(send_layers);
+    LogWarn("temporal layers %d -> %d, queue:%lldms, dropped:%d", send_layers_, send_layers, duration, dropped);
+    send_layers_ = send_layers;
+    last_shed_time_ = now;
+    msg_queue_->notify_msg3(MSG_RTSP_LAYER_CHANGE, send_layers_, dropped);
+}
+
 // 监测队列的缓存情况
 void RtspPusher::checkPacketQueueDuration()
 {
-    // Step 1: 获取队列状态
+    // Step 1: 获取队列状态，Push里兜底丢包时参考帧断了的话也要请求IDR
+    if(reference_lost_.exchange(false) && !keyframe_pending_) {
+        keyframe_pending_ = true;
+        random_access_count_ = queue_->GetRandomAccessCount();
+    }
     PacketQueueStats stats;
     queue_->GetStats(&stats);
 
@@ -290,8 +745,69 @@ void RtspPusher::checkPacketQueueDuration()
         msg_queue_->notify_msg3(MSG_RTSP_QUEUE_DURATION, stats.audio_duration, stats.video_duration);
         // Step 4: 打印警告信息
         LogWarn("drop packet -> a:%lld, v:%lld, th:%d", stats.audio_duration, stats.video_duration, max_queue_duration_);
-        // Step 5: 丢弃部分数据包
-        queue_->Drop(false, max_queue_duration_);
+        // Step 5: 丢弃部分数据包，接收端参考帧断了时记录下来请求IDR
+        if(queue_->Drop(false, max_queue_duration_) == 1 && !keyframe_pending_) {
+            keyframe_pending_ = true;
+            random_access_count_ = queue_->GetRandomAccessCount();
+        }
+    }
+}
+
+// 补发磁盘上的积压时按spill_catchup_rate_限速: 媒体时间最多是墙上时间的rate倍
+// 新包还在按1倍速入队，积压按(rate-1)倍速减少; 不限速的话刚恢复的链路马上又被打满
+void RtspPusher::paceCatchup(int64_t pts)
+{
+    if(spill_file_.empty()) {
+        return;
+    }
+    if(queue_->GetSpillPackets() <= 0) {
+        if(catchup_start_time_ >= 0) {
+            LogInfo("spill catch up done, %lldms", TimesUtil::GetTimeMillisecond() - catchup_start_time_);
+            catchup_start_time_ = -1;
+        }
+        return;
+    }
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    if(catchup_start_time_ < 0) {
+        catchup_start_time_ = now;
+        catchup_start_pts_ = pts;
+        LogInfo("spill catch up start, pts:%lld", pts);
+        return;
+    }
+    int64_t ahead = (pts - catchup_start_pts_) * 100 / spill_catchup_rate_ - (now - catchup_start_time_);
+    if(ahead > 0 && !request_abort_) {
+        // pts跳变时不要睡太久，下一个包再接着限速
+        std::this_thread::sleep_for(std::chrono::milliseconds(ahead < 200 ? ahead : 200));
+    }
+}
+
+// 丢包后请求IDR，两次请求至少间隔keyframe_request_interval_，被限制的请求延后发出
+// 丢包之后编码器已经自然出了关键帧(或者recovery point)的话就不用再请求
+// 没有设置keyframe_callback_的(备用目的地)不驱动编码器，从队列里的下一个解码起点继续
+void RtspPusher::checkKeyframeRequest()
+{
+    if(!keyframe_pending_) {
+        return;
+    }
+    if(!keyframe_callback_) {
+        keyframe_pending_ = false;
+        int dropped = queue_->DropToNextRandomAccess();
+        LogInfo("%s reference lost, resume at next random access, dropped:%d", url_.c_str(), dropped);
+        return;
+    }
+    if(queue_->GetRandomAccessCount() > random_access_count_) {
+        keyframe_pending_ = false;
+        return;
+    }
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    if(now - last_keyframe_request_time_ < keyframe_request_interval_) {
+        return;
+    }
+    keyframe_pending_ = false;
+    last_keyframe_request_time_ = now;
+    LogInfo("reference lost, request keyframe");
+    if(keyframe_callback_) {
+        keyframe_callback_();
     }
 }
 
@@ -312,7 +828,17 @@ int RtspPusher::sendPacket(AVPacket *pkt, MediaType media_type)
         return -1;
     }
     pkt->pts = av_rescale_q(pkt->pts, src_time_base, dst_time_base);
+    if(pkt->dts != AV_NOPTS_VALUE) {
+        pkt->dts = av_rescale_q(pkt->dts, src_time_base, dst_time_base);    // 有b帧时dts和pts不同
+    }
     pkt->duration = 0;
+    int size = pkt->size;
+    // 发送节奏: av_write_frame里rtp muxer每写一个rtp包都经过pacedWrite，这一帧最晚在deadline之前发完
+    if(rtp_pb_ && E_VIDEO_TYPE == media_type) {
+        pace_deadline_ = av_gettime_relative() + pacer_->GetMaxSpread();
+        pace_remaining_ = size;
+        pace_budget_ = 0;
+    }
 
     int ret = av_write_frame(fmt_ctx_, pkt);
     if(ret < 0) {
@@ -320,16 +846,259 @@ int RtspPusher::sendPacket(AVPacket *pkt, MediaType media_type)
         char str_error[512] = {0};
         av_strerror(ret, str_error, sizeof(str_error) -1);
         LogError("av_opt_set failed:%s", str_error);
+        // 连接断了，进入重连; 参数错误不是连接的问题
+        if(reconnect_enable_ && ret != AVERROR(EINVAL)) {
+            onDisconnect();
+        }
         return -1;
     }
-    
+    sent_bytes_ += size;
+    sent_packets_++;
     RestTimeout();
     return 0;
 }
 
+// 把发送节奏挂到视频rtp muxer的AVIOContext上: 替换write_packet，原来的函数和opaque不变，照常调用
+// 关闭之前必须恢复，avio_close会用到opaque
+void RtspPusher::hookRtpOutput()
+{
+    if(!pacer_ || !video_stream_ || rtp_pb_) {
+        return;
+    }
+    // 1. 确认是按这个布局编译的rtsp muxer
+    RtspStateHead *rt = (RtspStateHead *)fmt_ctx_->priv_data;
+    if(AV_VERSION_MAJOR(avformat_version()) != 58 || strcmp(fmt_ctx_->oformat->name, "rtsp") != 0
+            || !rt || !rt->av_class || strcmp(rt->av_class->class_name, "RTSP muxer") != 0
+            || rt->nb_rtsp_streams != (int)fmt_ctx_->nb_streams || !rt->rtsp_streams) {
+        LogWarn("unknown rtsp muxer layout, pacing disabled");
+        return;
+    }
+    // 2. udp时rtp muxer的pb直接写rtp socket
+    RtspStreamHead *rtsp_st = (RtspStreamHead *)rt->rtsp_streams[video_index_];
+    AVFormatContext *rtp_ctx = rtsp_st ? (AVFormatContext *)rtsp_st->transport_priv : NULL;
+    if(!rtp_ctx || !rtp_ctx->oformat || strcmp(rtp_ctx->oformat->name, "rtp") != 0
+            || !rtp_ctx->pb || !rtp_ctx->pb->write_packet || !rtp_ctx->pb->opaque) {
+        LogWarn("no rtp output for video, pacing disabled");
+        return;
+    }
+    std::lock_guard<std::mutex> lock(s_rtp_hooks_mutex);
+    rtp_pb_ = rtp_ctx->pb;
+    rtp_write_ = rtp_pb_->write_packet;
+    s_rtp_hooks[rtp_pb_->opaque] = this;
+    rtp_pb_->write_packet = pacedWrite;
+    LogInfo("pacing video rtp packets, max packet size:%d", rtp_pb_->max_packet_size);
+}
+
+void RtspPusher::unhookRtpOutput()
+{
+    if(!rtp_pb_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(s_rtp_hooks_mutex);
+    rtp_pb_->write_packet = rtp_write_;
+    s_rtp_hooks.erase(rtp_pb_->opaque);
+    rtp_pb_ = NULL;
+    rtp_write_ = NULL;
+}
+
+int RtspPusher::pacedWrite(void *opaque, uint8_t *buf, int buf_size)
+{
+    RtspPusher *pusher = NULL;
+    {
+        std::lock_guard<std::mutex> lock(s_rtp_hooks_mutex);
+        std::map<void *, RtspPusher *>::iterator it = s_rtp_hooks.find(opaque);
+        if(it != s_rtp_hooks.end()) {
+            pusher = it->second;
+        }
+    }
+    if(!pusher) {
+        LogError("rtp output is not hooked");
+        return AVERROR(EINVAL);
+    }
+    pusher->paceRtpPacket(buf, buf_size);
+    return pusher->rtp_write_(opaque, buf, buf_size);
+}
+
+// 一帧的rtp包按桶深分批，每批第一个包之前等待令牌，速率不够在deadline之前发完时提速; rtcp不等待
+void RtspPusher::paceRtpPacket(const uint8_t *buf, int size)
+{
+    if(size >= 2 && buf[1] >= 200 && buf[1] <= 204) {
+        return;
+    }
+    if(pace_budget_ < size) {
+        int bytes = pacer_->GetBurstBytes();
+        if(bytes > pace_remaining_) {
+            bytes = (int)pace_remaining_;
+        }
+        if(bytes < size) {
+            bytes = size;
+        }
+        int64_t wait = pacer_->Acquire(av_gettime_relative(), bytes, pace_deadline_, pace_remaining_);
+        if(wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+        pace_budget_ = bytes;
+    }
+    pace_budget_ -= size;
+    pace_remaining_ -= size;
+}
+
+// 发送失败: 拆掉旧连接，尽快出一个IDR，重连后从它开始发
+void RtspPusher::onDisconnect()
+{
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    LogWarn("%s disconnected, reconnecting", url_.c_str());
+    closeOutput();
+    disconnect_time_ = now;
+    reconnect_attempts_ = 0;
+    next_reconnect_time_ = now + backoffDelay(0);
+    if(interleaver_) {
+        interleaver_->Clear();
+    }
+    catchup_start_time_ = -1;
+    if(!keyframe_pending_) {
+        keyframe_pending_ = true;
+        random_access_count_ = queue_->GetRandomAccessCount();
+    }
+}
+
+// 重连路径上拆掉已经断开的连接: 链路已死，TEARDOWN发不出去，closing_让av_write_trailer的io直接中断，
+// 只释放本地资源，不等rtsp_timeout
+void RtspPusher::closeOutput()
+{
+    if(!fmt_ctx_) {
+        return;
+    }
+    unhookRtpOutput();
+    if(connected_) {
+        closing_ = true;
+        av_write_trailer(fmt_ctx_);
+        closing_ = false;
+        connected_ = false;
+    }
+    avformat_free_context(fmt_ctx_);
+    fmt_ctx_ = NULL;
+    video_stream_ = NULL;
+    audio_stream_ = NULL;
+}
+
+// 按保存的编码参数重建流，流的顺序和第一次连接一样
+RET_CODE RtspPusher::reopenOutput()
+{
+    if(allocOutput() != RET_OK) {
+        return RET_FAIL;
+    }
+    for(int i = 0; i < 2; i++) {
+        AVCodecParameters *par = NULL;
+        if(i == video_index_) {
+            par = video_par_;
+        } else if(i == audio_index_) {
+            par = audio_par_;
+        }
+        if(!par) {
+            continue;
+        }
+        AVStream *st = avformat_new_stream(fmt_ctx_, NULL);
+        if(!st || avcodec_parameters_copy(st->codecpar, par) < 0) {
+            LogError("create stream %d failed", i);
+            return RET_FAIL;
+        }
+        st->codecpar->codec_tag = 0;
+        if(par->codec_id == AV_CODEC_ID_OPUS) {
+            st->time_base = av_make_q(1, 48000);
+        }
+        if(i == video_index_) {
+            video_stream_ = st;
+        } else {
+            audio_stream_ = st;
+        }
+    }
+    RestTimeout();
+    int ret = avformat_write_header(fmt_ctx_, NULL);
+    if(ret < 0) {
+        char str_error[512] = {0};
+        av_strerror(ret, str_error, sizeof(str_error) -1);
+        LogWarn("reconnect %s failed:%s", url_.c_str(), str_error);
+        return RET_FAIL;
+    }
+    connected_ = true;
+    hookRtpOutput();
+    return RET_OK;
+}
+
+// 断线期间: 队列只保留最后一个解码起点开始的包，到时间后重连，失败时退避时间翻倍
+void RtspPusher::checkReconnect()
+{
+    // 1. 溢出模式要求完整，积压都保留; 否则旧的GOP重连后也没用
+    if(spill_file_.empty()) {
+        queue_->DropToLastRandomAccess();
+    }
+    checkPacketQueueDuration();
+    checkKeyframeRequest();
+
+    // 2. 等待退避时间
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    if(now < next_reconnect_time_) {
+        int64_t wait = next_reconnect_time_ - now;
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait < 100 ? wait : 100));
+        return;
+    }
+
+    // 3. 重连成功后从解码起点开始发，同时马上请求IDR，观众不用等旧GOP之后的下一个关键帧
+    reconnect_attempts_++;
+    if(reopenOutput() == RET_OK) {
+        now = TimesUtil::GetTimeMillisecond();
+        LogInfo("%s reconnected, attempts:%d, outage:%lldms", url_.c_str(), reconnect_attempts_,
+                now - disconnect_time_);
+        msg_queue_->notify_msg3(MSG_RTSP_RECONNECTED, reconnect_attempts_, (int)(now - disconnect_time_));
+        if(spill_file_.empty()) {
+            queue_->DropToLastRandomAccess();
+        }
+        keyframe_pending_ = false;
+        last_keyframe_request_time_ = now;
+        if(keyframe_callback_) {
+            keyframe_callback_();
+        } else if(spill_file_.empty()) {
+            queue_->DropToNextRandomAccess();   // 队列里没有解码起点时等下一个
+        }
+        return;
+    }
+    closeOutput();
+    if(reconnect_max_attempts_ > 0 && reconnect_attempts_ >= reconnect_max_attempts_) {
+        LogError("%s reconnect failed %d times, give up", url_.c_str(), reconnect_attempts_);
+        msg_queue_->notify_msg2(MSG_RTSP_ERROR, AVERROR(ECONNREFUSED));
+        reconnect_enable_ = false;
+        return;
+    }
+    int delay = backoffDelay(reconnect_attempts_);
+    next_reconnect_time_ = now + delay;
+    msg_queue_->notify_msg3(MSG_RTSP_RECONNECTING, reconnect_attempts_, delay);
+}
+
+// 指数退避: min_delay*2^attempts，不超过max_delay; 在[delay/2, delay]之间随机，多个推流端不会同时重连
+int RtspPusher::backoffDelay(int attempts)
+{
+    int64_t delay = reconnect_min_delay_;
+    for(int i = 0; i < attempts && delay < reconnect_max_delay_; i++) {
+        delay *= 2;
+    }
+    if(delay > reconnect_max_delay_) {
+        delay = reconnect_max_delay_;
+    }
+    std::uniform_int_distribution<int> dist((int)delay / 2, (int)delay);
+    return dist(rand_);
+}
+
 //超时处理
 bool RtspPusher::IsTimeout(){
-    if(TimesUtil::GetTimeMillisecond() - pre_time_ > rtsp_timeout_) {
+    if(closing_) {
+        return true;    // 拆断开的连接时不等待
+    }
+    int64_t now = TimesUtil::GetTimeMillisecond();
+    if(trailer_deadline_ > 0 && now > trailer_deadline_) {
+        return true;    // 正常退出时发TEARDOWN的时间有上限
+    }
+    if(now - pre_time_ > rtsp_timeout_) {
         return true;
     }
     return false;
@@ -1,18 +1,34 @@
 #ifndef RTSPPUSHER_H
 #define RTSPPUSHER_H
 
+#include <atomic>
+#include <random>
 #include "mediabase.h"
 #include "commonlooper.h"
 #include "packetqueue.h"
 #include "messagequeue.h"
+#include "bitratecontroller.h"
+#include "videoladder.h"
+#include "interleaver.h"
+#include "pacer.h"
 
 extern "C" {
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
 #include "libavcodec/avcodec.h"
 #include "libavutil/opt.h"
+#include "libavutil/time.h"
 }
 
+typedef struct rtsp_pusher_stats {
+    PacketQueueStats queue;     // 当前队列
+    int64_t sent_bytes;         // 累计发送的字节数
+    int64_t sent_packets;       // 累计发送的包数量
+    int64_t dropped_packets;    // 队列超过上限丢掉的包
+    int64_t shed_packets;       // 丢时间层丢掉的包
+    PacerStats pacer;           // 没有打开发送节奏(pacing)时全是0
+}RtspPusherStats;
+
 class RtspPusher: public CommonLooper
 {
 public:
@@ -21,6 +37,8 @@ public:
     RET_CODE Init(const Properties& properties);
     void DeInit();
     RET_CODE Push(AVPacket *pkt, MediaType media_type);
+    // 等待队列里面的包发送完，最多等待timeout毫秒
+    RET_CODE Drain(int timeout);
     // 连接服务器，如果连接成功则启动线程
     RET_CODE Connect();
 
@@ -28,6 +46,22 @@ public:
     RET_CODE ConfigVideoStream(const AVCodecContext *ctx);
     // 如果有音频成分
     RET_CODE ConfigAudioStream(const AVCodecContext *ctx);
+    // 码率自适应调整码率时回调，在发送线程里执行
+    void AddBitrateCallback(std::function<void(int bitrate)> callback);
+    // 码率最低仍然拥塞时降档、稳定后升档时回调，step.bitrate为新档位的起始码率，在发送线程里执行
+    void AddLadderCallback(std::function<void(const VideoLadderStep &step)> callback);
+    // 丢包导致接收端参考帧丢失时回调，请求编码器出IDR，在发送线程里执行
+    // 不设置时不请求IDR，丢掉解不了的视频，从队列里的下一个解码起点继续(备用目的地)
+    void AddKeyframeCallback(std::function<void()> callback);
+    // 切换档位改变帧率后更新队列时长的估算
+    void SetVideoFrameDuration(double video_frame_duration);
+    // 音视频交织的偏差统计，没有打开交织(interleave_max_hold)时返回RET_FAIL
+    RET_CODE GetInterleaveStats(InterleaveStats *stats);
+    // 发送和丢包统计，可以在任意线程获取
+    RET_CODE GetStats(RtspPusherStats *stats);
+    inline std::string GetUrl() {
+        return url_;
+    }
     virtual void Loop();
 
     //超时处理
@@ -41,7 +75,28 @@ private:
     void debugQueue(int64_t interval);  // 按时间间隔打印packetqueue的状况
     // 监测队列的缓存情况
     void checkPacketQueueDuration();
+    // 根据队列和发送吞吐量调整编码码率
+    void checkBitrate();
+    // 丢包之后按最小间隔请求IDR
+    void checkKeyframeRequest();
+    // 队列堆积时先丢弃最高的时间层，恢复后再加回来
+    void checkTemporalLayers();
+    // 补发溢出到磁盘的积压时限速
+    void paceCatchup(int64_t pts);
     int sendPacket(AVPacket *pkt, MediaType media_type);
+    // 创建输出上下文，Init和重连时调用
+    RET_CODE allocOutput();
+    // 断线重连: 拆掉旧连接，按保存的编码参数重建流并重新连接
+    void onDisconnect();
+    void closeOutput();
+    RET_CODE reopenOutput();
+    // 发送节奏挂在libavformat的rtp输出上，每个rtp包发出之前调用paceRtpPacket
+    void hookRtpOutput();
+    void unhookRtpOutput();
+    static int pacedWrite(void *opaque, uint8_t *buf, int buf_size);
+    void paceRtpPacket(const uint8_t *buf, int size);
+    void checkReconnect();
+    int backoffDelay(int attempts);
     // 整个输出流的上下文
     AVFormatContext *fmt_ctx_ = NULL;
     // 视频编码器上下文
@@ -58,15 +113,80 @@ private:
     std::string url_ = "";
     std::string rtsp_transport_ = "";
     int rtsp_timeout_ = 5000;
+    int trailer_timeout_ = 1000;            // 正常退出时等待TEARDOWN的最长时间
+    int64_t trailer_deadline_ = 0;          // >0时io超过这个时间点就中断
     int64_t pre_time_;
 
     double audio_frame_duration_ = 23.21995649; // 默认23.2ms 44.1khz  1024*1000ms/44100=23.21995649ms
     double video_frame_duration_ = 40;  // 40ms 视频帧率为25的  ， 1000ms/25=40ms
+    int video_max_interval_ = 0;        // 跳过静止帧或者可变帧率时两帧的最大间隔ms
     PacketQueue *queue_ = NULL;
 
      // 队列最大限制时长
     int max_queue_duration_ = 500;  // 默认100ms
 
+    // 码率自适应
+    bool abr_enable_ = false;
+    BitrateController *bitrate_controller_ = NULL;
+    std::function<void(int bitrate)> bitrate_callback_ = NULL;
+    std::atomic<int64_t> sent_bytes_;     // 累计发送的字节数
+    std::atomic<int64_t> sent_packets_;
+    // 分辨率/帧率降级阶梯，需要打开码率自适应
+    VideoLadder *video_ladder_ = NULL;
+    std::function<void(const VideoLadderStep &step)> ladder_callback_ = NULL;
+
+    bool intra_refresh_ = false;    // 视频使用intra-refresh，丢包以recovery point为起点
+
+    // 时间层丢弃，介于码率自适应和整个gop丢弃之间
+    int temporal_layers_ = 1;
+    int send_layers_ = 1;           // 当前发送的时间层数量
+    int shed_high_water_ = 600;     // 超过时少发一层ms
+    int shed_low_water_ = 300;      // 低于时多发一层ms
+    int shed_hold_time_ = 2000;     // 丢层之后至少保持多久才恢复ms
+    int64_t last_shed_time_ = 0;
+
+    // IDR请求
+    std::function<void()> keyframe_callback_ = NULL;
+    int keyframe_request_interval_ = 1000;  // 两次请求的最小间隔ms，避免持续拥塞时不停出IDR
+    int64_t last_keyframe_request_time_ = 0;
+    bool keyframe_pending_ = false;         // 丢包后还没有发出的请求
+    int64_t random_access_count_ = 0;       // 参考帧丢失时队列累计的解码起点数量
+    std::atomic<bool> reference_lost_;    // Push里兜底丢包时参考帧断了，由发送线程转成请求
+
+    // 溢出模式，spill_file为空时超过队列上限直接丢包
+    std::string spill_file_ = "";
+    int spill_catchup_rate_ = 200;          // 补发积压的速度，实时的百分比
+    int64_t catchup_start_time_ = -1;
+    int64_t catchup_start_pts_ = 0;
+
+    // 断线重连: 发送失败后按指数退避加随机抖动重连，编码器不停，队列只保留最新的GOP
+    bool reconnect_enable_ = true;
+    int reconnect_min_delay_ = 500;
+    int reconnect_max_delay_ = 10000;
+    int reconnect_max_attempts_ = 0;        // 连续失败多少次后放弃，0代表一直重试
+    bool connected_ = false;                // avformat_write_header成功，可以发送
+    bool closing_ = false;                  // 重连时拆已断开的连接，中断阻塞的io，不等rtsp_timeout
+    int reconnect_attempts_ = 0;
+    int64_t disconnect_time_ = 0;
+    int64_t next_reconnect_time_ = 0;
+    AVCodecParameters *video_par_ = NULL;   // 重建流用的编码参数
+    AVCodecParameters *audio_par_ = NULL;
+    std::mt19937 rand_;
+
+    // 发送节奏: 只支持udp，视频帧的rtp包按令牌桶分批发出，速率是目标码率加上余量
+    bool pacing_ = false;
+    int audio_bitrate_ = 0;                 // 目标码率里音频的部分，视频部分跟随码率自适应
+    Pacer *pacer_ = NULL;
+    AVIOContext *rtp_pb_ = NULL;            // 挂了发送节奏的视频rtp muxer输出
+    int (*rtp_write_)(void *opaque, uint8_t *buf, int buf_size) = NULL;    // 原来的write_packet
+    int64_t pace_deadline_ = 0;             // 当前帧最晚发完的时间us
+    int64_t pace_remaining_ = 0;            // 当前帧还没发的字节
+    int pace_budget_ = 0;                   // 当前这批还能发的字节
+
+    // 按dts交织音视频，只有一路有包时最多等interleave_max_hold_毫秒
+    int interleave_max_hold_ = 0;
+    Interleaver *interleaver_ = NULL;
+
     MessageQueue *msg_queue_ = NULL;
 };
 
@@ -0,0 +1,149 @@
+#include <math.h>
+#include "silencedetector.h"
+#include "dlog.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SILENCE_USE_SSE2 1
+#endif
+
+SilenceDetector::SilenceDetector()
+{
+    memset(&stats_, 0, sizeof(VadStats));
+}
+
+SilenceDetector::~SilenceDetector()
+{
+
+}
+
+RET_CODE SilenceDetector::Init(const Properties &properties)
+{
+    threshold_dbfs_ = properties.GetProperty("threshold", -60);
+    hangover_ms_    = properties.GetProperty("hangover", 500);
+    frame_duration_ = atof(properties.GetProperty("frame_duration", "21.3333"));
+    int window_ms   = properties.GetProperty("window", 10000);
+
+    if(threshold_dbfs_ > 0 || frame_duration_ <= 0 || hangover_ms_ < 0 || window_ms <= 0) {
+        LogError("threshold:%0.1lf, frame_duration:%0.2lf, hangover:%d, window:%d",
+                 threshold_dbfs_, frame_duration_, hangover_ms_, window_ms);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+
+    threshold_amp_   = 32768.0 * pow(10.0, threshold_dbfs_ / 20.0);
+    hangover_frames_ = (int)(hangover_ms_ / frame_duration_);
+    int window_frames = (int)(window_ms / frame_duration_);
+    if(window_frames < 1) {
+        window_frames = 1;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_.assign(window_frames, 0);
+    window_pos_ = 0;
+    window_voice_ = 0;
+    window_filled_ = 0;
+    silent_run_ = 0;
+    memset(&stats_, 0, sizeof(VadStats));
+    return RET_OK;
+}
+
+bool SilenceDetector::Process(const int16_t *samples, int count)
+{
+    if(!samples || count <= 0) {
+        return false;
+    }
+
+    // 1. 计算电平，这一步不需要加锁
+    uint64_t sum_sq = 0;
+    int peak = 0;
+    ComputeLevel(samples, count, &sum_sq, &peak);
+    double rms = sqrt((double)sum_sq / count);
+    bool voice = (rms >= threshold_amp_ || peak >= threshold_amp_);
+
+    // 2. 更新状态, hangover期间仍然按有声处理，避免句尾被截断
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(voice) {
+        silent_run_ = 0;
+    } else if(silent_run_ <= hangover_frames_) {
+        silent_run_++;
+    }
+    bool silent = silent_run_ > hangover_frames_;
+
+    // 3. 更新统计窗口
+    if(window_filled_ == (int)window_.size()) {
+        window_voice_ -= window_[window_pos_];
+    } else {
+        window_filled_++;
+    }
+    window_[window_pos_] = voice ? 1 : 0;
+    window_voice_ += window_[window_pos_];
+    window_pos_ = (window_pos_ + 1) % window_.size();
+
+    stats_.total_frames++;
+    if(voice) {
+        stats_.voice_frames++;
+    }
+    if(silent) {
+        stats_.silent_frames++;
+    }
+    stats_.silent      = silent ? 1 : 0;
+    stats_.level_dbfs  = rms > 0 ? 20 * log10(rms / 32768.0) : -120;
+    stats_.peak_dbfs   = peak > 0 ? 20 * log10(peak / 32768.0) : -120;
+    stats_.voice_ratio = (double)window_voice_ / window_filled_;
+    return silent;
+}
+
+void SilenceDetector::GetStats(VadStats *stats)
+{
+    if(!stats) {
+        LogError("stats is null");
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    *stats = stats_;
+}
+
+void SilenceDetector::ComputeLevel(const int16_t *samples, int count, uint64_t *sum_sq, int *peak)
+{
+    uint64_t sum = 0;
+    int max_val = 0;
+    int min_val = 0;
+    int i = 0;
+#ifdef SILENCE_USE_SSE2
+    // 每次处理8个采样点: madd得到4个32位的平方和(最大2*32768^2, 按无符号处理不会溢出)
+    __m128i zero   = _mm_setzero_si128();
+    __m128i acc_lo = _mm_setzero_si128();
+    __m128i acc_hi = _mm_setzero_si128();
+    __m128i vmax   = _mm_setzero_si128();
+    __m128i vmin   = _mm_setzero_si128();
+    for(; i + 8 <= count; i += 8) {
+        __m128i v  = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m128i sq = _mm_madd_epi16(v, v);
+        acc_lo = _mm_add_epi64(acc_lo, _mm_unpacklo_epi32(sq, zero));
+        acc_hi = _mm_add_epi64(acc_hi, _mm_unpackhi_epi32(sq, zero));
+        vmax = _mm_max_epi16(vmax, v);
+        vmin = _mm_min_epi16(vmin, v);
+    }
+    uint64_t acc[4];
+    int16_t maxs[8];
+    int16_t mins[8];
+    _mm_storeu_si128((__m128i *)acc, acc_lo);
+    _mm_storeu_si128((__m128i *)(acc + 2), acc_hi);
+    _mm_storeu_si128((__m128i *)maxs, vmax);
+    _mm_storeu_si128((__m128i *)mins, vmin);
+    sum = acc[0] + acc[1] + acc[2] + acc[3];
+    for(int j = 0; j < 8; j++) {
+        if(maxs[j] > max_val) max_val = maxs[j];
+        if(mins[j] < min_val) min_val = mins[j];
+    }
+#endif
+    // 剩余的采样点(或者没有SSE2时全部)用标量处理
+    for(; i < count; i++) {
+        int s = samples[i];
+        sum += (uint64_t)(s * s);
+        if(s > max_val) max_val = s;
+        if(s < min_val) min_val = s;
+    }
+    *sum_sq = sum;
+    *peak = max_val > -min_val ? max_val : -min_val;
+}
@@ -0,0 +1,64 @@
+#ifndef SILENCEDETECTOR_H
+#define SILENCEDETECTOR_H
+
+#include <mutex>
+#include <vector>
+#include "mediabase.h"
+
+typedef struct vad_stats {
+    int64_t total_frames;   // 检测过的帧数
+    int64_t voice_frames;   // 有声帧数
+    int64_t silent_frames;  // 静音帧数（超过hangover之后的）
+    int     silent;         // 当前是否处于静音状态
+    double  level_dbfs;     // 最近一帧的rms电平
+    double  peak_dbfs;      // 最近一帧的峰值电平
+    double  voice_ratio;    // 最近统计窗口内有声帧的比例
+}VadStats;
+
+// 基于能量/峰值的静音检测，输入是s16交织的pcm
+class SilenceDetector
+{
+public:
+    SilenceDetector();
+    ~SilenceDetector();
+    /**
+     * @brief Init
+     * @param "threshold", 静音门限dBFS，默认-60，rms和峰值都低于门限才算静音帧
+     *        "hangover", 连续静音多久(ms)才进入静音状态，默认500
+     *        "frame_duration", 一帧的时长(ms)，默认21
+     *        "window", 有声比例的统计窗口(ms)，默认10000
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    /**
+     * @brief Process 检测一帧pcm
+     * @param samples   s16交织数据
+     * @param count     采样点总数(nb_samples * channels)
+     * @return true 处于静音状态
+     */
+    bool Process(const int16_t *samples, int count);
+
+    void GetStats(VadStats *stats);
+
+    // 计算平方和以及峰值，SSE2加速
+    static void ComputeLevel(const int16_t *samples, int count, uint64_t *sum_sq, int *peak);
+private:
+    std::mutex mutex_;
+    double threshold_dbfs_ = -60;
+    int hangover_ms_ = 500;
+    double frame_duration_ = 21.3333;
+
+    double threshold_amp_ = 32.768;     // 门限对应的幅度
+    int hangover_frames_ = 0;
+    int silent_run_ = 0;                // 连续静音帧数
+
+    // 有声比例统计窗口
+    std::vector<uint8_t> window_;
+    int window_pos_ = 0;
+    int window_voice_ = 0;
+    int window_filled_ = 0;
+
+    VadStats stats_;
+};
+
+#endif // SILENCEDETECTOR_H
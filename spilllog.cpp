@@ -0,0 +1,122 @@
+#include "spilllog.h"
+#include "dlog.h"
+
+#define SPILL_MAGIC 0x4c4c5053      // "SPLL"
+
+SpillLog::SpillLog()
+{
+
+}
+
+SpillLog::~SpillLog()
+{
+    Close();
+}
+
+RET_CODE SpillLog::Open(const std::string &file_name, int64_t max_size)
+{
+    // fseek的偏移是long，windows上只有32位
+    if(max_size <= (int64_t)sizeof(SpillHeader) || max_size > 0x7fffffff) {
+        LogError("spill max_size:%lld is out of range", (long long)max_size);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    fp_ = fopen(file_name.c_str(), "wb+");
+    if(!fp_) {
+        LogError("fopen %s failed", file_name.c_str());
+        return RET_ERR_OPEN_FILE;
+    }
+    file_name_ = file_name;
+    max_size_ = max_size;
+    Clear();
+    return RET_OK;
+}
+
+void SpillLog::Close()
+{
+    if(fp_) {
+        fclose(fp_);
+        fp_ = NULL;
+    }
+    Clear();
+}
+
+bool SpillLog::Append(const AVPacket *pkt, MediaType media_type, int random_access, int temporal_layer)
+{
+    if(!fp_ || write_offset_ + (int64_t)sizeof(SpillHeader) + pkt->size > max_size_) {
+        return false;
+    }
+    SpillHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SPILL_MAGIC;
+    header.size = pkt->size;
+    header.pts = pkt->pts;
+    header.dts = pkt->dts;
+    header.flags = pkt->flags;
+    header.media_type = (uint8_t)media_type;
+    header.random_access = (uint8_t)random_access;
+    header.temporal_layer = (uint8_t)temporal_layer;
+    // 同一个FILE读写交替，切换前必须fseek
+    if(fseek(fp_, (long)write_offset_, SEEK_SET) != 0
+            || fwrite(&header, 1, sizeof(header), fp_) != sizeof(header)
+            || (pkt->size > 0 && fwrite(pkt->data, 1, pkt->size, fp_) != (size_t)pkt->size)) {
+        LogError("write %s failed", file_name_.c_str());
+        return false;
+    }
+    write_offset_ += sizeof(header) + pkt->size;
+    // 时长按dts算，有b帧时pts不是递增的
+    int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    if(packets_ == 0) {
+        front_dts_ = dts;
+    }
+    back_dts_ = dts;
+    packets_++;
+    return true;
+}
+
+AVPacket *SpillLog::Read(MediaType *media_type, int *random_access, int *temporal_layer)
+{
+    if(!fp_ || packets_ <= 0) {
+        return NULL;
+    }
+    SpillHeader header;
+    if(fseek(fp_, (long)read_offset_, SEEK_SET) != 0
+            || fread(&header, 1, sizeof(header), fp_) != sizeof(header)
+            || header.magic != SPILL_MAGIC || header.size < 0) {
+        LogError("read %s header failed at %lld", file_name_.c_str(), (long long)read_offset_);
+        return NULL;
+    }
+    AVPacket *pkt = av_packet_alloc();
+    if(!pkt || av_new_packet(pkt, header.size) < 0) {
+        LogError("alloc spill packet failed");
+        av_packet_free(&pkt);
+        return NULL;
+    }
+    if(header.size > 0 && fread(pkt->data, 1, header.size, fp_) != (size_t)header.size) {
+        LogError("read %s data failed at %lld", file_name_.c_str(), (long long)read_offset_);
+        av_packet_free(&pkt);
+        return NULL;
+    }
+    pkt->pts = header.pts;
+    pkt->dts = header.dts;
+    pkt->flags = header.flags;
+    *media_type = (MediaType)header.media_type;
+    *random_access = header.random_access;
+    *temporal_layer = header.temporal_layer;
+    read_offset_ += sizeof(header) + header.size;
+    packets_--;
+    if(packets_ == 0) {
+        Clear();                // 积压读完，从文件开头重新写
+    } else {
+        front_dts_ = header.dts != AV_NOPTS_VALUE ? header.dts : header.pts;
+    }
+    return pkt;
+}
+
+void SpillLog::Clear()
+{
+    write_offset_ = 0;
+    read_offset_ = 0;
+    packets_ = 0;
+    front_dts_ = 0;
+    back_dts_ = 0;
+}
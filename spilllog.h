@@ -0,0 +1,67 @@
+#ifndef SPILLLOG_H
+#define SPILLLOG_H
+
+#include <stdio.h>
+#include <string>
+#include "mediabase.h"
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+// 发送队列的溢出日志: 内存里放不下的旧包按顺序追加到文件，恢复后从文件头按顺序读回
+// 读完之后读写位置回到文件开头重新使用，文件大小不超过max_size
+// 不加锁，由PacketQueue在自己的锁里调用
+class SpillLog
+{
+public:
+    SpillLog();
+    ~SpillLog();
+    /**
+     * @brief Open 创建溢出文件，已有的内容会被清空
+     * @param max_size  文件的最大字节数，写满之后Append返回false
+     * @return
+     */
+    RET_CODE Open(const std::string &file_name, int64_t max_size);
+    void Close();
+    // 追加一个包，pts/dts原样保存; 文件写满或者写失败时返回false
+    bool Append(const AVPacket *pkt, MediaType media_type, int random_access, int temporal_layer);
+    // 读出最早的包，调用者负责av_packet_free; 读失败时返回NULL
+    AVPacket *Read(MediaType *media_type, int *random_access, int *temporal_layer);
+    // 丢掉所有积压
+    void Clear();
+    inline int Packets() {
+        return packets_;
+    }
+    inline int64_t Size() {
+        return write_offset_ - read_offset_;
+    }
+    // 积压的时长ms，按最早和最新的dts计算
+    inline int64_t Duration() {
+        return packets_ > 0 ? back_dts_ - front_dts_ : 0;
+    }
+private:
+    typedef struct spill_header {
+        uint32_t magic;
+        int32_t size;
+        int64_t pts;
+        int64_t dts;
+        int32_t flags;
+        uint8_t media_type;
+        uint8_t random_access;
+        uint8_t temporal_layer;
+        uint8_t reserved;
+    }SpillHeader;      // 32字节
+
+    std::string file_name_;
+    FILE *fp_ = NULL;
+    int64_t max_size_ = 0;
+    int64_t write_offset_ = 0;
+    int64_t read_offset_ = 0;
+    int packets_ = 0;
+    int64_t front_dts_ = 0;
+    int64_t back_dts_ = 0;
+};
+
+#endif // SPILLLOG_H
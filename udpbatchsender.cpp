@@ -0,0 +1,213 @@
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include "udpbatchsender.h"
+#include "dlog.h"
+
+#ifdef __linux__
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#define UDP_MAX_SEGMENTS    64      // 内核一个GSO消息最多的分段数
+#define UDP_MAX_GSO_BYTES   65000   // 一个GSO消息不能超过udp的64KB
+#define UDP_MAX_MSGS        64      // 一次sendmmsg的消息数
+#endif
+
+UdpBatchSender::UdpBatchSender()
+{
+
+}
+
+UdpBatchSender::~UdpBatchSender()
+{
+    Close();
+}
+
+const char *UdpBatchSender::ModeName(int mode)
+{
+    switch (mode) {
+    case UDP_SEND_SENDMMSG:
+        return "sendmmsg";
+    case UDP_SEND_GSO:
+        return "gso";
+    default:
+        return "sendto";
+    }
+}
+
+RET_CODE UdpBatchSender::Open(const std::string &host, int port, int mode)
+{
+    // 1. 解析地址，connect之后发送时不用再带地址
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    char port_str[16] = {0};
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if(getaddrinfo(host.c_str(), port_str, &hints, &res) != 0 || !res) {
+        LogError("getaddrinfo %s:%d failed", host.c_str(), port);
+        return RET_FAIL;
+    }
+    fd_ = socket(res->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if(fd_ == INVALID_SOCKET) {
+        LogError("create udp socket failed:%d", GetSockError());
+        freeaddrinfo(res);
+        return RET_FAIL;
+    }
+    if(connect(fd_, res->ai_addr, (int)res->ai_addrlen) != 0) {
+        LogError("connect %s:%d failed:%d", host.c_str(), port, GetSockError());
+        freeaddrinfo(res);
+        Close();
+        return RET_FAIL;
+    }
+    freeaddrinfo(res);
+    // 一次发出整个关键帧，发送缓冲区要放得下
+    int sndbuf = 4 * 1024 * 1024;
+    setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    // 2. 检查批量发送是否可用
+    mode_ = mode;
+#ifdef __linux__
+    if(UDP_SEND_GSO == mode_) {
+        int gso_size = 0;
+        socklen_t len = sizeof(gso_size);
+        if(getsockopt(fd_, SOL_UDP, UDP_SEGMENT, &gso_size, &len) != 0) {
+            LogWarn("UDP_SEGMENT is not supported, use sendmmsg");
+            mode_ = UDP_SEND_SENDMMSG;
+        }
+    }
+#else
+    if(mode_ != UDP_SEND_SENDTO) {
+        LogWarn("%s is only supported on linux, use sendto", ModeName(mode_));
+        mode_ = UDP_SEND_SENDTO;
+    }
+#endif
+    memset(&stats_, 0, sizeof(stats_));
+    LogInfo("udp %s:%d, mode:%s", host.c_str(), port, ModeName(mode_));
+    return RET_OK;
+}
+
+void UdpBatchSender::Close()
+{
+    if(fd_ != INVALID_SOCKET) {
+        closesocket(fd_);
+        fd_ = INVALID_SOCKET;
+    }
+}
+
+RET_CODE UdpBatchSender::Send(const uint8_t *buffer, const std::vector<RtpSlice> &slices)
+{
+    if(fd_ == INVALID_SOCKET) {
+        return RET_FAIL;
+    }
+    if(slices.empty()) {
+        return RET_OK;
+    }
+#ifdef __linux__
+    if(mode_ != UDP_SEND_SENDTO) {
+        return sendBatch(buffer, slices, UDP_SEND_GSO == mode_);
+    }
+#endif
+    return sendOneByOne(buffer, slices);
+}
+
+RET_CODE UdpBatchSender::sendOneByOne(const uint8_t *buffer, const std::vector<RtpSlice> &slices)
+{
+    RET_CODE ret = RET_OK;
+    for(size_t i = 0; i < slices.size(); i++) {
+        stats_.syscalls++;
+        if(send(fd_, (const char *)buffer + slices[i].offset, slices[i].size, 0) < 0) {
+            stats_.errors++;
+            ret = RET_FAIL;
+            continue;
+        }
+        stats_.packets++;
+        stats_.bytes += slices[i].size;
+    }
+    return ret;
+}
+
+#ifdef __linux__
+RET_CODE UdpBatchSender::sendBatch(const uint8_t *buffer, const std::vector<RtpSlice> &slices, bool gso)
+{
+    struct mmsghdr msgs[UDP_MAX_MSGS];
+    struct iovec iovs[UDP_MAX_MSGS];
+    char controls[UDP_MAX_MSGS][CMSG_SPACE(sizeof(uint16_t))];
+    size_t firsts[UDP_MAX_MSGS];        // 每个消息的第一个包
+    int segments[UDP_MAX_MSGS];
+    RET_CODE result = RET_OK;
+    size_t i = 0;
+    while(i < slices.size()) {
+        // 1. 组消息: gso时内存连续、同样大小的包合并成一个消息，只有最后一段可以更小
+        int n = 0;
+        while(i < slices.size() && n < UDP_MAX_MSGS) {
+            size_t j = i + 1;
+            int total = slices[i].size;
+            while(gso && j < slices.size() && j - i < UDP_MAX_SEGMENTS
+                  && slices[j].size <= slices[i].size
+                  && total + slices[j].size <= UDP_MAX_GSO_BYTES
+                  && slices[j].offset == slices[j - 1].offset + slices[j - 1].size) {
+                total += slices[j].size;
+                j++;
+                if(slices[j - 1].size < slices[i].size) {
+                    break;
+                }
+            }
+            memset(&msgs[n], 0, sizeof(msgs[n]));
+            iovs[n].iov_base = (void *)(buffer + slices[i].offset);
+            iovs[n].iov_len = total;
+            msgs[n].msg_hdr.msg_iov = &iovs[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            if(j - i > 1) {
+                msgs[n].msg_hdr.msg_control = controls[n];
+                msgs[n].msg_hdr.msg_controllen = sizeof(controls[n]);
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[n].msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment_size = (uint16_t)slices[i].size;
+                memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+            }
+            firsts[n] = i;
+            segments[n] = (int)(j - i);
+            n++;
+            i = j;
+        }
+
+        // 2. 一次sendmmsg发出，只发出一部分时接着发剩下的
+        int sent = 0;
+        while(sent < n) {
+            int ret = sendmmsg(fd_, msgs + sent, n - sent, 0);
+            stats_.syscalls++;
+            if(ret < 0) {
+                if(EINTR == errno) {
+                    continue;
+                }
+                // 网卡或者路径不支持分段，剩下的包不合并重新发
+                if(gso && (EIO == errno || EINVAL == errno) && segments[sent] > 1) {
+                    LogWarn("udp gso failed:%d, use sendmmsg", errno);
+                    mode_ = UDP_SEND_SENDMMSG;
+                    std::vector<RtpSlice> rest(slices.begin() + firsts[sent], slices.end());
+                    return sendBatch(buffer, rest, false);
+                }
+                stats_.errors += segments[sent];
+                result = RET_FAIL;
+                sent++;
+                continue;
+            }
+            for(int k = sent; k < sent + ret; k++) {
+                stats_.packets += segments[k];
+                stats_.bytes += iovs[k].iov_len;
+            }
+            sent += ret;
+        }
+    }
+    return result;
+}
+#endif
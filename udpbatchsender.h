@@ -0,0 +1,64 @@
+#ifndef UDPBATCHSENDER_H
+#define UDPBATCHSENDER_H
+
+#include <string>
+#include <vector>
+#include "mediabase.h"
+#include "rtppacketizer.h"
+#include "timesutil.h"
+
+#ifndef _WIN32
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#endif
+
+// 批量发送的方式，不支持时自动降级
+enum UDP_SEND_MODE
+{
+    UDP_SEND_SENDTO = 0,    // 每个包一次send
+    UDP_SEND_SENDMMSG,      // 一帧的包一次sendmmsg(linux)
+    UDP_SEND_GSO            // sendmmsg并且同样大小的连续包用UDP_SEGMENT合并成一个消息，由内核/网卡分段(linux 4.18+)
+};
+
+typedef struct udp_send_stats {
+    int64_t packets;        // 发出的udp包
+    int64_t bytes;
+    int64_t syscalls;       // 系统调用次数
+    int64_t errors;         // 发送失败的包
+}UdpSendStats;
+
+// 连接到一个目的地址的udp socket，一次调用发出一帧打包好的rtp包
+// 只在发送线程使用
+class UdpBatchSender
+{
+public:
+    UdpBatchSender();
+    ~UdpBatchSender();
+    /**
+     * @brief Open 创建socket并connect到目的地址
+     * @param mode  UDP_SEND_MODE，系统不支持时降级，实际的方式用GetMode获取
+     * @return
+     */
+    RET_CODE Open(const std::string &host, int port, int mode);
+    void Close();
+    // 发送buffer里的一组rtp包
+    RET_CODE Send(const uint8_t *buffer, const std::vector<RtpSlice> &slices);
+    inline int GetMode() {
+        return mode_;
+    }
+    inline void GetStats(UdpSendStats *stats) {
+        *stats = stats_;
+    }
+    static const char *ModeName(int mode);
+private:
+    RET_CODE sendOneByOne(const uint8_t *buffer, const std::vector<RtpSlice> &slices);
+#ifdef __linux__
+    RET_CODE sendBatch(const uint8_t *buffer, const std::vector<RtpSlice> &slices, bool gso);
+#endif
+
+    SOCKET fd_ = INVALID_SOCKET;
+    int mode_ = UDP_SEND_SENDTO;
+    UdpSendStats stats_ = {0, 0, 0, 0};
+};
+
+#endif // UDPBATCHSENDER_H
@@ -3,6 +3,10 @@
 #include "timesutil.h"
 #include "avpublishtime.h"
 
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
 VideoCapturer::VideoCapturer()
 {
 
@@ -16,6 +20,12 @@ VideoCapturer::~VideoCapturer()
     if(yuv_fp_){
         fclose(yuv_fp_);
     }
+    if(frame_) {
+        av_frame_free(&frame_);
+    }
+    if(frame_pool_) {
+        av_buffer_pool_uninit(&frame_pool_);     // 还被编码器引用的buffer在释放时才真正free
+    }
 }
 
 RET_CODE VideoCapturer::Init(const Properties &properties)
@@ -42,6 +52,13 @@ RET_CODE VideoCapturer::Init(const Properties &properties)
 
     frame_duration_ = 1000.0 / fps_;    // 单位是毫秒的
 
+    // 缓冲池，AddFrameCallback方式输出时使用
+    frame_pool_ = av_buffer_pool_init(yuv_buf_size_, av_buffer_alloc);
+    frame_ = av_frame_alloc();
+    if(!frame_pool_ || !frame_) {
+        return RET_ERR_OUTOFMEMORY;
+    }
+
     return RET_OK;
 }
 
@@ -57,7 +74,10 @@ void VideoCapturer::Loop()
             break;
         }
 
-        if(readYuvFile(yuv_buf_, yuv_buf_size_) == 0)
+        if(callback_get_frame_) {
+            captureFrame();
+        }
+        else if(readYuvFile(yuv_buf_, yuv_buf_size_) == 0)
         {
             if(!is_first_frame_) {
                 is_first_frame_ = true;
@@ -81,6 +101,43 @@ void VideoCapturer::AddCallback(std::function<void (uint8_t *, int32_t)> callbac
     callback_get_yuv_ = callback;
 }
 
+void VideoCapturer::AddFrameCallback(std::function<void (AVFrame *)> callback)
+{
+    callback_get_frame_ = callback;
+}
+
+int VideoCapturer::captureFrame()
+{
+    // 1. 从缓冲池取buffer，编码器还持有的buffer不会被取到
+    AVBufferRef *buf = av_buffer_pool_get(frame_pool_);
+    if(!buf) {
+        LogError("av_buffer_pool_get failed");
+        return RET_ERR_OUTOFMEMORY;
+    }
+    // 2. 直接读到buffer里面
+    int ret = readYuvFile(buf->data, yuv_buf_size_);
+    if(ret != RET_OK) {
+        av_buffer_unref(&buf);
+        return ret;
+    }
+    if(!is_first_frame_) {
+        is_first_frame_ = true;
+        LogInfo("video: %s:t%u", AVPublishTime::GetInstance()->getVInTag(),
+                AVPublishTime::GetInstance()->getCurrenTime());
+    }
+    // 3. 包装成AVFrame, frame_持有buffer的引用
+    frame_->buf[0]  = buf;
+    frame_->format  = pixel_format_;
+    frame_->width   = width_ + width_ % 2;
+    frame_->height  = height_ + height_ % 2;
+    av_image_fill_arrays(frame_->data, frame_->linesize, buf->data,
+                         (AVPixelFormat)frame_->format, frame_->width, frame_->height, 1);
+    callback_get_frame_(frame_);
+    // 4. 释放采集端的引用，编码器不再使用后buffer回到缓冲池
+    av_frame_unref(frame_);
+    return RET_OK;
+}
+
 int VideoCapturer::openYuvFile(const char *file_name)
 {
     yuv_fp_ = fopen(file_name,"rb");
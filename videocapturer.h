@@ -5,6 +5,11 @@
 #include "commonlooper.h"
 #include "mediabase.h"
 
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/buffer.h>
+}
+
 class VideoCapturer:public CommonLooper
 {
 public:
@@ -24,7 +29,16 @@ public:
 
     virtual void Loop();
     void AddCallback(std::function<void(uint8_t*, int32_t)> callback);
+    /**
+     * @brief AddFrameCallback 以引用计数的AVFrame输出，buffer来自缓冲池
+     *        回调里面可以av_frame_ref持有，全部引用释放后buffer才会被重新采集使用
+     *        设置了该回调时不再调用AddCallback设置的回调
+     */
+    void AddFrameCallback(std::function<void(AVFrame*)> callback);
 private:
+    // 从缓冲池取一个buffer采集一帧
+    int captureFrame();
+
     int openYuvFile(const char *file_name);
     int readYuvFile(uint8_t *yuv_buf, int32_t yuv_buf_size);
     int closeYuvFile();
@@ -40,6 +54,9 @@ private:
     double frame_duration_ = 40;
 
     std::function<void(uint8_t *, int32_t)> callback_get_yuv_;
+    std::function<void(AVFrame *)> callback_get_frame_;
+    AVBufferPool *frame_pool_ = NULL;
+    AVFrame *frame_ = NULL;
     uint8_t *yuv_buf_ = NULL; 
     int32_t yuv_buf_size_ = 0;
     FILE *yuv_fp_ = NULL;
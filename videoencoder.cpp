@@ -0,0 +1,468 @@
+#include "videoencoder.h"
+#include "nalutil.h"
+#include "dlog.h"
+
+VideoEncoder::VideoEncoder(const char *tag):
+    tag_(tag)
+{
+    bitrate_ = 0;
+    pending_bitrate_ = 0;
+    keyframe_request_ = false;
+}
+
+VideoEncoder::~VideoEncoder()
+{
+    if(ctx_) {
+        avcodec_free_context(&ctx_);
+    }
+    if(frame_) {
+        av_frame_free(&frame_);
+    }
+    while(!drained_.empty()) {
+        av_packet_free(&drained_.front());
+        drained_.pop_front();
+    }
+    if(dict_) {
+        av_dict_free(&dict_);
+    }
+}
+
+RET_CODE VideoEncoder::readProperties(const Properties &properties)
+{
+    width_      = properties.GetProperty("width", 1920);
+    if(width_ ==0 || width_%2 != 0) {
+        LogError("width:%d", width_);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    height_     = properties.GetProperty("height", 1080);
+    if(height_ ==0 || height_%2 != 0) {
+        LogError("height:%d", height_);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    fps_        = properties.GetProperty("fps", 25);
+    time_base_  = properties.GetProperty("time_base", fps_);
+    b_frames_   = properties.GetProperty("b_frames", 0);
+    bitrate_    = properties.GetProperty("bitrate", 500 * 1024);
+    gop_        = properties.GetProperty("gop", fps_);
+    threads_    = properties.GetProperty("threads", 1);
+    pix_fmt_    = properties.GetProperty("pix_fmt", AV_PIX_FMT_YUV420P);
+    vbv_            = properties.GetProperty("vbv", 0);
+    intra_refresh_  = properties.GetProperty("intra_refresh", false);
+    temporal_layers_ = properties.GetProperty("temporal_layers", 1);
+    if(fps_ <= 0 || time_base_ <= 0) {
+        LogError("fps:%d, time_base:%d", fps_, time_base_);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    if(threads_ < 0) {
+        LogError("threads:%d", threads_);
+        return RET_ERR_NOT_SUPPORT;
+    }
+    if(intra_refresh_ && vbv_ <= 0) {
+        vbv_ = 1000 / fps_ > 0 ? 1000 / fps_ : 1;
+    }
+    pending_bitrate_ = 0;
+    keyframe_request_ = false;
+    // b帧会重排序，按pts匹配送帧时间
+    stats_.Init(properties.GetProperty("stats_window", 300), true);
+    return RET_OK;
+}
+
+RET_CODE VideoEncoder::allocContext(AVCodecID codec_id, const std::string &codec_name)
+{
+    // 1.读取并选择编码器，如果未指定则按codec_id查找
+    if(codec_name == "default") {
+        codec_ = avcodec_find_encoder(codec_id);
+    }else {
+        codec_ = avcodec_find_encoder_by_name(codec_name.c_str());
+    }
+    if(!codec_) {
+        LogError("%s: can't find encoder", tag_.c_str());
+        return RET_FAIL;
+    }
+
+    // 2.配置编码器上下文
+    ctx_ = avcodec_alloc_context3(codec_);
+    if(!ctx_) {
+        LogError("%s: avcodec_alloc_context3 failed", tag_.c_str());
+        return RET_FAIL;
+    }
+
+    // 2.1设置编码器上下文的视频宽高、码率、GOP大小、帧率、时间基、像素格式、编码器类型、b帧数量
+    ctx_->width = width_;
+    ctx_->height = height_;
+    ctx_->bit_rate = bitrate_;
+    ctx_->gop_size = gop_;
+    ctx_->framerate.num = fps_;
+    ctx_->framerate.den = 1;
+    ctx_->time_base.num = 1;
+    ctx_->time_base.den = time_base_;
+    ctx_->pix_fmt = (enum AVPixelFormat)pix_fmt_;
+    ctx_->codec_type = AVMEDIA_TYPE_VIDEO;
+    ctx_->max_b_frames = b_frames_;
+    if(vbv_ > 0) {
+        // 设置VBV之后码控按缓冲区约束每一帧的大小，调整码率后能很快生效
+        ctx_->rc_max_rate = bitrate_;
+        ctx_->rc_buffer_size = (int)((int64_t)bitrate_ * vbv_ / 1000);
+    }
+    ctx_->thread_count = threads_;
+    ctx_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    return RET_OK;
+}
+
+RET_CODE VideoEncoder::openContext()
+{
+    // pict_type为I的帧编码成IDR，否则open-gop时可能只是普通I帧
+    av_dict_set(&dict_, "forced-idr", "1", 0);
+
+    // 1.初始化编码器
+    int ret = avcodec_open2(ctx_, codec_, &dict_);
+    if(ret < 0) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("%s: avcodec_open2 failed:%s", tag_.c_str(), buf);
+        return RET_FAIL;
+    }
+
+    // 2.从extradata读取参数集，个数和顺序由编码器决定(H264: SPS PPS, H265: VPS SPS PPS, 可能有SEI)
+    parameter_sets_.clear();
+    if(ctx_->extradata) {
+        static const uint8_t start_code[4] = {0, 0, 0, 1};
+        bool hevc = ctx_->codec_id == AV_CODEC_ID_HEVC;
+        const uint8_t *p = ctx_->extradata;
+        const uint8_t *end = ctx_->extradata + ctx_->extradata_size;
+        const uint8_t *nal = NULL;
+        int nal_size = 0;
+        while(NaluUtil::NextNal(&p, end, &nal, &nal_size)) {
+            if(nal_size <= 0) {
+                continue;
+            }
+            int type = hevc ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+            bool is_ps = hevc ? (type >= H265_NAL_VPS && type <= H265_NAL_PPS)
+                              : (type == H264_NAL_SPS || type == H264_NAL_PPS);
+            if(is_ps) {
+                parameter_sets_.append((const char *)start_code, 4);
+                parameter_sets_.append((const char *)nal, nal_size);
+            }
+        }
+    }
+    if(parameter_sets_.empty()) {
+        LogWarn("%s: no parameter sets in extradata", tag_.c_str());
+    }
+
+    // 3.分配视频帧内存，并设置帧的宽高和像素格式
+    if(!frame_) {
+        frame_ = av_frame_alloc();
+        frame_->width = ctx_->width;
+        frame_->height = ctx_->height;
+        frame_->format = ctx_->pix_fmt;
+        ret = av_frame_get_buffer(frame_,0);
+        if(ret < 0) {
+            LogError("%s: av_frame_get_buffer failed", tag_.c_str());
+            return RET_ERR_OUTOFMEMORY;
+        }
+    }
+    return RET_OK;
+}
+
+AVPacket *VideoEncoder::Encode(uint8_t *yuv,int size, const int64_t pts, int *pkt_frame, RET_CODE *ret)
+{
+    int local_ret = 0;
+    *ret = RET_OK;
+    *pkt_frame = 0;
+
+    // 1. 上下文检查
+    if(!ctx_){
+        *ret = RET_FAIL;
+        LogError("%s: no context", tag_.c_str());
+        return NULL;
+    }
+
+    // 2. 设置帧的时间戳并发送帧
+    if(yuv){
+        if(fillFrame(yuv, size) != RET_OK) {
+            *ret = RET_FAIL;
+            return NULL;
+        }
+        frame_->pts = pts;
+        frame_->pict_type = keyframe_request_.exchange(false) ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+        // 这个接口一次只返回一个包，drain出来的包先缓存，后面的调用依次返回
+        applyBitrate([this](AVPacket *pkt) {
+            drained_.push_back(pkt);
+        });
+        if(!ctx_) {
+            *ret = RET_FAIL;
+            return NULL;
+        }
+        local_ret = avcodec_send_frame(ctx_,frame_);
+        if(local_ret < 0){
+            *pkt_frame = 1;
+            // 帧没有送进去，IDR请求留给下一帧
+            if(frame_->pict_type == AV_PICTURE_TYPE_I) {
+                keyframe_request_ = true;
+            }
+            if(local_ret == AVERROR(EAGAIN)){
+                *ret = RET_ERR_EAGAIN;
+                return NULL;
+            }else if(local_ret == RET_ERR_EOF){
+                *ret = RET_ERR_EOF;
+                return NULL;
+            }else{
+                *ret = RET_FAIL;
+                return NULL;
+            }
+        }
+    }
+
+
+    // 4. 接收编码后的数据包，先返回drain出来的包
+    if(!drained_.empty()) {
+        AVPacket *packet = drained_.front();
+        drained_.pop_front();
+        *ret = RET_OK;
+        return packet;
+    }
+    AVPacket *packet = av_packet_alloc();
+    local_ret = avcodec_receive_packet(ctx_,packet);
+    if(local_ret < 0){
+        av_packet_free(&packet);
+        *pkt_frame = 0;
+        if(local_ret == AVERROR(EAGAIN)){
+            *ret = RET_ERR_EAGAIN;
+            return NULL;
+        }else if(local_ret == RET_ERR_EOF){
+            *ret = RET_ERR_EOF;
+            return NULL;
+        }else{
+            *ret = RET_FAIL;
+            return NULL;
+        }
+    }else{
+        *ret = RET_OK;
+        return packet;
+    }
+}
+
+RET_CODE VideoEncoder::Encode(uint8_t *yuv, int size, const int64_t pts, const PacketCallback &callback)
+{
+    // 1. 上下文检查
+    if(!ctx_){
+        LogError("%s: no context", tag_.c_str());
+        return RET_FAIL;
+    }
+
+    // 2. 设置帧的时间戳并发送帧
+    if(yuv){
+        if(fillFrame(yuv, size) != RET_OK) {
+            return RET_FAIL;
+        }
+        frame_->pts = pts;
+        return sendFrame(frame_, callback);
+    }
+
+    // 3. 取出所有能输出的包
+    return receivePackets(callback);
+}
+
+RET_CODE VideoEncoder::Encode(AVFrame *frame, const PacketCallback &callback)
+{
+    // 1. 上下文检查
+    if(!ctx_){
+        LogError("%s: no context", tag_.c_str());
+        return RET_FAIL;
+    }
+    if(!frame) {
+        return receivePackets(callback);
+    }
+
+    // 2. 帧参数必须和编码器一致，编码器不做缩放
+    if(frame->width != ctx_->width || frame->height != ctx_->height || frame->format != ctx_->pix_fmt) {
+        LogError("%s: frame %dx%d fmt:%d != encoder %dx%d fmt:%d", tag_.c_str(),
+                 frame->width, frame->height, frame->format,
+                 ctx_->width, ctx_->height, ctx_->pix_fmt);
+        return RET_ERR_PARAMISMATCH;
+    }
+    // 没有引用计数的帧编码器只能拷贝，提示调用者
+    if(!frame->buf[0]) {
+        LogWarn("%s: frame is not refcounted, encoder will copy it", tag_.c_str());
+    }
+    return sendFrame(frame, callback);
+}
+
+RET_CODE VideoEncoder::Flush(const PacketCallback &callback)
+{
+    if(!ctx_){
+        LogError("%s: no context", tag_.c_str());
+        return RET_FAIL;
+    }
+    // 送NULL进入drain模式
+    int ret = avcodec_send_frame(ctx_, NULL);
+    if(ret < 0 && ret != AVERROR_EOF) {
+        LogError("%s: enter drain mode failed", tag_.c_str());
+        return RET_FAIL;
+    }
+    ret = receivePackets(callback);
+    return (ret == RET_ERR_EOF) ? RET_OK : (RET_CODE)ret;
+}
+
+void VideoEncoder::SetBitrate(int bitrate)
+{
+    if(bitrate <= 0) {
+        LogError("%s: bitrate:%d", tag_.c_str(), bitrate);
+        return;
+    }
+    pending_bitrate_ = bitrate;
+}
+
+void VideoEncoder::RequestKeyframe()
+{
+    keyframe_request_ = true;
+}
+
+void VideoEncoder::SetRegionsOfInterest(const std::vector<VideoRegion> &regions)
+{
+    std::lock_guard<std::mutex> lock(roi_mutex_);
+    regions_ = regions;
+}
+
+bool VideoEncoder::attachRegions(AVFrame *frame)
+{
+    std::lock_guard<std::mutex> lock(roi_mutex_);
+    if(regions_.empty()) {
+        return false;
+    }
+    AVFrameSideData *sd = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST,
+                                                 regions_.size() * sizeof(AVRegionOfInterest));
+    if(!sd) {
+        LogError("%s: av_frame_new_side_data failed", tag_.c_str());
+        return false;
+    }
+    // 裁到画面内，完全在画面外的区域用空矩形占位(编码器会忽略)
+    AVRegionOfInterest *roi = (AVRegionOfInterest *)sd->data;
+    for(size_t i = 0; i < regions_.size(); i++) {
+        const VideoRegion &r = regions_[i];
+        roi[i].self_size = sizeof(AVRegionOfInterest);
+        roi[i].left   = FFMAX(r.x, 0);
+        roi[i].top    = FFMAX(r.y, 0);
+        roi[i].right  = FFMIN(r.x + r.width, frame->width);
+        roi[i].bottom = FFMIN(r.y + r.height, frame->height);
+        if(roi[i].right < roi[i].left) {
+            roi[i].right = roi[i].left;
+        }
+        if(roi[i].bottom < roi[i].top) {
+            roi[i].bottom = roi[i].top;
+        }
+        float qoffset = FFMAX(FFMIN(r.qoffset, 1.0f), -1.0f);
+        roi[i].qoffset = av_make_q((int)(qoffset * 1000), 1000);
+    }
+    return true;
+}
+
+// 在编码线程调用，libx264每次编码前检查bit_rate/rc_max_rate/rc_buffer_size，有变化时调用x264_encoder_reconfig
+void VideoEncoder::applyBitrate(const PacketCallback &)
+{
+    int bitrate = pending_bitrate_.exchange(0);
+    if(bitrate <= 0 || bitrate == bitrate_) {
+        return;
+    }
+    LogInfo("%s: bitrate %d -> %d", tag_.c_str(), (int)bitrate_, bitrate);
+    bitrate_ = bitrate;
+    ctx_->bit_rate = bitrate;
+    if(vbv_ > 0) {
+        ctx_->rc_max_rate = bitrate;
+        ctx_->rc_buffer_size = (int)((int64_t)bitrate * vbv_ / 1000);
+    }
+}
+
+// 把调用者的yuv拷贝到编码器自己的帧里面
+// frame_的buffer可能还被编码器引用着(lookahead、frame多线程)，先make_writable再拷贝
+RET_CODE VideoEncoder::fillFrame(uint8_t *yuv, int size)
+{
+    uint8_t *src_data[4];
+    int src_linesize[4];
+    int need_size = av_image_fill_arrays(src_data, src_linesize, yuv,
+                                         (AVPixelFormat)frame_->format,
+                                         frame_->width, frame_->height, 1);
+    if(need_size != size)  {
+        LogError("need_size:%d != size:%d", need_size, size);
+        return RET_FAIL;
+    }
+    if(av_frame_make_writable(frame_) < 0) {
+        LogError("%s: av_frame_make_writable failed", tag_.c_str());
+        return RET_ERR_OUTOFMEMORY;
+    }
+    av_image_copy(frame_->data, frame_->linesize, (const uint8_t **)src_data, src_linesize,
+                  (AVPixelFormat)frame_->format, frame_->width, frame_->height);
+    return RET_OK;
+}
+
+// 送入一帧，avcodec_send_frame会增加帧的引用计数，调用者可以马上unref自己的引用
+RET_CODE VideoEncoder::sendFrame(AVFrame *frame, const PacketCallback &callback)
+{
+    applyBitrate(callback);
+    if(!ctx_) {
+        return RET_FAIL;        // 重新打开编码器失败
+    }
+    frame->pict_type = keyframe_request_.exchange(false) ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    if(frame->pict_type == AV_PICTURE_TYPE_I) {
+        LogInfo("%s: force idr, pts:%lld", tag_.c_str(), frame->pts);
+    }
+    // avcodec_send_frame会引用side data，送完就从调用者的帧上删掉，避免带到下一帧
+    bool roi = attachRegions(frame);
+    int ret = avcodec_send_frame(ctx_, frame);
+    if(ret == AVERROR(EAGAIN)) {
+        // 先把编码器里面的包取出来再送一次
+        receivePackets(callback);
+        ret = avcodec_send_frame(ctx_, frame);
+    }
+    if(roi) {
+        av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+    }
+    if(ret < 0) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("%s: avcodec_send_frame failed:%s", tag_.c_str(), buf);
+        // 帧没有送进去，IDR请求留给下一帧，否则接收端要等到下一个gop
+        if(frame->pict_type == AV_PICTURE_TYPE_I) {
+            keyframe_request_ = true;
+        }
+        return ret == AVERROR(EAGAIN) ? RET_ERR_EAGAIN : RET_FAIL;
+    }
+    stats_.OnSend(frame->pts);
+
+    // 取出所有能输出的包
+    return receivePackets(callback);
+}
+
+// 返回值: RET_OK 已经取完(EAGAIN); RET_ERR_EOF drain完成; RET_FAIL出错
+RET_CODE VideoEncoder::receivePackets(const PacketCallback &callback)
+{
+    bool hevc = ctx_->codec_id == AV_CODEC_ID_HEVC;
+    while(true) {
+        AVPacket *packet = av_packet_alloc();
+        if(!packet) {
+            return RET_ERR_OUTOFMEMORY;
+        }
+        int ret = avcodec_receive_packet(ctx_, packet);
+        if(ret < 0) {
+            av_packet_free(&packet);
+            if(ret == AVERROR(EAGAIN)) {
+                return RET_OK;
+            } else if(ret == AVERROR_EOF) {
+                return RET_ERR_EOF;
+            }
+            LogError("%s: avcodec_receive_packet failed:%d", tag_.c_str(), ret);
+            return RET_FAIL;
+        }
+        // 不被参考的帧标记为可丢弃
+        if(temporal_layers_ > 1
+                && NaluUtil::TemporalLayer(packet->data, packet->size, temporal_layers_, hevc) == temporal_layers_ - 1) {
+            packet->flags |= AV_PKT_FLAG_DISPOSABLE;
+        }
+        stats_.OnPacket(packet, false);
+        if(callback) {
+            callback(packet);
+        } else {
+            av_packet_free(&packet);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef VIDEOENCODER_H
+#define VIDEOENCODER_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mediabase.h"
+#include "encoderstats.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/imgutils.h>//图像处理相关的功能
+}
+
+// 视频编码器基类，送帧/取包、码率调整、IDR请求、参数集的处理对H264/H265都一样
+class VideoEncoder
+{
+public:
+    VideoEncoder(const char *tag);
+    virtual ~VideoEncoder();
+
+    virtual RET_CODE Init(const Properties &properties) = 0;
+
+    virtual AVPacket *Encode(uint8_t *yuv,int size, const int64_t pts, int *pkt_frame, RET_CODE *ret);
+    /**
+     * @brief Encode 送入一帧，并取出编码器当前能输出的所有包
+     * @param yuv       yuv数据
+     * @param size      数据大小
+     * @param pts       时间戳
+     * @param callback  每输出一个包回调一次
+     * @return RET_OK正常; RET_ERR_EAGAIN编码器满了，这一帧没有送进去
+     */
+    virtual RET_CODE Encode(uint8_t *yuv, int size, const int64_t pts, const PacketCallback &callback);
+    /**
+     * @brief Encode 送入引用计数的帧(比如采集端缓冲池里面的帧)，编码器不拷贝数据
+     *        编码器需要时会持有帧的引用(lookahead、frame多线程)，释放后buffer才回到缓冲池
+     *        调用者送完之后可以直接av_frame_unref自己的引用
+     * @param frame     宽高和像素格式必须和编码器一致，pts由调用者设置
+     * @param callback  每输出一个包回调一次
+     * @return RET_OK正常; RET_ERR_EAGAIN编码器满了，这一帧没有送进去
+     */
+    virtual RET_CODE Encode(AVFrame *frame, const PacketCallback &callback);
+    /**
+     * @brief Flush 进入drain模式，输出编码器缓存的所有包(lookahead、b帧)，之后编码器不能再送帧
+     * @param callback  每输出一个包回调一次
+     * @return
+     */
+    virtual RET_CODE Flush(const PacketCallback &callback);
+    /**
+     * @brief SetBitrate 运行时修改码率，可以在任意线程调用
+     *        只记录新码率，在编码线程送下一帧之前生效
+     * @param bitrate   新码率bps
+     */
+    void SetBitrate(int bitrate);
+    inline int GetBitrate() {
+        return bitrate_;
+    }
+    /**
+     * @brief RequestKeyframe 请求下一帧编码成IDR，可以在任意线程调用
+     *        比如发送队列丢帧之后接收端没有参考帧了，不用等到下一个gop
+     */
+    void RequestKeyframe();
+    // 每帧的延迟、大小、qp统计，按帧类型分开，可以在任意线程调用
+    inline void GetStats(EncoderStatsInfo *info) {
+        stats_.GetStats(info);
+    }
+    // 是否有还没送出去的IDR请求
+    inline bool IsKeyframePending() {
+        return keyframe_request_;
+    }
+    /**
+     * @brief SetRegionsOfInterest 设置ROI区域，之后送入的每一帧都带上AV_FRAME_DATA_REGIONS_OF_INTEREST
+     *        x264/x265按区域的qoffset调整宏块qp，把码率集中到观众关注的区域(活动窗口、光标附近)
+     *        需要打开自适应量化(aq-mode，preset默认是打开的)，可以在任意线程调用
+     * @param regions   编码器坐标，超出画面的部分会被裁掉; 为空时取消ROI
+     */
+    void SetRegionsOfInterest(const std::vector<VideoRegion> &regions);
+
+    // annexb格式的参数集(H264: SPS PPS, H265: VPS SPS PPS)，带起始码，可以直接放在关键帧前面
+    inline const std::string &GetParameterSets() {
+        return parameter_sets_;
+    }
+    inline AVCodecID GetCodecId() {
+        return ctx_ ? ctx_->codec_id : AV_CODEC_ID_NONE;
+    }
+    inline int GetTemporalLayers() {
+        return temporal_layers_;
+    }
+    inline bool IsIntraRefresh() {
+        return intra_refresh_;
+    }
+    inline int GetFps() {
+        return fps_;
+    }
+    inline AVCodecContext *get_codec_context() {
+        return ctx_;
+    }
+protected:
+    // 读取通用的属性: width/height/fps/b_frames/bitrate/gop/threads/pix_fmt/vbv/intra_refresh/temporal_layers/time_base/stats_window
+    // time_base为时间基的分母，缺省为fps(pts是帧序号)，pts是ms时设为1000
+    RET_CODE readProperties(const Properties &properties);
+    // 查找编码器并设置通用的上下文参数，codec_name为default时按codec_id查找
+    RET_CODE allocContext(AVCodecID codec_id, const std::string &codec_name);
+    // 打开编码器，dict_里面是各编码器自己的参数; 然后解析参数集、分配帧
+    RET_CODE openContext();
+    // 码率有变化时在编码线程生效，默认修改上下文的码控参数，编码器每帧检查
+    // 需要重新打开编码器的(H265)把旧编码器drain出来的包交给callback
+    virtual void applyBitrate(const PacketCallback &callback);
+
+    RET_CODE fillFrame(uint8_t *yuv, int size);
+    // 把当前的ROI区域作为side data挂到帧上，送完帧之后要删掉
+    bool attachRegions(AVFrame *frame);
+    RET_CODE sendFrame(AVFrame *frame, const PacketCallback &callback);
+    RET_CODE receivePackets(const PacketCallback &callback);
+
+    std::string tag_;           // 日志前缀
+    int width_;
+    int height_;
+    int fps_;
+    int time_base_;
+    int b_frames_;
+    std::atomic<int> bitrate_;
+    std::atomic<int> pending_bitrate_;  // 待生效的码率，0代表没有
+    std::atomic<bool> keyframe_request_;
+    int gop_;
+    int threads_;
+    int pix_fmt_;
+    int vbv_ = 0;
+    bool intra_refresh_ = false;
+    int temporal_layers_ = 1;
+
+    std::string parameter_sets_;
+    std::mutex roi_mutex_;
+    std::vector<VideoRegion> regions_;  // ROI区域
+
+    AVCodec *codec_ = NULL;
+    AVCodecContext *ctx_ = NULL;
+    AVDictionary *dict_ = NULL; //用于传递各种参数，例如编解码器的选项、过滤器的参数、容器格式的选项等等
+    AVFrame *frame_ = NULL;
+    std::deque<AVPacket *> drained_;    // 只有一个返回值的Encode接口，重新打开编码器时drain出来的包
+    EncoderStats stats_;
+};
+
+#endif // VIDEOENCODER_H
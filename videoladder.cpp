@@ -0,0 +1,130 @@
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include "videoladder.h"
+#include "dlog.h"
+
+VideoLadder::VideoLadder()
+{
+
+}
+
+VideoLadder::~VideoLadder()
+{
+
+}
+
+RET_CODE VideoLadder::Init(const Properties &properties)
+{
+    // 1. 第0档就是编码器初始的参数
+    VideoLadderStep top;
+    top.width   = properties.GetProperty("width", 1920);
+    top.height  = properties.GetProperty("height", 1080);
+    top.fps     = properties.GetProperty("fps", 25);
+    top.bitrate = properties.GetProperty("bitrate", 1024*1024);
+    down_time_  = properties.GetProperty("down_time", 3000);
+    up_time_    = properties.GetProperty("up_time", 15000);
+    steps_.clear();
+    steps_.push_back(top);
+
+    // 2. 解析下级档位，必须逐档降低
+    std::stringstream ss(properties.GetProperty("ladder", ""));
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        if(item.empty()) {
+            continue;
+        }
+        VideoLadderStep step;
+        if(parseStep(item, step) != RET_OK) {
+            LogError("invalid ladder step:%s", item.c_str());
+            return RET_ERR_NOT_SUPPORT;
+        }
+        const VideoLadderStep &pre = steps_.back();
+        if(pre.width == 0) {
+            LogError("audio must be the last ladder step");
+            return RET_ERR_NOT_SUPPORT;
+        }
+        // 和第0档一样的配置直接跳过，方便把完整的阶梯写进配置
+        if(steps_.size() == 1 && step.width == top.width && step.height == top.height
+                && step.fps == top.fps) {
+            continue;
+        }
+        if(step.width != 0) {
+            if(step.width > top.width || step.height > top.height || step.fps > top.fps
+                    || (step.width == pre.width && step.height == pre.height && step.fps == pre.fps)) {
+                LogError("ladder step %dx%d@%d must be lower than %dx%d@%d",
+                         step.width, step.height, step.fps, pre.width, pre.height, pre.fps);
+                return RET_ERR_NOT_SUPPORT;
+            }
+            if(step.bitrate == 0) {
+                // 码率不是随像素率线性变化的，小分辨率需要的每像素码率更高
+                double ratio = (double)step.width * step.height * step.fps
+                        / ((double)top.width * top.height * top.fps);
+                step.bitrate = (int)(top.bitrate * pow(ratio, 0.75));
+            }
+        }
+        steps_.push_back(step);
+    }
+    if(steps_.size() < 2) {
+        LogError("ladder is empty");
+        return RET_FAIL;
+    }
+    for(size_t i = 0; i < steps_.size(); i++) {
+        LogInfo("ladder[%d]: %dx%d@%d, %dkbps", (int)i, steps_[i].width, steps_[i].height,
+                steps_[i].fps, steps_[i].bitrate / 1024);
+    }
+    return RET_OK;
+}
+
+int VideoLadder::Update(int64_t now, bool congested, bool at_min_bitrate, bool at_max_bitrate)
+{
+    // 1. 降档: 码率已经最低仍然持续拥塞
+    if(congested && at_min_bitrate && index_ + 1 < (int)steps_.size()) {
+        if(down_start_time_ == 0) {
+            down_start_time_ = now;
+        }
+    } else {
+        down_start_time_ = 0;
+    }
+    // 2. 升档: 码率已经升到最高并且没有拥塞，稳定一段时间
+    if(!congested && (at_max_bitrate || steps_[index_].width == 0) && index_ > 0) {
+        if(up_start_time_ == 0) {
+            up_start_time_ = now;
+        }
+    } else {
+        up_start_time_ = 0;
+    }
+
+    int index = -1;
+    if(down_start_time_ != 0 && now - down_start_time_ >= down_time_) {
+        index = index_ + 1;
+    } else if(up_start_time_ != 0 && now - up_start_time_ >= up_time_) {
+        index = index_ - 1;
+    }
+    if(index < 0) {
+        return -1;
+    }
+    LogInfo("ladder %d -> %d, %dx%d@%d", index_, index, steps_[index].width,
+            steps_[index].height, steps_[index].fps);
+    index_ = index;
+    down_start_time_ = 0;
+    up_start_time_ = 0;
+    return index_;
+}
+
+// 格式: 宽x高@帧率[:码率kbps] 或者 audio
+RET_CODE VideoLadder::parseStep(const std::string &str, VideoLadderStep &step)
+{
+    memset(&step, 0, sizeof(step));
+    if(str == "audio") {
+        return RET_OK;
+    }
+    int kbps = 0;
+    int n = sscanf(str.c_str(), "%dx%d@%d:%d", &step.width, &step.height, &step.fps, &kbps);
+    if(n < 3 || step.width <= 0 || step.height <= 0 || step.width % 2 != 0
+            || step.height % 2 != 0 || step.fps <= 0 || kbps < 0) {
+        return RET_FAIL;
+    }
+    step.bitrate = kbps * 1024;
+    return RET_OK;
+}
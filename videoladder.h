@@ -0,0 +1,64 @@
+#ifndef VIDEOLADDER_H
+#define VIDEOLADDER_H
+
+#include <string>
+#include <vector>
+#include "mediabase.h"
+
+// 降级阶梯的一档，width为0代表只推音频
+typedef struct video_ladder_step {
+    int width;
+    int height;
+    int fps;
+    int bitrate;        // 这一档的最大码率bps，码率自适应在[bitrate/4, bitrate]之间调整
+}VideoLadderStep;
+
+// 码率已经降到最低仍然拥塞时逐档降低分辨率/帧率，直到只推音频
+// 网络恢复并稳定一段时间后再逐档升回去
+class VideoLadder
+{
+public:
+    VideoLadder();
+    ~VideoLadder();
+    /**
+     * @brief Init
+     * @param "width"/"height"/"fps"/"bitrate", 最高档(第0档)，即编码器初始的参数
+     *        "ladder", 逗号分隔的下级档位，比如"1280x720@30,1280x720@15,854x480@15:600,audio"
+     *                  ":600"指定这一档的码率kbps，不指定时按像素率折算; audio代表只推音频，只能是最后一档
+     *        "down_time", 码率已经最低并且持续拥塞多久后降一档ms，默认3000
+     *        "up_time", 码率已经最高并且持续稳定多久后升一档ms，默认15000
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    /**
+     * @brief Update 每次码率自适应检测之后调用
+     * @param now               当前时间ms
+     * @param congested         队列是否拥塞
+     * @param at_min_bitrate    码率是否已经是当前档的最低值
+     * @param at_max_bitrate    码率是否已经是当前档的最高值
+     * @return 新的档位，-1代表不变
+     */
+    int Update(int64_t now, bool congested, bool at_min_bitrate, bool at_max_bitrate);
+
+    inline int GetIndex() {
+        return index_;
+    }
+    inline int GetSteps() {
+        return (int)steps_.size();
+    }
+    inline const VideoLadderStep &GetStep(int index) {
+        return steps_[index];
+    }
+private:
+    RET_CODE parseStep(const std::string &str, VideoLadderStep &step);
+
+    std::vector<VideoLadderStep> steps_;
+    int index_ = 0;
+    int down_time_ = 3000;
+    int up_time_ = 15000;
+
+    int64_t down_start_time_ = 0;   // 开始满足降档条件的时间
+    int64_t up_start_time_ = 0;     // 开始满足升档条件的时间
+};
+
+#endif // VIDEOLADDER_H